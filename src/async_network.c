@@ -29,6 +29,7 @@
 #include "ppb_message_loop.h"
 #include "ppb_tcp_socket.h"
 #include "ppb_udp_socket.h"
+#include "thread_local.h"
 #include "trace_core.h"
 #include "trace_helpers.h"
 #include <arpa/inet.h>
@@ -163,8 +164,8 @@ handle_tcp_connect_stage4(int sock, short event_flags, void *arg)
         ts->is_connected = (getpeername(ts->sock, (struct sockaddr *)buf, &len) == 0);
 
     if (ts->is_connected) {
-        ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0, PP_OK, 0,
-                                               __func__);
+        ppb_message_loop_post_work_with_priority(task->callback_ml, task->callback, 0, PP_OK, 0,
+                                                 ML_PRIORITY_NETWORK, __func__);
         pp_resource_release(task->resource);
         free(task->addr);
         task_destroy(task);
@@ -182,8 +183,8 @@ handle_tcp_connect_stage4(int sock, short event_flags, void *arg)
     // no addresses left, fail gracefully
     trace_warning("%s, connection failed to all addresses (%s:%u)\n", __func__, task->host,
                   (unsigned int)task->port);
-    ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0, get_pp_errno(), 0,
-                                           __func__);
+    ppb_message_loop_post_work_with_priority(task->callback_ml, task->callback, 0, get_pp_errno(),
+                                             0, ML_PRIORITY_NETWORK, __func__);
     pp_resource_release(task->resource);
     free(task->addr);
     task_destroy(task);
@@ -217,8 +218,8 @@ handle_tcp_connect_stage3(struct async_network_task_s *task)
     if (res != 0 && errno != EINPROGRESS) {
         trace_error("%s, res = %d, errno = %d (%s:%u)\n", __func__, res, errno, task->host,
                     (unsigned int)task->port);
-        ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0, get_pp_errno(),
-                                               0, __func__);
+        ppb_message_loop_post_work_with_priority(task->callback_ml, task->callback, 0,
+                                                 get_pp_errno(), 0, ML_PRIORITY_NETWORK, __func__);
         free(task->addr);
         task_destroy(task);
         return;
@@ -238,8 +239,9 @@ handle_tcp_connect_stage2(int result, char type, int count, int ttl, void *addre
     if (result != DNS_ERR_NONE || count < 1) {
         trace_warning("%s, evdns returned code %d, count = %d (%s:%u)\n", __func__, result, count,
                       task->host, (unsigned int)task->port);
-        ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0,
-                                               PP_ERROR_NAME_NOT_RESOLVED, 0, __func__);
+        ppb_message_loop_post_work_with_priority(task->callback_ml, task->callback, 0,
+                                                 PP_ERROR_NAME_NOT_RESOLVED, 0, ML_PRIORITY_NETWORK,
+                                                 __func__);
         task_destroy(task);
         return;
     }
@@ -259,8 +261,8 @@ handle_tcp_connect_stage2(int result, char type, int count, int ttl, void *addre
     } else {
         trace_error("%s, bad evdns type %d (%s:%u)\n", __func__, type, task->host,
                     (unsigned int)task->port);
-        ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0,
-                                               PP_ERROR_FAILED, 0, __func__);
+        ppb_message_loop_post_work_with_priority(task->callback_ml, task->callback, 0,
+                                                 PP_ERROR_FAILED, 0, ML_PRIORITY_NETWORK, __func__);
         task_destroy(task);
         return;
     }
@@ -290,8 +292,9 @@ handle_tcp_connect_stage1(struct async_network_task_s *task)
     if (!req) {
         trace_warning("%s, early dns resolution failure (%s:%u)\n", __func__, task->host,
                       (unsigned int)task->port);
-        ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0,
-                                               PP_ERROR_NAME_NOT_RESOLVED, 0, __func__);
+        ppb_message_loop_post_work_with_priority(task->callback_ml, task->callback, 0,
+                                                 PP_ERROR_NAME_NOT_RESOLVED, 0, ML_PRIORITY_NETWORK,
+                                                 __func__);
         task_destroy(task);
         return;
     }
@@ -311,8 +314,9 @@ handle_tcp_connect_with_net_address(struct async_network_task_s *task)
         handle_tcp_connect_stage2(DNS_ERR_NONE, DNS_IPv6_AAAA, 1, 3600, &sai->sin6_addr, task);
     } else {
         trace_error("%s, bad address type\n", __func__);
-        ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0,
-                                               PP_ERROR_NAME_NOT_RESOLVED, 0, __func__);
+        ppb_message_loop_post_work_with_priority(task->callback_ml, task->callback, 0,
+                                                 PP_ERROR_NAME_NOT_RESOLVED, 0, ML_PRIORITY_NETWORK,
+                                                 __func__);
         task_destroy(task);
     }
 }
@@ -335,8 +339,8 @@ handle_tcp_read_stage2(int sock, short event_flags, void *arg)
         }
     }
 
-    ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0, retval, 0,
-                                           __func__);
+    ppb_message_loop_post_work_with_priority(task->callback_ml, task->callback, 0, retval, 0,
+                                             ML_PRIORITY_NETWORK, __func__);
     task_destroy(task);
 }
 
@@ -367,8 +371,8 @@ handle_tcp_write_stage2(int sock, short event_flags, void *arg)
     if (retval < 0)
         retval = get_pp_errno();
 
-    ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0, retval, 0,
-                                           __func__);
+    ppb_message_loop_post_work_with_priority(task->callback_ml, task->callback, 0, retval, 0,
+                                             ML_PRIORITY_NETWORK, __func__);
     task_destroy(task);
 }
 
@@ -406,8 +410,9 @@ handle_disconnect_stage2(int sock, short event_flags, void *arg)
         if (cur->resource == task->resource) {
             g_hash_table_iter_remove(&iter);
             event_free(cur->event);
-            ppb_message_loop_post_work_with_result(cur->callback_ml, cur->callback, 0,
-                                                   PP_ERROR_ABORTED, 0, __func__);
+            ppb_message_loop_post_work_with_priority(cur->callback_ml, cur->callback, 0,
+                                                     PP_ERROR_ABORTED, 0, ML_PRIORITY_NETWORK,
+                                                     __func__);
             g_slice_free(struct async_network_task_s, cur);
         }
     }
@@ -455,8 +460,8 @@ handle_udp_recv_stage2(int sock, short event_flags, void *arg)
     }
 
     pp_resource_release(task->resource);
-    ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0, retval, 0,
-                                           __func__);
+    ppb_message_loop_post_work_with_priority(task->callback_ml, task->callback, 0, retval, 0,
+                                             ML_PRIORITY_NETWORK, __func__);
     task_destroy(task);
 }
 
@@ -490,8 +495,8 @@ handle_udp_send_stage2(int sock, short event_flags, void *arg)
     if (retval < 0)
         retval = get_pp_errno();
 
-    ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0, retval, 0,
-                                           __func__);
+    ppb_message_loop_post_work_with_priority(task->callback_ml, task->callback, 0, retval, 0,
+                                             ML_PRIORITY_NETWORK, __func__);
     task_destroy(task);
 }
 
@@ -513,8 +518,8 @@ handle_udp_send_stage1(struct async_network_task_s *task)
 
     if (retval >= 0) {
         // successfully sent
-        ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0, retval, 0,
-                                               __func__);
+        ppb_message_loop_post_work_with_priority(task->callback_ml, task->callback, 0, retval, 0,
+                                                 ML_PRIORITY_NETWORK, __func__);
         task_destroy(task);
         return;
     }
@@ -534,8 +539,9 @@ handle_host_resolve_stage2(int result, char type, int count, int ttl, void *addr
     if (result != DNS_ERR_NONE || count < 1) {
         trace_warning("%s, evdns returned code %d, count = %d (%s:%u)\n", __func__, result, count,
                       task->host, (unsigned int)task->port);
-        ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0,
-                                               PP_ERROR_NAME_NOT_RESOLVED, 0, __func__);
+        ppb_message_loop_post_work_with_priority(task->callback_ml, task->callback, 0,
+                                                 PP_ERROR_NAME_NOT_RESOLVED, 0, ML_PRIORITY_NETWORK,
+                                                 __func__);
         task_destroy(task);
         return;
     }
@@ -565,8 +571,8 @@ handle_host_resolve_stage2(int result, char type, int count, int ttl, void *addr
             memcpy(hr->addrs[k].data, &sai, sizeof(sai));
         }
 
-        ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0, PP_OK, 0,
-                                               __func__);
+        ppb_message_loop_post_work_with_priority(task->callback_ml, task->callback, 0, PP_OK, 0,
+                                                 ML_PRIORITY_NETWORK, __func__);
 
     } else if (type == DNS_IPv6_AAAA) {
         struct in6_addr *ipv6_addrs = addresses;
@@ -583,14 +589,14 @@ handle_host_resolve_stage2(int result, char type, int count, int ttl, void *addr
             memcpy(hr->addrs[k].data, &sai6, sizeof(sai6));
         }
 
-        ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0, PP_OK, 0,
-                                               __func__);
+        ppb_message_loop_post_work_with_priority(task->callback_ml, task->callback, 0, PP_OK, 0,
+                                                 ML_PRIORITY_NETWORK, __func__);
 
     } else {
         trace_error("%s, bad evdns type %d (%s:%u)\n", __func__, type, task->host,
                     (unsigned int)task->port);
-        ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0,
-                                               PP_ERROR_FAILED, 0, __func__);
+        ppb_message_loop_post_work_with_priority(task->callback_ml, task->callback, 0,
+                                                 PP_ERROR_FAILED, 0, ML_PRIORITY_NETWORK, __func__);
 
     }
 
@@ -612,8 +618,9 @@ handle_host_resolve_stage1(struct async_network_task_s *task)
     if (!req) {
         trace_warning("%s, early dns resolution failure (%s:%u)\n", __func__, task->host,
                       (unsigned int)task->port);
-        ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0,
-                                               PP_ERROR_NAME_NOT_RESOLVED, 0, __func__);
+        ppb_message_loop_post_work_with_priority(task->callback_ml, task->callback, 0,
+                                                 PP_ERROR_NAME_NOT_RESOLVED, 0, ML_PRIORITY_NETWORK,
+                                                 __func__);
         task_destroy(task);
         return;
     }
@@ -623,6 +630,7 @@ static
 void *
 network_worker_thread(void *param)
 {
+    thread_local_set_role(THREAD_ROLE_NETWORK);
     event_base_dispatch(event_b);
     event_base_free(event_b);
     trace_error("%s, thread terminated\n", __func__);
@@ -0,0 +1,716 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "audio_capture_pipeline.h"
+#include "eintr_retry.h"
+#include "ppb_message_loop.h"
+#include "trace_core.h"
+#include "utils.h"
+#include <glib.h>
+#include <inttypes.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if HAVE_SOXR
+#include <soxr.h>
+#endif
+
+#define RING_SIZE           (1024 * 1024)   // bytes, power of two
+#define AGC_TARGET_RMS      0.1f            // about -20 dBFS
+#define AGC_MAX_GAIN        10.0f
+#define AGC_NOISE_FLOOR     0.001f          // don't amplify silence
+#define AGC_ATTACK          0.5f            // gain reduction speed, per chunk
+#define AGC_RELEASE         0.02f           // gain increase speed, per chunk
+#define SINC_HALF_WIDTH     16              // kernel half-width, in output samples
+#define SINC_PASSBAND       0.9             // relative to the lower Nyquist frequency
+#define SINC_TABLE_STEPS    64              // kernel table entries per input sample
+
+struct chunk_header_s {
+    uint32_t            sz;
+    double              latency;
+    gint64              timestamp;      // monotonic, microseconds
+    audio_stream_format format;         // zero channels if not known at push time
+};
+
+struct audio_capture_pipeline_s {
+    // ring, single producer, single consumer
+    uint8_t                        *ring;
+    volatile guint                  ring_head;      // written by producer
+    volatile guint                  ring_tail;      // written by consumer
+    int                             wakeup_pipe[2];
+
+    const audio_stream_format      *in_format_src;  // read by producer, on every push
+    audio_stream_format             in_format;      // format of chunk being processed
+    unsigned int                    sample_rate;
+    uint32_t                        sample_frame_count;
+    int                             agc;
+    audio_capture_pipeline_cb_f    *cb;
+    void                           *cb_user_data;
+
+    pthread_t                       thread;
+    int                             thread_started;
+    volatile gint                   terminate;
+
+    // processing state, accessed by processing thread only
+    float                          *mono;           // input converted to mono float
+    size_t                          mono_size;      // in samples
+    float                          *resampled;
+    size_t                          resampled_size; // in samples
+#if HAVE_SOXR
+    soxr_t                          resampler;
+#else
+    float                          *history;        // tail of input, followed by new chunk
+    size_t                          history_size;   // in samples
+    size_t                          history_len;    // samples kept from previous chunks
+    double                          resample_pos;   // position of next output in history
+    int                             half_taps;      // kernel half-width, in input samples
+    float                          *kernel;         // half of the kernel, see resample_reset()
+#endif
+    float                           agc_gain;
+    int16_t                        *block;          // output block being assembled
+    uint32_t                        block_fill;     // in frames
+
+    // counters
+    pthread_mutex_t                 stats_lock;
+    struct audio_capture_stats_s    stats;
+    double                          latency_sum;
+    uint64_t                        latency_count;
+    volatile gint                   overruns;
+    volatile gint                   frames_dropped;
+};
+
+
+static
+void
+ring_write(audio_capture_pipeline *p, guint pos, const void *data, size_t sz)
+{
+    const guint ofs = pos & (RING_SIZE - 1);
+    const size_t part = MIN(sz, RING_SIZE - ofs);
+
+    memcpy(p->ring + ofs, data, part);
+    memcpy(p->ring, (const uint8_t *)data + part, sz - part);
+}
+
+static
+void
+ring_read(audio_capture_pipeline *p, guint pos, void *data, size_t sz)
+{
+    const guint ofs = pos & (RING_SIZE - 1);
+    const size_t part = MIN(sz, RING_SIZE - ofs);
+
+    memcpy(data, p->ring + ofs, part);
+    memcpy((uint8_t *)data + part, p->ring, sz - part);
+}
+
+void
+audio_capture_pipeline_push(audio_capture_pipeline *p, const void *buf, uint32_t sz,
+                            double latency)
+{
+    const guint head = g_atomic_int_get(&p->ring_head);
+    const guint tail = g_atomic_int_get(&p->ring_tail);
+    const size_t needed = sizeof(struct chunk_header_s) + sz;
+
+    if (sz == 0)
+        return;
+
+    // positions wrap around, but their difference is always correct
+    if (RING_SIZE - (head - tail) < needed) {
+        g_atomic_int_inc(&p->overruns);
+        g_atomic_int_add(&p->frames_dropped, sz);   // converted to frames by reader
+        return;
+    }
+
+    struct chunk_header_s hdr = {
+        .sz =           sz,
+        .latency =      latency,
+        .timestamp =    g_get_monotonic_time(),
+    };
+
+    // backend may switch format if stream gets re-created, so each chunk carries its own
+    const audio_stream_format *in_format = g_atomic_pointer_get(&p->in_format_src);
+    if (in_format)
+        hdr.format = *in_format;
+
+    ring_write(p, head, &hdr, sizeof(hdr));
+    ring_write(p, head + sizeof(hdr), buf, sz);
+    g_atomic_int_set(&p->ring_head, head + needed);
+
+    // pipe is non-blocking. If it's full, thread is going to wake up anyway
+    char c = 0;
+    if (write(p->wakeup_pipe[1], &c, 1) < 0) {
+        // ignore
+    }
+}
+
+static
+size_t
+in_frame_size(const audio_stream_format *fmt)
+{
+    const size_t sample_size = (fmt->sample_format == AUDIO_SAMPLE_S16) ? sizeof(int16_t)
+                                                                        : sizeof(float);
+    return fmt->channels * sample_size;
+}
+
+static
+int
+ensure_capacity(float **buf, size_t *size, size_t required)
+{
+    if (*size >= required)
+        return 0;
+
+    float *tmp = realloc(*buf, required * 2 * sizeof(float));
+    if (!tmp) {
+        trace_error("%s, can't allocate memory\n", __func__);
+        return -1;
+    }
+
+    *buf = tmp;
+    *size = required * 2;
+    return 0;
+}
+
+// Conversion loops below are kept simple, with no dependencies between iterations, so
+// compiler can vectorize them.
+
+static
+void
+to_mono_s16(float *restrict dst, const int16_t *restrict src, size_t frames,
+            unsigned int channels)
+{
+    const float scale = 1.0f / (32768.0f * channels);
+
+    if (channels == 1) {
+        for (size_t k = 0; k < frames; k ++)
+            dst[k] = src[k] * scale;
+        return;
+    }
+
+    if (channels == 2) {
+        for (size_t k = 0; k < frames; k ++)
+            dst[k] = ((int32_t)src[2 * k] + src[2 * k + 1]) * scale;
+        return;
+    }
+
+    for (size_t k = 0; k < frames; k ++) {
+        int32_t sum = 0;
+        for (unsigned int ch = 0; ch < channels; ch ++)
+            sum += src[k * channels + ch];
+        dst[k] = sum * scale;
+    }
+}
+
+static
+void
+to_mono_float(float *restrict dst, const float *restrict src, size_t frames,
+              unsigned int channels)
+{
+    const float scale = 1.0f / channels;
+
+    if (channels == 1) {
+        memcpy(dst, src, frames * sizeof(float));
+        return;
+    }
+
+    if (channels == 2) {
+        for (size_t k = 0; k < frames; k ++)
+            dst[k] = (src[2 * k] + src[2 * k + 1]) * scale;
+        return;
+    }
+
+    for (size_t k = 0; k < frames; k ++) {
+        float sum = 0;
+        for (unsigned int ch = 0; ch < channels; ch ++)
+            sum += src[k * channels + ch];
+        dst[k] = sum * scale;
+    }
+}
+
+#if HAVE_SOXR
+/// (re)creates resampler for current input format. Called on the processing thread, or before
+/// it's started
+static
+void
+resample_reset(audio_capture_pipeline *p)
+{
+    if (p->resampler) {
+        soxr_delete(p->resampler);
+        p->resampler = NULL;
+    }
+
+    if (p->in_format.sample_rate == p->sample_rate)
+        return;
+
+    soxr_error_t err;
+    const soxr_io_spec_t io_spec = soxr_io_spec(SOXR_FLOAT32_I, SOXR_FLOAT32_I);
+    const soxr_quality_spec_t quality_spec = soxr_quality_spec(SOXR_MQ, 0);
+
+    p->resampler = soxr_create(p->in_format.sample_rate, p->sample_rate, 1, &err, &io_spec,
+                               &quality_spec, NULL);
+    if (err != NULL) {
+        trace_error("%s, can't create resampler: %s\n", __func__, soxr_strerror(err));
+        p->resampler = NULL;
+    }
+}
+
+static
+void
+resample_free(audio_capture_pipeline *p)
+{
+    if (p->resampler)
+        soxr_delete(p->resampler);
+}
+
+/// band-limited resampler. soxr keeps state between chunks, so there are no discontinuities at
+/// chunk boundaries
+static
+size_t
+resample(audio_capture_pipeline *p, const float *src, size_t frames)
+{
+    const double ratio = (double)p->sample_rate / p->in_format.sample_rate;
+    size_t consumed = 0;
+    size_t out = 0;
+
+    if (!p->resampler)
+        return 0;
+
+    while (consumed < frames) {
+        size_t idone = 0, odone = 0;
+
+        if (ensure_capacity(&p->resampled, &p->resampled_size,
+                            out + (frames - consumed) * ratio + 64) != 0)
+        {
+            break;
+        }
+
+        soxr_error_t err = soxr_process(p->resampler, src + consumed, frames - consumed, &idone,
+                                        p->resampled + out, p->resampled_size - out, &odone);
+        if (err != NULL) {
+            trace_error("%s, soxr_process failed: %s\n", __func__, soxr_strerror(err));
+            break;
+        }
+
+        consumed += idone;
+        out += odone;
+        if (idone == 0 && odone == 0)
+            break;
+    }
+
+    return out;
+}
+
+#else // HAVE_SOXR
+
+/// Blackman-windowed sinc, |cutoff| in cycles per input sample
+static
+double
+sinc_kernel(double x, double cutoff, int half_taps)
+{
+    if (fabs(x) >= half_taps)
+        return 0;
+
+    const double w = 0.42 + 0.5 * cos(M_PI * x / half_taps) + 0.08 * cos(2 * M_PI * x / half_taps);
+    const double t = 2 * cutoff * x;
+    const double sinc = (fabs(t) < 1e-9) ? 1.0 : sin(M_PI * t) / (M_PI * t);
+
+    return 2 * cutoff * sinc * w;
+}
+
+/// prepares kernel for current input format. Kernel is tabulated for non-negative offsets, as it
+/// is symmetric. When downsampling, it gets wider and its cutoff follows output Nyquist
+/// frequency, so nothing above it folds back into the passband
+static
+void
+resample_reset(audio_capture_pipeline *p)
+{
+    const double ratio = MIN(1.0, (double)p->sample_rate / p->in_format.sample_rate);
+    const double cutoff = 0.5 * SINC_PASSBAND * ratio;
+    const int half_taps = ceil(SINC_HALF_WIDTH / ratio);
+    const size_t table_len = (size_t)half_taps * SINC_TABLE_STEPS + 1;
+
+    free(p->kernel);
+    p->kernel = malloc(table_len * sizeof(float));
+    if (!p->kernel) {
+        trace_error("%s, can't allocate memory\n", __func__);
+        p->half_taps = 0;
+        return;
+    }
+
+    for (size_t k = 0; k < table_len; k ++)
+        p->kernel[k] = sinc_kernel((double)k / SINC_TABLE_STEPS, cutoff, half_taps);
+
+    // start with silence, so the first outputs have full kernel support
+    p->half_taps = half_taps;
+    p->history_len = 0;
+    if (ensure_capacity(&p->history, &p->history_size, 2 * half_taps) == 0) {
+        p->history_len = 2 * half_taps;
+        memset(p->history, 0, p->history_len * sizeof(float));
+    }
+    p->resample_pos = half_taps;
+}
+
+static
+void
+resample_free(audio_capture_pipeline *p)
+{
+    free(p->kernel);
+    free(p->history);
+}
+
+static
+float
+kernel_at(const audio_capture_pipeline *p, double x)
+{
+    const double a = fabs(x) * SINC_TABLE_STEPS;
+    const size_t idx = (size_t)a;
+
+    if (idx >= (size_t)p->half_taps * SINC_TABLE_STEPS)
+        return 0;
+
+    const float frac = a - idx;
+    return p->kernel[idx] + (p->kernel[idx + 1] - p->kernel[idx]) * frac;
+}
+
+/// band-limited resampler. Tail of the input is kept between chunks, so there are no
+/// discontinuities at chunk boundaries
+static
+size_t
+resample(audio_capture_pipeline *p, const float *src, size_t frames)
+{
+    const double step = (double)p->in_format.sample_rate / p->sample_rate;
+    const int half = p->half_taps;
+    const size_t keep = 2 * (size_t)half;
+    const size_t total = p->history_len + frames;
+    double pos = p->resample_pos;
+    size_t out = 0;
+
+    if (half == 0 || p->history_len != keep)
+        return 0;
+
+    if (ensure_capacity(&p->history, &p->history_size, total) != 0 ||
+        ensure_capacity(&p->resampled, &p->resampled_size, frames / step + 2) != 0)
+    {
+        return 0;
+    }
+
+    float *buf = p->history;
+    memcpy(buf + p->history_len, src, frames * sizeof(float));
+
+    // output at |pos| needs input samples from pos - half + 1 to pos + half
+    while ((size_t)pos + half < total) {
+        const size_t c = (size_t)pos;
+        const double frac = pos - c;
+        float acc = 0;
+
+        for (int k = -half + 1; k <= half; k ++)
+            acc += buf[c + k] * kernel_at(p, k - frac);
+
+        p->resampled[out ++] = acc;
+        pos += step;
+    }
+
+    const size_t drop = total - keep;
+    memmove(buf, buf + drop, keep * sizeof(float));
+    p->resample_pos = pos - drop;
+    return out;
+}
+#endif // HAVE_SOXR
+
+static
+void
+apply_agc(audio_capture_pipeline *p, float *buf, size_t count)
+{
+    float energy = 0;
+    for (size_t k = 0; k < count; k ++)
+        energy += buf[k] * buf[k];
+
+    const float rms = sqrtf(energy / count);
+    if (rms > AGC_NOISE_FLOOR) {
+        const float desired = CLAMP(AGC_TARGET_RMS / rms, 1.0f, AGC_MAX_GAIN);
+        const float speed = (desired < p->agc_gain) ? AGC_ATTACK : AGC_RELEASE;
+        p->agc_gain += (desired - p->agc_gain) * speed;
+    }
+
+    const float gain = p->agc_gain;
+    for (size_t k = 0; k < count; k ++)
+        buf[k] *= gain;
+}
+
+static
+void
+emit_samples(audio_capture_pipeline *p, const float *buf, size_t count, double chunk_latency)
+{
+    const double out_rate = p->sample_rate;
+
+    for (size_t k = 0; k < count; k ++) {
+        const float v = CLAMP(buf[k], -1.0f, 1.0f);
+        p->block[p->block_fill ++] = (int16_t)lrintf(v * 32767.0f);
+
+        if (p->block_fill == p->sample_frame_count) {
+            // oldest sample in block was captured that long before the newest one
+            const size_t from_chunk = k + 1;
+            const double latency = chunk_latency +
+                            (p->sample_frame_count - MIN(from_chunk, p->sample_frame_count))
+                            / out_rate;
+
+            p->cb(p->block, p->sample_frame_count * sizeof(int16_t), latency, p->cb_user_data);
+            p->block_fill = 0;
+
+            pthread_mutex_lock(&p->stats_lock);
+            p->stats.frames_out += p->sample_frame_count;
+            pthread_mutex_unlock(&p->stats_lock);
+        }
+    }
+}
+
+static
+void
+switch_format(audio_capture_pipeline *p, const audio_stream_format *fmt)
+{
+    if (fmt->channels == 0 || memcmp(fmt, &p->in_format, sizeof(*fmt)) == 0)
+        return;
+
+    trace_info_f("%s, input changed to %u Hz, %u channel(s), %s\n", __func__,
+                 fmt->sample_rate, fmt->channels,
+                 fmt->sample_format == AUDIO_SAMPLE_S16 ? "s16" : "float");
+
+    p->in_format = *fmt;
+    resample_reset(p);
+}
+
+static
+void
+process_chunk(audio_capture_pipeline *p, const void *data, const struct chunk_header_s *hdr)
+{
+    switch_format(p, &hdr->format);
+
+    const size_t frame_size = in_frame_size(&p->in_format);
+    const size_t frames = hdr->sz / frame_size;
+    const double queued = (g_get_monotonic_time() - hdr->timestamp) / 1e6;
+
+    pthread_mutex_lock(&p->stats_lock);
+    p->stats.frames_in += frames;
+    p->latency_sum += queued;
+    p->latency_count += 1;
+    p->stats.latency_max = MAX(p->stats.latency_max, queued);
+    pthread_mutex_unlock(&p->stats_lock);
+
+    if (frames == 0)
+        return;
+
+    if (ensure_capacity(&p->mono, &p->mono_size, frames) != 0)
+        return;
+
+    if (p->in_format.sample_format == AUDIO_SAMPLE_S16)
+        to_mono_s16(p->mono, data, frames, p->in_format.channels);
+    else
+        to_mono_float(p->mono, data, frames, p->in_format.channels);
+
+    float *out = p->mono;
+    size_t out_count = frames;
+    if (p->in_format.sample_rate != p->sample_rate) {
+        out_count = resample(p, p->mono, frames);
+        out = p->resampled;
+    }
+
+    if (p->agc)
+        apply_agc(p, out, out_count);
+
+    emit_samples(p, out, out_count, hdr->latency + queued);
+}
+
+static
+void *
+pipeline_thread(void *param)
+{
+    audio_capture_pipeline *p = param;
+    void *data = NULL;
+    size_t data_size = 0;
+
+    ppb_message_loop_mark_thread_unsuitable();
+
+    while (!g_atomic_int_get(&p->terminate)) {
+        guint tail = g_atomic_int_get(&p->ring_tail);
+        const guint head = g_atomic_int_get(&p->ring_head);
+
+        if (head == tail) {
+            struct pollfd pfd = { .fd = p->wakeup_pipe[0], .events = POLLIN };
+            char tmp[64];
+
+            if (RETRY_ON_EINTR(poll(&pfd, 1, -1)) > 0) {
+                while (read(p->wakeup_pipe[0], tmp, sizeof(tmp)) > 0) {
+                    // drain
+                }
+            }
+            continue;
+        }
+
+        while (tail != head) {
+            struct chunk_header_s hdr;
+
+            ring_read(p, tail, &hdr, sizeof(hdr));
+            if (data_size < hdr.sz) {
+                void *tmp = realloc(data, hdr.sz);
+                if (tmp) {
+                    data = tmp;
+                    data_size = hdr.sz;
+                }
+            }
+
+            const int have_room = (data_size >= hdr.sz);
+            if (have_room)
+                ring_read(p, tail + sizeof(hdr), data, hdr.sz);
+
+            tail += sizeof(hdr) + hdr.sz;
+            g_atomic_int_set(&p->ring_tail, tail);
+
+            if (have_room)
+                process_chunk(p, data, &hdr);
+            else
+                trace_error("%s, can't allocate memory, chunk dropped\n", __func__);
+        }
+    }
+
+    free(data);
+    return NULL;
+}
+
+audio_capture_pipeline *
+audio_capture_pipeline_create(unsigned int sample_rate, uint32_t sample_frame_count, int agc,
+                              audio_capture_pipeline_cb_f *cb, void *cb_user_data)
+{
+    audio_capture_pipeline *p = calloc(1, sizeof(*p));
+    if (!p)
+        return NULL;
+
+    p->ring = malloc(RING_SIZE);
+    p->block = malloc(sample_frame_count * sizeof(int16_t));
+    if (!p->ring || !p->block)
+        goto err;
+
+    if (pipe(p->wakeup_pipe) != 0) {
+        trace_error("%s, can't create pipe\n", __func__);
+        goto err;
+    }
+
+    make_nonblock(p->wakeup_pipe[0]);
+    make_nonblock(p->wakeup_pipe[1]);
+
+    p->sample_rate = sample_rate;
+    p->sample_frame_count = sample_frame_count;
+    p->agc = agc;
+    p->agc_gain = 1.0f;
+    p->cb = cb;
+    p->cb_user_data = cb_user_data;
+    pthread_mutex_init(&p->stats_lock, NULL);
+
+    return p;
+
+err:
+    free(p->ring);
+    free(p->block);
+    free(p);
+    return NULL;
+}
+
+void
+audio_capture_pipeline_start(audio_capture_pipeline *p, const audio_stream_format *in_format)
+{
+    p->in_format = *in_format;
+    g_atomic_pointer_set(&p->in_format_src, in_format);
+
+    if (p->in_format.channels == 0) {
+        trace_error("%s, bad channel count, assuming mono\n", __func__);
+        p->in_format.channels = 1;
+    }
+
+    if (p->in_format.sample_rate != p->sample_rate || p->in_format.channels != 1 ||
+        p->in_format.sample_format != AUDIO_SAMPLE_S16)
+    {
+        trace_info_f("%s, converting %u Hz, %u channel(s), %s to %u Hz mono s16\n", __func__,
+                     p->in_format.sample_rate, p->in_format.channels,
+                     p->in_format.sample_format == AUDIO_SAMPLE_S16 ? "s16" : "float",
+                     p->sample_rate);
+    }
+
+    resample_reset(p);
+
+    if (pthread_create(&p->thread, NULL, pipeline_thread, p) != 0) {
+        trace_error("%s, can't create thread\n", __func__);
+        return;
+    }
+
+    p->thread_started = 1;
+}
+
+void
+audio_capture_pipeline_get_stats(audio_capture_pipeline *p, struct audio_capture_stats_s *stats)
+{
+    pthread_mutex_lock(&p->stats_lock);
+    *stats = p->stats;
+    stats->latency_avg = p->latency_count ? p->latency_sum / p->latency_count : 0;
+    pthread_mutex_unlock(&p->stats_lock);
+
+    stats->overruns = g_atomic_int_get(&p->overruns);
+
+    // push() doesn't know frame size, it counts bytes
+    const size_t frame_size = p->in_format.channels ? in_frame_size(&p->in_format) : 1;
+    stats->frames_dropped = (guint)g_atomic_int_get(&p->frames_dropped) / frame_size;
+}
+
+void
+audio_capture_pipeline_destroy(audio_capture_pipeline *p)
+{
+    if (!p)
+        return;
+
+    if (p->thread_started) {
+        char c = 0;
+        g_atomic_int_set(&p->terminate, 1);
+        if (write(p->wakeup_pipe[1], &c, 1) < 0) {
+            // pipe is full, thread will wake up anyway
+        }
+        pthread_join(p->thread, NULL);
+
+        struct audio_capture_stats_s stats;
+        audio_capture_pipeline_get_stats(p, &stats);
+        trace_info_f("%s, frames in %" PRIu64 ", out %" PRIu64 ", %u overruns (%" PRIu64
+                     " frames lost), ring latency avg %.1f ms, max %.1f ms\n", __func__,
+                     stats.frames_in, stats.frames_out, stats.overruns, stats.frames_dropped,
+                     1e3 * stats.latency_avg, 1e3 * stats.latency_max);
+    }
+
+    close(p->wakeup_pipe[0]);
+    close(p->wakeup_pipe[1]);
+    pthread_mutex_destroy(&p->stats_lock);
+    free(p->mono);
+    free(p->resampled);
+    resample_free(p);
+    free(p->block);
+    free(p->ring);
+    free(p);
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "audio_thread.h"
+#include <stdint.h>
+
+/// Converts captured audio from format backend delivers to mono signed 16-bit at requested
+/// rate, in blocks of exactly requested frame count. Processing happens on a dedicated
+/// thread, fed by a lock-free ring, so backend audio threads only copy data.
+
+typedef struct audio_capture_pipeline_s audio_capture_pipeline;
+
+/// receives |sz| bytes, sample_frame_count frames of mono signed 16-bit audio
+typedef void
+(audio_capture_pipeline_cb_f)(const void *buf, uint32_t sz, double latency, void *user_data);
+
+struct audio_capture_stats_s {
+    uint64_t    frames_in;          ///< input frames accepted into the ring
+    uint64_t    frames_out;         ///< output frames delivered
+    uint64_t    frames_dropped;     ///< input frames lost due to overruns
+    uint32_t    overruns;           ///< input chunks dropped because the ring was full
+    double      latency_avg;        ///< time chunks spent in the ring, seconds
+    double      latency_max;
+};
+
+/// creates pipeline. With |agc| set, automatic gain control is applied
+audio_capture_pipeline *
+audio_capture_pipeline_create(unsigned int sample_rate, uint32_t sample_frame_count, int agc,
+                              audio_capture_pipeline_cb_f *cb, void *cb_user_data);
+
+/// sets format of incoming data and starts processing thread. Data pushed before the call is
+/// kept in the ring. |in_format| must stay valid until pipeline is destroyed. It's read on
+/// each push, so changes made by backend when it re-creates stream are picked up
+void
+audio_capture_pipeline_start(audio_capture_pipeline *p, const audio_stream_format *in_format);
+
+/// queues captured data. Doesn't block or take locks, so it's safe to call from backend's
+/// audio thread. Only one thread may push
+void
+audio_capture_pipeline_push(audio_capture_pipeline *p, const void *buf, uint32_t sz,
+                            double latency);
+
+void
+audio_capture_pipeline_get_stats(audio_capture_pipeline *p, struct audio_capture_stats_s *stats);
+
+/// stops processing thread and frees resources. Backend stream must be destroyed before
+void
+audio_capture_pipeline_destroy(audio_capture_pipeline *p);
@@ -0,0 +1,284 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE             // for SCHED_RESET_ON_FORK
+#include "audio_rt.h"
+#include "compat.h"
+#include "config.h"
+#include "thread_local.h"
+#include "trace_core.h"
+#include <errno.h>
+#include <glib.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#if HAVE_GLIB_DBUS
+#include <gio/gio.h>
+#endif // HAVE_GLIB_DBUS
+
+#ifndef SCHED_RESET_ON_FORK
+#define SCHED_RESET_ON_FORK     0x40000000
+#endif
+
+#define RTKIT_SERVICE           "org.freedesktop.RealtimeKit1"
+#define RTKIT_PATH              "/org/freedesktop/RealtimeKit1"
+#define RTKIT_INTERFACE         "org.freedesktop.RealtimeKit1"
+
+/// part of the stack, below the frame of audio_rt_prepare_thread() caller, which is locked
+#define LOCKED_STACK_SIZE       (64 * 1024)
+
+/// rtkit only serves processes which limit CPU time real-time threads can take without
+/// blocking, and it's that limit which protects the system from a runaway real-time thread.
+/// Audio threads block every period, so limit is far from being reached. Only threads with
+/// real-time policy are affected by it
+#define RTTIME_LIMIT_US         (200 * 1000)
+
+/// elevation is done once per audio thread, yet a hung system bus shouldn't hang thread creation
+#define RTKIT_TIMEOUT_MS        1000
+
+static volatile gint    mlock_failure_reported = 0;
+
+
+static
+int
+realtime_enabled(void)
+{
+    return config.audio_realtime_priority > 0;
+}
+
+static
+int
+make_realtime_direct(pid_t tid, int priority)
+{
+    struct sched_param param = { .sched_priority = priority };
+
+    // processes spawned from this thread shouldn't inherit real-time policy
+    return sched_setscheduler(tid, SCHED_FIFO | SCHED_RESET_ON_FORK, &param);
+}
+
+#if HAVE_GLIB_DBUS
+static
+int64_t
+rtkit_get_property(GDBusConnection *connection, const char *name)
+{
+    GError *error = NULL;
+    GVariant *reply = g_dbus_connection_call_sync(connection, RTKIT_SERVICE, RTKIT_PATH,
+                                                  "org.freedesktop.DBus.Properties", "Get",
+                                                  g_variant_new("(ss)", RTKIT_INTERFACE, name),
+                                                  G_VARIANT_TYPE("(v)"),
+                                                  G_DBUS_CALL_FLAGS_NONE, RTKIT_TIMEOUT_MS,
+                                                  NULL, &error);
+    if (!reply) {
+        trace_error("%s, can't get %s, %s\n", __func__, name, error->message);
+        g_clear_error(&error);
+        return -1;
+    }
+
+    int64_t value = -1;
+    GVariant *v;
+    g_variant_get(reply, "(v)", &v);
+    if (g_variant_is_of_type(v, G_VARIANT_TYPE_INT32))
+        value = g_variant_get_int32(v);
+    else if (g_variant_is_of_type(v, G_VARIANT_TYPE_INT64))
+        value = g_variant_get_int64(v);
+
+    g_variant_unref(v);
+    g_variant_unref(reply);
+    return value;
+}
+
+static
+int
+make_realtime_rtkit(pid_t tid, int priority)
+{
+    GError *error = NULL;
+    GDBusConnection *connection = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
+    if (!connection) {
+        trace_error("%s, can't connect to system bus, %s\n", __func__, error->message);
+        g_clear_error(&error);
+        return -1;
+    }
+
+    const int64_t max_priority = rtkit_get_property(connection, "MaxRealtimePriority");
+    if (max_priority > 0)
+        priority = MIN(priority, max_priority);
+
+    const int64_t rttime_max = rtkit_get_property(connection, "RTTimeUSecMax");
+    const rlim_t rttime_limit = rttime_max > 0 ? MIN(rttime_max, RTTIME_LIMIT_US)
+                                               : RTTIME_LIMIT_US;
+
+    // the soft limit is lowered and stays so while the process lives, as rtkit expects. It's
+    // what stops a real-time thread that spins: it gets SIGXCPU. Other browser threads are
+    // not real-time, so they are not affected. Without the limit, thread is not elevated
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_RTTIME, &rl) != 0) {
+        trace_error("%s, can't get RLIMIT_RTTIME, errno=%d\n", __func__, errno);
+        g_object_unref(connection);
+        return -1;
+    }
+
+    if (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > rttime_limit) {
+        rl.rlim_cur = rttime_limit;
+        if (setrlimit(RLIMIT_RTTIME, &rl) != 0) {
+            trace_error("%s, can't set RLIMIT_RTTIME, errno=%d\n", __func__, errno);
+            g_object_unref(connection);
+            return -1;
+        }
+    }
+
+    GVariant *reply = g_dbus_connection_call_sync(connection, RTKIT_SERVICE, RTKIT_PATH,
+                                                  RTKIT_INTERFACE, "MakeThreadRealtime",
+                                                  g_variant_new("(tu)", (guint64)tid,
+                                                                (guint32)priority),
+                                                  NULL, G_DBUS_CALL_FLAGS_NONE,
+                                                  RTKIT_TIMEOUT_MS, NULL, &error);
+    g_object_unref(connection);
+
+    if (!reply) {
+        trace_error("%s, MakeThreadRealtime failed, %s\n", __func__, error->message);
+        g_clear_error(&error);
+        return -1;
+    }
+
+    g_variant_unref(reply);
+    return 0;
+}
+#endif // HAVE_GLIB_DBUS
+
+static
+enum audio_rt_state_e
+elevate_thread(pid_t tid)
+{
+    if (!realtime_enabled())
+        return AUDIO_RT_DISABLED;
+
+    const int policy = sched_getscheduler(tid) & ~SCHED_RESET_ON_FORK;
+    if (policy == SCHED_FIFO || policy == SCHED_RR)
+        return AUDIO_RT_ALREADY;
+
+    const int priority = CLAMP(config.audio_realtime_priority, sched_get_priority_min(SCHED_FIFO),
+                               sched_get_priority_max(SCHED_FIFO));
+
+    if (make_realtime_direct(tid, priority) == 0)
+        return AUDIO_RT_DIRECT;
+
+#if HAVE_GLIB_DBUS
+    if (make_realtime_rtkit(tid, priority) == 0)
+        return AUDIO_RT_RTKIT;
+#endif // HAVE_GLIB_DBUS
+
+    return AUDIO_RT_FAILED;
+}
+
+static
+void
+__attribute__((noinline))
+lock_stack(void)
+{
+    volatile char area[LOCKED_STACK_SIZE];
+
+    // callbacks will use about the same part of the stack. Pages are touched first, so they
+    // are mapped when locked
+    for (size_t k = 0; k < sizeof(area); k += 4096)
+        area[k] = 0;
+
+    audio_rt_lock_memory((const void *)area, sizeof(area));
+}
+
+enum audio_rt_state_e
+audio_rt_prepare_thread(void)
+{
+    struct thread_local_block *tl = get_thread_local();
+
+    if (tl->audio_rt_state != AUDIO_RT_NOT_TRIED)
+        return tl->audio_rt_state;
+
+    const enum audio_rt_state_e state = elevate_thread(thread_local_get_tid());
+    tl->audio_rt_state = state;
+
+    if (state == AUDIO_RT_DISABLED)
+        return state;
+
+    lock_stack();
+
+    // real-time priority was asked for, so failure to get it shouldn't go unnoticed
+    if (state == AUDIO_RT_FAILED)
+        trace_warning("%s, can't make audio thread real-time\n", __func__);
+    else
+        trace_info_f("%s, tid %d: %s\n", __func__, thread_local_get_tid(),
+                     audio_rt_state_name(state));
+    return state;
+}
+
+enum audio_rt_state_e
+audio_rt_elevate_thread(pid_t tid)
+{
+    const enum audio_rt_state_e state = elevate_thread(tid);
+
+    if (state == AUDIO_RT_FAILED)
+        trace_warning("%s, can't make audio thread %d real-time\n", __func__, (int)tid);
+    else if (state != AUDIO_RT_DISABLED)
+        trace_info_f("%s, tid %d: %s\n", __func__, (int)tid, audio_rt_state_name(state));
+    return state;
+}
+
+void
+audio_rt_lock_memory(const void *ptr, size_t size)
+{
+    if (!realtime_enabled() || !ptr || size == 0)
+        return;
+
+    if (mlock(ptr, size) != 0) {
+        // RLIMIT_MEMLOCK is often low; no point in repeating the same message for each buffer
+        if (g_atomic_int_compare_and_exchange(&mlock_failure_reported, 0, 1))
+            trace_error("%s, mlock failed, errno=%d\n", __func__, errno);
+    }
+}
+
+void
+audio_rt_unlock_memory(const void *ptr, size_t size)
+{
+    if (!realtime_enabled() || !ptr || size == 0)
+        return;
+
+    munlock(ptr, size);
+}
+
+const char *
+audio_rt_state_name(enum audio_rt_state_e state)
+{
+    switch (state) {
+    case AUDIO_RT_NOT_TRIED:    return "not tried";
+    case AUDIO_RT_DISABLED:     return "disabled";
+    case AUDIO_RT_FAILED:       return "failed";
+    case AUDIO_RT_ALREADY:      return "already real-time";
+    case AUDIO_RT_DIRECT:       return "SCHED_FIFO";
+    case AUDIO_RT_RTKIT:        return "SCHED_FIFO through rtkit";
+    default:                    return "unknown";
+    }
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/// Real-time scheduling of threads which run audio callbacks. If
+/// config.audio_realtime_priority is set, such threads are switched to SCHED_FIFO of that
+/// priority, directly if RLIMIT_RTPRIO permits, or through RealtimeKit otherwise. For the
+/// latter, soft RLIMIT_RTTIME of the process is set to 200 ms and left so, as RealtimeKit
+/// requires. Their stacks, as well as buffers used by backends on the callback path, are
+/// locked in memory.
+///
+/// Elevation may take D-Bus round-trips, so it's done once, when backend creates its thread,
+/// and never from within a callback.
+
+enum audio_rt_state_e {
+    AUDIO_RT_NOT_TRIED = 0,
+    AUDIO_RT_DISABLED,          ///< real-time scheduling is not configured
+    AUDIO_RT_FAILED,            ///< neither direct call nor rtkit worked
+    AUDIO_RT_ALREADY,           ///< thread was real-time already, e.g. JACK process thread
+    AUDIO_RT_DIRECT,
+    AUDIO_RT_RTKIT,
+};
+
+/// elevates current thread and locks part of its stack. Backend threads call it on start,
+/// before running any callback. Only the first call on a thread does anything; returns the
+/// outcome
+enum audio_rt_state_e
+audio_rt_prepare_thread(void);
+
+/// elevates thread |tid| of this process, which is created by an audio library rather than by
+/// a backend, e.g. PulseAudio mainloop thread. Must not be called from that thread's callbacks
+enum audio_rt_state_e
+audio_rt_elevate_thread(pid_t tid);
+
+/// locks buffer used on the callback path in memory. Does nothing unless real-time scheduling
+/// is configured. Failures, e.g. due to RLIMIT_MEMLOCK, are not fatal
+void
+audio_rt_lock_memory(const void *ptr, size_t size);
+
+void
+audio_rt_unlock_memory(const void *ptr, size_t size);
+
+const char *
+audio_rt_state_name(enum audio_rt_state_e state);
@@ -23,7 +23,15 @@
  */
 
 #include "audio_thread.h"
+#include "config.h"
+#include "ppb_message_loop.h"
+#include "trace_core.h"
+#include <glib.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 extern audio_stream_ops audio_alsa;
 extern audio_stream_ops audio_noaudio;
@@ -34,25 +42,509 @@ extern audio_stream_ops audio_pulse;
 extern audio_stream_ops audio_jack;
 #endif
 
+// Streams handed out by audio_select_implementation() are wrappers around backend streams.
+// Watchdog thread checks that running streams keep getting callbacks. If one stalls, its
+// backend is considered broken for the rest of the session, and all streams of that backend
+// are re-created on the next available one, in order of the table below. Time spent in plugin
+// callbacks doesn't count as a stall, it's not backend's fault.
 
-audio_stream_ops *
-audio_select_implementation(void)
-{
+#define WATCHDOG_CHECKS     4       // per stall timeout
+
+struct backend_s {
+    const char         *name;
+    audio_stream_ops   *ops;
+    volatile gint       failed;
+};
+
+static struct backend_s backends[] = {
 #if HAVE_JACK
-    if (audio_jack.available())
-        return &audio_jack;
+    { .name = "jack",       .ops = &audio_jack },
 #endif
 #if HAVE_PULSEAUDIO
-    if (audio_pulse.available())
-        return &audio_pulse;
+    { .name = "pulseaudio", .ops = &audio_pulse },
 #endif
+    { .name = "alsa",       .ops = &audio_alsa },
+    { .name = "null",       .ops = &audio_noaudio },
+};
+
+#define BACKEND_COUNT       (sizeof(backends) / sizeof(backends[0]))
+#define NULL_BACKEND        (BACKEND_COUNT - 1)
+
+enum {
+    LINK_IDLE = 0,
+    LINK_BUSY,      ///< backend stream is calling back
+    LINK_DETACHED,  ///< backend stream was replaced, its callbacks are ignored
+};
+
+/// user data of a backend stream. Each backend stream gets its own, so callbacks of a stalled
+/// one that wakes up after failover can be told from callbacks of its replacement
+struct backend_link_s {
+    audio_stream   *as;
+    volatile gint   state;
+};
+
+struct audio_stream_s {
+    audio_stream_direction      direction;
+    unsigned int                sample_rate;
+    unsigned int                sample_frame_count;
+    audio_stream_playback_cb_f *playback_cb;
+    audio_stream_capture_cb_f  *capture_cb;
+    void                       *cb_user_data;
+    char                       *longname;
+    audio_stream_format        *format;
+    int                         paused;
+    size_t                      backend_idx;
+    audio_stream               *stream;        ///< backend stream, NULL if none could be made
+    struct backend_link_s      *link;          ///< of |stream|
+    volatile gint               callback_count;
+    volatile gint               in_callback;    ///< plugin callbacks currently running
+    gint                        seen_count;     ///< callback count at last progress
+    gint64                      seen_time;      ///< when progress was seen, monotonic, us
+    gint64                      period_us;
+    volatile gint               slow_callbacks;
+    volatile gint               cb_time_max_us; ///< changed by thread running callbacks only
+    uint64_t                    prev_underruns; ///< of backend streams dropped on failover
+    uint64_t                    prev_overruns;
+};
+
+struct doomed_stream_s {
+    audio_stream_ops       *ops;
+    audio_stream           *stream;
+    struct backend_link_s  *link;
+};
 
-    if (audio_alsa.available())
-        return &audio_alsa;
+static pthread_mutex_t  lock = PTHREAD_MUTEX_INITIALIZER;
+static GList           *streams = NULL;
+
+// held while backend streams are destroyed, which may take long on a broken backend, so it's
+// done without |lock|. Wrappers are freed with it held only, so backend stream being torn down
+// never calls back into a freed wrapper
+static pthread_mutex_t  teardown_lock = PTHREAD_MUTEX_INITIALIZER;
+static int              watchdog_started = 0;
+static int              stall_timeout_ms = 2000;
+
+static pthread_mutex_t  preferred_lock = PTHREAD_MUTEX_INITIALIZER;
+static int              preferred_cached = 0;
+static int              preferred_result;
+static unsigned int     preferred_sample_rate;
+static unsigned int     preferred_period_frames;
+
+
+static
+int
+backend_usable(size_t idx)
+{
+    if (g_atomic_int_get(&backends[idx].failed))
+        return 0;
+
+    // when backend is forced, null one is still used as a fallback
+    const char *forced = config.audio_backend;
+    if (forced && forced[0] && idx != NULL_BACKEND && strcmp(forced, backends[idx].name) != 0)
+        return 0;
+
+    return backends[idx].ops->available();
+}
+
+static
+audio_stream_ops *
+current_backend(void)
+{
+    for (size_t k = 0; k < BACKEND_COUNT; k ++) {
+        if (backend_usable(k))
+            return backends[k].ops;
+    }
 
     return &audio_noaudio;
 }
 
+static
+void
+account_callback_time(audio_stream *as, gint64 start)
+{
+    const gint cb_time = g_get_monotonic_time() - start;
+
+    if (cb_time > as->period_us)
+        g_atomic_int_inc(&as->slow_callbacks);
+    if (cb_time > g_atomic_int_get(&as->cb_time_max_us))
+        g_atomic_int_set(&as->cb_time_max_us, cb_time);
+}
+
+static
+void
+failover_playback_cb(void *buf, uint32_t sz, double latency, void *user_data)
+{
+    struct backend_link_s *link = user_data;
+    audio_stream *as = link->as;
+
+    if (!g_atomic_int_compare_and_exchange(&link->state, LINK_IDLE, LINK_BUSY)) {
+        // replacement stream is feeding plugin already
+        memset(buf, 0, sz);
+        return;
+    }
+
+    const gint64 start = g_get_monotonic_time();
+    g_atomic_int_inc(&as->callback_count);
+    g_atomic_int_inc(&as->in_callback);
+    as->playback_cb(buf, sz, latency, as->cb_user_data);
+    g_atomic_int_add(&as->in_callback, -1);
+    account_callback_time(as, start);
+    g_atomic_int_set(&link->state, LINK_IDLE);
+}
+
+static
+void
+failover_capture_cb(const void *buf, uint32_t sz, double latency, void *user_data)
+{
+    struct backend_link_s *link = user_data;
+    audio_stream *as = link->as;
+
+    if (!g_atomic_int_compare_and_exchange(&link->state, LINK_IDLE, LINK_BUSY))
+        return;
+
+    const gint64 start = g_get_monotonic_time();
+    g_atomic_int_inc(&as->callback_count);
+    g_atomic_int_inc(&as->in_callback);
+    as->capture_cb(buf, sz, latency, as->cb_user_data);
+    g_atomic_int_add(&as->in_callback, -1);
+    account_callback_time(as, start);
+    g_atomic_int_set(&link->state, LINK_IDLE);
+}
+
+/// adds glitch counts of backend stream to |stats|. Called with lock held
+static
+void
+add_backend_stats(audio_stream *as, struct audio_stream_stats_s *stats)
+{
+    struct audio_stream_stats_s backend_stats = {};
+    audio_stream_ops *ops = backends[as->backend_idx].ops;
+
+    if (!as->stream || !ops->get_stats)
+        return;
+
+    ops->get_stats(as->stream, &backend_stats);
+    stats->underruns += backend_stats.underruns;
+    stats->overruns += backend_stats.overruns;
+}
+
+/// creates backend stream on the first usable backend. Called with lock held
+static
+int
+create_backend_stream(audio_stream *as)
+{
+    for (size_t k = 0; k < BACKEND_COUNT; k ++) {
+        if (!backend_usable(k))
+            continue;
+
+        struct backend_link_s *link = g_slice_new0(struct backend_link_s);
+        link->as = as;
+        link->state = LINK_IDLE;
+
+        audio_stream_ops *ops = backends[k].ops;
+        if (as->direction == STREAM_PLAYBACK) {
+            as->stream = ops->create_playback_stream(as->sample_rate, as->sample_frame_count,
+                                                     failover_playback_cb, link);
+        } else {
+            as->stream = ops->create_capture_stream(as->sample_rate, as->sample_frame_count,
+                                                    failover_capture_cb, link, as->longname,
+                                                    as->format);
+        }
+
+        if (as->stream) {
+            as->link = link;
+            as->backend_idx = k;
+            as->seen_count = g_atomic_int_get(&as->callback_count);
+            as->seen_time = g_get_monotonic_time();
+            if (!as->paused)
+                ops->pause(as->stream, 0);
+            return 0;
+        }
+
+        g_slice_free(struct backend_link_s, link);
+
+        // failure to create a stream doesn't make backend broken, it may lack capture
+        // support, or a device
+        trace_info_f("%s, can't create %s stream on %s backend\n", __func__,
+                     as->direction == STREAM_PLAYBACK ? "playback" : "capture",
+                     backends[k].name);
+    }
+
+    return -1;
+}
+
+/// moves stream to another backend. Called with lock held. Backend stream is not destroyed
+/// here, it's prepended to |doomed| instead
+static
+GList *
+move_stream(audio_stream *as, GList *doomed)
+{
+    // detaching fails if backend is calling back right now. Then it's alive after all, and
+    // stream is moved on the next check, as its backend is marked failed already. Otherwise
+    // new backend stream is started while the old one may still wake up, but the old one
+    // can't reach plugin callbacks anymore
+    if (!g_atomic_int_compare_and_exchange(&as->link->state, LINK_IDLE, LINK_DETACHED))
+        return doomed;
+
+    // glitches on failed backend still count
+    struct audio_stream_stats_s stats = {};
+    add_backend_stats(as, &stats);
+    as->prev_underruns += stats.underruns;
+    as->prev_overruns += stats.overruns;
+
+    struct doomed_stream_s *ds = g_slice_new(struct doomed_stream_s);
+    ds->ops = backends[as->backend_idx].ops;
+    ds->stream = as->stream;
+    ds->link = as->link;
+    doomed = g_list_prepend(doomed, ds);
+
+    as->stream = NULL;
+    as->link = NULL;
+    if (create_backend_stream(as) != 0)
+        trace_error("%s, no backend can take the stream\n", __func__);
+
+    return doomed;
+}
+
+/// moves all streams off the backend. Called with lock held
+static
+GList *
+fail_backend(size_t idx, GList *doomed)
+{
+    trace_error("%s, %s backend stalled, switching streams to another one\n", __func__,
+                backends[idx].name);
+    g_atomic_int_set(&backends[idx].failed, 1);
+
+    for (GList *ll = streams; ll != NULL; ll = g_list_next(ll)) {
+        audio_stream *as = ll->data;
+
+        if (as->stream && as->backend_idx == idx)
+            doomed = move_stream(as, doomed);
+    }
+
+    // device parameters came from failed backend
+    audio_preferred_params_invalidate();
+    return doomed;
+}
+
+static
+int
+stream_stalled(audio_stream *as, gint64 now)
+{
+    const gint count = g_atomic_int_get(&as->callback_count);
+
+    // blocked in plugin code, backend itself may be fine
+    if (as->paused || count != as->seen_count || g_atomic_int_get(&as->in_callback) > 0) {
+        as->seen_count = count;
+        as->seen_time = now;
+        return 0;
+    }
+
+    // null backend is driven by a timer, it can't stall
+    if (!as->stream || as->backend_idx == NULL_BACKEND)
+        return 0;
+
+    return now - as->seen_time > (gint64)stall_timeout_ms * 1000;
+}
+
+static
+void *
+watchdog_thread(void *param)
+{
+    ppb_message_loop_mark_thread_unsuitable();
+
+    while (1) {
+        usleep(stall_timeout_ms * 1000 / WATCHDOG_CHECKS);
+        GList *doomed = NULL;
+
+        pthread_mutex_lock(&teardown_lock);
+        pthread_mutex_lock(&lock);
+        const gint64 now = g_get_monotonic_time();
+        for (GList *ll = streams; ll != NULL; ll = g_list_next(ll)) {
+            audio_stream *as = ll->data;
+            // list itself is not changed, only streams in it
+            if (stream_stalled(as, now))
+                doomed = fail_backend(as->backend_idx, doomed);
+            else if (as->stream && g_atomic_int_get(&backends[as->backend_idx].failed))
+                doomed = move_stream(as, doomed);
+        }
+        pthread_mutex_unlock(&lock);
+
+        for (GList *ll = doomed; ll != NULL; ll = g_list_next(ll)) {
+            struct doomed_stream_s *ds = ll->data;
+            ds->ops->destroy(ds->stream);
+            g_slice_free(struct backend_link_s, ds->link);
+            g_slice_free(struct doomed_stream_s, ds);
+        }
+        g_list_free(doomed);
+        pthread_mutex_unlock(&teardown_lock);
+    }
+
+    return NULL;
+}
+
+static
+audio_stream *
+failover_create_stream(audio_stream *as)
+{
+    as->paused = 1;
+
+    pthread_mutex_lock(&lock);
+    if (!watchdog_started) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, watchdog_thread, NULL) == 0) {
+            pthread_detach(t);
+            watchdog_started = 1;
+        } else {
+            trace_error("%s, can't create watchdog thread\n", __func__);
+        }
+    }
+
+    if (create_backend_stream(as) != 0) {
+        pthread_mutex_unlock(&lock);
+        free(as->longname);
+        free(as);
+        return NULL;
+    }
+
+    streams = g_list_prepend(streams, as);
+    pthread_mutex_unlock(&lock);
+
+    return as;
+}
+
+static
+audio_stream *
+failover_create_playback_stream(unsigned int sample_rate, unsigned int sample_frame_count,
+                                audio_stream_playback_cb_f *cb, void *cb_user_data)
+{
+    audio_stream *as = calloc(1, sizeof(*as));
+    if (!as)
+        return NULL;
+
+    as->direction = STREAM_PLAYBACK;
+    as->sample_rate = sample_rate;
+    as->sample_frame_count = sample_frame_count;
+    as->period_us = (gint64)sample_frame_count * 1000 * 1000 / MAX(sample_rate, 1);
+    as->playback_cb = cb;
+    as->cb_user_data = cb_user_data;
+
+    return failover_create_stream(as);
+}
+
+static
+audio_stream *
+failover_create_capture_stream(unsigned int sample_rate, unsigned int sample_frame_count,
+                               audio_stream_capture_cb_f *cb, void *cb_user_data,
+                               const char *longname, audio_stream_format *format)
+{
+    audio_stream *as = calloc(1, sizeof(*as));
+    if (!as)
+        return NULL;
+
+    as->direction = STREAM_CAPTURE;
+    as->sample_rate = sample_rate;
+    as->sample_frame_count = sample_frame_count;
+    as->period_us = (gint64)sample_frame_count * 1000 * 1000 / MAX(sample_rate, 1);
+    as->capture_cb = cb;
+    as->cb_user_data = cb_user_data;
+    as->longname = longname ? strdup(longname) : NULL;
+    as->format = format;
+
+    return failover_create_stream(as);
+}
+
+static
+audio_device_name *
+failover_enumerate_capture_devices(void)
+{
+    return current_backend()->enumerate_capture_devices();
+}
+
+static
+int
+failover_get_preferred_params(unsigned int *sample_rate, unsigned int *period_frames)
+{
+    return current_backend()->get_preferred_params(sample_rate, period_frames);
+}
+
+static
+void
+failover_pause_stream(audio_stream *as, int enabled)
+{
+    pthread_mutex_lock(&lock);
+    as->paused = enabled;
+    if (as->stream)
+        backends[as->backend_idx].ops->pause(as->stream, enabled);
+    pthread_mutex_unlock(&lock);
+}
+
+static
+void
+failover_destroy_stream(audio_stream *as)
+{
+    pthread_mutex_lock(&teardown_lock);
+    pthread_mutex_lock(&lock);
+    streams = g_list_remove(streams, as);
+    audio_stream *stream = as->stream;
+    struct backend_link_s *link = as->link;
+    audio_stream_ops *ops = backends[as->backend_idx].ops;
+    as->stream = NULL;
+    as->link = NULL;
+    pthread_mutex_unlock(&lock);
+
+    // backends return from destroy only after their threads stopped calling back
+    if (stream)
+        ops->destroy(stream);
+    pthread_mutex_unlock(&teardown_lock);
+
+    if (link)
+        g_slice_free(struct backend_link_s, link);
+
+    free(as->longname);
+    free(as);
+}
+
+static
+void
+failover_get_stream_stats(audio_stream *as, struct audio_stream_stats_s *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    pthread_mutex_lock(&lock);
+    add_backend_stats(as, stats);
+    stats->underruns += as->prev_underruns;
+    stats->overruns += as->prev_overruns;
+    pthread_mutex_unlock(&lock);
+
+    stats->callbacks = g_atomic_int_get(&as->callback_count);
+    stats->slow_callbacks = g_atomic_int_get(&as->slow_callbacks);
+    stats->cb_time_max = g_atomic_int_get(&as->cb_time_max_us) / 1e6;
+}
+
+static
+int
+failover_available(void)
+{
+    // there is always null backend to fall back to
+    return 1;
+}
+
+static audio_stream_ops audio_failover = {
+    .available =                    failover_available,
+    .create_playback_stream =       failover_create_playback_stream,
+    .create_capture_stream =        failover_create_capture_stream,
+    .enumerate_capture_devices =    failover_enumerate_capture_devices,
+    .get_preferred_params =         failover_get_preferred_params,
+    .pause =                        failover_pause_stream,
+    .destroy =                      failover_destroy_stream,
+    .get_stats =                    failover_get_stream_stats,
+};
+
+audio_stream_ops *
+audio_select_implementation(void)
+{
+    return &audio_failover;
+}
+
 void
 audio_capture_device_list_free(audio_device_name *list)
 {
@@ -65,3 +557,50 @@ audio_capture_device_list_free(audio_device_name *list)
     }
     free(list);
 }
+
+int
+audio_get_preferred_params(unsigned int *sample_rate, unsigned int *period_frames)
+{
+    pthread_mutex_lock(&preferred_lock);
+    if (!preferred_cached) {
+        // querying backend may require opening device, so results are kept
+        preferred_sample_rate = 0;
+        preferred_period_frames = 0;
+        preferred_result = audio_select_implementation()->get_preferred_params(
+                                        &preferred_sample_rate, &preferred_period_frames);
+        preferred_cached = 1;
+    }
+
+    const int result = preferred_result;
+    *sample_rate = preferred_sample_rate;
+    *period_frames = preferred_period_frames;
+    pthread_mutex_unlock(&preferred_lock);
+
+    return result;
+}
+
+void
+audio_report_stream_stats(audio_stream_ops *ops, audio_stream *s, const char *name)
+{
+    struct audio_stream_stats_s stats = {};
+
+    if (!s || !ops->get_stats)
+        return;
+
+    ops->get_stats(s, &stats);
+    if (stats.underruns == 0 && stats.overruns == 0 && stats.slow_callbacks == 0)
+        return;
+
+    trace_warning("%s, %s stream: %" PRIu64 " callbacks, %" PRIu64 " underruns, %" PRIu64
+                  " overruns, %" PRIu64 " callbacks longer than a period, longest %.1f ms\n",
+                  __func__, name, stats.callbacks, stats.underruns, stats.overruns,
+                  stats.slow_callbacks, 1e3 * stats.cb_time_max);
+}
+
+void
+audio_preferred_params_invalidate(void)
+{
+    pthread_mutex_lock(&preferred_lock);
+    preferred_cached = 0;
+    pthread_mutex_unlock(&preferred_lock);
+}
@@ -36,8 +36,29 @@ typedef struct {
     char *longname;
 } audio_device_name;
 
+typedef enum {
+    AUDIO_SAMPLE_S16,       ///< signed 16-bit, native endian
+    AUDIO_SAMPLE_FLOAT,     ///< 32-bit float, native endian, [-1; 1]
+} audio_sample_format;
+
+/// describes interleaved data capture stream delivers
+typedef struct {
+    unsigned int        sample_rate;
+    unsigned int        channels;
+    audio_sample_format sample_format;
+} audio_stream_format;
+
 typedef struct audio_stream_s audio_stream;
 
+/// glitch counters of a stream
+struct audio_stream_stats_s {
+    uint64_t    callbacks;
+    uint64_t    underruns;          ///< device ran out of playback data
+    uint64_t    overruns;           ///< captured data was lost
+    uint64_t    slow_callbacks;     ///< callbacks which took longer than a period
+    double      cb_time_max;        ///< seconds
+};
+
 typedef void
 (audio_stream_capture_cb_f)(const void *buf, uint32_t sz, double latency, void *user_data);
 
@@ -51,10 +72,14 @@ typedef audio_stream *
 (audio_create_playback_stream_f)(unsigned int sample_rate, unsigned int sample_frame_count,
                                  audio_stream_playback_cb_f *cb, void *cb_user_data);
 
+/// opens capture stream. Backend may choose format closer to what device supports than
+/// requested mono signed 16-bit at sample_rate; actual format is stored to |format|.
+/// |format| must stay valid while stream exists, since it's updated again if stream is
+/// re-created on another backend
 typedef audio_stream *
 (audio_create_capture_stream_f)(unsigned int sample_rate, unsigned int sample_frame_count,
                                 audio_stream_capture_cb_f *cb, void *cb_user_data,
-                                const char *device_longname);
+                                const char *device_longname, audio_stream_format *format);
 
 /// returns NULL-terminated array of device names
 ///
@@ -62,24 +87,69 @@ typedef audio_stream *
 typedef audio_device_name *
 (audio_enumerate_capture_devices_f)(void);
 
+/// queries native sample rate and period size (in frames, at that rate) of the default
+/// playback device
+///
+/// returns 0 on success. Zero period means backend has no preference
+typedef int
+(audio_get_preferred_params_f)(unsigned int *sample_rate, unsigned int *period_frames);
+
 typedef void
 (audio_pause_stream_f)(audio_stream *s, int enabled);
 
+/// returns only after backend threads stopped using the stream: no callback is running or
+/// will be made with its user data once this returns. Must not be called from a callback
 typedef void
 (audio_destroy_stream_f)(audio_stream *s);
 
+/// backends fill underrun and overrun counts only; may be NULL
+typedef void
+(audio_get_stream_stats_f)(audio_stream *s, struct audio_stream_stats_s *stats);
+
 typedef struct {
     audio_available_f                  *available;
     audio_create_playback_stream_f     *create_playback_stream;
     audio_create_capture_stream_f      *create_capture_stream;
     audio_enumerate_capture_devices_f  *enumerate_capture_devices;
+    audio_get_preferred_params_f       *get_preferred_params;
     audio_pause_stream_f               *pause;
     audio_destroy_stream_f             *destroy;
+    audio_get_stream_stats_f           *get_stats;
 } audio_stream_ops;
 
-
+/// callback timing of null sink backend, which consumes audio at real-time rate
+struct audio_null_sink_stats_s {
+    uint64_t    callbacks;
+    uint64_t    late_callbacks;     ///< callbacks delayed for more than a period
+    double      jitter_avg;         ///< callback delay relative to schedule, seconds
+    double      jitter_max;
+    double      cb_time_avg;        ///< time spent in callbacks, seconds
+    double      cb_time_max;
+};
+
+/// returns implementation which forwards calls to the best available backend. Streams
+/// which stop receiving callbacks are transparently re-created on the next backend
 audio_stream_ops *
 audio_select_implementation(void);
 
 void
 audio_capture_device_list_free(audio_device_name *list);
+
+/// returns preferred parameters of selected implementation. Values are cached until
+/// audio_preferred_params_invalidate() is called
+int
+audio_get_preferred_params(unsigned int *sample_rate, unsigned int *period_frames);
+
+/// drops cached preferred parameters. Called when sound devices change
+void
+audio_preferred_params_invalidate(void);
+
+/// reports glitches stream had, if any. Called before stream is destroyed
+void
+audio_report_stream_stats(audio_stream_ops *ops, audio_stream *s, const char *name);
+
+void
+audio_null_sink_get_stats(struct audio_null_sink_stats_s *stats);
+
+void
+audio_null_sink_reset_stats(void);
@@ -22,10 +22,12 @@
  * SOFTWARE.
  */
 
+#include "audio_rt.h"
 #include "audio_thread.h"
 #include "config.h"
 #include "eintr_retry.h"
 #include "ppb_message_loop.h"
+#include "thread_local.h"
 #include "trace_core.h"
 #include "trace_helpers.h"
 #include "utils.h"
@@ -45,10 +47,12 @@ struct audio_stream_s {
     struct pollfd              *fds;
     size_t                      nfds;
     size_t                      sample_frame_count;
+    size_t                      capture_frame_size;
     audio_stream_capture_cb_f  *capture_cb;
     audio_stream_playback_cb_f *playback_cb;
     void                       *cb_user_data;
     volatile int                paused;
+    volatile gint               xruns;
 };
 
 static GHashTable      *active_streams_ht = NULL;
@@ -60,15 +64,19 @@ static volatile int     terminate_thread = 0;
 static int              notification_pipe[2];
 static pthread_t        audio_thread_id;
 static pthread_mutex_t  lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t  wakeup_lock = PTHREAD_MUTEX_INITIALIZER;  // one waiter at the barrier
 static pthread_barrier_t stream_list_update_barrier;
 
 
 static
 void
-recover_pcm(snd_pcm_t *pcm)
+recover_pcm(audio_stream *as)
 {
+    snd_pcm_t *pcm = as->pcm;
+
     switch (snd_pcm_state(pcm)) {
     case SND_PCM_STATE_XRUN:
+        g_atomic_int_inc(&as->xruns);
         snd_pcm_recover(pcm, -EPIPE, 1);
         break;
     case SND_PCM_STATE_SUSPENDED:
@@ -182,6 +190,9 @@ audio_thread(void *param)
     static char     buf[16 * 1024];
 
     ppb_message_loop_mark_thread_unsuitable();
+    thread_local_set_role(THREAD_ROLE_AUDIO);
+    audio_rt_prepare_thread();
+    audio_rt_lock_memory(buf, sizeof(buf));
 
     nfds = do_rebuild_fds(&fds);
     pthread_barrier_wait(&stream_list_update_barrier);
@@ -226,7 +237,7 @@ audio_thread(void *param)
             if (revents & (~(POLLIN | POLLOUT))) {
                 trace_warning("%s, revents have unexpected flags set (%u)\n", __func__,
                               (unsigned int)revents);
-                recover_pcm(as->pcm);
+                recover_pcm(as);
             }
 
             if (revents & (POLLIN | POLLOUT)) {
@@ -235,7 +246,7 @@ audio_thread(void *param)
 
                 if (revents & POLLIN) {
                     // POLLIN
-                    const size_t frame_size = 1 * sizeof(int16_t); // mono 16-bit
+                    const size_t frame_size = as->capture_frame_size;
                     const size_t max_segment_length = MIN(as->sample_frame_count * frame_size,
                                                           sizeof(buf));
                     size_t       to_process = frame_count * frame_size;
@@ -248,7 +259,7 @@ audio_thread(void *param)
                         if (frames_read < 0) {
                             trace_warning("%s, snd_pcm_readi error %d\n", __func__,
                                           (int)frames_read);
-                            recover_pcm(as->pcm);
+                            recover_pcm(as);
                             continue;
                         }
 
@@ -279,7 +290,7 @@ audio_thread(void *param)
                         if (frames_written < 0) {
                             trace_warning("%s, snd_pcm_writei error %d\n", __func__,
                                           (int)frames_written);
-                            recover_pcm(as->pcm);
+                            recover_pcm(as);
                             continue;
                         }
 
@@ -335,32 +346,40 @@ static
 void
 wakeup_audio_thread(void)
 {
+    // barrier is for two, concurrent callers would otherwise pass it with each other instead
+    // of the audio thread
+    pthread_mutex_lock(&wakeup_lock);
     g_atomic_int_set(&rebuild_fds, 1);
     RETRY_ON_EINTR(write(notification_pipe[1], "+", 1));
     pthread_barrier_wait(&stream_list_update_barrier);
+    pthread_mutex_unlock(&wakeup_lock);
 }
 
 static
 audio_stream *
 alsa_create_stream(audio_stream_direction direction, unsigned int sample_rate,
-                   unsigned int sample_frame_count, const char *pcm_name)
+                   unsigned int sample_frame_count, const char *pcm_name,
+                   audio_stream_format *format)
 {
     audio_stream *as;
     snd_pcm_hw_params_t *hw_params;
     snd_pcm_sw_params_t *sw_params;
     int dir;
 
+    pthread_mutex_lock(&wakeup_lock);
     if (!g_atomic_int_get(&audio_thread_started)) {
         pthread_barrier_init(&stream_list_update_barrier, NULL, 2);
         pthread_create(&audio_thread_id, NULL, audio_thread, NULL);
         g_atomic_int_set(&audio_thread_started, 1);
         pthread_barrier_wait(&stream_list_update_barrier);
     }
+    pthread_mutex_unlock(&wakeup_lock);
 
     as = calloc(1, sizeof(*as));
     if (!as)
         goto err;
 
+    as->direction = direction;
     as->sample_frame_count = sample_frame_count;
     g_atomic_int_set(&as->paused, 1);
 
@@ -381,13 +400,33 @@ alsa_create_stream(audio_stream_direction direction, unsigned int sample_rate,
     CHECK_A(snd_pcm_hw_params_malloc, (&hw_params));
     CHECK_A(snd_pcm_hw_params_any, (as->pcm, hw_params));
     CHECK_A(snd_pcm_hw_params_set_access, (as->pcm, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED));
-    CHECK_A(snd_pcm_hw_params_set_format, (as->pcm, hw_params, SND_PCM_FORMAT_S16_LE));
-    dir = 0;
     unsigned int rate = sample_rate;
-    CHECK_A(snd_pcm_hw_params_set_rate_near, (as->pcm, hw_params, &rate, &dir));
+    if (direction == STREAM_PLAYBACK) {
+        CHECK_A(snd_pcm_hw_params_set_format, (as->pcm, hw_params, SND_PCM_FORMAT_S16_LE));
+        dir = 0;
+        CHECK_A(snd_pcm_hw_params_set_rate_near, (as->pcm, hw_params, &rate, &dir));
+        CHECK_A(snd_pcm_hw_params_set_channels, (as->pcm, hw_params, 2));
+    } else {
+        // take what device offers natively, capture pipeline converts it to requested format
+        unsigned int channel_count = 1;
+
+        if (snd_pcm_hw_params_set_format(as->pcm, hw_params, SND_PCM_FORMAT_S16) == 0) {
+            format->sample_format = AUDIO_SAMPLE_S16;
+        } else {
+            CHECK_A(snd_pcm_hw_params_set_format, (as->pcm, hw_params, SND_PCM_FORMAT_FLOAT));
+            format->sample_format = AUDIO_SAMPLE_FLOAT;
+        }
 
-    const int channel_count = (direction == STREAM_PLAYBACK) ? 2 : 1;
-    CHECK_A(snd_pcm_hw_params_set_channels, (as->pcm, hw_params, channel_count));
+        CHECK_A(snd_pcm_hw_params_set_rate_resample, (as->pcm, hw_params, 0));
+        dir = 0;
+        CHECK_A(snd_pcm_hw_params_set_rate_near, (as->pcm, hw_params, &rate, &dir));
+        CHECK_A(snd_pcm_hw_params_set_channels_near, (as->pcm, hw_params, &channel_count));
+
+        format->sample_rate = rate;
+        format->channels = channel_count;
+        as->capture_frame_size = channel_count * (format->sample_format == AUDIO_SAMPLE_S16
+                                                  ? sizeof(int16_t) : sizeof(float));
+    }
 
     unsigned int period_time = (long long)sample_frame_count * 1000 * 1000 / sample_rate;
     period_time = CLAMP(period_time,
@@ -444,7 +483,7 @@ alsa_create_playback_stream(unsigned int sample_rate, unsigned int sample_frame_
                             audio_stream_playback_cb_f *cb, void *cb_user_data)
 {
     audio_stream *as = alsa_create_stream(STREAM_PLAYBACK, sample_rate, sample_frame_count,
-                                          "default");
+                                          "default", NULL);
     if (!as)
         return NULL;
 
@@ -513,11 +552,11 @@ static
 audio_stream *
 alsa_create_capture_stream(unsigned int sample_rate, unsigned int sample_frame_count,
                            audio_stream_capture_cb_f *cb, void *cb_user_data,
-                           const char *longname)
+                           const char *longname, audio_stream_format *format)
 {
     char *pcm_name = find_pcm_name(longname);
     audio_stream *as = alsa_create_stream(STREAM_CAPTURE, sample_rate, sample_frame_count,
-                                          pcm_name);
+                                          pcm_name, format);
     free(pcm_name);
 
     if (!as)
@@ -584,6 +623,81 @@ alsa_enumerate_capture_devices(void)
     return list;
 }
 
+static
+int
+alsa_get_preferred_params(unsigned int *sample_rate, unsigned int *period_frames)
+{
+    snd_pcm_t *pcm;
+    snd_pcm_hw_params_t *hw_params;
+    unsigned int rate_min, rate_max, rate;
+    snd_pcm_uframes_t period_size;
+    unsigned int period_time;
+    int dir;
+
+    if (snd_pcm_open(&pcm, "default", SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK) < 0)
+        return -1;
+
+    if (snd_pcm_hw_params_malloc(&hw_params) < 0) {
+        snd_pcm_close(pcm);
+        return -1;
+    }
+
+#define CHECK_A(funcname, params)                                                       \
+    do {                                                                                \
+        int errcode___ = funcname params;                                               \
+        if (errcode___ < 0) {                                                           \
+            trace_error("%s, " #funcname ", %s\n", __func__, snd_strerror(errcode___)); \
+            goto err;                                                                   \
+        }                                                                               \
+    } while (0)
+
+    // same configuration space as streams use, but without ALSA's own resampling, so
+    // only rates device accepts directly remain
+    CHECK_A(snd_pcm_hw_params_any, (pcm, hw_params));
+    CHECK_A(snd_pcm_hw_params_set_rate_resample, (pcm, hw_params, 0));
+    CHECK_A(snd_pcm_hw_params_set_access, (pcm, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED));
+    CHECK_A(snd_pcm_hw_params_set_format, (pcm, hw_params, SND_PCM_FORMAT_S16_LE));
+    CHECK_A(snd_pcm_hw_params_set_channels, (pcm, hw_params, 2));
+
+    dir = 0;
+    CHECK_A(snd_pcm_hw_params_get_rate_min, (hw_params, &rate_min, &dir));
+    dir = 0;
+    CHECK_A(snd_pcm_hw_params_get_rate_max, (hw_params, &rate_max, &dir));
+
+    // prefer rates Pepper can use
+    if (rate_min <= 48000 && 48000 <= rate_max)
+        rate = 48000;
+    else if (rate_min <= 44100 && 44100 <= rate_max)
+        rate = 44100;
+    else
+        rate = rate_min;
+
+    dir = 0;
+    CHECK_A(snd_pcm_hw_params_set_rate_near, (pcm, hw_params, &rate, &dir));
+
+    // shortest period streams would be allowed to have
+    period_time = 1000 * (unsigned int)config.audio_buffer_min_ms;
+    dir = 1;
+    CHECK_A(snd_pcm_hw_params_set_period_time_near, (pcm, hw_params, &period_time, &dir));
+
+    dir = 0;
+    CHECK_A(snd_pcm_hw_params_get_period_size, (hw_params, &period_size, &dir));
+
+#undef CHECK_A
+
+    snd_pcm_hw_params_free(hw_params);
+    snd_pcm_close(pcm);
+
+    *sample_rate = rate;
+    *period_frames = period_size;
+    return 0;
+
+err:
+    snd_pcm_hw_params_free(hw_params);
+    snd_pcm_close(pcm);
+    return -1;
+}
+
 static
 void
 alsa_pause_stream(audio_stream *as, int enabled)
@@ -591,6 +705,8 @@ alsa_pause_stream(audio_stream *as, int enabled)
     g_atomic_int_set(&as->paused, enabled);
 }
 
+/// audio thread frees the stream when it rebuilds its descriptor list, which happens between
+/// callbacks. Waiting at the barrier for that makes destroy synchronous
 static
 void
 alsa_destroy_stream(audio_stream *as)
@@ -602,6 +718,17 @@ alsa_destroy_stream(audio_stream *as)
     wakeup_audio_thread();
 }
 
+static
+void
+alsa_get_stream_stats(audio_stream *as, struct audio_stream_stats_s *stats)
+{
+    // ALSA doesn't tell one from another, direction does
+    if (as->direction == STREAM_PLAYBACK)
+        stats->underruns = g_atomic_int_get(&as->xruns);
+    else
+        stats->overruns = g_atomic_int_get(&as->xruns);
+}
+
 static
 int
 alsa_available(void)
@@ -637,6 +764,8 @@ audio_stream_ops audio_alsa = {
     .create_playback_stream =       alsa_create_playback_stream,
     .create_capture_stream =        alsa_create_capture_stream,
     .enumerate_capture_devices =    alsa_enumerate_capture_devices,
+    .get_preferred_params =         alsa_get_preferred_params,
     .pause =                        alsa_pause_stream,
     .destroy =                      alsa_destroy_stream,
+    .get_stats =                    alsa_get_stream_stats,
 };
@@ -22,8 +22,10 @@
  * SOFTWARE.
  */
 
+#include "audio_rt.h"
 #include "audio_thread.h"
 #include "config.h"
+#include "thread_local.h"
 #include "trace_core.h"
 #include "trace_helpers.h"
 #include <glib.h>
@@ -66,6 +68,8 @@ struct audio_stream_s {
     soxr_t              resampler;
     jack_ringbuffer_t  *rb_in;              ///< ringbuffer for audio capture
     jack_ringbuffer_t  *rb_out[2];          ///< ringbuffer for audio playback
+    volatile gint       underruns;
+    volatile gint       overruns;
 };
 
 static
@@ -81,6 +85,9 @@ ja_playback_resampler_thread_func(void *param)
 {
     audio_stream *as = param;
 
+    thread_local_set_role(THREAD_ROLE_AUDIO);
+    audio_rt_prepare_thread();
+
     while (1) {
         while (jack_ringbuffer_read_space(as->rb_out[0]) < as->jack_buf_size / 2) {
             if (g_atomic_int_get(&as->paused)) {
@@ -116,6 +123,9 @@ ja_capture_resampler_thread_func(void *param)
 {
     audio_stream *as = param;
 
+    thread_local_set_role(THREAD_ROLE_AUDIO);
+    audio_rt_prepare_thread();
+
     while (1) {
         if (jack_ringbuffer_read_space(as->rb_in) > as->jack_buf_size / 2) {
 
@@ -158,27 +168,55 @@ ja_process_cb(jack_nframes_t nframes, void *param)
         size_t wr1 = jack_ringbuffer_read(as->rb_out[0], out[0], nframes * sizeof(float));
         size_t wr2 = jack_ringbuffer_read(as->rb_out[1], out[1], nframes * sizeof(float));
 
+        // no logging here, process callback runs on JACK real-time thread
         if (wr1 != nframes * sizeof(float) || wr2 != nframes * sizeof(float))
-            trace_error("%s, ringbuffer underrun\n", __func__);
+            g_atomic_int_inc(&as->underruns);
     } else {
         // STREAM_CAPTURE
         void *in = jack_port_get_buffer(as->input_port, nframes);
 
         size_t wr1 = jack_ringbuffer_write(as->rb_in, in, nframes * sizeof(float));
         if (wr1 != nframes * sizeof(float))
-            trace_error("%s, ringbuffer overrun\n", __func__);
+            g_atomic_int_inc(&as->overruns);
     }
 
     g_async_queue_push(as->async_q, CMD_RESAMPLE_NEXT_CHUNK);
     return 0;
 }
 
+/// buffers are touched every period by JACK process callback and resampler thread
 static
-audio_stream *
-ja_do_create_stream(unsigned int sample_rate, unsigned int sample_frame_count,
-                    audio_stream_playback_cb_f *playback_cb,
-                    audio_stream_capture_cb_f *capture_cb, void *cb_user_data,
-                    audio_stream_direction direction)
+void
+ja_lock_buffers(audio_stream *as)
+{
+    audio_rt_lock_memory(as->pepper_buf, as->pepper_buf_size);
+    audio_rt_lock_memory(as->jack_buf[0], as->jack_buf_size);
+    audio_rt_lock_memory(as->jack_buf[1], as->jack_buf_size);
+
+    if (config.audio_realtime_priority <= 0)
+        return;
+
+    if (as->rb_out[0])
+        jack_ringbuffer_mlock(as->rb_out[0]);
+    if (as->rb_out[1])
+        jack_ringbuffer_mlock(as->rb_out[1]);
+    if (as->rb_in)
+        jack_ringbuffer_mlock(as->rb_in);
+}
+
+/// ringbuffers are unlocked by jack_ringbuffer_free()
+static
+void
+ja_unlock_buffers(audio_stream *as)
+{
+    audio_rt_unlock_memory(as->pepper_buf, as->pepper_buf_size);
+    audio_rt_unlock_memory(as->jack_buf[0], as->jack_buf_size);
+    audio_rt_unlock_memory(as->jack_buf[1], as->jack_buf_size);
+}
+
+static
+jack_client_t *
+ja_open_client(void)
 {
     jack_options_t  options = JackNullOption;
     jack_status_t   status;
@@ -190,6 +228,23 @@ ja_do_create_stream(unsigned int sample_rate, unsigned int sample_frame_count,
     if (!config.jack_autostart_server)
         options |= JackNoStartServer;
 
+    jack_client_t *client = jack_client_open(CLIENT_NAME, options, &status, server_name);
+    if (!client) {
+        trace_error("%s, jack_client_open() failed with status=0x%x\n", __func__, status);
+        if (status & JackServerFailed)
+            trace_error("%s, can't connect to JACK server\n", __func__);
+    }
+
+    return client;
+}
+
+static
+audio_stream *
+ja_do_create_stream(unsigned int sample_rate, unsigned int sample_frame_count,
+                    audio_stream_playback_cb_f *playback_cb,
+                    audio_stream_capture_cb_f *capture_cb, void *cb_user_data,
+                    audio_stream_direction direction, const char *capture_port)
+{
     audio_stream *as = calloc(1, sizeof(*as));
     if (!as) {
         trace_error("%s, memory allocation failure, point 1\n", __func__);
@@ -202,14 +257,9 @@ ja_do_create_stream(unsigned int sample_rate, unsigned int sample_frame_count,
     as->direction =    direction;
     g_atomic_int_set(&as->paused, 1);
 
-    as->client = jack_client_open(CLIENT_NAME, options, &status, server_name);
-    if (!as->client) {
-        trace_error("%s, jack_client_open() failed with status=0x%x\n", __func__, status);
-        if (status & JackServerFailed)
-            trace_error("%s, can't connect to JACK server\n", __func__);
-
+    as->client = ja_open_client();
+    if (!as->client)
         goto err_2;
-    }
 
     as->sample_rate =             sample_rate;
     as->sample_frame_count =      sample_frame_count;
@@ -254,6 +304,8 @@ ja_do_create_stream(unsigned int sample_rate, unsigned int sample_frame_count,
         }
     }
 
+    ja_lock_buffers(as);
+
     soxr_quality_spec_t quality_spec = soxr_quality_spec(SOXR_QQ, 0);
     if (as->sample_rate == as->jack_sample_rate) {
         // workaround issue with same input and output rate
@@ -315,7 +367,13 @@ ja_do_create_stream(unsigned int sample_rate, unsigned int sample_frame_count,
         goto err_6;
     }
 
-    if (config.jack_autoconnect_ports) {
+    if (direction == STREAM_CAPTURE && capture_port &&
+        jack_port_by_name(as->client, capture_port) != NULL)
+    {
+        // port was explicitly selected, connect to it only
+        if (jack_connect(as->client, capture_port, jack_port_name(as->input_port)) != 0)
+            trace_error("%s, can't connect input port to %s\n", __func__, capture_port);
+    } else if (config.jack_autoconnect_ports) {
         const char **ports;
         if (direction == STREAM_PLAYBACK) {
             ports = jack_get_ports(as->client, NULL, NULL, JackPortIsPhysical | JackPortIsInput);
@@ -363,6 +421,7 @@ err_5:
 err_4:
     soxr_delete(as->resampler);
 err_3:
+    ja_unlock_buffers(as);
     if (as->rb_out[0])
         jack_ringbuffer_free(as->rb_out[0]);
     if (as->rb_out[1])
@@ -386,35 +445,88 @@ ja_create_playback_stream(unsigned int sample_rate, unsigned int sample_frame_co
                           audio_stream_playback_cb_f *cb, void *cb_user_data)
 {
     return ja_do_create_stream(sample_rate, sample_frame_count, cb, NULL, cb_user_data,
-                               STREAM_PLAYBACK);
+                               STREAM_PLAYBACK, NULL);
 }
 
 static
 audio_stream *
 ja_create_capture_stream(unsigned int sample_rate, unsigned int sample_frame_count,
                          audio_stream_capture_cb_f *cb, void *cb_user_data,
-                         const char *longname)
+                         const char *longname, audio_stream_format *format)
 {
-    (void)longname; // have no meaning here. JACK itself selects appropriate sound device
+    // resampler converts to requested format already
+    format->sample_rate =   sample_rate;
+    format->channels =      1;
+    format->sample_format = AUDIO_SAMPLE_S16;
+
+    // longname is a JACK port name
     return ja_do_create_stream(sample_rate, sample_frame_count, NULL, cb, cb_user_data,
-                               STREAM_CAPTURE);
+                               STREAM_CAPTURE, longname);
+}
+
+static
+void
+ja_append_ports(GArray *list, jack_client_t *client, unsigned long flags, int physical)
+{
+    const char **ports = jack_get_ports(client, NULL, JACK_DEFAULT_AUDIO_TYPE, flags);
+    if (!ports)
+        return;
+
+    for (uintptr_t k = 0; ports[k] != NULL; k ++) {
+        jack_port_t *port = jack_port_by_name(client, ports[k]);
+        if (!port)
+            continue;
+
+        // physical ports were already listed
+        if (!physical && (jack_port_flags(port) & JackPortIsPhysical))
+            continue;
+
+        // own ports are of no interest
+        if (jack_port_is_mine(client, port))
+            continue;
+
+        audio_device_name dev = {
+            .name =     strdup(ports[k]),
+            .longname = strdup(ports[k]),
+        };
+        g_array_append_val(list, dev);
+    }
+
+    jack_free(ports);
 }
 
 static
 audio_device_name *
 ja_enumerate_capture_devices(void)
 {
-    audio_device_name *list = malloc(sizeof(audio_device_name) * 2);
-    if (!list)
+    jack_client_t *client = ja_open_client();
+    if (!client)
         return NULL;
 
-    list[0].name = strdup("JACK capture device");
-    list[0].longname = strdup(list[0].name);
+    // any output port can be a source for capture. Physical ones go first
+    GArray *list = g_array_new(TRUE, TRUE, sizeof(audio_device_name));
+    ja_append_ports(list, client, JackPortIsOutput | JackPortIsPhysical, 1);
+    ja_append_ports(list, client, JackPortIsOutput, 0);
+    jack_client_close(client);
+
+    // array is zero-terminated, so it can be freed by audio_capture_device_list_free()
+    return (audio_device_name *)g_array_free(list, FALSE);
+}
 
-    list[1].name = NULL;
-    list[1].longname = NULL;
+static
+int
+ja_get_preferred_params(unsigned int *sample_rate, unsigned int *period_frames)
+{
+    jack_client_t *client = ja_open_client();
+    if (!client)
+        return -1;
 
-    return list;
+    // streams are resampled to server rate and processed in server-sized blocks
+    *sample_rate = jack_get_sample_rate(client);
+    *period_frames = jack_get_buffer_size(client);
+    jack_client_close(client);
+
+    return 0;
 }
 
 static
@@ -434,6 +546,7 @@ ja_destroy_stream(audio_stream *as)
     g_async_queue_unref(as->async_q);
     soxr_delete(as->resampler);
 
+    ja_unlock_buffers(as);
     free(as->pepper_buf);
     free(as->jack_buf[0]);
     free(as->jack_buf[1]);
@@ -445,12 +558,22 @@ ja_destroy_stream(audio_stream *as)
         jack_ringbuffer_free(as->rb_in);
 }
 
+static
+void
+ja_get_stream_stats(audio_stream *as, struct audio_stream_stats_s *stats)
+{
+    stats->underruns = g_atomic_int_get(&as->underruns);
+    stats->overruns = g_atomic_int_get(&as->overruns);
+}
+
 
 audio_stream_ops audio_jack = {
     .available =                    ja_available,
     .create_playback_stream =       ja_create_playback_stream,
     .create_capture_stream =        ja_create_capture_stream,
     .enumerate_capture_devices =    ja_enumerate_capture_devices,
+    .get_preferred_params =         ja_get_preferred_params,
     .pause =                        ja_pause_stream,
     .destroy =                      ja_destroy_stream,
+    .get_stats =                    ja_get_stream_stats,
 };
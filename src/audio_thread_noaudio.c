@@ -22,73 +22,174 @@
  * SOFTWARE.
  */
 
+#include "audio_rt.h"
 #include "audio_thread.h"
+#include "config.h"
 #include "ppb_message_loop.h"
+#include "thread_local.h"
+#include "trace_core.h"
 #include <glib.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+// Null sink. Calls playback callbacks at the rate real device would, scheduling them at
+// absolute deadlines of monotonic clock, so timing errors don't accumulate. Delays against
+// schedule are recorded, which makes sink usable for measuring callback latency and CPU
+// usage without sound hardware.
+
+#define SAMPLE_SIZE     (2 * sizeof(int16_t))   // signed 16-bit stereo
+#define RESYNC_PERIODS  4                       // skip ahead if late for that many periods
 
 struct audio_stream_s {
-    size_t                      sample_frame_count;
-    size_t                      sample_rate;
-    size_t                      samples_wanted;
+    unsigned int                sample_frame_count;
+    unsigned int                sample_rate;
+    int64_t                     period;         // ns
+    int64_t                     deadline;       // ns, monotonic
     audio_stream_playback_cb_f *playback_cb;
     void                       *cb_user_data;
-    volatile int                paused;
-    volatile int                alive;
+    char                       *buf;
+    int                         paused;         // protected by lock
+    int                         alive;          // protected by lock
+    volatile gint               underruns;      // callbacks late by more than a period
 };
 
-static GHashTable      *active_streams_ht = NULL;
-static volatile int     audio_thread_started = 0;
-static volatile int     terminate_thread = 0;
+static pthread_mutex_t  lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   cond;
+static pthread_cond_t   batch_done_cond = PTHREAD_COND_INITIALIZER;
+static GList           *streams = NULL;
+static int              batch_running = 0;  // callbacks are being called without lock held
+static uint64_t         batch_serial = 0;
+static int              audio_thread_started = 0;
+static int              terminate_thread = 0;
 static pthread_t        audio_thread_id;
+static FILE            *sink_file = NULL;
+
+static pthread_mutex_t                  stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct audio_null_sink_stats_s   stats;
+static double                           jitter_sum;
+static double                           cb_time_sum;
 
 
+static
+int64_t
+monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * (int64_t)1000000000 + ts.tv_nsec;
+}
+
+static
+void
+record_callback(double jitter, double cb_time, int64_t period)
+{
+    pthread_mutex_lock(&stats_lock);
+    stats.callbacks += 1;
+    stats.late_callbacks += (jitter * 1e9 > period);
+    stats.jitter_max = MAX(stats.jitter_max, jitter);
+    stats.cb_time_max = MAX(stats.cb_time_max, cb_time);
+    jitter_sum += jitter;
+    cb_time_sum += cb_time;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static
+void
+call_stream(audio_stream *as, int64_t now)
+{
+    const uint32_t sz = as->sample_frame_count * SAMPLE_SIZE;
+    const int64_t started = monotonic_ns();
+
+    as->playback_cb(as->buf, sz, 0, as->cb_user_data);
+
+    const int64_t finished = monotonic_ns();
+    record_callback((now - as->deadline) / 1e9, (finished - started) / 1e9, as->period);
+
+    // real device would have run out of data before the callback delivered it
+    if (finished - as->deadline > as->period)
+        g_atomic_int_inc(&as->underruns);
+
+    if (sink_file) {
+        if (fwrite(as->buf, sz, 1, sink_file) != 1)
+            trace_error("%s, can't write to null sink file\n", __func__);
+    }
+
+    as->deadline += as->period;
+    if (finished - as->deadline > RESYNC_PERIODS * as->period) {
+        // stalled for too long, catching up would produce burst of callbacks
+        as->deadline = finished;
+    }
+}
+
 static
 void *
 audio_thread(void *param)
 {
-    static char buf[16 * 1024];
-    const size_t delay_ms = 20;
-
     ppb_message_loop_mark_thread_unsuitable();
+    thread_local_set_role(THREAD_ROLE_AUDIO);
+    audio_rt_prepare_thread();
 
-    while (1) {
-        if (g_atomic_int_get(&terminate_thread))
-            goto quit;
+    pthread_mutex_lock(&lock);
+    while (!terminate_thread) {
+        int64_t earliest = INT64_MAX;
 
-        GList *streams = g_hash_table_get_keys(active_streams_ht);
+        // free destroyed streams, and find when next callback is due
         GList *ll = streams;
         while (ll) {
-            struct audio_stream_s *as = ll->data;
-
-            if (g_atomic_int_get(&as->alive)) {
-                const size_t sample_size = 2 * sizeof(int16_t); // signed 16-bit stereo
-                const size_t buf_size = MIN(as->sample_frame_count * sample_size, sizeof(buf));
-
-                as->samples_wanted += as->sample_rate * delay_ms / 1000;
-
-                while (as->samples_wanted * sample_size > buf_size) {
-                    as->playback_cb(buf, buf_size, 0, as->cb_user_data);
-                    as->samples_wanted -= buf_size / sample_size;
-                }
+            audio_stream *as = ll->data;
+            GList *next = g_list_next(ll);
 
-            } else {
-                g_hash_table_remove(active_streams_ht, as);
+            if (!as->alive) {
+                streams = g_list_delete_link(streams, ll);
+                free(as->buf);
                 free(as);
+            } else if (!as->paused) {
+                earliest = MIN(earliest, as->deadline);
             }
+            ll = next;
+        }
 
-            ll = g_list_next(ll);
+        if (earliest == INT64_MAX) {
+            pthread_cond_wait(&cond, &lock);
+            continue;
         }
 
-        g_list_free(streams);
+        const int64_t now = monotonic_ns();
+        if (earliest > now) {
+            struct timespec ts = {
+                .tv_sec =   earliest / 1000000000,
+                .tv_nsec =  earliest % 1000000000,
+            };
+
+            // woken up earlier when streams change
+            pthread_cond_timedwait(&cond, &lock, &ts);
+            continue;
+        }
+
+        // streams are freed by this thread only, so they can be used without lock held
+        GList *due = NULL;
+        for (ll = streams; ll != NULL; ll = g_list_next(ll)) {
+            audio_stream *as = ll->data;
+            if (as->alive && !as->paused && as->deadline <= now)
+                due = g_list_prepend(due, as);
+        }
 
-        usleep(delay_ms * 1000);
+        batch_running = 1;
+        batch_serial ++;
+        pthread_mutex_unlock(&lock);
+        for (ll = due; ll != NULL; ll = g_list_next(ll))
+            call_stream(ll->data, now);
+        g_list_free(due);
+        pthread_mutex_lock(&lock);
+        batch_running = 0;
+        pthread_cond_broadcast(&batch_done_cond);
     }
+    pthread_mutex_unlock(&lock);
 
-quit:
     return NULL;
 }
 
@@ -97,7 +198,13 @@ void
 __attribute__((constructor))
 constructor_audio_thread_noaudio(void)
 {
-    active_streams_ht = g_hash_table_new(g_direct_hash, g_direct_equal);
+    pthread_condattr_t attr;
+
+    // deadlines are kept in monotonic time
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond, &attr);
+    pthread_condattr_destroy(&attr);
 }
 
 static
@@ -105,41 +212,20 @@ void
 __attribute__((destructor))
 destructor_audio_thread_noaudio(void)
 {
-    if (g_atomic_int_get(&audio_thread_started)) {
-        g_atomic_int_set(&terminate_thread, 1);
-        pthread_join(audio_thread_id, NULL);
-    }
-
-    g_hash_table_unref(active_streams_ht);
-}
-
-static
-audio_stream *
-noaudio_create_stream(unsigned int sample_rate, unsigned int sample_frame_count)
-{
-    audio_stream *as;
+    pthread_mutex_lock(&lock);
+    const int started = audio_thread_started;
+    terminate_thread = 1;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
 
-    if (!g_atomic_int_get(&audio_thread_started)) {
-        pthread_create(&audio_thread_id, NULL, audio_thread, NULL);
-        g_atomic_int_set(&audio_thread_started, 1);
-    }
-
-    as = calloc(1, sizeof(*as));
-    if (!as)
-        goto err;
-
-    as->sample_rate = sample_rate;
-    as->sample_frame_count = sample_frame_count;
-    g_atomic_int_set(&as->paused, 1);
-    g_atomic_int_set(&as->alive, 1);
-
-    g_hash_table_insert(active_streams_ht, as, GINT_TO_POINTER(1));
+    if (started)
+        pthread_join(audio_thread_id, NULL);
 
-    return as;
+    if (sink_file)
+        fclose(sink_file);
 
-err:
-    free(as);
-    return NULL;
+    pthread_cond_destroy(&cond);
+    pthread_cond_destroy(&batch_done_cond);
 }
 
 static
@@ -147,12 +233,48 @@ audio_stream *
 noaudio_create_playback_stream(unsigned int sample_rate, unsigned int sample_frame_count,
                                audio_stream_playback_cb_f *cb, void *cb_user_data)
 {
-    audio_stream *as = noaudio_create_stream(sample_rate, sample_frame_count);
+    if (sample_rate == 0 || sample_frame_count == 0)
+        return NULL;
+
+    audio_stream *as = calloc(1, sizeof(*as));
     if (!as)
         return NULL;
 
+    as->buf = calloc(sample_frame_count, SAMPLE_SIZE);
+    if (!as->buf) {
+        free(as);
+        return NULL;
+    }
+
+    as->sample_rate = sample_rate;
+    as->sample_frame_count = sample_frame_count;
+    as->period = (int64_t)sample_frame_count * 1000000000 / sample_rate;
     as->playback_cb = cb;
     as->cb_user_data = cb_user_data;
+    as->paused = 1;
+    as->alive = 1;
+
+    pthread_mutex_lock(&lock);
+    if (config.audio_null_sink_file && !sink_file) {
+        sink_file = fopen(config.audio_null_sink_file, "wb");
+        if (!sink_file)
+            trace_error("%s, can't open %s\n", __func__, config.audio_null_sink_file);
+    }
+
+    if (!audio_thread_started) {
+        if (pthread_create(&audio_thread_id, NULL, audio_thread, NULL) != 0) {
+            pthread_mutex_unlock(&lock);
+            trace_error("%s, can't create thread\n", __func__);
+            free(as->buf);
+            free(as);
+            return NULL;
+        }
+        audio_thread_started = 1;
+    }
+
+    streams = g_list_prepend(streams, as);
+    pthread_mutex_unlock(&lock);
+
     return as;
 }
 
@@ -160,7 +282,7 @@ static
 audio_stream *
 noaudio_create_capture_stream(unsigned int sample_rate, unsigned int sample_frame_count,
                               audio_stream_capture_cb_f *cb, void *cb_user_data,
-                              const char *longname)
+                              const char *longname, audio_stream_format *format)
 {
     return NULL;
 }
@@ -173,11 +295,26 @@ noaudio_enumerate_capture_devices(void)
     return calloc(sizeof(audio_device_name), 1);
 }
 
+static
+int
+noaudio_get_preferred_params(unsigned int *sample_rate, unsigned int *period_frames)
+{
+    // no device, no preference
+    return -1;
+}
+
 static
 void
 noaudio_pause_stream(audio_stream *as, int enabled)
 {
-    g_atomic_int_set(&as->paused, enabled);
+    pthread_mutex_lock(&lock);
+    if (as->paused && !enabled) {
+        // first callback is due right away, as device would ask to fill its buffer
+        as->deadline = monotonic_ns();
+    }
+    as->paused = enabled;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
 }
 
 static
@@ -185,7 +322,15 @@ void
 noaudio_destroy_stream(audio_stream *as)
 {
     // mark as non-alive. Worker thread will free memory
-    g_atomic_int_set(&as->alive, 0);
+    pthread_mutex_lock(&lock);
+    as->alive = 0;
+    pthread_cond_signal(&cond);
+
+    // stream could have been taken into the batch being called right now. Later batches skip it
+    const uint64_t serial = batch_serial;
+    while (batch_running && batch_serial == serial)
+        pthread_cond_wait(&batch_done_cond, &lock);
+    pthread_mutex_unlock(&lock);
 }
 
 static
@@ -196,11 +341,42 @@ noaudio_available(void)
     return 1;
 }
 
+void
+audio_null_sink_get_stats(struct audio_null_sink_stats_s *s)
+{
+    pthread_mutex_lock(&stats_lock);
+    *s = stats;
+    if (stats.callbacks > 0) {
+        s->jitter_avg = jitter_sum / stats.callbacks;
+        s->cb_time_avg = cb_time_sum / stats.callbacks;
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void
+audio_null_sink_reset_stats(void)
+{
+    pthread_mutex_lock(&stats_lock);
+    memset(&stats, 0, sizeof(stats));
+    jitter_sum = 0;
+    cb_time_sum = 0;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static
+void
+noaudio_get_stream_stats(audio_stream *as, struct audio_stream_stats_s *s)
+{
+    s->underruns = g_atomic_int_get(&as->underruns);
+}
+
 audio_stream_ops audio_noaudio = {
     .available =                    noaudio_available,
     .create_playback_stream =       noaudio_create_playback_stream,
     .create_capture_stream =        noaudio_create_capture_stream,
     .enumerate_capture_devices =    noaudio_enumerate_capture_devices,
+    .get_preferred_params =         noaudio_get_preferred_params,
     .pause =                        noaudio_pause_stream,
     .destroy =                      noaudio_destroy_stream,
+    .get_stats =                    noaudio_get_stream_stats,
 };
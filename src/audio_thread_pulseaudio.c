@@ -22,7 +22,10 @@
  * SOFTWARE.
  */
 
+#include "audio_rt.h"
 #include "audio_thread.h"
+#include "config.h"
+#include "thread_local.h"
 #include "trace_core.h"
 #include "trace_helpers.h"
 #include <glib.h>
@@ -44,6 +47,8 @@ struct audio_stream_s {
     audio_stream_capture_cb_f  *capture_cb;
     void                       *cb_user_data;
     volatile int                paused;
+    volatile gint               underruns;
+    volatile gint               overruns;
 };
 
 
@@ -52,12 +57,16 @@ static int                          probed = 0;
 static int                          available = 0;
 static struct pa_threaded_mainloop *mainloop;
 static struct pa_context           *context;
+static pid_t                        mainloop_tid;   ///< thread which runs stream callbacks
 
 
 static
 void
 pulse_context_state_cb(pa_context *c, void *user_data)
 {
+    // runs on the mainloop thread
+    mainloop_tid = thread_local_get_tid();
+
     switch (pa_context_get_state(c)) {
     case PA_CONTEXT_READY:
     case PA_CONTEXT_TERMINATED:
@@ -136,6 +145,11 @@ pulse_available(void)
     }
 
     pa_threaded_mainloop_unlock(mainloop);
+
+    // mainloop thread is owned by libpulse, so it's elevated from here, once, with mainloop
+    // unlocked
+    audio_rt_elevate_thread(mainloop_tid);
+
     available = 1;
     pthread_mutex_unlock(&lock);
     return 1;
@@ -225,6 +239,22 @@ pulse_stream_read_cb(pa_stream *s, size_t length, void *user_data)
     pa_stream_drop(s);
 }
 
+static
+void
+pulse_stream_underflow_cb(pa_stream *s, void *user_data)
+{
+    audio_stream *as = user_data;
+    g_atomic_int_inc(&as->underruns);
+}
+
+static
+void
+pulse_stream_overflow_cb(pa_stream *s, void *user_data)
+{
+    audio_stream *as = user_data;
+    g_atomic_int_inc(&as->overruns);
+}
+
 static
 void
 pulse_stream_latency_update_cb(pa_stream *s, void *user_data)
@@ -237,7 +267,7 @@ audio_stream *
 pulse_do_create_stream(unsigned int sample_rate, unsigned int sample_frame_count,
                        audio_stream_playback_cb_f *playback_cb,
                        audio_stream_capture_cb_f  *capture_cb, void *cb_user_data,
-                       audio_stream_direction direction)
+                       audio_stream_direction direction, const char *device)
 {
     // ensure main loop is running
     if (!pulse_available()) {
@@ -279,6 +309,8 @@ pulse_do_create_stream(unsigned int sample_rate, unsigned int sample_frame_count
     pa_stream_set_read_callback(as->stream, pulse_stream_read_cb, as);
     pa_stream_set_write_callback(as->stream, pulse_stream_write_cb, as);
     pa_stream_set_latency_update_callback(as->stream, pulse_stream_latency_update_cb, as);
+    pa_stream_set_underflow_callback(as->stream, pulse_stream_underflow_cb, as);
+    pa_stream_set_overflow_callback(as->stream, pulse_stream_overflow_cb, as);
 
     const size_t frame_size = pa_frame_size(&as->sample_spec);
     pa_buffer_attr buf_attr = {
@@ -296,7 +328,7 @@ pulse_do_create_stream(unsigned int sample_rate, unsigned int sample_frame_count
         }
     } else {
         int flags = PA_STREAM_ADJUST_LATENCY;
-        if (pa_stream_connect_record(as->stream, NULL, &buf_attr, flags) < 0) {
+        if (pa_stream_connect_record(as->stream, device, &buf_attr, flags) < 0) {
             trace_error("%s, can't connect capture stream\n", __func__);
             goto err_2;
         }
@@ -331,63 +363,195 @@ pulse_create_playback_stream(unsigned int sample_rate, unsigned int sample_frame
                              audio_stream_playback_cb_f *cb, void *cb_user_data)
 {
     return pulse_do_create_stream(sample_rate, sample_frame_count, cb, NULL, cb_user_data,
-                                  STREAM_PLAYBACK);
+                                  STREAM_PLAYBACK, NULL);
+}
+
+static
+void
+pulse_wait_for_completion(pa_operation *op, pa_threaded_mainloop *ml)
+{
+    if (!op) {
+        trace_error("%s, operation is NULL\n", __func__);
+        return;
+    }
+
+    while (pa_operation_get_state(op) == PA_OPERATION_RUNNING)
+        pa_threaded_mainloop_wait(ml);
+    pa_operation_unref(op);
 }
 
 static
 audio_stream *
 pulse_create_capture_stream(unsigned int sample_rate, unsigned int sample_frame_count,
                             audio_stream_capture_cb_f *cb, void *cb_user_data,
-                            const char *longname)
+                            const char *longname, audio_stream_format *format)
 {
-    (void)longname; // have no meaning here. PulseAudio itself selects appropriate sound device
-    return pulse_do_create_stream(sample_rate, sample_frame_count, NULL, cb, cb_user_data,
-                                  STREAM_CAPTURE);
+    // server converts from whatever source provides
+    format->sample_rate =   sample_rate;
+    format->channels =      1;
+    format->sample_format = AUDIO_SAMPLE_S16;
+
+    // longname is a PulseAudio source name
+    audio_stream *as = pulse_do_create_stream(sample_rate, sample_frame_count, NULL, cb,
+                                              cb_user_data, STREAM_CAPTURE, longname);
+    if (!as && longname) {
+        // source could have gone since enumeration
+        trace_warning("%s, can't open source \"%s\", trying default one\n", __func__, longname);
+        as = pulse_do_create_stream(sample_rate, sample_frame_count, NULL, cb, cb_user_data,
+                                    STREAM_CAPTURE, NULL);
+    }
+
+    return as;
+}
+
+struct enumerate_param_s {
+    GArray     *list;               // of audio_device_name
+    char       *default_source;
+};
+
+static
+void
+pulse_server_info_cb(pa_context *c, const pa_server_info *i, void *user_data)
+{
+    struct enumerate_param_s *p = user_data;
+
+    if (i && i->default_source_name)
+        p->default_source = strdup(i->default_source_name);
+    pa_threaded_mainloop_signal(mainloop, 0);
+}
+
+static
+void
+pulse_source_info_cb(pa_context *c, const pa_source_info *i, int eol, void *user_data)
+{
+    struct enumerate_param_s *p = user_data;
+
+    if (eol) {
+        pa_threaded_mainloop_signal(mainloop, 0);
+        return;
+    }
+
+    // monitor sources are listed too, they allow capturing of what is being played
+    audio_device_name dev = {
+        .name =     strdup(i->description ? i->description : i->name),
+        .longname = strdup(i->name),
+    };
+
+    if (p->default_source && strcmp(i->name, p->default_source) == 0) {
+        // default source goes first
+        g_array_prepend_val(p->list, dev);
+    } else {
+        g_array_append_val(p->list, dev);
+    }
 }
 
 static
 audio_device_name *
 pulse_enumerate_capture_devices(void)
 {
-    audio_device_name *list = malloc(sizeof(audio_device_name) * 2);
-    if (!list)
+    if (!pulse_available())
         return NULL;
 
-    list[0].name = strdup("PulseAudio capture device");
-    list[0].longname = strdup(list[0].name);
+    struct enumerate_param_s p = {
+        .list =             g_array_new(TRUE, TRUE, sizeof(audio_device_name)),
+        .default_source =   NULL,
+    };
 
-    list[1].name = NULL;
-    list[1].longname = NULL;
+    pa_threaded_mainloop_lock(mainloop);
+    pulse_wait_for_completion(pa_context_get_server_info(context, pulse_server_info_cb, &p),
+                              mainloop);
+    pulse_wait_for_completion(pa_context_get_source_info_list(context, pulse_source_info_cb, &p),
+                              mainloop);
+    pa_threaded_mainloop_unlock(mainloop);
 
-    return list;
+    free(p.default_source);
+
+    // array is zero-terminated, so it can be freed by audio_capture_device_list_free()
+    return (audio_device_name *)g_array_free(p.list, FALSE);
 }
 
+struct preferred_param_s {
+    unsigned int    sample_rate;
+    pa_usec_t       latency;
+    char           *default_sink;
+};
+
 static
 void
-pulse_pause_stream(audio_stream *as, int enabled)
+pulse_preferred_server_info_cb(pa_context *c, const pa_server_info *i, void *user_data)
 {
-    g_atomic_int_set(&as->paused, enabled);
+    struct preferred_param_s *p = user_data;
+
+    if (i) {
+        p->sample_rate = i->sample_spec.rate;
+        if (i->default_sink_name)
+            p->default_sink = strdup(i->default_sink_name);
+    }
+    pa_threaded_mainloop_signal(mainloop, 0);
 }
 
 static
 void
-pulse_stream_success_cb(pa_stream *s, int success, void *user_data)
+pulse_preferred_sink_info_cb(pa_context *c, const pa_sink_info *i, int eol, void *user_data)
 {
+    struct preferred_param_s *p = user_data;
+
+    if (!eol && i)
+        p->latency = i->configured_latency ? i->configured_latency : i->latency;
     pa_threaded_mainloop_signal(mainloop, 0);
 }
 
 static
-void
-pulse_wait_for_completion(pa_operation *op, pa_threaded_mainloop *ml)
+int
+pulse_get_preferred_params(unsigned int *sample_rate, unsigned int *period_frames)
 {
-    if (!op) {
-        trace_error("%s, operation is NULL\n", __func__);
-        return;
+    if (!pulse_available())
+        return -1;
+
+    struct preferred_param_s p = {};
+
+    pa_threaded_mainloop_lock(mainloop);
+    pulse_wait_for_completion(pa_context_get_server_info(context,
+                                                         pulse_preferred_server_info_cb, &p),
+                              mainloop);
+    if (p.default_sink) {
+        pulse_wait_for_completion(pa_context_get_sink_info_by_name(context, p.default_sink,
+                                                     pulse_preferred_sink_info_cb, &p),
+                                  mainloop);
     }
+    pa_threaded_mainloop_unlock(mainloop);
 
-    while (pa_operation_get_state(op) == PA_OPERATION_RUNNING)
-        pa_threaded_mainloop_wait(ml);
-    pa_operation_unref(op);
+    free(p.default_sink);
+
+    if (p.sample_rate == 0)
+        return -1;
+
+    // server mixes at its default rate; sink latency hints at block size it's happy with.
+    // Timer-based scheduling can report huge latencies, those carry no information
+    const pa_usec_t min_latency = 1000 * (pa_usec_t)config.audio_buffer_min_ms;
+    const pa_usec_t max_latency = 1000 * (pa_usec_t)config.audio_buffer_max_ms;
+
+    *sample_rate = p.sample_rate;
+    if (min_latency <= p.latency && p.latency <= max_latency)
+        *period_frames = p.latency * p.sample_rate / 1000000;
+    else
+        *period_frames = 0;
+
+    return 0;
+}
+
+static
+void
+pulse_pause_stream(audio_stream *as, int enabled)
+{
+    g_atomic_int_set(&as->paused, enabled);
+}
+
+static
+void
+pulse_stream_success_cb(pa_stream *s, int success, void *user_data)
+{
+    pa_threaded_mainloop_signal(mainloop, 0);
 }
 
 static
@@ -403,18 +567,30 @@ pulse_destroy_stream(audio_stream *as)
     pa_stream_set_state_callback(as->stream, NULL, NULL);
     pa_stream_set_write_callback(as->stream, NULL, NULL);
     pa_stream_set_latency_update_callback(as->stream, NULL, NULL);
+    pa_stream_set_underflow_callback(as->stream, NULL, NULL);
+    pa_stream_set_overflow_callback(as->stream, NULL, NULL);
     pa_stream_unref(as->stream);
 
     pa_threaded_mainloop_unlock(mainloop);
     free(as);
 }
 
+static
+void
+pulse_get_stream_stats(audio_stream *as, struct audio_stream_stats_s *stats)
+{
+    stats->underruns = g_atomic_int_get(&as->underruns);
+    stats->overruns = g_atomic_int_get(&as->overruns);
+}
+
 
 audio_stream_ops audio_pulse = {
     .available =                    pulse_available,
     .create_playback_stream =       pulse_create_playback_stream,
     .create_capture_stream =        pulse_create_capture_stream,
     .enumerate_capture_devices =    pulse_enumerate_capture_devices,
+    .get_preferred_params =         pulse_get_preferred_params,
     .pause =                        pulse_pause_stream,
     .destroy =                      pulse_destroy_stream,
+    .get_stats =                    pulse_get_stream_stats,
 };
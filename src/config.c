@@ -36,6 +36,9 @@ static struct fpp_config_s default_config = {
     .audio_buffer_min_ms =      20,
     .audio_buffer_max_ms =      500,
     .audio_use_jack      =      0,
+    .audio_capture_agc   =      0,
+    .audio_backend       =      NULL,
+    .audio_null_sink_file =     NULL,
     .jack_autoconnect_ports =   1,
     .jack_server_name =         NULL,
     .jack_autostart_server =    1,
@@ -63,6 +66,17 @@ static struct fpp_config_s default_config = {
     .show_version_info =        0,
     .probe_video_capture_devices = 1,
     .enable_xrender =           1,
+    .enable_egl_offscreen =     0,
+    .track_objects =            0,
+    .memory_report_interval =   0,
+    .timer_slack_ms =           1,
+    .task_profile_interval =    0,
+    .long_task_threshold_ms =   0,
+    .hang_watchdog_ms =         0,
+    .lock_stats_interval =      0,
+    .separate_x_connections =   1,
+    .background_threads =       0,
+    .audio_realtime_priority =  0,
     .quirks = {
         .connect_first_loader_to_unrequested_stream = 0,
         .dump_resource_histogram    = 0,
@@ -79,6 +93,9 @@ static cfg_opt_t opts[] = {
     CFG_SIMPLE_INT("audio_buffer_min_ms",    &config.audio_buffer_min_ms),
     CFG_SIMPLE_INT("audio_buffer_max_ms",    &config.audio_buffer_max_ms),
     CFG_SIMPLE_INT("audio_use_jack",         &config.audio_use_jack),
+    CFG_SIMPLE_INT("audio_capture_agc",      &config.audio_capture_agc),
+    CFG_SIMPLE_STR("audio_backend",          &config.audio_backend),
+    CFG_SIMPLE_STR("audio_null_sink_file",   &config.audio_null_sink_file),
     CFG_SIMPLE_INT("jack_autoconnect_ports", &config.jack_autoconnect_ports),
     CFG_SIMPLE_STR("jack_server_name",       &config.jack_server_name),
     CFG_SIMPLE_INT("jack_autostart_server",  &config.jack_autostart_server),
@@ -107,6 +124,17 @@ static cfg_opt_t opts[] = {
     CFG_SIMPLE_INT("show_version_info",      &config.show_version_info),
     CFG_SIMPLE_INT("probe_video_capture_devices", &config.probe_video_capture_devices),
     CFG_SIMPLE_INT("enable_xrender",         &config.enable_xrender),
+    CFG_SIMPLE_INT("enable_egl_offscreen",   &config.enable_egl_offscreen),
+    CFG_SIMPLE_INT("track_objects",          &config.track_objects),
+    CFG_SIMPLE_INT("memory_report_interval", &config.memory_report_interval),
+    CFG_SIMPLE_INT("timer_slack_ms",         &config.timer_slack_ms),
+    CFG_SIMPLE_INT("task_profile_interval",  &config.task_profile_interval),
+    CFG_SIMPLE_INT("long_task_threshold_ms", &config.long_task_threshold_ms),
+    CFG_SIMPLE_INT("hang_watchdog_ms",       &config.hang_watchdog_ms),
+    CFG_SIMPLE_INT("lock_stats_interval",    &config.lock_stats_interval),
+    CFG_SIMPLE_INT("separate_x_connections", &config.separate_x_connections),
+    CFG_SIMPLE_INT("background_threads",     &config.background_threads),
+    CFG_SIMPLE_INT("audio_realtime_priority", &config.audio_realtime_priority),
     CFG_END()
 };
 
@@ -187,6 +215,8 @@ fpp_config_initialize(void)
 
     // all non-NULL strings values need to be duplicated, since config parser free()'s
     // their previous versions
+    DUP_CFG_STRING(config.audio_backend);
+    DUP_CFG_STRING(config.audio_null_sink_file);
     DUP_CFG_STRING(config.jack_server_name);
     DUP_CFG_STRING(config.pepperflash_path);
     DUP_CFG_STRING(config.flash_command_line);
@@ -241,6 +271,8 @@ fpp_config_destroy(void)
     FREE_IF_CHANGED(pepperflash_path);
     FREE_IF_CHANGED(flash_command_line);
     FREE_IF_CHANGED(jack_server_name);
+    FREE_IF_CHANGED(audio_backend);
+    FREE_IF_CHANGED(audio_null_sink_file);
     FREE_IF_CHANGED(fullscreen_window_geometry);
     g_free(pepper_data_dir);
     g_free(pepper_salt_file_name);
@@ -28,6 +28,9 @@ struct fpp_config_s {
     int     audio_buffer_min_ms;
     int     audio_buffer_max_ms;
     int     audio_use_jack;
+    int     audio_capture_agc;
+    char   *audio_backend;
+    char   *audio_null_sink_file;
     int     jack_autoconnect_ports;
     char   *jack_server_name;
     int     jack_autostart_server;
@@ -55,6 +58,17 @@ struct fpp_config_s {
     int     show_version_info;
     int     probe_video_capture_devices;
     int     enable_xrender;
+    int     enable_egl_offscreen;
+    int     track_objects;
+    int     memory_report_interval;
+    int     timer_slack_ms;
+    int     task_profile_interval;
+    int     long_task_threshold_ms;
+    int     hang_watchdog_ms;
+    int     lock_stats_interval;
+    int     separate_x_connections;
+    int     background_threads;
+    int     audio_realtime_priority;
     struct {
         int   connect_first_loader_to_unrequested_stream;
         int   dump_resource_histogram;
@@ -0,0 +1,509 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "audio_thread.h"
+#include "device_registry.h"
+#include "eintr_retry.h"
+#include "ppb_core.h"
+#include "ppb_device_ref.h"
+#include "ppb_message_loop.h"
+#include "ppb_var.h"
+#include "ppb_video_capture.h"
+#include "trace_core.h"
+#include "utils.h"
+#include <dirent.h>
+#include <errno.h>
+#include <glib.h>
+#include <poll.h>
+#include <ppapi/c/pp_errors.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define SETTLE_TIME_MS  300     ///< udev needs some time to finish setting up device nodes
+
+struct device_s {
+    char   *name;
+    char   *longname;
+};
+
+struct monitor_s {
+    PP_Resource                     owner;
+    PP_Instance                     instance;
+    enum device_registry_kind_e     kind;
+    PP_MonitorDeviceChangeCallback  callback;
+    void                           *user_data;
+    PP_Resource                     m_loop;
+    uint32_t                        serial;     ///< tells apart subsequent registrations
+};
+
+struct notify_task_s {
+    PP_Resource     owner;
+    uint32_t        serial;
+};
+
+static pthread_mutex_t  lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   populated_cond = PTHREAD_COND_INITIALIZER;
+static uint32_t         thread_started = 0;
+static uint32_t         populated = 0;
+static GArray          *devices[DEVICE_REGISTRY_KIND_COUNT];    // of struct device_s
+static GList           *monitors = NULL;                        // of struct monitor_s
+static uint32_t         monitor_serial = 0;
+
+static const PP_DeviceType_Dev pp_device_type[DEVICE_REGISTRY_KIND_COUNT] = {
+    [DEVICE_REGISTRY_VIDEO_CAPTURE] = PP_DEVICETYPE_DEV_VIDEOCAPTURE,
+    [DEVICE_REGISTRY_AUDIO_CAPTURE] = PP_DEVICETYPE_DEV_AUDIOCAPTURE,
+};
+
+static
+void
+device_list_free(GArray *list)
+{
+    if (!list)
+        return;
+
+    for (guint k = 0; k < list->len; k ++) {
+        struct device_s *d = &g_array_index(list, struct device_s, k);
+        g_free(d->name);
+        g_free(d->longname);
+    }
+    g_array_free(list, TRUE);
+}
+
+static
+GArray *
+device_list_copy(GArray *list)
+{
+    GArray *copy = g_array_new(FALSE, TRUE, sizeof(struct device_s));
+
+    for (guint k = 0; list && k < list->len; k ++) {
+        struct device_s *d = &g_array_index(list, struct device_s, k);
+        struct device_s c = {
+            .name =     g_strdup(d->name),
+            .longname = g_strdup(d->longname),
+        };
+        g_array_append_val(copy, c);
+    }
+
+    return copy;
+}
+
+static
+int
+device_lists_equal(GArray *a, GArray *b)
+{
+    if (!a || !b)
+        return a == b;
+
+    if (a->len != b->len)
+        return 0;
+
+    for (guint k = 0; k < a->len; k ++) {
+        struct device_s *da = &g_array_index(a, struct device_s, k);
+        struct device_s *db = &g_array_index(b, struct device_s, k);
+        if (strcmp(da->name, db->name) != 0 || strcmp(da->longname, db->longname) != 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+static
+GArray *
+probe_video_capture_devices(void)
+{
+    GArray *list = g_array_new(FALSE, TRUE, sizeof(struct device_s));
+    struct dirent **namelist;
+
+    int n = scandir("/dev", &namelist, NULL, alphasort);
+    if (n < 0)
+        return list;
+
+    for (int k = 0; k < n; k ++) {
+        if (strncmp(namelist[k]->d_name, "video", sizeof("video") - 1) == 0) {
+            char *fullpath = g_strdup_printf("/dev/%s", namelist[k]->d_name);
+            char *shortname = NULL;
+
+            if (ppb_video_capture_device_is_usable(fullpath, &shortname)) {
+                struct device_s d = {
+                    .name =     shortname,
+                    .longname = fullpath,
+                };
+                g_array_append_val(list, d);
+            } else {
+                g_free(fullpath);
+            }
+        }
+        free(namelist[k]);
+    }
+    free(namelist);
+
+    return list;
+}
+
+static
+GArray *
+probe_audio_capture_devices(void)
+{
+    GArray *list = g_array_new(FALSE, TRUE, sizeof(struct device_s));
+    audio_device_name *names = audio_select_implementation()->enumerate_capture_devices();
+
+    for (uintptr_t k = 0; names && names[k].name; k ++) {
+        struct device_s d = {
+            .name =     g_strdup(names[k].name),
+            .longname = g_strdup(names[k].longname),
+        };
+        g_array_append_val(list, d);
+    }
+
+    audio_capture_device_list_free(names);
+    return list;
+}
+
+static GArray *(*const probe_devices[DEVICE_REGISTRY_KIND_COUNT])(void) = {
+    [DEVICE_REGISTRY_VIDEO_CAPTURE] = probe_video_capture_devices,
+    [DEVICE_REGISTRY_AUDIO_CAPTURE] = probe_audio_capture_devices,
+};
+
+static
+GArray *
+create_device_refs(PP_Instance instance, enum device_registry_kind_e kind, GArray *list)
+{
+    GArray *refs = g_array_new(FALSE, TRUE, sizeof(PP_Resource));
+
+    for (guint k = 0; k < list->len; k ++) {
+        struct device_s *d = &g_array_index(list, struct device_s, k);
+        struct PP_Var name =     ppb_var_var_from_utf8_z(d->name);
+        struct PP_Var longname = ppb_var_var_from_utf8_z(d->longname);
+        PP_Resource device = ppb_device_ref_create(instance, name, longname,
+                                                   pp_device_type[kind]);
+        g_array_append_val(refs, device);
+        ppb_var_release(name);
+        ppb_var_release(longname);
+    }
+
+    return refs;
+}
+
+static
+void
+notify_comt(void *user_data, int32_t result)
+{
+    struct notify_task_s           *task = user_data;
+    PP_MonitorDeviceChangeCallback  callback = NULL;
+    void                           *cb_user_data = NULL;
+    PP_Instance                     instance = 0;
+    enum device_registry_kind_e     kind = DEVICE_REGISTRY_VIDEO_CAPTURE;
+    GArray                         *list = NULL;
+
+    pthread_mutex_lock(&lock);
+    for (GList *ll = monitors; ll != NULL; ll = g_list_next(ll)) {
+        struct monitor_s *m = ll->data;
+        if (m->owner == task->owner && m->serial == task->serial) {
+            callback =      m->callback;
+            cb_user_data =  m->user_data;
+            instance =      m->instance;
+            kind =          m->kind;
+            list =          device_list_copy(devices[kind]);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    g_slice_free1(sizeof(*task), task);
+
+    if (!callback) {
+        // monitoring was cancelled or callback was replaced since notification was posted
+        return;
+    }
+
+    GArray *refs = create_device_refs(instance, kind, list);
+    device_list_free(list);
+
+    callback(cb_user_data, refs->len, (const PP_Resource *)refs->data);
+
+    for (guint k = 0; k < refs->len; k ++)
+        ppb_core_release_resource(g_array_index(refs, PP_Resource, k));
+    g_array_free(refs, TRUE);
+}
+
+// caller must hold lock
+static
+void
+post_notification(struct monitor_s *m)
+{
+    struct notify_task_s *task = g_slice_alloc(sizeof(*task));
+    task->owner =   m->owner;
+    task->serial =  m->serial;
+
+    int32_t ret = ppb_message_loop_post_work_with_result(m->m_loop, PP_MakeCCB(notify_comt, task),
+                                                         0, PP_OK, 0, __func__);
+    if (ret != PP_OK) {
+        trace_warning("%s, can't post notification, ret=%d\n", __func__, ret);
+        g_slice_free1(sizeof(*task), task);
+    }
+}
+
+// caller must hold lock
+static
+void
+notify_monitors(enum device_registry_kind_e kind)
+{
+    for (GList *ll = monitors; ll != NULL; ll = g_list_next(ll)) {
+        struct monitor_s *m = ll->data;
+        if (m->kind == kind)
+            post_notification(m);
+    }
+}
+
+static
+void
+refresh_devices(enum device_registry_kind_e kind)
+{
+    GArray *list = probe_devices[kind]();
+
+    pthread_mutex_lock(&lock);
+    if (device_lists_equal(devices[kind], list)) {
+        pthread_mutex_unlock(&lock);
+        device_list_free(list);
+        return;
+    }
+
+    GArray *old_list = devices[kind];
+    devices[kind] = list;
+    notify_monitors(kind);
+    pthread_mutex_unlock(&lock);
+
+    device_list_free(old_list);
+}
+
+static
+void
+populate(void)
+{
+    GArray *lists[DEVICE_REGISTRY_KIND_COUNT];
+
+    for (int k = 0; k < DEVICE_REGISTRY_KIND_COUNT; k ++)
+        lists[k] = probe_devices[k]();
+
+    pthread_mutex_lock(&lock);
+    for (int k = 0; k < DEVICE_REGISTRY_KIND_COUNT; k ++) {
+        devices[k] = lists[k];
+        // monitors registered before population completed haven't got initial notification
+        notify_monitors(k);
+    }
+    populated = 1;
+    pthread_cond_broadcast(&populated_cond);
+    pthread_mutex_unlock(&lock);
+}
+
+static
+void *
+device_registry_thread(void *param)
+{
+    const uint32_t mask = IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO;
+    int wd_dev = -1;
+    int wd_snd = -1;
+
+    // watches are set up before population, so changes made in between are not lost
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd >= 0) {
+        wd_dev = inotify_add_watch(fd, "/dev", mask);
+        wd_snd = inotify_add_watch(fd, "/dev/snd", mask);
+    } else {
+        trace_warning("%s, inotify unavailable, device lists won't be updated\n", __func__);
+    }
+
+    populate();
+
+    if (fd < 0)
+        return NULL;
+
+    uint32_t dirty = 0;     // bitmask of device kinds to refresh
+
+    while (1) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int ret = poll(&pfd, 1, dirty ? SETTLE_TIME_MS : -1);
+
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            trace_error("%s, poll() failed, errno=%d\n", __func__, errno);
+            sleep(1);   // relax tight loop
+            continue;
+        }
+
+        if (ret == 0) {
+            // no events for a while, device nodes are settled
+            if (dirty & (1u << DEVICE_REGISTRY_AUDIO_CAPTURE))
+                audio_preferred_params_invalidate();
+
+            for (int k = 0; k < DEVICE_REGISTRY_KIND_COUNT; k ++) {
+                if (dirty & (1u << k))
+                    refresh_devices(k);
+            }
+            dirty = 0;
+            continue;
+        }
+
+        char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t len = RETRY_ON_EINTR(read(fd, buf, sizeof(buf)));
+        if (len <= 0)
+            continue;
+
+        char *ptr = buf;
+        while (ptr < buf + len) {
+            const struct inotify_event *ev = (const struct inotify_event *)ptr;
+            ptr += sizeof(*ev) + ev->len;
+
+            if (ev->wd == wd_dev && ev->len > 0) {
+                const int created = !!(ev->mask & (IN_CREATE | IN_MOVED_TO));
+
+                if (strncmp(ev->name, "video", sizeof("video") - 1) == 0) {
+                    dirty |= 1u << DEVICE_REGISTRY_VIDEO_CAPTURE;
+                } else if (strcmp(ev->name, "snd") == 0 && created) {
+                    // first sound card appeared
+                    wd_snd = inotify_add_watch(fd, "/dev/snd", mask);
+                    dirty |= 1u << DEVICE_REGISTRY_AUDIO_CAPTURE;
+                }
+            } else if (ev->wd == wd_snd) {
+                if (ev->mask & IN_IGNORED)
+                    wd_snd = -1;
+                dirty |= 1u << DEVICE_REGISTRY_AUDIO_CAPTURE;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+void
+device_registry_start(void)
+{
+    pthread_mutex_lock(&lock);
+    if (thread_started) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    pthread_t thread;
+    thread_started = 1;
+    int ret = pthread_create(&thread, NULL, device_registry_thread, NULL);
+    pthread_mutex_unlock(&lock);
+
+    if (ret == 0) {
+        pthread_detach(thread);
+    } else {
+        trace_error("%s, can't create thread, populating registry synchronously\n", __func__);
+        populate();
+    }
+}
+
+int32_t
+device_registry_enumerate(PP_Instance instance, enum device_registry_kind_e kind,
+                          struct PP_ArrayOutput output)
+{
+    device_registry_start();
+
+    pthread_mutex_lock(&lock);
+    while (!populated)
+        pthread_cond_wait(&populated_cond, &lock);
+    GArray *list = device_list_copy(devices[kind]);
+    pthread_mutex_unlock(&lock);
+
+    const uint32_t count = list->len;
+    PP_Resource *devs = output.GetDataBuffer(output.user_data, count, sizeof(PP_Resource));
+    if (!devs && count > 0) {
+        device_list_free(list);
+        return PP_ERROR_FAILED;
+    }
+
+    GArray *refs = create_device_refs(instance, kind, list);
+    for (uint32_t k = 0; k < count; k ++)
+        devs[k] = g_array_index(refs, PP_Resource, k);
+
+    g_array_free(refs, TRUE);
+    device_list_free(list);
+    return PP_OK;
+}
+
+// caller must hold lock
+static
+void
+remove_monitor(PP_Resource owner)
+{
+    for (GList *ll = monitors; ll != NULL; ll = g_list_next(ll)) {
+        struct monitor_s *m = ll->data;
+        if (m->owner == owner) {
+            monitors = g_list_delete_link(monitors, ll);
+            g_slice_free1(sizeof(*m), m);
+            return;
+        }
+    }
+}
+
+int32_t
+device_registry_monitor(PP_Resource owner, PP_Instance instance,
+                        enum device_registry_kind_e kind, PP_MonitorDeviceChangeCallback callback,
+                        void *user_data)
+{
+    PP_Resource m_loop = ppb_message_loop_get_current();
+
+    if (callback && !m_loop) {
+        trace_error("%s, no message loop attached to current thread\n", __func__);
+        return PP_ERROR_NO_MESSAGE_LOOP;
+    }
+
+    device_registry_start();
+
+    pthread_mutex_lock(&lock);
+    remove_monitor(owner);
+    if (callback) {
+        struct monitor_s *m = g_slice_alloc(sizeof(*m));
+        m->owner =      owner;
+        m->instance =   instance;
+        m->kind =       kind;
+        m->callback =   callback;
+        m->user_data =  user_data;
+        m->m_loop =     m_loop;
+        m->serial =     ++monitor_serial;
+        monitors = g_list_prepend(monitors, m);
+
+        // otherwise notification will be sent on population
+        if (populated)
+            post_notification(m);
+    }
+    pthread_mutex_unlock(&lock);
+
+    return PP_OK;
+}
+
+void
+device_registry_forget_owner(PP_Resource owner)
+{
+    pthread_mutex_lock(&lock);
+    remove_monitor(owner);
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <ppapi/c/dev/ppb_device_ref_dev.h>
+#include <ppapi/c/pp_array_output.h>
+#include <ppapi/c/pp_instance.h>
+#include <ppapi/c/pp_resource.h>
+#include <stdint.h>
+
+/// Process-wide list of capture devices. Populated on a background thread, which then keeps
+/// it current by watching /dev and /dev/snd for changes.
+
+enum device_registry_kind_e {
+    DEVICE_REGISTRY_VIDEO_CAPTURE = 0,
+    DEVICE_REGISTRY_AUDIO_CAPTURE,
+    DEVICE_REGISTRY_KIND_COUNT,
+};
+
+/// starts background thread, if it's not running yet
+void
+device_registry_start(void);
+
+/// fills |output| with device refs for currently known devices of |kind|
+///
+/// Waits for initial population to complete, but never probes devices by itself.
+int32_t
+device_registry_enumerate(PP_Instance instance, enum device_registry_kind_e kind,
+                          struct PP_ArrayOutput output);
+
+/// sets device change callback for |owner| resource, replacing previous one. Passing NULL
+/// as |callback| cancels notifications
+///
+/// Callback is called on the current thread, once for the currently available devices, and
+/// then every time the list changes.
+int32_t
+device_registry_monitor(PP_Resource owner, PP_Instance instance,
+                        enum device_registry_kind_e kind, PP_MonitorDeviceChangeCallback callback,
+                        void *user_data);
+
+/// cancels notifications for |owner|. Should be called when resource is destroyed
+void
+device_registry_forget_owner(PP_Resource owner);
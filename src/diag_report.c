@@ -0,0 +1,136 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+#include "diag_report.h"
+#include "trace_core.h"
+#include <pthread.h>
+#include <unistd.h>
+
+struct report_request_s {
+    diag_report_writer_f   *writer;
+};
+
+static pthread_once_t   report_thread_once = PTHREAD_ONCE_INIT;
+static GAsyncQueue     *report_q = NULL;
+
+void
+diag_histogram_add(struct diag_histogram_s *h, int64_t value_us)
+{
+    int k = 0;
+
+    value_us = MAX(value_us, 0);
+    while (k < DIAG_HISTOGRAM_BUCKETS - 1 && value_us + 1 >= ((int64_t)2 << k))
+        k ++;
+
+    h->count ++;
+    h->sum_us += value_us;
+    h->max_us = MAX(h->max_us, value_us);
+    h->bucket[k] ++;
+}
+
+int64_t
+diag_histogram_percentile(const struct diag_histogram_s *h, double fraction)
+{
+    const uint64_t target = (uint64_t)(fraction * h->count);
+    uint64_t seen = 0;
+
+    for (int k = 0; k < DIAG_HISTOGRAM_BUCKETS; k ++) {
+        seen += h->bucket[k];
+        if (seen > target)
+            return MIN(((int64_t)2 << k) - 1, h->max_us);
+    }
+
+    return h->max_us;
+}
+
+int
+diag_write_report(const char *name, const char *report)
+{
+    const char *data_dir = fpp_config_get_pepper_data_dir();
+    if (!data_dir) {
+        trace_error("%s, no data directory\n", __func__);
+        return -1;
+    }
+
+    gchar *fname = g_strdup_printf("%s/%s.%d.txt", data_dir, name, (int)getpid());
+    GError *error = NULL;
+    int retval = 0;
+
+    if (!g_file_set_contents(fname, report, -1, &error)) {
+        trace_error("%s, can't write %s: %s\n", __func__, fname, error->message);
+        g_error_free(error);
+        retval = -1;
+    }
+
+    g_free(fname);
+    return retval;
+}
+
+static
+void *
+report_thread_func(void *param)
+{
+    GAsyncQueue *q = param;
+
+    while (1) {
+        struct report_request_s *req = g_async_queue_pop(q);
+        req->writer();
+        g_slice_free(struct report_request_s, req);
+    }
+
+    return NULL;
+}
+
+static
+void
+start_report_thread(void)
+{
+    pthread_t t;
+    GAsyncQueue *q = g_async_queue_new();
+
+    if (pthread_create(&t, NULL, report_thread_func, q) != 0) {
+        trace_error("%s, can't create thread\n", __func__);
+        g_async_queue_unref(q);
+        return;
+    }
+
+    pthread_detach(t);
+    report_q = q;
+}
+
+void
+diag_write_report_async(diag_report_writer_f *writer)
+{
+    // queue is set once, pthread_once() makes it visible
+    pthread_once(&report_thread_once, start_report_thread);
+    if (!report_q) {
+        trace_error("%s, no report thread, report dropped\n", __func__);
+        return;
+    }
+
+    struct report_request_s *req = g_slice_new(struct report_request_s);
+    req->writer = writer;
+    g_async_queue_push(report_q, req);
+}
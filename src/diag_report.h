@@ -0,0 +1,60 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <stdint.h>
+
+/// Helpers shared by diagnostic modules (memory accounting, task profiler, hang watchdog, lock
+/// statistics): latency histograms and report files in the plugin data directory.
+
+/// histogram buckets are powers of two, in microseconds. Last one holds everything longer
+#define DIAG_HISTOGRAM_BUCKETS  22
+
+struct diag_histogram_s {
+    uint64_t    count;
+    int64_t     sum_us;
+    int64_t     max_us;
+    uint64_t    bucket[DIAG_HISTOGRAM_BUCKETS]; ///< [k] holds values in [2^k - 1, 2^(k+1) - 1)
+};
+
+void
+diag_histogram_add(struct diag_histogram_s *h, int64_t value_us);
+
+/// returns upper bound of the bucket holding value at |fraction| of the histogram, capped by
+/// its maximum
+int64_t
+diag_histogram_percentile(const struct diag_histogram_s *h, double fraction);
+
+/// writes |report| to "<name>.<pid>.txt" in the plugin data directory. Returns 0 on success
+int
+diag_write_report(const char *name, const char *report);
+
+typedef int (diag_report_writer_f)(void);
+
+/// calls |writer| on a separate diagnostics thread, so periodic reports are not built and
+/// written in hot paths which noticed they are due
+void
+diag_write_report_async(diag_report_writer_f *writer);
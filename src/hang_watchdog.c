@@ -0,0 +1,573 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+#include "diag_report.h"
+#include "hang_watchdog.h"
+#include "thread_local.h"
+#include "trace_core.h"
+#include <errno.h>
+#include <execinfo.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/// signal used to sample stacks of stuck threads
+#define SAMPLE_SIGNAL           (SIGRTMIN + 5)
+#define SAMPLE_TIMEOUT_MS       200
+#define MAX_FRAMES              64
+#define MAX_SLOTS               64
+#define MAX_LOCKS               8
+
+enum slot_state_e {
+    SLOT_IDLE = 0,
+    SLOT_BUSY,
+    SLOT_NESTED_WAIT,
+};
+
+struct slot_s {
+    int                 in_use;
+    const char         *name;
+    int                 has_thread;
+    pid_t               tid;
+    enum thread_role_e  role;
+    int                 nesting;        ///< touched by owner thread only
+    volatile gint       state;
+    volatile gint64     since;          ///< when current state was entered, monotonic, us
+    gint64              reported_since; ///< |since| of the last reported hang
+};
+
+struct lock_s {
+    const char         *name;
+    pthread_mutex_t    *mutex;
+};
+
+static pthread_mutex_t  lock = PTHREAD_MUTEX_INITIALIZER;
+static struct slot_s    slots[MAX_SLOTS];
+static struct slot_s    browser_slot = { .in_use = 1, .name = "browser thread calls" };
+static struct lock_s    locks[MAX_LOCKS];
+static gchar           *log_ring[HANG_WATCHDOG_LOG_SIZE];
+static int              report_count = 0;
+static int              watchdog_running = 0;
+static volatile gint    watchdog_stop = 0;
+static pthread_t        watchdog_thread;
+
+/// hang found under |lock|, reported after it's released
+struct pending_report_s {
+    GString            *header;
+    GString            *locks;
+    pid_t               tid;        ///< thread to sample, zero if unknown
+};
+
+// filled by signal handler of a sampled thread. Each request gets a new sequence number; the
+// handler claims it by resetting |sample_wanted|, so a late handler of an abandoned request
+// can't fill frames for the next one
+static void                    *sample_frames[MAX_FRAMES];
+static volatile int             sample_depth;
+static volatile gint            sample_wanted = 0;  ///< sequence number, zero if none
+static volatile gint            sample_tid = 0;     ///< thread which should respond
+static volatile gint            sample_seq = 0;     ///< sequence number of |sample_frames|
+static gint                     next_sample_seq = 1;
+static sem_t                    sample_done;
+static int                      sampling_available = 0;
+
+
+static
+void
+sample_signal_handler(int sig)
+{
+    const int saved_errno = errno;
+    const gint seq = g_atomic_int_get(&sample_wanted);
+
+    if (seq != 0 && g_atomic_int_get(&sample_tid) == (gint)syscall(__NR_gettid) &&
+        g_atomic_int_compare_and_exchange(&sample_wanted, seq, 0))
+    {
+        sample_depth = backtrace(sample_frames, MAX_FRAMES);
+        g_atomic_int_set(&sample_seq, seq);
+        sem_post(&sample_done);
+    }
+
+    errno = saved_errno;
+}
+
+static
+void
+setup_sampling(void)
+{
+    struct sigaction prev;
+    struct sigaction sa = {
+        .sa_handler = sample_signal_handler,
+        .sa_flags =   SA_RESTART,
+    };
+
+    // someone else may use the signal
+    if (sigaction(SAMPLE_SIGNAL, NULL, &prev) != 0 || prev.sa_handler != SIG_DFL) {
+        trace_warning("%s, signal %d is in use, stacks won't be sampled\n", __func__,
+                      SAMPLE_SIGNAL);
+        return;
+    }
+
+    // backtrace() may allocate on its first call, which is not allowed in signal handler
+    void *frames[2];
+    backtrace(frames, 2);
+
+    sem_init(&sample_done, 0, 0);
+    sigemptyset(&sa.sa_mask);
+    sampling_available = sigaction(SAMPLE_SIGNAL, &sa, NULL) == 0;
+}
+
+/// waits for handler to post |sample_done| for request |seq|. Returns 0 on success
+static
+int
+wait_for_sample(gint seq, const struct timespec *deadline)
+{
+    while (1) {
+        if (sem_timedwait(&sample_done, deadline) != 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        if (g_atomic_int_get(&sample_seq) == seq)
+            return 0;
+        // post left from an earlier request
+    }
+}
+
+/// samples stack of thread |tid|. Should be called from watchdog thread only, without |lock|
+/// held, as the thread may take a while to respond
+static
+void
+append_stack(GString *s, pid_t tid)
+{
+    if (!sampling_available) {
+        g_string_append(s, "  stack: unavailable\n");
+        return;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += SAMPLE_TIMEOUT_MS * 1000 * 1000;
+    deadline.tv_sec += deadline.tv_nsec / (1000 * 1000 * 1000);
+    deadline.tv_nsec %= 1000 * 1000 * 1000;
+
+    // drop posts of earlier requests
+    while (sem_trywait(&sample_done) == 0 || errno == EINTR) {
+    }
+
+    const gint seq = next_sample_seq ++;
+    if (next_sample_seq <= 0)
+        next_sample_seq = 1;
+
+    g_atomic_int_set(&sample_tid, tid);
+    g_atomic_int_set(&sample_wanted, seq);
+
+    // thread may have exited since the hang was found, so it's addressed by tid; handler
+    // checks tid anyway
+    if (syscall(__NR_tgkill, getpid(), tid, SAMPLE_SIGNAL) != 0) {
+        g_atomic_int_set(&sample_wanted, 0);
+        g_string_append(s, "  stack: can't signal thread\n");
+        return;
+    }
+
+    if (wait_for_sample(seq, &deadline) != 0) {
+        // if handler has claimed the request already, it's about to post; frames buffer can't
+        // be reused before it does
+        if (g_atomic_int_compare_and_exchange(&sample_wanted, seq, 0)) {
+            g_string_append(s, "  stack: thread didn't respond\n");
+            return;
+        }
+
+        while (sem_wait(&sample_done) != 0 || g_atomic_int_get(&sample_seq) != seq) {
+        }
+    }
+
+    char **symbols = backtrace_symbols(sample_frames, sample_depth);
+    g_string_append(s, "  stack:\n");
+    // frame 0 is the handler itself, frame 1 is signal trampoline
+    for (int k = 2; k < sample_depth; k ++) {
+        g_string_append_printf(s, "    #%-2d %s\n", k - 2, symbols ? symbols[k] : "?");
+    }
+    free(symbols);
+}
+
+static
+pid_t
+mutex_owner(pthread_mutex_t *mutex)
+{
+#ifdef __GLIBC__
+    return mutex->__data.__owner;
+#else
+    if (pthread_mutex_trylock(mutex) != 0)
+        return -1;  // held, owner is unknown
+    pthread_mutex_unlock(mutex);
+    return 0;
+#endif
+}
+
+/// should be called with lock held
+static
+void
+append_locks(GString *s, pid_t stuck_tid)
+{
+    g_string_append(s, "  locks:\n");
+    for (int k = 0; k < MAX_LOCKS; k ++) {
+        if (!locks[k].mutex)
+            continue;
+
+        const pid_t owner = mutex_owner(locks[k].mutex);
+        g_string_append_printf(s, "    %-20s ", locks[k].name);
+        if (owner == 0)
+            g_string_append(s, "free\n");
+        else if (owner < 0)
+            g_string_append(s, "held\n");
+        else
+            g_string_append_printf(s, "held by tid %d%s\n", (int)owner,
+                                   owner == stuck_tid ? " (this thread)" : "");
+    }
+}
+
+/// describes hang. Should be called with lock held. Stack is sampled later, by
+/// finish_report(), once lock is released
+static
+struct pending_report_s *
+report_hang(struct slot_s *slot, int state, gint64 duration_us)
+{
+    struct pending_report_s *pr = g_slice_new0(struct pending_report_s);
+    GString *s = g_string_new(NULL);
+
+    g_string_append_printf(s, "%.3f s: \"%s\"", g_get_monotonic_time() / 1e6, slot->name);
+    if (slot->tid) {
+        g_string_append_printf(s, " (tid %d, %s thread)", (int)slot->tid,
+                               thread_local_role_name(slot->role));
+    }
+    g_string_append_printf(s, " %s for %.0f ms\n",
+                           state == SLOT_NESTED_WAIT ? "waits in nested loop" : "is busy",
+                           duration_us / 1e3);
+
+    pr->header = s;
+    pr->tid = slot->has_thread ? slot->tid : 0;
+    pr->locks = g_string_new(NULL);
+    append_locks(pr->locks, slot->tid);
+
+    trace_warning("hang detected: \"%s\" %s for %.0f ms\n", slot->name,
+                  state == SLOT_NESTED_WAIT ? "waits in nested loop" : "is busy",
+                  duration_us / 1e3);
+
+    return pr;
+}
+
+/// samples stack and adds report to the log. Should be called without lock held
+static
+void
+finish_report(struct pending_report_s *pr)
+{
+    if (pr->tid)
+        append_stack(pr->header, pr->tid);
+    g_string_append_len(pr->header, pr->locks->str, pr->locks->len);
+    g_string_free(pr->locks, TRUE);
+
+    pthread_mutex_lock(&lock);
+    const int idx = report_count % HANG_WATCHDOG_LOG_SIZE;
+    g_free(log_ring[idx]);
+    log_ring[idx] = g_string_free(pr->header, FALSE);
+    report_count ++;
+    pthread_mutex_unlock(&lock);
+
+    g_slice_free(struct pending_report_s, pr);
+}
+
+static
+void
+write_log(void)
+{
+    gchar *log = hang_watchdog_get_log();
+    diag_write_report("hangs", log);
+    g_free(log);
+}
+
+/// should be called with lock held. Hang found is prepended to |pending|
+static
+GList *
+check_slot(struct slot_s *slot, gint64 now, gint64 threshold_us, GList *pending)
+{
+    const int state = g_atomic_int_get(&slot->state);
+    const gint64 since = slot->since;
+
+    if (state == SLOT_IDLE || since == slot->reported_since || now - since < threshold_us)
+        return pending;
+
+    // reported once per episode
+    slot->reported_since = since;
+    return g_list_prepend(pending, report_hang(slot, state, now - since));
+}
+
+static
+void *
+watchdog_thread_func(void *param)
+{
+    setup_sampling();
+
+    while (!g_atomic_int_get(&watchdog_stop)) {
+        const gint64 threshold_us = (gint64)config.hang_watchdog_ms * 1000;
+        g_usleep(MAX(threshold_us / 4, 10 * 1000));
+
+        const gint64 now = g_get_monotonic_time();
+        GList *pending = NULL;
+
+        pthread_mutex_lock(&lock);
+        for (int k = 0; k < MAX_SLOTS; k ++) {
+            if (slots[k].in_use)
+                pending = check_slot(&slots[k], now, threshold_us, pending);
+        }
+        pending = check_slot(&browser_slot, now, threshold_us, pending);
+        pthread_mutex_unlock(&lock);
+
+        if (!pending)
+            continue;
+
+        // sampling takes up to SAMPLE_TIMEOUT_MS per thread, and entering and leaving threads
+        // shouldn't wait for it
+        pending = g_list_reverse(pending);
+        for (GList *ll = pending; ll != NULL; ll = g_list_next(ll))
+            finish_report(ll->data);
+        g_list_free(pending);
+        write_log();
+    }
+
+    return NULL;
+}
+
+/// should be called with lock held
+static
+void
+ensure_watchdog_running(void)
+{
+    if (watchdog_running || config.hang_watchdog_ms <= 0)
+        return;
+
+    g_atomic_int_set(&watchdog_stop, 0);
+    if (pthread_create(&watchdog_thread, NULL, watchdog_thread_func, NULL) != 0) {
+        trace_error("%s, can't create thread\n", __func__);
+        return;
+    }
+    watchdog_running = 1;
+}
+
+static
+struct slot_s *
+get_current_slot(void)
+{
+    const int idx = get_thread_local()->watchdog_slot;
+    return idx > 0 ? &slots[idx - 1] : NULL;
+}
+
+static
+void
+set_state(struct slot_s *slot, int state)
+{
+    // |since| goes first, so watchdog never sees new state with old timestamp
+    slot->since = g_get_monotonic_time();
+    g_atomic_int_set(&slot->state, state);
+}
+
+void
+hang_watchdog_thread_enter(const char *name)
+{
+    if (config.hang_watchdog_ms <= 0)
+        return;
+
+    struct slot_s *slot = get_current_slot();
+    if (slot) {
+        slot->nesting ++;
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    ensure_watchdog_running();
+    for (int k = 0; k < MAX_SLOTS; k ++) {
+        if (!slots[k].in_use) {
+            slot = &slots[k];
+            memset(slot, 0, sizeof(*slot));
+            slot->in_use = 1;
+            slot->name = name;
+            slot->has_thread = 1;
+            slot->tid = thread_local_get_tid();
+            slot->role = thread_local_get_role();
+            slot->nesting = 1;
+            set_state(slot, SLOT_BUSY);
+            get_thread_local()->watchdog_slot = k + 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (!slot)
+        trace_error("%s, too many threads\n", __func__);
+}
+
+void
+hang_watchdog_thread_leave(void)
+{
+    struct slot_s *slot = get_current_slot();
+    if (!slot)
+        return;
+
+    if (-- slot->nesting > 0)
+        return;
+
+    pthread_mutex_lock(&lock);
+    slot->in_use = 0;
+    get_thread_local()->watchdog_slot = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+void
+hang_watchdog_thread_busy(void)
+{
+    struct slot_s *slot = get_current_slot();
+    if (slot)
+        set_state(slot, SLOT_BUSY);
+}
+
+void
+hang_watchdog_thread_waiting(int nested)
+{
+    struct slot_s *slot = get_current_slot();
+    if (slot)
+        set_state(slot, nested ? SLOT_NESTED_WAIT : SLOT_IDLE);
+}
+
+void
+hang_watchdog_browser_call_posted(void)
+{
+    if (config.hang_watchdog_ms <= 0)
+        return;
+
+    if (!watchdog_running) {
+        pthread_mutex_lock(&lock);
+        ensure_watchdog_running();
+        pthread_mutex_unlock(&lock);
+    }
+
+    // the oldest pending call matters
+    if (g_atomic_int_get(&browser_slot.state) == SLOT_IDLE)
+        set_state(&browser_slot, SLOT_BUSY);
+}
+
+void
+hang_watchdog_browser_calls_drained(void)
+{
+    if (config.hang_watchdog_ms <= 0)
+        return;
+
+    if (!browser_slot.has_thread) {
+        pthread_mutex_lock(&lock);
+        browser_slot.tid = thread_local_get_tid();
+        browser_slot.role = THREAD_ROLE_BROWSER;
+        browser_slot.has_thread = 1;
+        pthread_mutex_unlock(&lock);
+    }
+
+    set_state(&browser_slot, SLOT_IDLE);
+}
+
+void
+hang_watchdog_register_lock(const char *name, pthread_mutex_t *mutex)
+{
+    pthread_mutex_lock(&lock);
+    for (int k = 0; k < MAX_LOCKS; k ++) {
+        if (!locks[k].mutex) {
+            locks[k].name = name;
+            locks[k].mutex = mutex;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void
+hang_watchdog_unregister_lock(pthread_mutex_t *mutex)
+{
+    pthread_mutex_lock(&lock);
+    for (int k = 0; k < MAX_LOCKS; k ++) {
+        if (locks[k].mutex == mutex)
+            locks[k].mutex = NULL;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+int
+hang_watchdog_get_report_count(void)
+{
+    pthread_mutex_lock(&lock);
+    int count = report_count;
+    pthread_mutex_unlock(&lock);
+    return count;
+}
+
+gchar *
+hang_watchdog_get_log(void)
+{
+    GString *s = g_string_new(NULL);
+
+    pthread_mutex_lock(&lock);
+    const int first = MAX(report_count - HANG_WATCHDOG_LOG_SIZE, 0);
+    for (int k = first; k < report_count; k ++)
+        g_string_append(s, log_ring[k % HANG_WATCHDOG_LOG_SIZE]);
+    pthread_mutex_unlock(&lock);
+
+    return g_string_free(s, FALSE);
+}
+
+void
+hang_watchdog_reset(void)
+{
+    pthread_mutex_lock(&lock);
+    const int was_running = watchdog_running;
+    watchdog_running = 0;
+    pthread_mutex_unlock(&lock);
+
+    if (was_running) {
+        g_atomic_int_set(&watchdog_stop, 1);
+        pthread_join(watchdog_thread, NULL);
+    }
+
+    pthread_mutex_lock(&lock);
+    for (int k = 0; k < HANG_WATCHDOG_LOG_SIZE; k ++) {
+        g_free(log_ring[k]);
+        log_ring[k] = NULL;
+    }
+    report_count = 0;
+    for (int k = 0; k < MAX_SLOTS; k ++)
+        slots[k].reported_since = 0;
+    browser_slot.reported_since = 0;
+    pthread_mutex_unlock(&lock);
+}
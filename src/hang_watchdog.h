@@ -0,0 +1,81 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <pthread.h>
+
+/// Watches for plugin threads which stay busy for too long. Message loops report whether they
+/// run a task or wait for one; waiting in a nested loop means the outer task is blocked, so it
+/// counts as busy too. Calls scheduled to the browser thread are watched the same way, from
+/// posting until they are run. If config.hang_watchdog_ms is set and some thread stays busy
+/// for longer than that, its stack is sampled (a signal is sent to it, and handler records
+/// backtrace()), and owners of registered global locks are noted. Reports are kept in a ring,
+/// and written to "hangs.<pid>.txt" in the plugin data directory.
+
+/// number of reports kept
+#define HANG_WATCHDOG_LOG_SIZE      16
+
+/// registers current thread. Calls may nest; thread is unregistered on the last leave
+void
+hang_watchdog_thread_enter(const char *name);
+
+void
+hang_watchdog_thread_leave(void);
+
+/// current thread starts doing something
+void
+hang_watchdog_thread_busy(void);
+
+/// current thread is going to wait for work. |nested| means it waits inside of a task
+void
+hang_watchdog_thread_waiting(int nested);
+
+/// call to browser thread was scheduled
+void
+hang_watchdog_browser_call_posted(void);
+
+/// all scheduled calls to browser thread were run. Should be called on browser thread
+void
+hang_watchdog_browser_calls_drained(void);
+
+/// lock to be included in reports
+void
+hang_watchdog_register_lock(const char *name, pthread_mutex_t *mutex);
+
+void
+hang_watchdog_unregister_lock(pthread_mutex_t *mutex);
+
+/// number of hangs detected so far
+int
+hang_watchdog_get_report_count(void);
+
+/// returns kept reports, oldest first. Caller should free it with g_free()
+gchar *
+hang_watchdog_get_log(void);
+
+/// stops watchdog thread and forgets reports
+void
+hang_watchdog_reset(void);
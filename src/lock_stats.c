@@ -0,0 +1,288 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+#include "lock_stats.h"
+#include "object_tracker.h"
+#include "trace_core.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_LOCKS       8
+#define TOP_SITES       5
+
+struct tracked_lock_s {
+    pthread_mutex_t        *mutex;
+    int                     depth;          ///< recursion depth, changed by owner only
+    gint64                  hold_start;
+    struct lock_stats_s     stats;          ///< updated with |mutex| held
+};
+
+static pthread_mutex_t          lock = PTHREAD_MUTEX_INITIALIZER;
+static struct tracked_lock_s    tracked[MAX_LOCKS];
+static volatile gint            next_report_s = 0;    ///< monotonic time, in seconds
+
+
+static
+struct tracked_lock_s *
+find_tracked(pthread_mutex_t *mutex)
+{
+    for (int k = 0; k < MAX_LOCKS; k ++) {
+        if (tracked[k].mutex == mutex)
+            return &tracked[k];
+    }
+
+    return NULL;
+}
+
+/// should be called with tracked mutex held
+static
+void
+record_site(struct lock_stats_s *stats, const void *site, int contended, int64_t wait_us)
+{
+    const guint start = GPOINTER_TO_SIZE(site) % LOCK_STATS_SITES;
+
+    for (guint k = 0; k < LOCK_STATS_SITES; k ++) {
+        struct lock_site_stats_s *s = &stats->sites[(start + k) % LOCK_STATS_SITES];
+
+        if (s->site == NULL)
+            s->site = site;
+
+        if (s->site == site) {
+            s->acquisitions ++;
+            s->contended += contended;
+            s->wait_us += wait_us;
+            return;
+        }
+    }
+
+    stats->other_sites ++;
+}
+
+void
+lock_stats_register(const char *name, pthread_mutex_t *mutex)
+{
+    pthread_mutex_lock(&lock);
+    struct tracked_lock_s *tl = find_tracked(NULL);
+    if (tl) {
+        memset(tl, 0, sizeof(*tl));
+        tl->stats.name = name;
+        tl->mutex = mutex;
+    } else {
+        trace_error("%s, too many locks\n", __func__);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void
+lock_stats_unregister(pthread_mutex_t *mutex)
+{
+    pthread_mutex_lock(&lock);
+    struct tracked_lock_s *tl = find_tracked(mutex);
+    if (tl)
+        tl->mutex = NULL;
+    pthread_mutex_unlock(&lock);
+}
+
+__attribute__((noinline))
+int
+lock_stats_lock(pthread_mutex_t *mutex)
+{
+    if (config.lock_stats_interval <= 0)
+        return pthread_mutex_lock(mutex);
+
+    struct tracked_lock_s *tl = find_tracked(mutex);
+    if (!tl)
+        return pthread_mutex_lock(mutex);
+
+    const gint64 start = g_get_monotonic_time();
+    gint64 acquired = start;
+    int contended = 0;
+
+    int ret = pthread_mutex_trylock(mutex);
+    if (ret == EBUSY) {
+        contended = 1;
+        ret = pthread_mutex_lock(mutex);
+        acquired = g_get_monotonic_time();
+    }
+
+    if (ret != 0)
+        return ret;
+
+    // from now on, statistics are protected by the mutex itself
+    if (tl->depth ++ == 0)
+        tl->hold_start = acquired;
+
+    tl->stats.acquisitions ++;
+    tl->stats.contended += contended;
+    diag_histogram_add(&tl->stats.wait, acquired - start);
+    record_site(&tl->stats, __builtin_return_address(0), contended, acquired - start);
+
+    return 0;
+}
+
+__attribute__((noinline))
+int
+lock_stats_unlock(pthread_mutex_t *mutex)
+{
+    if (config.lock_stats_interval <= 0)
+        return pthread_mutex_unlock(mutex);
+
+    struct tracked_lock_s *tl = find_tracked(mutex);
+
+    // lock may have been taken before statistics were enabled
+    if (tl && tl->depth > 0) {
+        if (-- tl->depth == 0)
+            diag_histogram_add(&tl->stats.hold, g_get_monotonic_time() - tl->hold_start);
+    }
+
+    const int ret = pthread_mutex_unlock(mutex);
+
+    // only the thread which moved the deadline asks for the report; it's written elsewhere,
+    // unlocking shouldn't take long
+    const gint now_s = g_get_monotonic_time() / G_USEC_PER_SEC;
+    const gint deadline = g_atomic_int_get(&next_report_s);
+    if (deadline == 0) {
+        g_atomic_int_compare_and_exchange(&next_report_s, 0,
+                                          now_s + config.lock_stats_interval);
+    } else if (now_s >= deadline &&
+               g_atomic_int_compare_and_exchange(&next_report_s, deadline,
+                                                 now_s + config.lock_stats_interval))
+    {
+        diag_write_report_async(lock_stats_write_report);
+    }
+
+    return ret;
+}
+
+int
+lock_stats_get(pthread_mutex_t *mutex, struct lock_stats_s *stats)
+{
+    pthread_mutex_lock(&lock);
+    struct tracked_lock_s *tl = find_tracked(mutex);
+
+    // copied without taking the lock itself, to avoid lock order issues. Counters may be
+    // slightly off
+    if (tl)
+        *stats = tl->stats;
+    pthread_mutex_unlock(&lock);
+
+    return tl ? 0 : -1;
+}
+
+static
+void
+append_histogram(GString *s, const char *name, const struct diag_histogram_s *h)
+{
+    g_string_append_printf(s, "    %-5s avg %8.3f ms, p50 %8.3f ms, p99 %8.3f ms, max %8.3f ms, "
+                           "total %.3f s\n", name, h->count ? h->sum_us / 1e3 / h->count : 0,
+                           diag_histogram_percentile(h, 0.5) / 1e3,
+                           diag_histogram_percentile(h, 0.99) / 1e3, h->max_us / 1e3,
+                           h->sum_us / 1e6);
+}
+
+static
+gint
+compare_sites_by_wait(gconstpointer a, gconstpointer b)
+{
+    const struct lock_site_stats_s *sa = a;
+    const struct lock_site_stats_s *sb = b;
+
+    if (sa->wait_us != sb->wait_us)
+        return sa->wait_us > sb->wait_us ? -1 : 1;
+    return sa->acquisitions > sb->acquisitions ? -1 : (sa->acquisitions < sb->acquisitions);
+}
+
+gchar *
+lock_stats_get_report(void)
+{
+    GArray *locks = g_array_new(FALSE, FALSE, sizeof(struct lock_stats_s));
+
+    pthread_mutex_lock(&lock);
+    for (int k = 0; k < MAX_LOCKS; k ++) {
+        if (tracked[k].mutex)
+            g_array_append_vals(locks, &tracked[k].stats, 1);
+    }
+    pthread_mutex_unlock(&lock);
+
+    GString *s = g_string_new(NULL);
+    g_string_append_printf(s, "lock statistics, pid %d, %.1f s\n", (int)getpid(),
+                           g_get_monotonic_time() / 1e6);
+
+    for (guint k = 0; k < locks->len; k ++) {
+        struct lock_stats_s *ls = &g_array_index(locks, struct lock_stats_s, k);
+
+        g_string_append_printf(s, "%s: %" PRIu64 " acquisitions, %" PRIu64 " contended "
+                               "(%.1f%%)\n", ls->name, ls->acquisitions, ls->contended,
+                               ls->acquisitions ? 100.0 * ls->contended / ls->acquisitions
+                                                : 0.0);
+        append_histogram(s, "wait", &ls->wait);
+        append_histogram(s, "hold", &ls->hold);
+
+        qsort(ls->sites, LOCK_STATS_SITES, sizeof(ls->sites[0]), compare_sites_by_wait);
+        for (int j = 0; j < TOP_SITES && ls->sites[j].site; j ++) {
+            const struct lock_site_stats_s *site = &ls->sites[j];
+            gchar *s_site = object_tracker_describe_site(site->site);
+            g_string_append_printf(s, "    %-40s %8" PRIu64 " acquisitions, %8" PRIu64
+                                   " contended, waited %.3f s\n", s_site, site->acquisitions,
+                                   site->contended, site->wait_us / 1e6);
+            g_free(s_site);
+        }
+        if (ls->other_sites > 0) {
+            g_string_append_printf(s, "    (%" PRIu64 " acquisitions from other sites)\n",
+                                   ls->other_sites);
+        }
+    }
+
+    g_array_free(locks, TRUE);
+    return g_string_free(s, FALSE);
+}
+
+int
+lock_stats_write_report(void)
+{
+    gchar *report = lock_stats_get_report();
+    int retval = diag_write_report("lock_stats", report);
+
+    g_free(report);
+    return retval;
+}
+
+void
+lock_stats_reset(void)
+{
+    pthread_mutex_lock(&lock);
+    for (int k = 0; k < MAX_LOCKS; k ++) {
+        const char *name = tracked[k].stats.name;
+        memset(&tracked[k].stats, 0, sizeof(tracked[k].stats));
+        tracked[k].stats.name = name;
+    }
+    g_atomic_int_set(&next_report_s, 0);
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "diag_report.h"
+#include <glib.h>
+#include <pthread.h>
+#include <stdint.h>
+
+/// Contention statistics for global mutexes. Registered locks should be taken with
+/// lock_stats_lock() and released with lock_stats_unlock(). Unless config.lock_stats_interval
+/// is set, those just call pthread functions. Otherwise acquisition counts, histograms of wait
+/// and hold times, and call sites which waited the most are collected, and report is written
+/// to "lock_stats.<pid>.txt" in the plugin data directory that often, by diagnostics thread.
+
+#define LOCK_STATS_SITES        64
+
+struct lock_site_stats_s {
+    const void     *site;
+    uint64_t        acquisitions;
+    uint64_t        contended;
+    int64_t         wait_us;
+};
+
+struct lock_stats_s {
+    const char                 *name;
+    uint64_t                    acquisitions;
+    uint64_t                    contended;      ///< acquisitions which had to wait
+    struct diag_histogram_s     wait;
+    struct diag_histogram_s     hold;
+    struct lock_site_stats_s    sites[LOCK_STATS_SITES];
+    uint64_t                    other_sites;    ///< acquisitions from sites which didn't fit
+};
+
+/// starts collecting statistics for |mutex|
+void
+lock_stats_register(const char *name, pthread_mutex_t *mutex);
+
+void
+lock_stats_unregister(pthread_mutex_t *mutex);
+
+int
+lock_stats_lock(pthread_mutex_t *mutex);
+
+int
+lock_stats_unlock(pthread_mutex_t *mutex);
+
+/// copies statistics of |mutex|. Returns 0 on success, -1 if it's not registered
+int
+lock_stats_get(pthread_mutex_t *mutex, struct lock_stats_s *stats);
+
+/// returns human-readable report. Caller should free it with g_free()
+gchar *
+lock_stats_get_report(void);
+
+/// writes report to the file in plugin data directory. Returns 0 on success
+int
+lock_stats_write_report(void);
+
+/// clears collected statistics
+void
+lock_stats_reset(void);
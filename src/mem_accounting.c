@@ -0,0 +1,279 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+#include "diag_report.h"
+#include "mem_accounting.h"
+#include "reverse_constant.h"
+#include "trace_core.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+struct instance_usage_s {
+    PP_Instance         instance;
+    int                 destroyed;
+    struct mem_usage_s  usage;
+};
+
+static pthread_mutex_t      lock = PTHREAD_MUTEX_INITIALIZER;
+static GHashTable          *instances_ht;      // PP_Instance -> struct instance_usage_s
+static struct mem_usage_s   total;
+static gint64               next_report = 0;
+static const char          *kind_names[MEM_KIND_COUNT] = { "heap", "pixmaps", "temp files" };
+
+
+/// should be called with lock held
+static
+GHashTable *
+get_instances_ht(void)
+{
+    if (!instances_ht)
+        instances_ht = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+
+    return instances_ht;
+}
+
+static
+void
+usage_change(struct mem_usage_s *usage, int type, enum mem_kind_e kind, int64_t delta)
+{
+    usage->current[type][kind] += delta;
+    usage->peak[type][kind] = MAX(usage->peak[type][kind], usage->current[type][kind]);
+    usage->total_current[kind] += delta;
+    usage->total_peak[kind] = MAX(usage->total_peak[kind], usage->total_current[kind]);
+}
+
+static
+int
+usage_is_empty(const struct mem_usage_s *usage)
+{
+    for (int kind = 0; kind < MEM_KIND_COUNT; kind ++) {
+        if (usage->total_current[kind] != 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+void
+mem_accounting_change(PP_Instance instance, int type, enum mem_kind_e kind, int64_t delta)
+{
+    if (delta == 0)
+        return;
+
+    if (type < 0 || type >= MEM_TYPE_COUNT || kind >= MEM_KIND_COUNT) {
+        trace_error("%s, bad type %d or kind %d\n", __func__, type, kind);
+        return;
+    }
+
+    const gint64 interval = (gint64)config.memory_report_interval * G_USEC_PER_SEC;
+    int report_due = 0;
+
+    pthread_mutex_lock(&lock);
+    GHashTable *ht = get_instances_ht();
+    struct instance_usage_s *iu = g_hash_table_lookup(ht, GINT_TO_POINTER(instance));
+    if (!iu) {
+        iu = g_new0(struct instance_usage_s, 1);
+        iu->instance = instance;
+        g_hash_table_insert(ht, GINT_TO_POINTER(instance), iu);
+    }
+
+    usage_change(&iu->usage, type, kind, delta);
+    usage_change(&total, type, kind, delta);
+
+    if (iu->destroyed && usage_is_empty(&iu->usage))
+        g_hash_table_remove(ht, GINT_TO_POINTER(instance));
+
+    if (interval > 0) {
+        const gint64 now = g_get_monotonic_time();
+        if (next_report == 0) {
+            next_report = now + interval;
+        } else if (now >= next_report) {
+            next_report = now + interval;
+            report_due = 1;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (report_due)
+        mem_accounting_write_report();
+}
+
+int64_t
+mem_accounting_pixmap_size(int32_t width, int32_t height, int32_t depth)
+{
+    // X servers store 24- and 32-bit pixmaps with 4 bytes per pixel
+    const int64_t bpp = depth > 16 ? 4 : depth > 8 ? 2 : 1;
+    return (int64_t)MAX(width, 0) * MAX(height, 0) * bpp;
+}
+
+int
+mem_accounting_get_usage(PP_Instance instance, struct mem_usage_s *usage)
+{
+    pthread_mutex_lock(&lock);
+    struct instance_usage_s *iu = g_hash_table_lookup(get_instances_ht(),
+                                                      GINT_TO_POINTER(instance));
+    if (iu)
+        *usage = iu->usage;
+    pthread_mutex_unlock(&lock);
+
+    return iu ? 0 : -1;
+}
+
+void
+mem_accounting_get_total_usage(struct mem_usage_s *usage)
+{
+    pthread_mutex_lock(&lock);
+    *usage = total;
+    pthread_mutex_unlock(&lock);
+}
+
+void
+mem_accounting_instance_destroyed(PP_Instance instance)
+{
+    pthread_mutex_lock(&lock);
+    GHashTable *ht = get_instances_ht();
+    struct instance_usage_s *iu = g_hash_table_lookup(ht, GINT_TO_POINTER(instance));
+    if (iu) {
+        iu->destroyed = 1;
+        if (usage_is_empty(&iu->usage))
+            g_hash_table_remove(ht, GINT_TO_POINTER(instance));
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (config.memory_report_interval > 0)
+        mem_accounting_write_report();
+}
+
+static
+void
+append_usage(GString *s, const struct mem_usage_s *usage)
+{
+    for (int kind = 0; kind < MEM_KIND_COUNT; kind ++) {
+        g_string_append_printf(s, "  %s %" PRId64 " (peak %" PRId64 ")", kind_names[kind],
+                               usage->total_current[kind], usage->total_peak[kind]);
+    }
+    g_string_append(s, "\n");
+
+    for (int type = 0; type < MEM_TYPE_COUNT; type ++) {
+        int used = 0;
+        for (int kind = 0; kind < MEM_KIND_COUNT; kind ++)
+            used = used || usage->peak[type][kind] > 0;
+
+        if (!used)
+            continue;
+
+        g_string_append_printf(s, "    %-30s",
+                               type == MEM_TYPE_VAR ? "vars" : reverse_resource_type(type));
+        for (int kind = 0; kind < MEM_KIND_COUNT; kind ++) {
+            if (usage->peak[type][kind] > 0) {
+                g_string_append_printf(s, "  %s %" PRId64 " (peak %" PRId64 ")",
+                                       kind_names[kind], usage->current[type][kind],
+                                       usage->peak[type][kind]);
+            }
+        }
+        g_string_append(s, "\n");
+    }
+}
+
+static
+gint
+compare_instances(gconstpointer a, gconstpointer b)
+{
+    const struct instance_usage_s *ia = a;
+    const struct instance_usage_s *ib = b;
+
+    return ia->instance < ib->instance ? -1 : (ia->instance > ib->instance);
+}
+
+gchar *
+mem_accounting_get_report(void)
+{
+    GArray *instances = g_array_new(FALSE, FALSE, sizeof(struct instance_usage_s));
+    struct mem_usage_s total_copy;
+    GHashTableIter iter;
+    gpointer value;
+
+    // usage is copied, so formatting doesn't block accounting
+    pthread_mutex_lock(&lock);
+    g_hash_table_iter_init(&iter, get_instances_ht());
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+        g_array_append_vals(instances, value, 1);
+    total_copy = total;
+    pthread_mutex_unlock(&lock);
+
+    g_array_sort(instances, compare_instances);
+
+    GString *s = g_string_new(NULL);
+    g_string_append_printf(s, "memory usage, bytes, pid %d, %.1f s\n", (int)getpid(),
+                           g_get_monotonic_time() / 1e6);
+    g_string_append(s, "total:");
+    append_usage(s, &total_copy);
+
+    for (guint k = 0; k < instances->len; k ++) {
+        const struct instance_usage_s *iu = &g_array_index(instances, struct instance_usage_s, k);
+
+        if (iu->instance == 0)
+            g_string_append(s, "unattributed:");
+        else
+            g_string_append_printf(s, "instance %d%s:", iu->instance,
+                                   iu->destroyed ? " (destroyed, leftovers)" : "");
+        append_usage(s, &iu->usage);
+    }
+
+    g_array_free(instances, TRUE);
+    return g_string_free(s, FALSE);
+}
+
+int
+mem_accounting_write_report(void)
+{
+    gchar *report = mem_accounting_get_report();
+    int retval = diag_write_report("memory_usage", report);
+
+    g_free(report);
+    return retval;
+}
+
+void
+mem_accounting_reset(void)
+{
+    pthread_mutex_lock(&lock);
+    g_hash_table_remove_all(get_instances_ht());
+    memset(&total, 0, sizeof(total));
+    next_report = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+static
+void
+__attribute__((destructor))
+destructor_mem_accounting(void)
+{
+    if (instances_ht)
+        g_hash_table_unref(instances_ht);
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "pp_resource.h"
+#include <glib.h>
+#include <ppapi/c/pp_instance.h>
+#include <stdint.h>
+
+/// Accounts memory held on behalf of instances: wrapper's own heap buffers, X server pixmaps
+/// (estimated by their size), and temporary files. Usage is kept per instance and per resource
+/// type along with high-water marks. If config.memory_report_interval is set, report is
+/// written to "memory_usage.<pid>.txt" in the plugin data directory that often, and on each
+/// instance destruction.
+
+enum mem_kind_e {
+    MEM_KIND_HEAP,
+    MEM_KIND_X_PIXMAP,
+    MEM_KIND_TEMP_FILE,
+    MEM_KIND_COUNT,
+};
+
+/// pseudo resource type for var storage. Vars don't belong to instances, so they are
+/// accounted with instance 0
+#define MEM_TYPE_VAR        PP_RESOURCE_TYPES_COUNT
+#define MEM_TYPE_COUNT      (PP_RESOURCE_TYPES_COUNT + 1)
+
+struct mem_usage_s {
+    int64_t     current[MEM_TYPE_COUNT][MEM_KIND_COUNT];
+    int64_t     peak[MEM_TYPE_COUNT][MEM_KIND_COUNT];
+    int64_t     total_current[MEM_KIND_COUNT];
+    int64_t     total_peak[MEM_KIND_COUNT];     ///< high-water mark of the sum, not sum of peaks
+};
+
+/// adds |delta| bytes (negative ones release) to usage of |instance|
+void
+mem_accounting_change(PP_Instance instance, int type, enum mem_kind_e kind, int64_t delta);
+
+/// estimated size of X server pixmap
+int64_t
+mem_accounting_pixmap_size(int32_t width, int32_t height, int32_t depth);
+
+/// gets usage of a single instance. Returns 0 on success, -1 if nothing was ever accounted for
+/// that instance
+int
+mem_accounting_get_usage(PP_Instance instance, struct mem_usage_s *usage);
+
+/// gets usage summed over all instances, with its own high-water marks
+void
+mem_accounting_get_total_usage(struct mem_usage_s *usage);
+
+/// marks instance destroyed. Its entry is dropped once everything it held is released;
+/// until then it's reported as leftover
+void
+mem_accounting_instance_destroyed(PP_Instance instance);
+
+/// returns human-readable report. Caller should free it with g_free()
+gchar *
+mem_accounting_get_report(void);
+
+/// writes report to the file in plugin data directory. Returns 0 on success
+int
+mem_accounting_write_report(void);
+
+/// forgets everything
+void
+mem_accounting_reset(void);
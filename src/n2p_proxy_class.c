@@ -28,9 +28,11 @@
 
 #include "n2p_proxy_class.h"
 #include "ppb_core.h"
+#include "ppb_memory.h"
 #include "ppb_message_loop.h"
 #include "ppb_var.h"
 #include "tables.h"
+#include "thread_local.h"
 #include "trace_core.h"
 #include "trace_helpers.h"
 #include "utils.h"
@@ -43,10 +45,104 @@
 #include <ppapi/c/pp_errors.h>
 #include <ppapi/c/pp_resource.h>
 #include <ppapi/c/pp_var.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
+/// property names and primitive values of an object, taken in a single browser thread call.
+/// Snapshot is valid only during the plugin call it was taken in, and only for the thread
+/// which took it. Any mutation invalidates all snapshots.
+struct n2p_snapshot_s {
+    void                       *object;
+    struct thread_local_block  *owner;
+    uint32_t                    task_serial;
+    uint32_t                    count;
+    struct PP_Var              *names;
+    struct PP_Var              *values;
+    uint8_t                    *value_cached;   ///< objects are not kept in a snapshot
+    GHashTable                 *index;          ///< name -> position + 1
+};
+
+static GHashTable      *snapshot_ht = NULL;     ///< object -> struct n2p_snapshot_s
+static pthread_mutex_t  snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static
+void
+n2p_snapshot_free(void *p)
+{
+    struct n2p_snapshot_s *s = p;
+
+    for (uint32_t k = 0; k < s->count; k ++) {
+        ppb_var_release(s->names[k]);
+        if (s->value_cached[k])
+            ppb_var_release(s->values[k]);
+    }
+
+    if (s->index)
+        g_hash_table_destroy(s->index);
+    free(s->names);
+    free(s->values);
+    free(s->value_cached);
+    g_slice_free1(sizeof(*s), s);
+}
+
+static
+gboolean
+n2p_snapshot_is_stale(gpointer key, gpointer value, gpointer user_data)
+{
+    struct n2p_snapshot_s *s = value;
+    struct thread_local_block *tl = user_data;
+
+    return s->owner == tl && s->task_serial != tl->task_serial;
+}
+
+// caller must hold snapshot_lock
+static
+struct n2p_snapshot_s *
+n2p_snapshot_lookup(void *object)
+{
+    if (!snapshot_ht)
+        return NULL;
+
+    struct n2p_snapshot_s *s = g_hash_table_lookup(snapshot_ht, object);
+    struct thread_local_block *tl = get_thread_local();
+
+    if (!s || s->owner != tl || s->task_serial != tl->task_serial)
+        return NULL;
+
+    return s;
+}
+
+// caller must hold snapshot_lock
+static
+int
+n2p_snapshot_find(struct n2p_snapshot_s *s, struct PP_Var name)
+{
+    const char *s_name = ppb_var_var_to_utf8(name, NULL);
+    return GPOINTER_TO_SIZE(g_hash_table_lookup(s->index, s_name)) - 1;
+}
+
+static
+void
+n2p_snapshot_invalidate_all(void)
+{
+    pthread_mutex_lock(&snapshot_lock);
+    if (snapshot_ht)
+        g_hash_table_remove_all(snapshot_ht);
+    pthread_mutex_unlock(&snapshot_lock);
+}
+
+static
+void
+n2p_snapshot_invalidate(void *object)
+{
+    pthread_mutex_lock(&snapshot_lock);
+    if (snapshot_ht)
+        g_hash_table_remove(snapshot_ht, object);
+    pthread_mutex_unlock(&snapshot_lock);
+}
+
 struct has_property_param_s {
     struct PP_Var       name;
     struct PP_Var      *exception;
@@ -90,6 +186,14 @@ n2p_has_property(void *object, struct PP_Var name, struct PP_Var *exception)
         return false;
     }
 
+    pthread_mutex_lock(&snapshot_lock);
+    struct n2p_snapshot_s *snapshot = n2p_snapshot_lookup(object);
+    if (snapshot && n2p_snapshot_find(snapshot, name) >= 0) {
+        pthread_mutex_unlock(&snapshot_lock);
+        return true;
+    }
+    pthread_mutex_unlock(&snapshot_lock);
+
     struct has_property_param_s *p = g_slice_alloc(sizeof(*p));
     p->object =     object;
     p->name =       name;
@@ -166,6 +270,18 @@ n2p_get_property(void *object, struct PP_Var name, struct PP_Var *exception)
         return PP_MakeUndefined();
     }
 
+    pthread_mutex_lock(&snapshot_lock);
+    struct n2p_snapshot_s *snapshot = n2p_snapshot_lookup(object);
+    if (snapshot) {
+        int idx = n2p_snapshot_find(snapshot, name);
+        if (idx >= 0 && snapshot->value_cached[idx]) {
+            struct PP_Var value = ppb_var_add_ref2(snapshot->values[idx]);
+            pthread_mutex_unlock(&snapshot_lock);
+            return value;
+        }
+    }
+    pthread_mutex_unlock(&snapshot_lock);
+
     struct get_property_param_s *p = g_slice_alloc(sizeof(*p));
     p->object =     object;
     p->name =       name;
@@ -183,23 +299,268 @@ n2p_get_property(void *object, struct PP_Var name, struct PP_Var *exception)
     return result;
 }
 
+struct get_all_property_names_param_s {
+    void                   *object;
+    struct n2p_snapshot_s  *snapshot;
+    PP_Resource             m_loop;
+    int                     depth;
+};
+
+static
+void
+n2p_get_all_property_names_ptac(void *param)
+{
+    struct get_all_property_names_param_s *p = param;
+    NPP npp = tables_get_npobj_npp_mapping(p->object);
+    NPIdentifier *ids = NULL;
+    uint32_t count = 0;
+
+    p->snapshot = NULL;
+    if (!npp || !npn.enumerate(npp, p->object, &ids, &count))
+        goto done;
+
+    // take names along with values, so subsequent GetProperty calls need no thread switches
+    struct n2p_snapshot_s *s = g_slice_alloc0(sizeof(*s));
+    s->object =         p->object;
+    s->count =          count;
+    s->names =          calloc(count, sizeof(struct PP_Var));
+    s->values =         calloc(count, sizeof(struct PP_Var));
+    s->value_cached =   calloc(count, sizeof(uint8_t));
+
+    for (uint32_t k = 0; k < count; k ++) {
+        if (npn.identifierisstring(ids[k])) {
+            NPUTF8 *s_name = npn.utf8fromidentifier(ids[k]);
+            s->names[k] = ppb_var_var_from_utf8_z(s_name);
+            npn.memfree(s_name);
+        } else {
+            char *s_name = g_strdup_printf("%d", npn.intfromidentifier(ids[k]));
+            s->names[k] = ppb_var_var_from_utf8_z(s_name);
+            g_free(s_name);
+        }
+
+        NPVariant np_value;
+        if (npn.getproperty(npp, p->object, ids[k], &np_value)) {
+            if (np_value.type != NPVariantType_Object) {
+                s->values[k] = np_variant_to_pp_var(np_value);
+                s->value_cached[k] = 1;
+            }
+            npn.releasevariantvalue(&np_value);
+        }
+    }
+
+    npn.memfree(ids);
+    p->snapshot = s;
+
+done:
+    ppb_message_loop_post_quit_depth(p->m_loop, PP_FALSE, p->depth);
+}
+
+static
+void
+n2p_get_all_property_names_comt(void *user_data, int32_t result)
+{
+    struct get_all_property_names_param_s *p = user_data;
+    ppb_core_call_on_browser_thread(0, n2p_get_all_property_names_ptac, p);
+}
+
+// caller must hold snapshot_lock
+static
+void
+n2p_snapshot_copy_names(struct n2p_snapshot_s *s, uint32_t *property_count,
+                        struct PP_Var **properties)
+{
+    if (s->count == 0)
+        return;
+
+    *properties = ppb_memory_mem_alloc(s->count * sizeof(struct PP_Var));
+    for (uint32_t k = 0; k < s->count; k ++)
+        (*properties)[k] = ppb_var_add_ref2(s->names[k]);
+    *property_count = s->count;
+}
+
 static
 void
 n2p_get_all_property_names(void *object, uint32_t *property_count, struct PP_Var **properties,
                            struct PP_Var *exception)
 {
+    *property_count = 0;
+    *properties = NULL;
+
+    // snapshot can be invalidated by any other thread as soon as lock is released
+    pthread_mutex_lock(&snapshot_lock);
+    struct n2p_snapshot_s *snapshot = n2p_snapshot_lookup(object);
+    if (snapshot) {
+        n2p_snapshot_copy_names(snapshot, property_count, properties);
+        pthread_mutex_unlock(&snapshot_lock);
+        return;
+    }
+    pthread_mutex_unlock(&snapshot_lock);
+
+    struct get_all_property_names_param_s *p = g_slice_alloc(sizeof(*p));
+    p->object = object;
+    p->m_loop = ppb_message_loop_get_current();
+    p->depth =  ppb_message_loop_get_depth(p->m_loop) + 1;
+
+    ppb_message_loop_post_work_with_result(p->m_loop,
+                                           PP_MakeCCB(n2p_get_all_property_names_comt, p), 0,
+                                           PP_OK, p->depth, __func__);
+    ppb_message_loop_run_nested(p->m_loop);
+
+    struct n2p_snapshot_s *fresh = p->snapshot;
+    g_slice_free1(sizeof(*p), p);
+
+    if (!fresh) {
+        // TODO: fill exception
+        trace_error("%s, NPN_Enumerate failed (or there were no npp)\n", __func__);
+        return;
+    }
+
+    struct thread_local_block *tl = get_thread_local();
+    fresh->owner = tl;
+    fresh->task_serial = tl->task_serial;
+    fresh->index = g_hash_table_new(g_str_hash, g_str_equal);
+    for (uint32_t k = 0; k < fresh->count; k ++) {
+        const char *s_name = ppb_var_var_to_utf8(fresh->names[k], NULL);
+        g_hash_table_insert(fresh->index, (void *)s_name, GSIZE_TO_POINTER(k + 1));
+    }
+
+    pthread_mutex_lock(&snapshot_lock);
+    if (!snapshot_ht) {
+        snapshot_ht = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                            n2p_snapshot_free);
+    }
+    g_hash_table_foreach_remove(snapshot_ht, n2p_snapshot_is_stale, tl);
+
+    // nested loop could have run a call which took a snapshot of the same object already
+    snapshot = n2p_snapshot_lookup(object);
+    if (snapshot) {
+        n2p_snapshot_free(fresh);
+    } else {
+        g_hash_table_insert(snapshot_ht, object, fresh);
+        snapshot = fresh;
+    }
+
+    n2p_snapshot_copy_names(snapshot, property_count, properties);
+    pthread_mutex_unlock(&snapshot_lock);
+}
+
+struct set_property_param_s {
+    void               *object;
+    struct PP_Var       name;
+    struct PP_Var       value;
+    struct PP_Var      *exception;
+    PP_Resource         m_loop;
+    int                 depth;
+};
+
+static
+void
+n2p_set_property_ptac(void *param)
+{
+    struct set_property_param_s *p = param;
+    const char *s_name = ppb_var_var_to_utf8(p->name, NULL);
+    NPIdentifier identifier = npn.getstringidentifier(s_name);
+    NPP npp = tables_get_npobj_npp_mapping(p->object);
+
+    if (npp) {
+        NPVariant np_value = pp_var_to_np_variant(p->value);
+        npn.setproperty(npp, p->object, identifier, &np_value);
+        npn.releasevariantvalue(&np_value);
+    }
+
+    ppb_message_loop_post_quit_depth(p->m_loop, PP_FALSE, p->depth);
+}
+
+static
+void
+n2p_set_property_comt(void *user_data, int32_t result)
+{
+    struct set_property_param_s *p = user_data;
+    ppb_core_call_on_browser_thread(0, n2p_set_property_ptac, p);
 }
 
 static
 void
 n2p_set_property(void *object, struct PP_Var name, struct PP_Var value, struct PP_Var *exception)
 {
+    if (name.type != PP_VARTYPE_STRING) {
+        trace_error("%s, name is not a string\n", __func__);
+        // TODO: fill exception
+        return;
+    }
+
+    n2p_snapshot_invalidate_all();
+
+    struct set_property_param_s *p = g_slice_alloc(sizeof(*p));
+    p->object =     object;
+    p->name =       name;
+    p->value =      value;
+    p->exception =  exception;
+    p->m_loop =     ppb_message_loop_get_current();
+    p->depth =      ppb_message_loop_get_depth(p->m_loop) + 1;
+
+    ppb_message_loop_post_work_with_result(p->m_loop, PP_MakeCCB(n2p_set_property_comt, p), 0,
+                                           PP_OK, p->depth, __func__);
+    ppb_message_loop_run_nested(p->m_loop);
+
+    g_slice_free1(sizeof(*p), p);
+}
+
+struct remove_property_param_s {
+    void               *object;
+    struct PP_Var       name;
+    struct PP_Var      *exception;
+    PP_Resource         m_loop;
+    int                 depth;
+};
+
+static
+void
+n2p_remove_property_ptac(void *param)
+{
+    struct remove_property_param_s *p = param;
+    const char *s_name = ppb_var_var_to_utf8(p->name, NULL);
+    NPIdentifier identifier = npn.getstringidentifier(s_name);
+    NPP npp = tables_get_npobj_npp_mapping(p->object);
+
+    if (npp)
+        npn.removeproperty(npp, p->object, identifier);
+
+    ppb_message_loop_post_quit_depth(p->m_loop, PP_FALSE, p->depth);
+}
+
+static
+void
+n2p_remove_property_comt(void *user_data, int32_t result)
+{
+    struct remove_property_param_s *p = user_data;
+    ppb_core_call_on_browser_thread(0, n2p_remove_property_ptac, p);
 }
 
 static
 void
 n2p_remove_property(void *object, struct PP_Var name, struct PP_Var *exception)
 {
+    if (name.type != PP_VARTYPE_STRING) {
+        trace_error("%s, name is not a string\n", __func__);
+        // TODO: fill exception
+        return;
+    }
+
+    n2p_snapshot_invalidate_all();
+
+    struct remove_property_param_s *p = g_slice_alloc(sizeof(*p));
+    p->object =     object;
+    p->name =       name;
+    p->exception =  exception;
+    p->m_loop =     ppb_message_loop_get_current();
+    p->depth =      ppb_message_loop_get_depth(p->m_loop) + 1;
+
+    ppb_message_loop_post_work_with_result(p->m_loop, PP_MakeCCB(n2p_remove_property_comt, p), 0,
+                                           PP_OK, p->depth, __func__);
+    ppb_message_loop_run_nested(p->m_loop);
+
+    g_slice_free1(sizeof(*p), p);
 }
 
 struct call_param_s {
@@ -222,7 +583,8 @@ n2p_call_ptac(void *param)
     NPIdentifier np_method_name = npn.getstringidentifier(s_method_name);
     NPP npp = tables_get_npobj_npp_mapping(p->object);
 
-    NPVariant *np_args = malloc(p->argc * sizeof(NPVariant));
+    // NPN calls may reenter, but always free their own arguments before returning
+    NPVariant *np_args = thread_local_scratch_alloc(p->argc * sizeof(NPVariant));
     for (uint32_t k = 0; k < p->argc; k ++)
         np_args[k] = pp_var_to_np_variant(p->argv[k]);
 
@@ -232,7 +594,7 @@ n2p_call_ptac(void *param)
 
     for (uint32_t k = 0; k < p->argc; k ++)
         npn.releasevariantvalue(&np_args[k]);
-    free(np_args);
+    thread_local_scratch_free(np_args);
 
     if (res) {
         struct PP_Var var = np_variant_to_pp_var(np_result);
@@ -270,6 +632,9 @@ n2p_call(void *object, struct PP_Var method_name, uint32_t argc, struct PP_Var *
         return PP_MakeUndefined();
     }
 
+    // JavaScript code can change anything
+    n2p_snapshot_invalidate_all();
+
     struct call_param_s *p = g_slice_alloc(sizeof(*p));
     p->object =         object;
     p->method_name =    method_name;
@@ -306,7 +671,7 @@ n2p_construct_ptac(void *param)
     struct construct_param_s *p = param;
     NPP npp = tables_get_npobj_npp_mapping(p->object);
 
-    NPVariant *np_args = malloc(p->argc * sizeof(NPVariant));
+    NPVariant *np_args = thread_local_scratch_alloc(p->argc * sizeof(NPVariant));
     for (uint32_t k = 0; k < p->argc; k ++)
         np_args[k] = pp_var_to_np_variant(p->argv[k]);
 
@@ -315,7 +680,7 @@ n2p_construct_ptac(void *param)
 
     for (uint32_t k = 0; k < p->argc; k ++)
         npn.releasevariantvalue(&np_args[k]);
-    free(np_args);
+    thread_local_scratch_free(np_args);
 
     if (res) {
         struct PP_Var var = np_variant_to_pp_var(np_result);
@@ -345,6 +710,8 @@ static
 struct PP_Var
 n2p_construct(void *object, uint32_t argc, struct PP_Var *argv, struct PP_Var *exception)
 {
+    n2p_snapshot_invalidate_all();
+
     struct construct_param_s *p = g_slice_alloc(sizeof(*p));
     p->object =     object;
     p->argc =       argc;
@@ -403,6 +770,8 @@ n2p_deallocate(void *object)
         return;
     }
 
+    n2p_snapshot_invalidate(object);
+
     struct deallocate_param_s *p = g_slice_alloc(sizeof(*p));
     p->object = object;
     p->m_loop = ppb_message_loop_get_current();
@@ -452,7 +821,7 @@ void
 trace_n2p_get_all_property_names(void *object, uint32_t *property_count, struct PP_Var **properties,
                                  struct PP_Var *exception)
 {
-    trace_info("[CLS] {zilch} %s object=%p\n", __func__+6, object);
+    trace_info("[CLS] {full} %s object=%p\n", __func__+6, object);
     n2p_get_all_property_names(object, property_count, properties, exception);
 }
 
@@ -463,7 +832,7 @@ trace_n2p_set_property(void *object, struct PP_Var name, struct PP_Var value,
 {
     char *s_name = trace_var_as_string(name);
     char *s_value = trace_var_as_string(value);
-    trace_info("[CLS] {zilch} %s object=%p, name=%s, value=%s\n", __func__+6, object,
+    trace_info("[CLS] {full} %s object=%p, name=%s, value=%s\n", __func__+6, object,
                s_name, s_value);
     g_free(s_name);
     g_free(s_value);
@@ -475,7 +844,7 @@ void
 trace_n2p_remove_property(void *object, struct PP_Var name, struct PP_Var *exception)
 {
     char *s_name = trace_var_as_string(name);
-    trace_info("[CLS] {zilch} %s object=%p, name=%s\n", __func__+6, object, s_name);
+    trace_info("[CLS] {full} %s object=%p, name=%s\n", __func__+6, object, s_name);
     g_free(s_name);
     n2p_remove_property(object, name, exception);
 }
@@ -513,9 +882,9 @@ const struct PPP_Class_Deprecated n2p_proxy_class = {
     .HasProperty =          TWRAPF(n2p_has_property),
     .HasMethod =            TWRAPZ(n2p_has_method),
     .GetProperty =          TWRAPF(n2p_get_property),
-    .GetAllPropertyNames =  TWRAPZ(n2p_get_all_property_names),
-    .SetProperty =          TWRAPZ(n2p_set_property),
-    .RemoveProperty =       TWRAPZ(n2p_remove_property),
+    .GetAllPropertyNames =  TWRAPF(n2p_get_all_property_names),
+    .SetProperty =          TWRAPF(n2p_set_property),
+    .RemoveProperty =       TWRAPF(n2p_remove_property),
     .Call =                 TWRAPF(n2p_call),
     .Construct =            TWRAPF(n2p_construct),
     .Deallocate =           TWRAPF(n2p_deallocate),
@@ -28,7 +28,147 @@
 #include <npapi/npapi.h>
 #include <stddef.h>
 
-static GMainContext *g_main_context_of_main_thread;
+// Calls are pushed to a lock-free stack by any thread, and are drained by a single GSource
+// attached to the main context of the browser thread. Dispatch takes the whole stack at once,
+// restores call order, and runs calls until time budget is exhausted. Remaining ones are left
+// for next main loop iteration, so a burst of calls doesn't starve browser's own sources.
+// A call may spin a nested main loop (e.g. NPN_Evaluate showing a JavaScript alert), so the
+// source is allowed to recurse. That's safe, as dispatch unlinks each call before running it,
+// and re-reads the pending list afterwards.
+// On shutdown, new calls are refused first. Once producers that got the source before that
+// are done pushing, calls made so far are run, and only then the source is destroyed.
+
+/// how long a single dispatch may run calls, in microseconds
+#define DISPATCH_BUDGET_US      (5 * 1000)
+
+struct async_call_s {
+    void                  (*func)(void *);
+    void                   *user_data;
+    struct async_call_s    *next;
+};
+
+struct async_source_s {
+    GSource                 source;
+    struct async_call_s    *incoming;       ///< pushed by producers, newest first
+    struct async_call_s    *pending;        ///< taken by dispatch, oldest first
+    struct async_call_s    *pending_tail;
+};
+
+static GMainContext            *g_main_context_of_main_thread;
+static struct async_source_s   *async_source;       ///< accessed atomically
+static volatile gint            active_producers = 0;
+
+static
+gboolean
+async_source_has_calls(struct async_source_s *as)
+{
+    return as->pending != NULL || g_atomic_pointer_get(&as->incoming) != NULL;
+}
+
+static
+gboolean
+async_source_prepare(GSource *source, gint *timeout)
+{
+    *timeout = -1;
+    return async_source_has_calls((struct async_source_s *)source);
+}
+
+static
+gboolean
+async_source_check(GSource *source)
+{
+    return async_source_has_calls((struct async_source_s *)source);
+}
+
+static
+void
+async_source_take_incoming(struct async_source_s *as)
+{
+    struct async_call_s *list;
+
+    do {
+        list = g_atomic_pointer_get(&as->incoming);
+    } while (!g_atomic_pointer_compare_and_exchange(&as->incoming, list, NULL));
+
+    if (!list)
+        return;
+
+    // reverse, to get calls in order they were made
+    struct async_call_s *tail = list;
+    struct async_call_s *head = NULL;
+    while (list) {
+        struct async_call_s *next = list->next;
+        list->next = head;
+        head = list;
+        list = next;
+    }
+
+    if (as->pending_tail)
+        as->pending_tail->next = head;
+    else
+        as->pending = head;
+    as->pending_tail = tail;
+}
+
+/// runs pending calls until |deadline|, or all of them if it's zero
+static
+void
+async_source_run_pending(struct async_source_s *as, gint64 deadline)
+{
+    while (as->pending) {
+        struct async_call_s *c = as->pending;
+        as->pending = c->next;
+        if (!as->pending)
+            as->pending_tail = NULL;
+
+        c->func(c->user_data);
+        g_slice_free(struct async_call_s, c);
+
+        if (deadline != 0 && g_get_monotonic_time() >= deadline)
+            break;
+    }
+}
+
+static
+gboolean
+async_source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+    struct async_source_s *as = (struct async_source_s *)source;
+
+    async_source_take_incoming(as);
+    async_source_run_pending(as, g_get_monotonic_time() + DISPATCH_BUDGET_US);
+
+    return TRUE;    // source stays attached
+}
+
+static
+void
+async_source_finalize(GSource *source)
+{
+    struct async_source_s *as = (struct async_source_s *)source;
+    int dropped = 0;
+
+    // shutdown runs all calls, so these can only be ones made while it did that. Their
+    // user_data leaks, as only the call knows how to free it
+    async_source_take_incoming(as);
+    while (as->pending) {
+        struct async_call_s *c = as->pending;
+        as->pending = c->next;
+        g_slice_free(struct async_call_s, c);
+        dropped ++;
+    }
+    as->pending_tail = NULL;
+
+    if (dropped > 0)
+        trace_error("%s, %d calls dropped\n", __func__, dropped);
+}
+
+static GSourceFuncs async_source_funcs = {
+    .prepare =  async_source_prepare,
+    .check =    async_source_check,
+    .dispatch = async_source_dispatch,
+    .finalize = async_source_finalize,
+};
 
 int
 np_asynccall_initialize(void)
@@ -37,47 +177,69 @@ np_asynccall_initialize(void)
     if (!g_main_context_of_main_thread)
         return 1;
 
+    if (g_atomic_pointer_get(&async_source))
+        return 0;
+
+    GSource *source = g_source_new(&async_source_funcs, sizeof(struct async_source_s));
+    if (!source) {
+        trace_error("%s, can't create GSource\n", __func__);
+        return 1;
+    }
+
+    g_source_set_priority(source, G_PRIORITY_DEFAULT);
+    g_source_set_can_recurse(source, TRUE);
+    g_source_attach(source, g_main_context_of_main_thread);
+    g_atomic_pointer_set(&async_source, (struct async_source_s *)source);
+
     return 0;
 }
 
-struct np_asynccall_callback_proxy_params {
-    void (*func)(void *);
-    void *user_data;
-};
-
-static gboolean
-np_asynccall_callback_proxy(void *user_data)
+void
+np_asynccall_shutdown(void)
 {
-    struct np_asynccall_callback_proxy_params *p = user_data;
+    struct async_source_s *as = g_atomic_pointer_get(&async_source);
+    if (!as)
+        return;
 
-    p->func(p->user_data);
-    g_slice_free(struct np_asynccall_callback_proxy_params, p);
+    // refuse new calls, then wait for those which got the source before that
+    g_atomic_pointer_set(&async_source, NULL);
+    while (g_atomic_int_get(&active_producers) > 0)
+        g_usleep(100);
 
-    // This is a oneshot operation, source should be removed.
-    return FALSE;
+    // calls may own memory which only they free, so they are run rather than dropped
+    async_source_take_incoming(as);
+    async_source_run_pending(as, 0);
+
+    g_source_destroy(&as->source);
+    g_source_unref(&as->source);
 }
 
 void
 np_asynccall_call(NPP instance, void (*func)(void *), void *user_data)
 {
-    GSource *source = g_idle_source_new();
-    if (!source) {
-        trace_error("%s, can't create GSource\n", __func__);
+    // counted before the source is looked at, so shutdown can't destroy it meanwhile
+    g_atomic_int_inc(&active_producers);
+    struct async_source_s *as = g_atomic_pointer_get(&async_source);
+    if (!as) {
+        g_atomic_int_add(&active_producers, -1);
+        trace_error("%s, not initialized or shut down\n", __func__);
         return;
     }
 
-    struct np_asynccall_callback_proxy_params *p = g_slice_alloc0(sizeof(*p));
-    if (!p) {
-        g_source_unref(source);
-        trace_error("%s, can't allocate memory\n", __func__);
-        return;
-    }
+    struct async_call_s *c = g_slice_alloc(sizeof(*c));
+    c->func = func;
+    c->user_data = user_data;
 
-    p->func = func;
-    p->user_data = user_data;
+    struct async_call_s *head;
+    do {
+        head = g_atomic_pointer_get(&as->incoming);
+        c->next = head;
+    } while (!g_atomic_pointer_compare_and_exchange(&as->incoming, head, c));
 
-    g_source_set_priority(source, G_PRIORITY_DEFAULT);
-    g_source_set_callback(source, np_asynccall_callback_proxy, p, NULL);
-    g_source_attach(source, g_main_context_of_main_thread);
-    g_source_unref(source);
+    // main context needs to be woken up only once per batch, by the first call put into
+    // an empty queue
+    if (!head)
+        g_main_context_wakeup(g_main_context_of_main_thread);
+
+    g_atomic_int_add(&active_producers, -1);
 }
@@ -30,7 +30,8 @@
 //
 // There are versions of Firefox, which have NPN_PluginThreadAsyncCall removed.
 // Since it's required by FreshPlayerPlugin, it needs to be emulated.
-// Current implementation uses the fact the browser runs GLib's mainloop.
+// Current implementation uses the fact the browser runs GLib's mainloop. All calls are
+// dispatched by a single source attached to it.
 
 /// Initialize plugin-thread-async-call emulation.
 ///
@@ -38,6 +39,11 @@
 int
 np_asynccall_initialize(void);
 
+/// Remove dispatch source from the browser main loop. Calls made before are run first, calls
+/// made afterwards are refused. Must be performed from plugin's main thread.
+void
+np_asynccall_shutdown(void);
+
 /// Schedule |func| on the plugin's main thread.
 void
 np_asynccall_call(NPP instance, void (*func)(void *), void *userData);
@@ -176,8 +176,7 @@ load_ppp_module()
     // allocate message loop for browser thread
     if (ppb_message_loop_get_current() == 0) {
         PP_Resource message_loop = ppb_message_loop_create(aux_instance->id);
-        ppb_message_loop_attach_to_current_thread(message_loop);
-        ppb_message_loop_proclaim_this_thread_browser();
+        ppb_message_loop_attach_to_browser_thread(message_loop);
     }
 
     // allocate message loop for plugin thread (main thread)
@@ -472,6 +471,8 @@ NP_Shutdown(void)
 {
     trace_info_f("[NP] %s\n", __func__);
 
+    // pending calls may go into plugin code, they are run while module is still there
+    np_asynccall_shutdown();
     unload_ppp_module();
     tables_close_display();
 
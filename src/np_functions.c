@@ -28,6 +28,7 @@
 #include "gtk_wrapper.h"
 #include "header_parser.h"
 #include "keycodeconvert.h"
+#include "mem_accounting.h"
 #include "pp_interface.h"
 #include "pp_resource.h"
 #include "ppb_core.h"
@@ -98,13 +99,13 @@ set_window_comt(void *user_data, int32_t result)
     struct pp_view_s *v = pp_resource_acquire(view, PP_RESOURCE_VIEW);
 
     if (v) {
-        pthread_mutex_lock(&display.lock);
+        lock_stats_lock(&display.lock);
         v->rect.point.x = 0;
         v->rect.point.y = 0;
         v->rect.size.width = pp_i->width / config.device_scale + 0.5;
         v->rect.size.height = pp_i->height / config.device_scale + 0.5;
         pp_resource_release(view);
-        pthread_mutex_unlock(&display.lock);
+        lock_stats_unlock(&display.lock);
 
         pp_i->ppp_instance_1_1->DidChangeView(pp_i->id, view);
         ppb_core_release_resource(view);
@@ -147,14 +148,14 @@ NPP_SetWindow(NPP npp, NPWindow *window)
                                           pp_i->use_xembed);
     }
 
-    pthread_mutex_lock(&display.lock);
+    lock_stats_lock(&display.lock);
     if (!pp_i->is_fullscreen) {
         if (g_atomic_int_get(&pp_i->instance_loaded)) {
             ppb_core_call_on_main_thread2(0, PP_MakeCCB(set_window_comt, GINT_TO_POINTER(pp_i->id)),
                                           PP_OK, __func__);
         }
     }
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(&display.lock);
 
     return NPERR_NO_ERROR;
 }
@@ -320,8 +321,8 @@ ppp_handle_input_event_helper(struct pp_instance_s *pp_i, PP_Resource event_id)
     struct call_plugin_handle_input_event_param_s *p = g_slice_alloc0(sizeof(*p));
     p->instance = pp_i->id;
     p->event_id = event_id;
-    ppb_core_call_on_main_thread2(0, PP_MakeCCB(call_ppp_handle_input_event_comt, p), PP_OK,
-                                  __func__);
+    ppb_core_call_on_main_thread_with_priority(0, PP_MakeCCB(call_ppp_handle_input_event_comt, p),
+                                               PP_OK, ML_PRIORITY_INPUT, __func__);
 }
 
 static
@@ -461,9 +462,9 @@ NPP_New(NPMIMEType pluginType, NPP npp, uint16_t mode, int16_t argc, char *argn[
     if (!pp_i)
         return NPERR_OUT_OF_MEMORY_ERROR;
 
-    pthread_mutex_lock(&display.lock);
+    lock_stats_lock(&display.lock);
     pp_i->npp = npp;
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(&display.lock);
 
     // windowed mode will only be used if enabled in config file. If used, it will be disabled
     // for instances with wmode equal to either "transparent" or "opaque"
@@ -633,10 +634,11 @@ destroy_instance_comt(void *user_data, int32_t result)
     ppb_flash_fullscreen_set_fullscreen(p->pp_i->id, PP_FALSE);
 
     p->pp_i->ppp_instance_1_1->DidDestroy(p->pp_i->id);
+    ppb_instance_drop_cached_objects(p->pp_i->id);
     tables_remove_pp_instance(p->pp_i->id);
-    pthread_mutex_lock(&display.lock);
+    lock_stats_lock(&display.lock);
     p->pp_i->npp = NULL;
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(&display.lock);
 
     ppb_var_release(p->pp_i->instance_url);
     ppb_var_release(p->pp_i->document_url);
@@ -667,9 +669,9 @@ NPP_Destroy(NPP npp, NPSavedData **save)
         x11et_unregister_window(pp_i->wnd);
 
     if (pp_i->have_prev_cursor) {
-        pthread_mutex_lock(&display.lock);
+        lock_stats_lock(&display.lock);
         XFreeCursor(display.x, pp_i->prev_cursor);
-        pthread_mutex_unlock(&display.lock);
+        lock_stats_unlock(&display.lock);
     }
 
     pp_i->im_context = NULL;
@@ -688,6 +690,8 @@ NPP_Destroy(NPP npp, NPSavedData **save)
     ppb_message_loop_run_nested(p->m_loop);
     g_slice_free1(sizeof(*p), p);
 
+    ppb_graphics2d_release_instance_pool(pp_i);
+    mem_accounting_instance_destroyed(pp_i->id);
     g_object_ref_sink(pp_i->catcher_widget);
 
     npn.releaseobject(pp_i->np_window_obj);
@@ -798,8 +802,11 @@ NPP_NewStream(NPP npp, NPMIMEType type, NPStream *stream, NPBool seekable, uint1
     }
 
 quit:
-    if (ccb.func)
-        ppb_message_loop_post_work_with_result(ccb_ml, ccb, 0, PP_OK, 0, __func__);
+    // URL loader completions share priority class with reads, to keep their order
+    if (ccb.func) {
+        ppb_message_loop_post_work_with_priority(ccb_ml, ccb, 0, PP_OK, 0, ML_PRIORITY_NETWORK,
+                                                 __func__);
+    }
 
     return NPERR_NO_ERROR;
 }
@@ -870,9 +877,9 @@ NPP_DestroyStream(NPP npp, NPStream *stream, NPReason reason)
             ul->read_pos += read_bytes;
 
         pp_resource_release(loader);
-        ppb_message_loop_post_work_with_result(rt->ccb_ml,
-                                               PP_MakeCCB(url_read_task_wrapper_comt, rt), 0,
-                                               read_bytes, 0, __func__);
+        ppb_message_loop_post_work_with_priority(rt->ccb_ml,
+                                                 PP_MakeCCB(url_read_task_wrapper_comt, rt), 0,
+                                                 read_bytes, 0, ML_PRIORITY_NETWORK, __func__);
         ul = pp_resource_acquire(loader, PP_RESOURCE_URL_LOADER);
     }
 
@@ -881,7 +888,9 @@ NPP_DestroyStream(NPP npp, NPStream *stream, NPReason reason)
         PP_Resource                  ccb_ml = ul->stream_to_file_ccb_ml;
 
         pp_resource_release(loader);
-        ppb_message_loop_post_work_with_result(ccb_ml, ccb, 0, PP_OK, 0, __func__);
+        // must come after completions of remaining reads, which are posted in this class
+        ppb_message_loop_post_work_with_priority(ccb_ml, ccb, 0, PP_OK, 0, ML_PRIORITY_NETWORK,
+                                                 __func__);
         return NPERR_NO_ERROR;
     }
 
@@ -927,7 +936,12 @@ NPP_Write(NPP npp, NPStream *stream, int32_t offset, int32_t len, void *buffer)
         return -1;
     }
 
-    RETRY_ON_EINTR(write(ul->fd, buffer, len));
+    const ssize_t written = RETRY_ON_EINTR(write(ul->fd, buffer, len));
+    if (written > 0 && offset + written > ul->fd_size) {
+        mem_accounting_change(ul->instance->id, PP_RESOURCE_URL_LOADER, MEM_KIND_TEMP_FILE,
+                              offset + written - ul->fd_size);
+        ul->fd_size = offset + written;
+    }
 
     if (ul->read_tasks == NULL) {
         pp_resource_release(loader);
@@ -947,9 +961,9 @@ NPP_Write(NPP npp, NPStream *stream, int32_t offset, int32_t len, void *buffer)
 
     if (read_bytes > 0) {
         pp_resource_release(loader);
-        ppb_message_loop_post_work_with_result(rt->ccb_ml,
-                                               PP_MakeCCB(url_read_task_wrapper_comt, rt), 0,
-                                               read_bytes, 0, __func__);
+        ppb_message_loop_post_work_with_priority(rt->ccb_ml,
+                                                 PP_MakeCCB(url_read_task_wrapper_comt, rt), 0,
+                                                 read_bytes, 0, ML_PRIORITY_NETWORK, __func__);
         return len;
     } else {
         // reschedule task
@@ -982,11 +996,11 @@ graphics_ccb_wrapper_comt(void *user_data, int32_t result)
     if (!pp_i)
         return;
 
-    pthread_mutex_lock(&display.lock);
+    lock_stats_lock(&display.lock);
     struct PP_CompletionCallback ccb = pp_i->graphics_ccb;
     pp_i->graphics_ccb = PP_MakeCCB(NULL, NULL);
     pp_i->graphics_in_progress = 0;
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(&display.lock);
 
     if (ccb.func)
         ccb.func(ccb.user_data, result);
@@ -1088,19 +1102,18 @@ handle_graphics_expose_event(NPP npp, void *event)
     Display *dpy = ev->display;
     Drawable drawable = ev->drawable;
     int screen = DefaultScreen(dpy);
-    int retval;
 
     if (pp_i->windowed_mode && pp_i->browser_wnd != None) {
         int wnd_x, wnd_y;
         int browser_x, browser_y;
         Window child;
 
-        pthread_mutex_lock(&display.lock);
+        lock_stats_lock(&display.lock);
         XTranslateCoordinates(dpy, (Window)drawable, DefaultRootWindow(dpy), 0, 0,
                               &wnd_x, &wnd_y, &child);
         XTranslateCoordinates(dpy, pp_i->browser_wnd, DefaultRootWindow(dpy), 0, 0,
                               &browser_x, &browser_y, &child);
-        pthread_mutex_unlock(&display.lock);
+        lock_stats_unlock(&display.lock);
 
         pp_i->offset_x = wnd_x - browser_x;
         pp_i->offset_y = wnd_y - browser_y;
@@ -1109,14 +1122,24 @@ handle_graphics_expose_event(NPP npp, void *event)
     const int32_t source_x = pp_i->windowed_mode ? 0 : pp_i->clip_rect.left - pp_i->x;
     const int32_t source_y = pp_i->windowed_mode ? 0 : pp_i->clip_rect.top - pp_i->y;
 
-    pthread_mutex_lock(&display.lock);
+    // frame resources belong to either 2D or GL connection; the other one, and instance state
+    // under display.lock, stay available while drawing
+    struct x_conn_s *xc = g2d ? &display.g2d : &display.gl;
+    pthread_mutex_t *lock = xc->lock;
+
+    // events for plugin's own windows come with display.x. Drawing goes over the subsystem
+    // connection instead, as display.x is not protected by |lock|
+    if (dpy == display.x)
+        dpy = xc->x;
+
+    lock_stats_lock(lock);
     if (g2d) {
         Visual *visual = DefaultVisual(dpy, screen);
         const int depth = pp_i->is_transparent ? 32 : 24;
         XVisualInfo vi_template = { .depth = depth, };
 
         int nitems = 0;
-        XVisualInfo *vi = XGetVisualInfo(display.x, VisualDepthMask, &vi_template, &nitems);
+        XVisualInfo *vi = XGetVisualInfo(dpy, VisualDepthMask, &vi_template, &nitems);
 
         if (vi && nitems >= 1) {
             visual = vi[0].visual;
@@ -1167,29 +1190,37 @@ handle_graphics_expose_event(NPP npp, void *event)
             XRenderFreePicture(dpy, dst_pict);
             XFlush(dpy);
         } else {
-            // software compositing fallback
-            draw_drawable_on_drawable(dpy, screen, pp_i->is_transparent, g3d->pixmap[1], source_x,
-                                      source_y, drawable, ev->x, ev->y, ev->width, ev->height);
+            if (g3d->readback_valid) {
+                // software compositing fallback, frame was already read back to memory
+                draw_argb32_on_drawable(dpy, screen, pp_i->is_transparent, g3d->readback,
+                                        g3d->width, g3d->height, g3d->width * 4, source_x,
+                                        source_y, drawable, ev->x, ev->y, ev->width, ev->height);
+            } else {
+                // software compositing fallback
+                draw_drawable_on_drawable(dpy, screen, pp_i->is_transparent, g3d->pixmap[1],
+                                          source_x, source_y, drawable, ev->x, ev->y, ev->width,
+                                          ev->height);
+            }
         }
     } else {
-        retval = 0;
-        goto done;
+        lock_stats_unlock(lock);
+        return 0;
     }
 
     pp_resource_release(pp_i->graphics);
+    lock_stats_unlock(lock);
+
+    lock_stats_lock(&display.lock);
     if (pp_i->graphics_in_progress) {
         if (pp_i->graphics_ccb.func)
-            ppb_message_loop_post_work_with_result(pp_i->graphics_ccb_ml,
-                                                   PP_MakeCCB(graphics_ccb_wrapper_comt,
-                                                              GSIZE_TO_POINTER(pp_i->id)),
-                                                   0, PP_OK, 0, __func__);
+            ppb_message_loop_post_work_with_priority(pp_i->graphics_ccb_ml,
+                                                     PP_MakeCCB(graphics_ccb_wrapper_comt,
+                                                                GSIZE_TO_POINTER(pp_i->id)),
+                                                     0, PP_OK, 0, ML_PRIORITY_PAINT, __func__);
     }
+    lock_stats_unlock(&display.lock);
 
-    retval = 1;
-
-done:
-    pthread_mutex_unlock(&display.lock);
-    return retval;
+    return 1;
 }
 
 /// diplay plugin placeholder and error message in it
@@ -1572,7 +1603,7 @@ handle_key_press_release_event(NPP npp, void *event)
         }
         ev->window = browser_window;
 
-        pthread_mutex_lock(&display.lock);
+        lock_stats_lock(&display.lock);
         GdkEvent *gev = make_gdk_key_event_from_x_key(ev);
         if (gev) {
             // tie catcher_widget to GdkWindow
@@ -1589,11 +1620,11 @@ handle_key_press_release_event(NPP npp, void *event)
 
             gw_gdk_event_free(gev);
             if (stop) {
-                pthread_mutex_unlock(&display.lock);
+                lock_stats_unlock(&display.lock);
                 return 1;
             }
         }
-        pthread_mutex_unlock(&display.lock);
+        lock_stats_unlock(&display.lock);
     }
 
     char            buffer[20];
@@ -1604,9 +1635,9 @@ handle_key_press_release_event(NPP npp, void *event)
     PP_Resource     pp_event;
     unsigned int    mod;
 
-    pthread_mutex_lock(&display.lock);
+    lock_stats_lock(&display.lock);
     charcount = XLookupString(ev, buffer, sizeof(buffer), &keysym, &compose_status);
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(&display.lock);
 
     pp_keycode = xkeycode_to_pp_keycode(keysym);
     mod = x_state_mask_to_pp_inputevent_modifier(ev->state);
@@ -1650,11 +1681,11 @@ call_ppp_did_change_focus_comt(void *user_data, int32_t result)
     PP_Bool has_focus = result;
 
     // determine whenever we should pass focus event to the plugin instance
-    pthread_mutex_lock(&display.lock);
+    lock_stats_lock(&display.lock);
     int muffle_event = (pp_i->ignore_focus_events_cnt > 0);
     if (pp_i->ignore_focus_events_cnt > 0)
         pp_i->ignore_focus_events_cnt -= 1;
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(&display.lock);
 
     if (pp_i->ppp_instance_1_1 && pp_i->ppp_instance_1_1->DidChangeFocus && !muffle_event)
         pp_i->ppp_instance_1_1->DidChangeFocus(pp_i->id, has_focus);
@@ -1674,8 +1705,9 @@ handle_focus_in_out_event(NPP npp, void *event)
             gw_gtk_im_context_focus_out(pp_i->im_context);
     }
 
-    ppb_core_call_on_main_thread2(0, PP_MakeCCB(call_ppp_did_change_focus_comt,
-                                                GINT_TO_POINTER(pp_i->id)), has_focus, __func__);
+    ppb_core_call_on_main_thread_with_priority(0, PP_MakeCCB(call_ppp_did_change_focus_comt,
+                                                             GINT_TO_POINTER(pp_i->id)),
+                                               has_focus, ML_PRIORITY_INPUT, __func__);
     return 1;
 }
 
@@ -1768,9 +1800,11 @@ NPP_URLNotify(NPP npp, const char *url, NPReason reason, void *notifyData)
     ul->ccb = PP_MakeCCB(NULL, NULL); // prevent callback from being called twice
     pp_resource_release(url_loader);
 
-    // notify plugin that download have failed
-    if (ccb.func)
-        ppb_message_loop_post_work_with_result(ccb_ml, ccb, 0, PP_ERROR_FAILED, 0, __func__);
+    // notify plugin that download have failed, after reads which were completed already
+    if (ccb.func) {
+        ppb_message_loop_post_work_with_priority(ccb_ml, ccb, 0, PP_ERROR_FAILED, 0,
+                                                 ML_PRIORITY_NETWORK, __func__);
+    }
 }
 
 NPError
@@ -0,0 +1,338 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE             // for dladdr()
+#include "config.h"
+#include "diag_report.h"
+#include "object_tracker.h"
+#include "thread_local.h"
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HISTORY_SIZE        8       // last reference count changes kept per object
+#define REPORT_SITES        10
+#define REPORT_OLDEST       5
+
+struct history_entry_s {
+    const void *site;
+    gint64      time;
+    int         ref_count;
+    pid_t       thread;
+};
+
+struct tracked_object_s {
+    enum object_kind_e      kind;
+    int32_t                 id;
+    int                     type;
+    const void             *site;
+    pid_t                   thread;
+    gint64                  created;
+    uint32_t                history_len;    // total changes recorded, last ones are kept
+    struct history_entry_s  history[HISTORY_SIZE];
+};
+
+static pthread_mutex_t  lock = PTHREAD_MUTEX_INITIALIZER;
+static GHashTable      *objects_ht[OBJECT_KIND_COUNT];
+static volatile gint    next_report_s = 0;    ///< monotonic time, in seconds
+static const char      *kind_names[OBJECT_KIND_COUNT] = { "resource", "var" };
+
+
+/// should be called with lock held
+static
+GHashTable *
+get_objects_ht(enum object_kind_e kind)
+{
+    if (!objects_ht[kind])
+        objects_ht[kind] = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+
+    return objects_ht[kind];
+}
+
+static
+void
+add_history(struct tracked_object_s *obj, int ref_count, const void *site, gint64 now)
+{
+    struct history_entry_s *h = &obj->history[obj->history_len % HISTORY_SIZE];
+
+    h->site = site;
+    h->time = now;
+    h->ref_count = ref_count;
+    h->thread = thread_local_get_tid();
+    obj->history_len ++;
+}
+
+void
+object_tracker_created(enum object_kind_e kind, int32_t id, int type, const void *site)
+{
+    struct tracked_object_s *obj = g_new0(struct tracked_object_s, 1);
+    const gint64 now = g_get_monotonic_time();
+
+    obj->kind = kind;
+    obj->id = id;
+    obj->type = type;
+    obj->site = site;
+    obj->thread = thread_local_get_tid();
+    obj->created = now;
+    add_history(obj, 1, site, now);
+
+    pthread_mutex_lock(&lock);
+    g_hash_table_replace(get_objects_ht(kind), GINT_TO_POINTER(id), obj);
+    pthread_mutex_unlock(&lock);
+
+    // objects are created on hot paths; report is built and written by diagnostics thread
+    const gint now_s = now / G_USEC_PER_SEC;
+    const gint deadline = g_atomic_int_get(&next_report_s);
+    if (deadline == 0) {
+        g_atomic_int_compare_and_exchange(&next_report_s, 0, now_s + config.track_objects);
+    } else if (now_s >= deadline &&
+               g_atomic_int_compare_and_exchange(&next_report_s, deadline,
+                                                 now_s + config.track_objects))
+    {
+        diag_write_report_async(object_tracker_write_report);
+    }
+}
+
+void
+object_tracker_ref_changed(enum object_kind_e kind, int32_t id, int ref_count,
+                           const void *site)
+{
+    pthread_mutex_lock(&lock);
+    struct tracked_object_s *obj = g_hash_table_lookup(get_objects_ht(kind),
+                                                       GINT_TO_POINTER(id));
+    // objects created before tracking was enabled are not known
+    if (obj)
+        add_history(obj, ref_count, site, g_get_monotonic_time());
+    pthread_mutex_unlock(&lock);
+}
+
+void
+object_tracker_destroyed(enum object_kind_e kind, int32_t id)
+{
+    pthread_mutex_lock(&lock);
+    g_hash_table_remove(get_objects_ht(kind), GINT_TO_POINTER(id));
+    pthread_mutex_unlock(&lock);
+}
+
+uint32_t
+object_tracker_live_count(enum object_kind_e kind)
+{
+    pthread_mutex_lock(&lock);
+    const uint32_t count = g_hash_table_size(get_objects_ht(kind));
+    pthread_mutex_unlock(&lock);
+
+    return count;
+}
+
+static
+gint
+compare_sites_by_count(gconstpointer a, gconstpointer b)
+{
+    const struct object_site_s *sa = a;
+    const struct object_site_s *sb = b;
+
+    if (sa->count != sb->count)
+        return sa->count > sb->count ? -1 : 1;
+
+    return sa->oldest < sb->oldest ? -1 : (sa->oldest > sb->oldest);
+}
+
+GArray *
+object_tracker_get_sites(void)
+{
+    GArray *sites = g_array_new(FALSE, FALSE, sizeof(struct object_site_s));
+
+    pthread_mutex_lock(&lock);
+    for (int kind = 0; kind < OBJECT_KIND_COUNT; kind ++) {
+        // creation site -> index in sites array
+        GHashTable *idx_ht = g_hash_table_new(g_direct_hash, g_direct_equal);
+        GHashTableIter iter;
+        gpointer value;
+
+        g_hash_table_iter_init(&iter, get_objects_ht(kind));
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            struct tracked_object_s *obj = value;
+            gpointer idx;
+
+            if (g_hash_table_lookup_extended(idx_ht, obj->site, NULL, &idx)) {
+                struct object_site_s *s = &g_array_index(sites, struct object_site_s,
+                                                         GPOINTER_TO_SIZE(idx));
+                s->count ++;
+                s->oldest = MIN(s->oldest, obj->created);
+            } else {
+                struct object_site_s s = {
+                    .kind =     kind,
+                    .type =     obj->type,
+                    .site =     obj->site,
+                    .count =    1,
+                    .oldest =   obj->created,
+                };
+
+                g_hash_table_insert(idx_ht, (void *)obj->site, GSIZE_TO_POINTER(sites->len));
+                g_array_append_val(sites, s);
+            }
+        }
+
+        g_hash_table_unref(idx_ht);
+    }
+    pthread_mutex_unlock(&lock);
+
+    g_array_sort(sites, compare_sites_by_count);
+    return sites;
+}
+
+gchar *
+object_tracker_describe_site(const void *site)
+{
+    Dl_info info;
+
+    if (dladdr(site, &info) == 0)
+        return g_strdup_printf("%p", site);
+
+    if (info.dli_sname) {
+        return g_strdup_printf("%s+0x%tx", info.dli_sname,
+                               (const char *)site - (const char *)info.dli_saddr);
+    }
+
+    // static functions have no symbols, offset within the file can be fed to addr2line
+    const char *fname = info.dli_fname ? info.dli_fname : "?";
+    const char *slash = strrchr(fname, '/');
+    return g_strdup_printf("%s+0x%tx", slash ? slash + 1 : fname,
+                           (const char *)site - (const char *)info.dli_fbase);
+}
+
+static
+gint
+compare_objects_by_age(gconstpointer a, gconstpointer b)
+{
+    const struct tracked_object_s *oa = a;
+    const struct tracked_object_s *ob = b;
+
+    return oa->created < ob->created ? -1 : (oa->created > ob->created);
+}
+
+static
+void
+append_object(GString *s, const struct tracked_object_s *obj, gint64 now)
+{
+    gchar *s_site = object_tracker_describe_site(obj->site);
+    g_string_append_printf(s, "%s %d, type %d, age %.1f s, created by thread %d at %s\n",
+                           kind_names[obj->kind], obj->id, obj->type,
+                           (now - obj->created) / 1e6, (int)obj->thread, s_site);
+    g_free(s_site);
+
+    const uint32_t first = obj->history_len > HISTORY_SIZE ? obj->history_len - HISTORY_SIZE
+                                                           : 0;
+    if (first > 0)
+        g_string_append_printf(s, "    (%u earlier changes omitted)\n", first);
+
+    for (uint32_t k = first; k < obj->history_len; k ++) {
+        const struct history_entry_s *h = &obj->history[k % HISTORY_SIZE];
+        gchar *s_hsite = object_tracker_describe_site(h->site);
+
+        g_string_append_printf(s, "    %.1f s ago, ref count %d, thread %d, at %s\n",
+                               (now - h->time) / 1e6, h->ref_count, (int)h->thread, s_hsite);
+        g_free(s_hsite);
+    }
+}
+
+gchar *
+object_tracker_get_report(void)
+{
+    const gint64 now = g_get_monotonic_time();
+    GArray *sites = object_tracker_get_sites();
+    GArray *oldest = g_array_new(FALSE, FALSE, sizeof(struct tracked_object_s));
+
+    // objects are copied, so reporting doesn't block creation of new ones
+    pthread_mutex_lock(&lock);
+    const uint32_t res_count = g_hash_table_size(get_objects_ht(OBJECT_KIND_RESOURCE));
+    const uint32_t var_count = g_hash_table_size(get_objects_ht(OBJECT_KIND_VAR));
+    for (int kind = 0; kind < OBJECT_KIND_COUNT; kind ++) {
+        GHashTableIter iter;
+        gpointer value;
+
+        g_hash_table_iter_init(&iter, get_objects_ht(kind));
+        while (g_hash_table_iter_next(&iter, NULL, &value))
+            g_array_append_vals(oldest, value, 1);
+    }
+    pthread_mutex_unlock(&lock);
+
+    g_array_sort(oldest, compare_objects_by_age);
+
+    GString *s = g_string_new(NULL);
+    g_string_append_printf(s, "live objects, pid %d, %.1f s\n", (int)getpid(), now / 1e6);
+    g_string_append_printf(s, "--- %u live resources, %u live vars ---\n", res_count,
+                           var_count);
+    for (guint k = 0; k < MIN(sites->len, REPORT_SITES); k ++) {
+        const struct object_site_s *site = &g_array_index(sites, struct object_site_s, k);
+        gchar *s_site = object_tracker_describe_site(site->site);
+
+        g_string_append_printf(s, "%6u %-8s type %2d, oldest %.1f s, created at %s\n",
+                               site->count, kind_names[site->kind], site->type,
+                               (now - site->oldest) / 1e6, s_site);
+        g_free(s_site);
+    }
+
+    g_string_append(s, "--- oldest ---\n");
+    for (guint k = 0; k < MIN(oldest->len, REPORT_OLDEST); k ++)
+        append_object(s, &g_array_index(oldest, struct tracked_object_s, k), now);
+
+    g_array_free(oldest, TRUE);
+    g_array_free(sites, TRUE);
+    return g_string_free(s, FALSE);
+}
+
+int
+object_tracker_write_report(void)
+{
+    gchar *report = object_tracker_get_report();
+    int retval = diag_write_report("objects", report);
+
+    g_free(report);
+    return retval;
+}
+
+void
+object_tracker_reset(void)
+{
+    pthread_mutex_lock(&lock);
+    for (int kind = 0; kind < OBJECT_KIND_COUNT; kind ++)
+        g_hash_table_remove_all(get_objects_ht(kind));
+    g_atomic_int_set(&next_report_s, 0);
+    pthread_mutex_unlock(&lock);
+}
+
+static
+void
+__attribute__((destructor))
+destructor_object_tracker(void)
+{
+    for (int kind = 0; kind < OBJECT_KIND_COUNT; kind ++) {
+        if (objects_ht[kind])
+            g_hash_table_unref(objects_ht[kind]);
+        objects_ht[kind] = NULL;
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <stdint.h>
+
+/// Records where resources and reference-counted vars were created and how their reference
+/// counts changed, to find what keeps them alive. Callers check config.track_objects before
+/// calling, so there is no overhead when tracking is disabled. With tracking enabled, report
+/// of live objects grouped by creation site is written to "objects.<pid>.txt" in the plugin
+/// data directory every config.track_objects seconds, by diagnostics thread.
+
+enum object_kind_e {
+    OBJECT_KIND_RESOURCE,
+    OBJECT_KIND_VAR,
+    OBJECT_KIND_COUNT,
+};
+
+/// live objects created at the same site
+struct object_site_s {
+    enum object_kind_e  kind;
+    int                 type;           ///< resource type, or PP_VarType
+    const void         *site;           ///< code address object was created from
+    uint32_t            count;
+    gint64              oldest;         ///< creation time of the oldest one, monotonic, us
+};
+
+/// registers new object. |type| is resource type or PP_VarType
+void
+object_tracker_created(enum object_kind_e kind, int32_t id, int type, const void *site);
+
+/// records reference count change. |ref_count| is the value after the change
+void
+object_tracker_ref_changed(enum object_kind_e kind, int32_t id, int ref_count,
+                           const void *site);
+
+void
+object_tracker_destroyed(enum object_kind_e kind, int32_t id);
+
+/// returns number of live tracked objects of given kind
+uint32_t
+object_tracker_live_count(enum object_kind_e kind);
+
+/// returns array of struct object_site_s, sorted by count, largest first.
+/// Caller should free it with g_array_free()
+GArray *
+object_tracker_get_sites(void);
+
+/// returns human-readable name of code address, like "ppb_url_loader_create+0x4f". Caller
+/// should free it with g_free()
+gchar *
+object_tracker_describe_site(const void *site);
+
+/// returns report of live objects: most numerous sites and the oldest objects with their
+/// history. Caller should free it with g_free()
+gchar *
+object_tracker_get_report(void);
+
+/// writes report to the file in plugin data directory. Returns 0 on success
+int
+object_tracker_write_report(void);
+
+/// forgets all tracked objects
+void
+object_tracker_reset(void);
@@ -23,6 +23,9 @@
  */
 
 #include "config.h"
+#include "hang_watchdog.h"
+#include "lock_stats.h"
+#include "object_tracker.h"
 #include "pp_resource.h"
 #include "trace_core.h"
 #include <glib.h>
@@ -41,15 +44,22 @@ struct pp_resource_generic_s {
     COMMON_STRUCTURE_FIELDS
 };
 
+static
+void
+resource_unref(PP_Resource resource, const void *site);
+
 static
 __attribute__((constructor))
 void
 constructor_pp_resource(void)
 {
-    pthread_mutex_lock(&res_tbl_lock);
+    lock_stats_lock(&res_tbl_lock);
     res_tbl = g_hash_table_new(g_direct_hash, g_direct_equal);
     res_tbl_next = 1;
-    pthread_mutex_unlock(&res_tbl_lock);
+    lock_stats_unlock(&res_tbl_lock);
+
+    hang_watchdog_register_lock("res_tbl_lock", &res_tbl_lock);
+    lock_stats_register("res_tbl_lock", &res_tbl_lock);
 }
 
 PP_Resource
@@ -61,24 +71,31 @@ pp_resource_allocate(enum pp_resource_type_e type, struct pp_instance_s *instanc
     pthread_mutex_init(&res->lock, NULL);
     res->instance = instance;
 
-    pthread_mutex_lock(&res_tbl_lock);
+    lock_stats_lock(&res_tbl_lock);
     res->self_id = res_tbl_next ++;
     g_hash_table_insert(res_tbl, GINT_TO_POINTER(res->self_id), res);
-    pthread_mutex_unlock(&res_tbl_lock);
+    const PP_Resource resource = res->self_id;
+    lock_stats_unlock(&res_tbl_lock);
+
+    if (config.track_objects)
+        object_tracker_created(OBJECT_KIND_RESOURCE, resource, type, __builtin_return_address(0));
 
-    return res->self_id;
+    return resource;
 }
 
 void
 pp_resource_expunge(PP_Resource resource)
 {
-    pthread_mutex_lock(&res_tbl_lock);
+    lock_stats_lock(&res_tbl_lock);
     void *ptr = g_hash_table_lookup(res_tbl, GINT_TO_POINTER(resource));
     if (ptr) {
         g_slice_free1(LARGEST_RESOURCE_SIZE, ptr);
         g_hash_table_remove(res_tbl, GINT_TO_POINTER(resource));
     }
-    pthread_mutex_unlock(&res_tbl_lock);
+    lock_stats_unlock(&res_tbl_lock);
+
+    if (ptr && config.track_objects)
+        object_tracker_destroyed(OBJECT_KIND_RESOURCE, resource);
 }
 
 void *
@@ -86,7 +103,7 @@ pp_resource_acquire(PP_Resource resource, enum pp_resource_type_e type)
 {
     struct pp_resource_generic_s *gr = NULL;
     while (1) {
-        pthread_mutex_lock(&res_tbl_lock);
+        lock_stats_lock(&res_tbl_lock);
         gr = g_hash_table_lookup(res_tbl, GINT_TO_POINTER(resource));
         if (!gr || gr->resource_type != type) {
             gr = NULL;
@@ -94,7 +111,7 @@ pp_resource_acquire(PP_Resource resource, enum pp_resource_type_e type)
         }
         if (pthread_mutex_trylock(&gr->lock) == 0)
             break;
-        pthread_mutex_unlock(&res_tbl_lock);
+        lock_stats_unlock(&res_tbl_lock);
         usleep(1);
     }
 
@@ -102,48 +119,57 @@ pp_resource_acquire(PP_Resource resource, enum pp_resource_type_e type)
     if (gr)
         gr->ref_cnt++;
 
-    pthread_mutex_unlock(&res_tbl_lock);
+    lock_stats_unlock(&res_tbl_lock);
     return gr;
 }
 
 void
 pp_resource_release(PP_Resource resource)
 {
-    pthread_mutex_lock(&res_tbl_lock);
+    lock_stats_lock(&res_tbl_lock);
     struct pp_resource_generic_s *gr = g_hash_table_lookup(res_tbl, GINT_TO_POINTER(resource));
     if (gr) {
         pthread_mutex_unlock(&gr->lock);
     }
-    pthread_mutex_unlock(&res_tbl_lock);
+    lock_stats_unlock(&res_tbl_lock);
 
-    // unref referenced in pp_resource_acquire()
-    pp_resource_unref(resource);
+    // unref referenced in pp_resource_acquire(). Acquire-release pairs are not interesting
+    // for object tracker, so they are not recorded
+    resource_unref(resource, NULL);
 }
 
 enum pp_resource_type_e
 pp_resource_get_type(PP_Resource resource)
 {
     enum pp_resource_type_e type = PP_RESOURCE_UNKNOWN;
-    pthread_mutex_lock(&res_tbl_lock);
+    lock_stats_lock(&res_tbl_lock);
     struct pp_resource_generic_s *ptr = g_hash_table_lookup(res_tbl, GINT_TO_POINTER(resource));
     if (ptr) {
         type = ptr->resource_type;
     }
-    pthread_mutex_unlock(&res_tbl_lock);
+    lock_stats_unlock(&res_tbl_lock);
     return type;
 }
 
 PP_Resource
 pp_resource_ref(PP_Resource resource)
 {
-    pthread_mutex_lock(&res_tbl_lock);
+    int ref_cnt = 0;
+
+    lock_stats_lock(&res_tbl_lock);
     struct pp_resource_generic_s *ptr = g_hash_table_lookup(res_tbl, GINT_TO_POINTER(resource));
     if (ptr) {
-        ptr->ref_cnt ++;
+        ref_cnt = ++ptr->ref_cnt;
     } else {
         trace_warning("%s, no such resource %d\n", __func__, resource);
     }
-    pthread_mutex_unlock(&res_tbl_lock);
+    lock_stats_unlock(&res_tbl_lock);
+
+    if (ptr && config.track_objects) {
+        object_tracker_ref_changed(OBJECT_KIND_RESOURCE, resource, ref_cnt,
+                                   __builtin_return_address(0));
+    }
+
     return resource;
 }
 
@@ -160,13 +186,16 @@ count_resources_cb(gpointer key, gpointer value, gpointer user_data)
         counts[PP_RESOURCE_TYPES_COUNT] ++;
 }
 
+/// |site| is code address to attribute the change to in object tracker, or NULL to not
+/// record it
+static
 void
-pp_resource_unref(PP_Resource resource)
+resource_unref(PP_Resource resource, const void *site)
 {
     void (*resource_destructor)(void *) = NULL;
     int ref_cnt = 0;
 
-    pthread_mutex_lock(&res_tbl_lock);
+    lock_stats_lock(&res_tbl_lock);
     struct pp_resource_generic_s *ptr = g_hash_table_lookup(res_tbl, GINT_TO_POINTER(resource));
     if (ptr) {
         ref_cnt = --ptr->ref_cnt;
@@ -183,11 +212,18 @@ pp_resource_unref(PP_Resource resource)
         resource_destructor = g_hash_table_lookup(destructors_ht,
                                                   GSIZE_TO_POINTER(ptr->resource_type));
     }
-    pthread_mutex_unlock(&res_tbl_lock);
+    lock_stats_unlock(&res_tbl_lock);
 
     if (!ptr)
         return;
 
+    if (config.track_objects) {
+        if (ref_cnt <= 0)
+            object_tracker_destroyed(OBJECT_KIND_RESOURCE, resource);
+        else if (site)
+            object_tracker_ref_changed(OBJECT_KIND_RESOURCE, resource, ref_cnt, site);
+    }
+
     if (ref_cnt <= 0) {
         if (resource_destructor)
             resource_destructor(ptr);
@@ -206,9 +242,9 @@ pp_resource_unref(PP_Resource resource)
             if (!throttling) {
                 int counts[PP_RESOURCE_TYPES_COUNT + 1] = {};
 
-                pthread_mutex_lock(&res_tbl_lock);
+                lock_stats_lock(&res_tbl_lock);
                 g_hash_table_foreach(res_tbl, count_resources_cb, counts);
-                pthread_mutex_unlock(&res_tbl_lock);
+                lock_stats_unlock(&res_tbl_lock);
 
                 trace_error("-- %10lu ------------\n", (unsigned long)current_time);
                 for (int k = 0; k < PP_RESOURCE_TYPES_COUNT; k ++)
@@ -226,17 +262,23 @@ pp_resource_unref(PP_Resource resource)
     }
 }
 
+void
+pp_resource_unref(PP_Resource resource)
+{
+    resource_unref(resource, __builtin_return_address(0));
+}
+
 void
 register_resource(enum pp_resource_type_e type, void (*destructor)(void *ptr))
 {
-    pthread_mutex_lock(&res_tbl_lock);
+    lock_stats_lock(&res_tbl_lock);
 
     if (!destructors_ht)
         destructors_ht = g_hash_table_new(g_direct_hash, g_direct_equal);
 
     g_hash_table_insert(destructors_ht, GSIZE_TO_POINTER(type), (void *)destructor);
 
-    pthread_mutex_unlock(&res_tbl_lock);
+    lock_stats_unlock(&res_tbl_lock);
 }
 
 static
@@ -152,6 +152,7 @@ ppb_audio_destroy(void *p)
         a->is_playing = 0;
     }
 
+    audio_report_stream_stats(a->stream_ops, a->stream, "playback");
     a->stream_ops->destroy(a->stream);
 }
 
@@ -22,6 +22,8 @@
  * SOFTWARE.
  */
 
+#include "audio_thread.h"
+#include "device_registry.h"
 #include "pp_interface.h"
 #include "pp_resource.h"
 #include "ppb_audio_config.h"
@@ -67,11 +69,36 @@ uint32_t
 ppb_audio_config_recommend_sample_frame_count(PP_Instance instance, PP_AudioSampleRate sample_rate,
                                               uint32_t requested_sample_frame_count)
 {
+    unsigned int device_rate, period_frames;
+
     (void)instance;
-    (void)sample_rate;
 
-    return CLAMP(requested_sample_frame_count,
-                 PP_AUDIOMINSAMPLEFRAMECOUNT, PP_AUDIOMAXSAMPLEFRAMECOUNT);
+    // device registry drops cached parameters when sound devices change
+    device_registry_start();
+
+    if (audio_get_preferred_params(&device_rate, &period_frames) != 0 || period_frames == 0 ||
+        device_rate == 0)
+    {
+        return CLAMP(requested_sample_frame_count,
+                     PP_AUDIOMINSAMPLEFRAMECOUNT, PP_AUDIOMAXSAMPLEFRAMECOUNT);
+    }
+
+    // device period, expressed at requested rate
+    uint32_t period = ((uint64_t)period_frames * sample_rate + device_rate / 2) / device_rate;
+    if (period == 0 || period > PP_AUDIOMAXSAMPLEFRAMECOUNT) {
+        return CLAMP(requested_sample_frame_count,
+                     PP_AUDIOMINSAMPLEFRAMECOUNT, PP_AUDIOMAXSAMPLEFRAMECOUNT);
+    }
+
+    // whole number of periods closest to requested size, so each callback maps to
+    // device periods without partial blocks
+    uint32_t n_periods = MAX(1, (requested_sample_frame_count + period / 2) / period);
+    while (n_periods * period > PP_AUDIOMAXSAMPLEFRAMECOUNT && n_periods > 1)
+        n_periods --;
+    while (n_periods * period < PP_AUDIOMINSAMPLEFRAMECOUNT)
+        n_periods ++;
+
+    return CLAMP(n_periods * period, PP_AUDIOMINSAMPLEFRAMECOUNT, PP_AUDIOMAXSAMPLEFRAMECOUNT);
 }
 
 PP_Bool
@@ -109,7 +136,19 @@ ppb_audio_config_get_sample_frame_count(PP_Resource config)
 PP_AudioSampleRate
 ppb_audio_config_recommend_sample_rate(PP_Instance instance)
 {
+    unsigned int device_rate, period_frames;
+
     (void)instance;
+    device_registry_start();
+
+    // Pepper offers 44100 and 48000 only. Pick the one device runs at (or its multiple),
+    // to avoid resampling
+    if (audio_get_preferred_params(&device_rate, &period_frames) == 0 && device_rate > 0 &&
+        device_rate % 11025 == 0)
+    {
+        return PP_AUDIOSAMPLERATE_44100;
+    }
+
     return PP_AUDIOSAMPLERATE_48000;
 }
 
@@ -22,7 +22,10 @@
  * SOFTWARE.
  */
 
+#include "audio_capture_pipeline.h"
 #include "audio_thread.h"
+#include "config.h"
+#include "device_registry.h"
 #include "pp_interface.h"
 #include "pp_resource.h"
 #include "ppb_audio_config.h"
@@ -47,6 +50,8 @@ struct pp_audio_input_s {
     void                       *cb_user_data;
     audio_stream_ops           *stream_ops;
     audio_stream               *stream;
+    audio_capture_pipeline     *pipeline;
+    audio_stream_format         format;     ///< updated by backend if stream is re-created
 };
 
 STATIC_ASSERT(sizeof(struct pp_audio_input_s) <= LARGEST_RESOURCE_SIZE);
@@ -69,6 +74,9 @@ ppb_audio_input_create(PP_Instance instance)
     ai->stream_ops = audio_select_implementation();
 
     pp_resource_release(audio_input);
+
+    // device list will likely be requested soon, start gathering it now
+    device_registry_start();
     return audio_input;
 }
 
@@ -77,8 +85,18 @@ void
 ppb_audio_input_destroy(void *ptr)
 {
     struct pp_audio_input_s *ai = ptr;
-    if (ai->stream)
+
+    device_registry_forget_owner(ai->self_id);
+    if (ai->stream) {
+        audio_report_stream_stats(ai->stream_ops, ai->stream, "capture");
+        // returns once backend is done with capture_cb(), which pushes into the pipeline
         ai->stream_ops->destroy(ai->stream);
+        ai->stream = NULL;
+    }
+
+    // no more data comes from backend, pipeline can be stopped
+    audio_capture_pipeline_destroy(ai->pipeline);
+    ai->pipeline = NULL;
 }
 
 PP_Bool
@@ -96,26 +114,15 @@ ppb_audio_input_enumerate_devices(PP_Resource audio_input, struct PP_ArrayOutput
         trace_error("%s, bad resource\n", __func__);
         return PP_ERROR_FAILED;
     }
+    PP_Instance instance = ai->instance->id;
+    pp_resource_release(audio_input);
 
-    audio_device_name *list = ai->stream_ops->enumerate_capture_devices();
-    size_t cnt = 0;
-    while (list && list[cnt].name)
-        cnt ++;
-
-    PP_Resource *refs = output.GetDataBuffer(output.user_data, cnt, sizeof(PP_Resource));
-    for (uintptr_t k = 0; k < cnt; k ++) {
-        struct PP_Var name =     ppb_var_var_from_utf8_z(list[k].name);
-        struct PP_Var longname = ppb_var_var_from_utf8_z(list[k].longname);
-        refs[k] = ppb_device_ref_create(ai->instance->id, name, longname,
-                                        PP_DEVICETYPE_DEV_AUDIOCAPTURE);
-        ppb_var_release(name);
-        ppb_var_release(longname);
-    }
+    int32_t retval = device_registry_enumerate(instance, DEVICE_REGISTRY_AUDIO_CAPTURE, output);
+    if (retval != PP_OK)
+        return retval;
 
-    audio_capture_device_list_free(list);
     ppb_message_loop_post_work_with_result(ppb_message_loop_get_current(), callback, 0, PP_OK, 0,
                                            __func__);
-    pp_resource_release(audio_input);
     return PP_OK_COMPLETIONPENDING;
 }
 
@@ -123,7 +130,16 @@ int32_t
 ppb_audio_input_monitor_device_change(PP_Resource audio_input,
                                       PP_MonitorDeviceChangeCallback callback, void *user_data)
 {
-    return 0;
+    struct pp_audio_input_s *ai = pp_resource_acquire(audio_input, PP_RESOURCE_AUDIO_INPUT);
+    if (!ai) {
+        trace_error("%s, bad resource\n", __func__);
+        return PP_ERROR_BADRESOURCE;
+    }
+    PP_Instance instance = ai->instance->id;
+    pp_resource_release(audio_input);
+
+    return device_registry_monitor(audio_input, instance, DEVICE_REGISTRY_AUDIO_CAPTURE, callback,
+                                   user_data);
 }
 
 static
@@ -132,6 +148,15 @@ capture_cb(const void *buf, uint32_t sz, double latency, void *user_data)
 {
     struct pp_audio_input_s *ai = user_data;
 
+    audio_capture_pipeline_push(ai->pipeline, buf, sz, latency);
+}
+
+static
+void
+pipeline_output_cb(const void *buf, uint32_t sz, double latency, void *user_data)
+{
+    struct pp_audio_input_s *ai = user_data;
+
     if (ai->cb_0_3) {
         ai->cb_0_3(buf, sz, ai->cb_user_data);
     } else if (ai->cb_0_4) {
@@ -139,6 +164,14 @@ capture_cb(const void *buf, uint32_t sz, double latency, void *user_data)
     }
 }
 
+static
+int
+agc_enabled(void)
+{
+    // global config is shadowed by parameters in functions below
+    return config.audio_capture_agc;
+}
+
 static
 int32_t
 do_ppb_audio_input_open(PP_Resource audio_input, PP_Resource device_ref, PP_Resource config,
@@ -172,13 +205,24 @@ do_ppb_audio_input_open(PP_Resource audio_input, PP_Resource device_ref, PP_Reso
     ai->cb_0_4 = audio_input_callback_0_4;
     ai->cb_user_data = user_data;
 
+    ai->pipeline = audio_capture_pipeline_create(ai->sample_rate, ai->sample_frame_count,
+                                                 agc_enabled(), pipeline_output_cb, ai);
+    if (!ai->pipeline) {
+        trace_error("%s, can't create capture pipeline\n", __func__);
+        goto err_3;
+    }
+
     ai->stream = ai->stream_ops->create_capture_stream(ai->sample_rate, ai->sample_frame_count,
-                                                       capture_cb, ai, longname);
+                                                       capture_cb, ai, longname, &ai->format);
     if (!ai->stream) {
         trace_error("%s, can't create capture stream\n", __func__);
+        audio_capture_pipeline_destroy(ai->pipeline);
+        ai->pipeline = NULL;
         goto err_3;
     }
 
+    audio_capture_pipeline_start(ai->pipeline, &ai->format);
+
     ppb_message_loop_post_work_with_result(ppb_message_loop_get_current(), callback, 0, PP_OK, 0,
                                            __func__);
     retval = PP_OK_COMPLETIONPENDING;
@@ -309,7 +353,7 @@ trace_ppb_audio_input_monitor_device_change(PP_Resource audio_input,
                                             PP_MonitorDeviceChangeCallback callback,
                                             void *user_data)
 {
-    trace_info("[PPB] {zilch} %s audio_input=%d, callback=%p, user_data=%p\n", __func__+6,
+    trace_info("[PPB] {full} %s audio_input=%d, callback=%p, user_data=%p\n", __func__+6,
                audio_input, callback, user_data);
     return ppb_audio_input_monitor_device_change(audio_input, callback, user_data);
 }
@@ -379,7 +423,7 @@ const struct PPB_AudioInput_Dev_0_3 ppb_audio_input_dev_interface_0_3 = {
     .Create =               TWRAPF(ppb_audio_input_create),
     .IsAudioInput =         TWRAPF(ppb_audio_input_is_audio_input),
     .EnumerateDevices =     TWRAPF(ppb_audio_input_enumerate_devices),
-    .MonitorDeviceChange =  TWRAPZ(ppb_audio_input_monitor_device_change),
+    .MonitorDeviceChange =  TWRAPF(ppb_audio_input_monitor_device_change),
     .Open =                 TWRAPF(ppb_audio_input_open_0_3),
     .GetCurrentConfig =     TWRAPF(ppb_audio_input_get_current_config),
     .StartCapture =         TWRAPF(ppb_audio_input_start_capture),
@@ -391,7 +435,7 @@ const struct PPB_AudioInput_Dev_0_4 ppb_audio_input_dev_interface_0_4 = {
     .Create =               TWRAPF(ppb_audio_input_create),
     .IsAudioInput =         TWRAPF(ppb_audio_input_is_audio_input),
     .EnumerateDevices =     TWRAPF(ppb_audio_input_enumerate_devices),
-    .MonitorDeviceChange =  TWRAPZ(ppb_audio_input_monitor_device_change),
+    .MonitorDeviceChange =  TWRAPF(ppb_audio_input_monitor_device_change),
     .Open =                 TWRAPF(ppb_audio_input_open),
     .GetCurrentConfig =     TWRAPF(ppb_audio_input_get_current_config),
     .StartCapture =         TWRAPF(ppb_audio_input_start_capture),
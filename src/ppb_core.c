@@ -22,6 +22,7 @@
  * SOFTWARE.
  */
 
+#include "hang_watchdog.h"
 #include "pp_interface.h"
 #include "pp_resource.h"
 #include "ppb_core.h"
@@ -78,22 +79,36 @@ ppb_core_trampoline_to_main_thread(struct PP_CompletionCallback callback, int32_
 }
 
 void
-ppb_core_call_on_main_thread2(int32_t delay_in_milliseconds, struct PP_CompletionCallback callback,
-                              int32_t result, const char *origin)
+ppb_core_call_on_main_thread_with_priority(int32_t delay_in_milliseconds,
+                                           struct PP_CompletionCallback callback, int32_t result,
+                                           enum ml_priority_e priority, const char *origin)
 {
     PP_Resource main_message_loop = ppb_message_loop_get_for_main_thread();
     if (main_message_loop == 0)
         trace_error("%s, no main loop\n", __func__);
     const int depth = 1;
-    ppb_message_loop_post_work_with_result(main_message_loop, callback, delay_in_milliseconds,
-                                           result, depth, origin);
+    ppb_message_loop_post_work_with_priority(main_message_loop, callback, delay_in_milliseconds,
+                                             result, depth, priority, origin);
+}
+
+void
+ppb_core_call_on_main_thread2(int32_t delay_in_milliseconds, struct PP_CompletionCallback callback,
+                              int32_t result, const char *origin)
+{
+    ppb_core_call_on_main_thread_with_priority(delay_in_milliseconds, callback, result,
+                                               ML_PRIORITY_NORMAL, origin);
 }
 
 void
 ppb_core_call_on_main_thread(int32_t delay_in_milliseconds, struct PP_CompletionCallback callback,
                              int32_t result)
 {
-    return ppb_core_call_on_main_thread2(delay_in_milliseconds, callback, result, __func__);
+    // plugin uses delayed calls as timers
+    return ppb_core_call_on_main_thread_with_priority(delay_in_milliseconds, callback, result,
+                                                      delay_in_milliseconds > 0
+                                                          ? ML_PRIORITY_TIMER
+                                                          : ML_PRIORITY_NORMAL,
+                                                      __func__);
 }
 
 struct call_on_browser_thread_task_s {
@@ -118,6 +133,7 @@ activate_browser_thread_ml_ptac(void *param)
     // without waiting.
     PP_Resource m_loop = ppb_message_loop_get_for_browser_thread();
     ppb_message_loop_run_int(m_loop, ML_INCREASE_DEPTH | ML_EXIT_ON_EMPTY | ML_NESTED);
+    hang_watchdog_browser_calls_drained();
 }
 
 // Schedules task for execution on browser thread.
@@ -141,6 +157,7 @@ ppb_core_call_on_browser_thread(PP_Instance instance, void (*func)(void *), void
     PP_Resource m_loop = ppb_message_loop_get_for_browser_thread();
     ppb_message_loop_post_work_with_result(m_loop, PP_MakeCCB(call_on_browser_thread_comt, task), 0,
                                            PP_OK, 0, __func__);
+    hang_watchdog_browser_call_posted();
 
     struct pp_instance_s *pp_i = instance ? tables_get_pp_instance(instance)
                                           : tables_get_some_pp_instance();
@@ -150,10 +167,10 @@ ppb_core_call_on_browser_thread(PP_Instance instance, void (*func)(void *), void
     }
 
     // Schedule activation routine.
-    pthread_mutex_lock(&display.lock);
+    lock_stats_lock(&display.lock);
     if (pp_i->npp)
         npn.pluginthreadasynccall(pp_i->npp, activate_browser_thread_ml_ptac, user_data);
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(&display.lock);
 }
 
 PP_Bool
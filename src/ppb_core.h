@@ -24,6 +24,7 @@
 
 #pragma once
 
+#include "ppb_message_loop.h"
 #include <ppapi/c/pp_instance.h>
 #include <ppapi/c/ppb_core.h>
 
@@ -51,6 +52,11 @@ void
 ppb_core_call_on_main_thread2(int32_t delay_in_milliseconds, struct PP_CompletionCallback callback,
                               int32_t result, const char *origin);
 
+void
+ppb_core_call_on_main_thread_with_priority(int32_t delay_in_milliseconds,
+                                           struct PP_CompletionCallback callback, int32_t result,
+                                           enum ml_priority_e priority, const char *origin);
+
 /// schedule task for execution on browser thread
 ///
 /// @param instance is optional, pass 0 if there are no instance id available
@@ -94,7 +94,7 @@ set_cursor_ptac(void *user_data)
         }
     }
 
-    pthread_mutex_lock(&display.lock);
+    lock_stats_lock(&display.lock);
 
     if (params->hide_cursor) {
         cursor = display.transparent_cursor;
@@ -116,7 +116,7 @@ set_cursor_ptac(void *user_data)
         pp_i->prev_cursor = cursor;
     }
 
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(&display.lock);
 
 quit:
     g_slice_free(struct comt_param_s, params);
@@ -223,6 +223,13 @@ ppb_flash_navigate(PP_Resource request_info, const char *target, PP_Bool from_us
     }
     pp_resource_release(request_info);
 
+    // document in plugin's frame is going away, along with its window object
+    if (target && (strcmp(target, "_self") == 0 || strcmp(target, "_top") == 0 ||
+                   strcmp(target, "_parent") == 0))
+    {
+        ppb_instance_drop_cached_objects(ri->instance->id);
+    }
+
     PP_Resource url_loader = ppb_url_loader_create(ri->instance->id);
     int32_t result = ppb_url_loader_open_target(url_loader, request_info,
                                                 PP_MakeCCB(nop_callback, NULL), target);
@@ -349,9 +356,9 @@ ppb_flash_is_rect_topmost(PP_Instance instance, const struct PP_Rect *rect)
 void
 ppb_flash_update_activity(PP_Instance instance)
 {
-    pthread_mutex_lock(&display.lock);
+    lock_stats_lock(&display.lock);
     screensaver_deactivate(display.x, display.screensaver_types);
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(&display.lock);
 }
 
 struct PP_Var
@@ -32,6 +32,8 @@
 #include "static_assert.h"
 #include "tables.h"
 #include "trace_core.h"
+#include "work_pool.h"
+#include <glib.h>
 #include <ppapi/c/pp_errors.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -42,6 +44,13 @@ STATIC_ASSERT_LESS_OR_EQ(salt_length, 32);
 
 struct pp_flash_drm_s {
     COMMON_STRUCTURE_FIELDS
+    struct work_token_s    *token;      ///< cancels pending requests on destruction
+};
+
+struct get_device_id_param_s {
+    struct PP_Var                  *id;
+    struct PP_CompletionCallback    ccb;
+    char                            salt[salt_length];
 };
 
 STATIC_ASSERT(sizeof(struct pp_flash_drm_s) <= LARGEST_RESOURCE_SIZE);
@@ -61,6 +70,8 @@ ppb_flash_drm_create(PP_Instance instance)
         return 0;
     }
 
+    fd->token = work_token_new();
+
     pp_resource_release(flash_drm);
     return flash_drm;
 }
@@ -69,6 +80,10 @@ static
 void
 ppb_flash_drm_destroy(void *p)
 {
+    struct pp_flash_drm_s *fd = p;
+
+    work_token_cancel(fd->token);
+    work_token_unref(fd->token);
 }
 
 static
@@ -113,15 +128,14 @@ get_system_salt(char *salt)
     }
 }
 
+/// reads salt file, creating it if needed. Runs on a worker thread
+static
 int32_t
-ppb_flash_drm_get_device_id(PP_Resource drm, struct PP_Var *id,
-                            struct PP_CompletionCallback callback)
+read_salt_work(void *user_data)
 {
+    struct get_device_id_param_s *p = user_data;
     const char *salt_fname = fpp_config_get_pepper_salt_file_name();
     FILE *fp;
-    char salt[salt_length];
-
-    (void)drm;
 
     fp = fopen(salt_fname, "rb");
     if (!fp) {
@@ -133,8 +147,8 @@ ppb_flash_drm_get_device_id(PP_Resource drm, struct PP_Var *id,
             return PP_ERROR_FAILED;
         }
 
-        get_system_salt(salt);
-        size_t written = fwrite(salt, 1, salt_length, fp);
+        get_system_salt(p->salt);
+        size_t written = fwrite(p->salt, 1, salt_length, fp);
         fclose(fp);
 
         if (written != salt_length) {
@@ -149,7 +163,7 @@ ppb_flash_drm_get_device_id(PP_Resource drm, struct PP_Var *id,
         }
     }
 
-    size_t read_bytes = fread(salt, 1, salt_length, fp);
+    size_t read_bytes = fread(p->salt, 1, salt_length, fp);
     fclose(fp);
 
     if (read_bytes != salt_length) {
@@ -157,9 +171,46 @@ ppb_flash_drm_get_device_id(PP_Resource drm, struct PP_Var *id,
         return PP_ERROR_FAILED;
     }
 
-    *id = ppb_var_var_from_utf8(salt, salt_length);
-    ppb_message_loop_post_work_with_result(ppb_message_loop_get_current(), callback, 0, PP_OK, 0,
-                                           __func__);
+    return PP_OK;
+}
+
+static
+void
+get_device_id_comt(void *user_data, int32_t result)
+{
+    struct get_device_id_param_s *p = user_data;
+
+    if (result == PP_OK)
+        *p->id = ppb_var_var_from_utf8(p->salt, salt_length);
+
+    p->ccb.func(p->ccb.user_data, result);
+    g_slice_free(struct get_device_id_param_s, p);
+}
+
+int32_t
+ppb_flash_drm_get_device_id(PP_Resource drm, struct PP_Var *id,
+                            struct PP_CompletionCallback callback)
+{
+    struct pp_flash_drm_s *fd = pp_resource_acquire(drm, PP_RESOURCE_FLASH_DRM);
+    if (!fd) {
+        trace_error("%s, bad resource\n", __func__);
+        return PP_ERROR_BADRESOURCE;
+    }
+
+    struct get_device_id_param_s *p = g_slice_new0(struct get_device_id_param_s);
+    p->id =     id;
+    p->ccb =    callback;
+
+    // requests are serialized, so concurrent ones don't race creating salt file
+    int ret = work_pool_submit(work_pool_get_queue("flash_drm", 1), read_salt_work,
+                               get_device_id_comt, p, fd->token, __func__);
+    pp_resource_release(drm);
+
+    if (ret != PP_OK) {
+        g_slice_free(struct get_device_id_param_s, p);
+        return ret;
+    }
+
     return PP_OK_COMPLETIONPENDING;
 }
 
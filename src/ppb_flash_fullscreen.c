@@ -90,9 +90,9 @@ ppb_flash_fullscreen_is_fullscreen(PP_Instance instance)
         return PP_FALSE;
     }
 
-    pthread_mutex_lock(&display.lock);
+    lock_stats_lock(&display.lock);
     uint32_t is_fullscreen = pp_i->is_fullscreen_apparent;
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(&display.lock);
 
     return is_fullscreen;
 }
@@ -136,9 +136,9 @@ call_did_change_view_comt(void *user_data, int32_t result)
     }
     pp_resource_release(view);
 
-    pthread_mutex_lock(&display.lock);
+    lock_stats_lock(&display.lock);
     pp_i->is_fullscreen_apparent = is_fullscreen;
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(&display.lock);
 
     pp_i->ppp_instance_1_1->DidChangeView(pp_i->id, view);
     ppb_core_release_resource(view);
@@ -372,11 +372,11 @@ fullscreen_window_thread_int(Display *dpy, struct thread_param_s *tp)
             trace_error("%s, can't get tp->browser_window\n", __func__);
     }
 
-    pthread_mutex_lock(&display.lock);
+    lock_stats_lock(&display.lock);
     pp_i->is_fullscreen = 1;
     pp_i->fs_width_current = fs_wnd_rect.size.width;
     pp_i->fs_height_current = fs_wnd_rect.size.height;
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(&display.lock);
 
     int called_did_change_view = 0;
     int graphics_expose_events_in_queue = 0;
@@ -439,10 +439,10 @@ fullscreen_window_thread_int(Display *dpy, struct thread_param_s *tp)
                 break;
 
             case ConfigureNotify:
-                pthread_mutex_lock(&display.lock);
+                lock_stats_lock(&display.lock);
                 pp_i->fs_width_current = ev.xconfigure.width;
                 pp_i->fs_height_current = ev.xconfigure.height;
-                pthread_mutex_unlock(&display.lock);
+                lock_stats_unlock(&display.lock);
 
                 handled = 1;
                 break;
@@ -479,10 +479,10 @@ fullscreen_window_thread_int(Display *dpy, struct thread_param_s *tp)
 
 quit_and_destroy_fs_wnd:
 
-    pthread_mutex_lock(&display.lock);
+    lock_stats_lock(&display.lock);
     pp_i->is_fullscreen = 0;
     pp_i->is_fullscreen_apparent = 0;
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(&display.lock);
 
     XDestroyWindow(dpy, pp_i->fs_wnd);
     XFlush(dpy);
@@ -554,7 +554,7 @@ delay_thread(void *param)
     // first, wait some time before window manager performs fullscreen transition
     usleep(config.fs_delay_ms * 1000);
 
-    pthread_mutex_lock(&display.lock);
+    lock_stats_lock(&display.lock);
     if (pp_i->is_fullscreen) {
         XEvent ev = {
             .xclient = {
@@ -569,7 +569,7 @@ delay_thread(void *param)
         XSendEvent(display.x, ev.xclient.window, False, NoEventMask, &ev);
         XFlush(display.x);
     }
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(&display.lock);
 
     if (!config.enable_vsync) {
         // if no vsync required, just wait until thread could be terminated
@@ -582,7 +582,7 @@ delay_thread(void *param)
 
     // wait for vsync events, pass them back to fullscreen thread
     while (g_atomic_int_get(&run_delay_thread)) {
-        pthread_mutex_lock(&display.lock);
+        lock_stats_lock(&display.lock);
         if (pp_i->is_fullscreen) {
             XEvent ev = {
                 .xclient = {
@@ -597,7 +597,7 @@ delay_thread(void *param)
             XSendEvent(display.x, ev.xclient.window, False, NoEventMask, &ev);
             XFlush(display.x);
         }
-        pthread_mutex_unlock(&display.lock);
+        lock_stats_unlock(&display.lock);
 
         if (display.dri_fd >= 0) {
             if (enable_drm_vsync)
@@ -654,9 +654,9 @@ ppb_flash_fullscreen_set_fullscreen(PP_Instance instance, PP_Bool fullscreen)
         return PP_FALSE;
     }
 
-    pthread_mutex_lock(&display.lock);
+    lock_stats_lock(&display.lock);
     int in_same_state = (!!fullscreen == !!pp_i->is_fullscreen);
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(&display.lock);
     if (in_same_state)
         return PP_FALSE;
 
@@ -677,7 +677,7 @@ ppb_flash_fullscreen_set_fullscreen(PP_Instance instance, PP_Bool fullscreen)
         tparams->pp_i = pp_i;
         g_async_queue_push(fullscreen_transition_queue, tparams);
     } else if (g_atomic_int_get(&currently_fullscreen)) {
-        pthread_mutex_lock(&display.lock);
+        lock_stats_lock(&display.lock);
         pp_i->is_fullscreen = 0;
         XKeyEvent ev = {
             .type = KeyPress,
@@ -688,7 +688,7 @@ ppb_flash_fullscreen_set_fullscreen(PP_Instance instance, PP_Bool fullscreen)
 
         XSendEvent(display.x, pp_i->fs_wnd, False, 0, (void *)&ev);
         XFlush(display.x);
-        pthread_mutex_unlock(&display.lock);
+        lock_stats_unlock(&display.lock);
     }
 
     return PP_TRUE;
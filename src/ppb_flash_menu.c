@@ -282,12 +282,12 @@ ppb_flash_menu_show(PP_Resource menu_id, const struct PP_Point *location, int32_
     popup_menu_ccb_ml = ppb_message_loop_get_current();
     popup_menu_result = selected_id;
 
-    pthread_mutex_lock(&display.lock);
+    lock_stats_lock(&display.lock);
     // creating and showing menu together with its closing generates pair of focus events,
     // FocusOut and FocusIn, which should not be passed to the plugin instance. Otherwise they
     // will tamper with text selection.
     pp_i->ignore_focus_events_cnt = 2;
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(&display.lock);
 
     ppb_core_call_on_browser_thread(pp_i->id, menu_popup_ptac, fm->menu);
 
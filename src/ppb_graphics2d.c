@@ -23,6 +23,7 @@
  */
 
 #include "config.h"
+#include "mem_accounting.h"
 #include "pp_interface.h"
 #include "pp_resource.h"
 #include "ppb_core.h"
@@ -44,6 +45,9 @@
 
 STATIC_ASSERT(sizeof(struct pp_graphics2d_s) <= LARGEST_RESOURCE_SIZE);
 
+#define G2D_XRES_BUCKET         64      ///< pooled pixmap dimensions are multiples of this
+#define G2D_XRES_IDLE_TIMEOUT   5000    ///< unused pooled resources are freed after, ms
+
 struct g2d_paint_task_s {
     enum g2d_paint_task_type_e {
         gpt_paint_id,
@@ -55,6 +59,191 @@ struct g2d_paint_task_s {
     int             src_is_set;
 };
 
+static
+int32_t
+g2d_xres_bucket(int32_t size)
+{
+    size = MAX(size, 1);
+    return (size + G2D_XRES_BUCKET - 1) / G2D_XRES_BUCKET * G2D_XRES_BUCKET;
+}
+
+// caller must hold display.g2d.lock
+static
+void
+g2d_xres_create(PP_Instance instance, struct g2d_xres_s *xres, int32_t width, int32_t height,
+                int32_t depth)
+{
+    XRenderPictFormat *pictfmt = (depth == 32) ? display.pictfmt_argb32 : display.pictfmt_rgb24;
+
+    xres->pixmap = XCreatePixmap(display.g2d.x, DefaultRootWindow(display.g2d.x), width, height,
+                                 depth);
+    XFlush(display.g2d.x);
+    xres->xr_pict = XRenderCreatePicture(display.g2d.x, xres->pixmap, pictfmt, 0, 0);
+    xres->gc = XCreateGC(display.g2d.x, xres->pixmap, 0, 0);
+
+    // browser thread draws with these over its own connection, they must exist by then
+    XSync(display.g2d.x, False);
+
+    xres->width = width;
+    xres->height = height;
+    xres->depth = depth;
+    mem_accounting_change(instance, PP_RESOURCE_GRAPHICS2D, MEM_KIND_X_PIXMAP,
+                          mem_accounting_pixmap_size(width, height, depth));
+}
+
+// caller must hold display.g2d.lock
+static
+void
+g2d_xres_free(PP_Instance instance, struct g2d_xres_s *xres)
+{
+    mem_accounting_change(instance, PP_RESOURCE_GRAPHICS2D, MEM_KIND_X_PIXMAP,
+                          -mem_accounting_pixmap_size(xres->width, xres->height, xres->depth));
+    XRenderFreePicture(display.g2d.x, xres->xr_pict);
+    XFreeGC(display.g2d.x, xres->gc);
+    XFreePixmap(display.g2d.x, xres->pixmap);
+    memset(xres, 0, sizeof(*xres));
+}
+
+/// frees pool slots which are allocated but not used. Caller must hold display.g2d.lock
+static
+void
+g2d_xres_pool_free_unused(struct g2d_xres_pool_s *pool)
+{
+    for (int k = 0; k < G2D_XRES_POOL_SIZE; k ++) {
+        struct g2d_xres_s *xres = &pool->slot[k];
+        if (xres->pixmap && !xres->in_use)
+            g2d_xres_free(pool->instance, xres);
+    }
+}
+
+/// drops a reference to the pool, freeing it with the last one. Caller must hold
+/// display.g2d.lock
+static
+void
+g2d_xres_pool_unref(struct g2d_xres_pool_s *pool)
+{
+    if (--pool->ref_cnt > 0)
+        return;
+
+    g2d_xres_pool_free_unused(pool);
+    g_slice_free(struct g2d_xres_pool_s, pool);
+}
+
+/// takes a free pool slot with resources of at least |width|x|height|. If there is no such slot,
+/// one is (re)allocated. Pool only grows: replaced pixmap is never smaller than the one it
+/// replaces, so shrink-grow sequences during resizes don't cause reallocations. Returns NULL
+/// if all slots are in use. Caller must hold display.g2d.lock
+static
+struct g2d_xres_s *
+g2d_xres_acquire(struct g2d_xres_pool_s *pool, int32_t width, int32_t height, int32_t depth)
+{
+    struct g2d_xres_s *fit = NULL;      // smallest of large enough
+    struct g2d_xres_s *small = NULL;    // largest of too small
+    struct g2d_xres_s *empty = NULL;
+    struct g2d_xres_s *other = NULL;    // different depth
+
+    for (int k = 0; k < G2D_XRES_POOL_SIZE; k ++) {
+        struct g2d_xres_s *xres = &pool->slot[k];
+
+        if (xres->in_use)
+            continue;
+
+        if (!xres->pixmap) {
+            empty = empty ? empty : xres;
+        } else if (xres->depth != depth) {
+            other = other ? other : xres;
+        } else if (xres->width >= width && xres->height >= height) {
+            if (!fit || xres->width * xres->height < fit->width * fit->height)
+                fit = xres;
+        } else {
+            if (!small || xres->width * xres->height > small->width * small->height)
+                small = xres;
+        }
+    }
+
+    if (fit) {
+        fit->in_use = 1;
+        return fit;
+    }
+
+    int32_t alloc_width = g2d_xres_bucket(width);
+    int32_t alloc_height = g2d_xres_bucket(height);
+    struct g2d_xres_s *xres;
+
+    if (small) {
+        xres = small;
+        alloc_width = MAX(alloc_width, small->width);
+        alloc_height = MAX(alloc_height, small->height);
+    } else if (empty) {
+        xres = empty;
+    } else if (other) {
+        xres = other;
+    } else {
+        return NULL;
+    }
+
+    if (xres->pixmap)
+        g2d_xres_free(pool->instance, xres);
+
+    g2d_xres_create(pool->instance, xres, alloc_width, alloc_height, depth);
+    xres->in_use = 1;
+    return xres;
+}
+
+void
+ppb_graphics2d_release_instance_pool(struct pp_instance_s *pp_i)
+{
+    lock_stats_lock(display.g2d.lock);
+    struct g2d_xres_pool_s *pool = pp_i->g2d_xres_pool;
+    pp_i->g2d_xres_pool = NULL;
+    if (pool) {
+        pool->orphaned = 1;
+        g2d_xres_pool_free_unused(pool);
+        g2d_xres_pool_unref(pool);
+    }
+    lock_stats_unlock(display.g2d.lock);
+}
+
+static
+void
+g2d_xres_trim_comt(void *user_data, int32_t result)
+{
+    struct pp_instance_s *pp_i = tables_get_pp_instance(GPOINTER_TO_SIZE(user_data));
+    if (!pp_i)
+        return;
+
+    const gint64 now = g_get_monotonic_time();
+    int reschedule = 0;
+
+    lock_stats_lock(display.g2d.lock);
+    struct g2d_xres_pool_s *pool = pp_i->g2d_xres_pool;
+    if (!pool) {
+        lock_stats_unlock(display.g2d.lock);
+        return;
+    }
+
+    pool->trim_scheduled = 0;
+    for (int k = 0; k < G2D_XRES_POOL_SIZE; k ++) {
+        struct g2d_xres_s *xres = &pool->slot[k];
+        if (!xres->pixmap || xres->in_use)
+            continue;
+
+        if (now - xres->released_at >= G2D_XRES_IDLE_TIMEOUT * 1000)
+            g2d_xres_free(pool->instance, xres);
+        else
+            reschedule = 1;
+    }
+
+    if (reschedule)
+        pool->trim_scheduled = 1;
+    lock_stats_unlock(display.g2d.lock);
+
+    if (reschedule) {
+        ppb_core_call_on_main_thread2(G2D_XRES_IDLE_TIMEOUT, PP_MakeCCB(g2d_xres_trim_comt,
+                                      user_data), PP_OK, __func__);
+    }
+}
+
 PP_Resource
 ppb_graphics2d_create(PP_Instance instance, const struct PP_Size *size, PP_Bool is_always_opaque)
 {
@@ -70,6 +259,7 @@ ppb_graphics2d_create(PP_Instance instance, const struct PP_Size *size, PP_Bool
         return 0;
     }
 
+    g2d->instance_id = instance;
     g2d->is_always_opaque = is_always_opaque;
     g2d->scale = config.device_scale;
     g2d->external_scale = 1.0;
@@ -91,22 +281,49 @@ ppb_graphics2d_create(PP_Instance instance, const struct PP_Size *size, PP_Bool
         ppb_core_release_resource(graphics_2d);
         return 0;
     }
+    mem_accounting_change(instance, PP_RESOURCE_GRAPHICS2D, MEM_KIND_HEAP,
+                          (int64_t)g2d->stride * g2d->height +
+                              (int64_t)g2d->scaled_stride * g2d->scaled_height);
     g2d->cairo_surf = cairo_image_surface_create_for_data((unsigned char *)g2d->data,
                             CAIRO_FORMAT_ARGB32, g2d->width, g2d->height, g2d->stride);
     g2d->task_list = NULL;
 
+    g2d->xres_pool = NULL;
     if (pp_i->is_transparent && display.have_xrender) {
         // we need XRender picture (which in turn requires X Pixmap) to alpha blend
         // our images with existing pixmap provided by the browser. This is only needed
         // is instance is transparent, therefore depth is always 32-bit.
-        pthread_mutex_lock(&display.lock);
-        g2d->pixmap = XCreatePixmap(display.x, DefaultRootWindow(display.x), g2d->scaled_width,
-                                    g2d->scaled_height, 32);
-        XFlush(display.x);
-        g2d->xr_pict = XRenderCreatePicture(display.x, g2d->pixmap, display.pictfmt_argb32, 0, 0);
-        g2d->gc = XCreateGC(display.x, g2d->pixmap, 0, 0);
-        XFlush(display.x);
-        pthread_mutex_unlock(&display.lock);
+        //
+        // Plugins tend to recreate Graphics2D on every resize, so these are taken from
+        // the per-instance pool instead of being created anew each time.
+        lock_stats_lock(display.g2d.lock);
+        struct g2d_xres_pool_s *pool = pp_i->g2d_xres_pool;
+        if (!pool) {
+            pool = g_slice_new0(struct g2d_xres_pool_s);
+            pool->ref_cnt = 1;
+            pool->instance = instance;
+            pp_i->g2d_xres_pool = pool;
+        }
+
+        struct g2d_xres_s *xres = g2d_xres_acquire(pool, g2d->scaled_width, g2d->scaled_height,
+                                                   32);
+        if (xres) {
+            g2d->pixmap = xres->pixmap;
+            g2d->xr_pict = xres->xr_pict;
+            g2d->gc = xres->gc;
+            g2d->xres_pool = pool;
+            g2d->xres_slot = xres - pool->slot;
+            pool->ref_cnt ++;
+        } else {
+            // all pool slots are taken, use private resources
+            struct g2d_xres_s tmp;
+            g2d_xres_create(instance, &tmp, g2d->scaled_width, g2d->scaled_height, 32);
+            g2d->pixmap = tmp.pixmap;
+            g2d->xr_pict = tmp.xr_pict;
+            g2d->gc = tmp.gc;
+            g2d->private_xres_size = mem_accounting_pixmap_size(tmp.width, tmp.height, 32);
+        }
+        lock_stats_unlock(display.g2d.lock);
     }
 
     // without XRender, fall back to software compositing
@@ -122,6 +339,14 @@ ppb_graphics2d_destroy(void *p)
     if (!p)
         return;
     struct pp_graphics2d_s *g2d = p;
+    int64_t heap_size = 0;
+
+    if (g2d->data)
+        heap_size += (int64_t)g2d->stride * g2d->height;
+    if (g2d->second_buffer)
+        heap_size += (int64_t)g2d->scaled_stride * g2d->scaled_height;
+    mem_accounting_change(g2d->instance_id, PP_RESOURCE_GRAPHICS2D, MEM_KIND_HEAP, -heap_size);
+
     free_and_nullify(g2d->data);
     free_and_nullify(g2d->second_buffer);
     if (g2d->cairo_surf) {
@@ -129,12 +354,38 @@ ppb_graphics2d_destroy(void *p)
         g2d->cairo_surf = NULL;
     }
 
-    if (g2d->instance->is_transparent && display.have_xrender) {
-        pthread_mutex_lock(&display.lock);
-        XRenderFreePicture(display.x, g2d->xr_pict);
-        XFreePixmap(display.x, g2d->pixmap);
-        XFreeGC(display.x, g2d->gc);
-        pthread_mutex_unlock(&display.lock);
+    if (!g2d->pixmap)
+        return;
+
+    // instance could be already destroyed, g2d->instance must not be touched here
+    struct g2d_xres_pool_s *pool = g2d->xres_pool;
+    int schedule_trim = 0;
+
+    lock_stats_lock(display.g2d.lock);
+    if (pool) {
+        // return resources to the pool; they are freed later if they stay unused
+        struct g2d_xres_s *xres = &pool->slot[g2d->xres_slot];
+        xres->in_use = 0;
+        xres->released_at = g_get_monotonic_time();
+        if (pool->orphaned) {
+            g2d_xres_free(pool->instance, xres);
+        } else if (!pool->trim_scheduled) {
+            pool->trim_scheduled = 1;
+            schedule_trim = 1;
+        }
+        g2d_xres_pool_unref(pool);
+    } else {
+        XRenderFreePicture(display.g2d.x, g2d->xr_pict);
+        XFreePixmap(display.g2d.x, g2d->pixmap);
+        XFreeGC(display.g2d.x, g2d->gc);
+        mem_accounting_change(g2d->instance_id, PP_RESOURCE_GRAPHICS2D, MEM_KIND_X_PIXMAP,
+                              -g2d->private_xres_size);
+    }
+    lock_stats_unlock(display.g2d.lock);
+
+    if (schedule_trim) {
+        ppb_core_call_on_main_thread2(G2D_XRES_IDLE_TIMEOUT, PP_MakeCCB(g2d_xres_trim_comt,
+                                      GSIZE_TO_POINTER(g2d->instance_id)), PP_OK, __func__);
     }
 }
 
@@ -222,10 +473,10 @@ call_forceredraw_ptac(void *param)
             }
         };
 
-        pthread_mutex_lock(&display.lock);
+        lock_stats_lock(&display.lock);
         XSendEvent(display.x, ev.xgraphicsexpose.drawable, True, ExposureMask, &ev);
         XFlush(display.x);
-        pthread_mutex_unlock(&display.lock);
+        lock_stats_unlock(&display.lock);
     } else {
         NPRect npr = {.top = 0, .left = 0, .bottom = pp_i->height, .right = pp_i->width};
         npn.invalidaterect(pp_i->npp, &npr);
@@ -244,11 +495,11 @@ ppb_graphics2d_flush(PP_Resource graphics_2d, struct PP_CompletionCallback callb
 
     struct pp_instance_s *pp_i = g2d->instance;
 
-    pthread_mutex_lock(&display.lock);
+    lock_stats_lock(&display.lock);
 
     if (pp_i->graphics_in_progress) {
         pp_resource_release(graphics_2d);
-        pthread_mutex_unlock(&display.lock);
+        lock_stats_unlock(&display.lock);
         return PP_ERROR_INPROGRESS;
     }
 
@@ -257,7 +508,7 @@ ppb_graphics2d_flush(PP_Resource graphics_2d, struct PP_CompletionCallback callb
         pp_i->graphics_ccb_ml = ppb_message_loop_get_current();
         pp_i->graphics_in_progress = 1;
     }
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(&display.lock);
 
     while (g2d->task_list) {
         GList *link = g_list_first(g2d->task_list);
@@ -339,8 +590,8 @@ ppb_graphics2d_flush(PP_Resource graphics_2d, struct PP_CompletionCallback callb
     if (callback.func) {
         // invoke callback as soon as possible if graphics device is not bound to an instance
         if (pp_i->graphics != graphics_2d)
-            ppb_message_loop_post_work_with_result(ppb_message_loop_get_current(), callback, 0,
-                                                   PP_OK, 0, __func__);
+            ppb_message_loop_post_work_with_priority(ppb_message_loop_get_current(), callback, 0,
+                                                     PP_OK, 0, ML_PRIORITY_PAINT, __func__);
         return PP_OK_COMPLETIONPENDING;
     }
 
@@ -357,6 +608,9 @@ ppb_graphics2d_set_scale(PP_Resource resource, float scale)
         return PP_ERROR_BADRESOURCE;
     }
 
+    const int64_t old_size = g2d->second_buffer ? (int64_t)g2d->scaled_stride * g2d->scaled_height
+                                                : 0;
+
     g2d->external_scale = scale;
     g2d->scale = scale * config.device_scale;
 
@@ -368,6 +622,10 @@ ppb_graphics2d_set_scale(PP_Resource resource, float scale)
     g2d->second_buffer = calloc(g2d->scaled_stride * g2d->scaled_height, 1);
     PP_Bool ret = !!g2d->second_buffer;
 
+    const int64_t new_size = ret ? (int64_t)g2d->scaled_stride * g2d->scaled_height : 0;
+    mem_accounting_change(g2d->instance->id, PP_RESOURCE_GRAPHICS2D, MEM_KIND_HEAP,
+                          new_size - old_size);
+
     pp_resource_release(resource);
     return ret;
 }
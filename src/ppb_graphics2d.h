@@ -46,11 +46,17 @@ struct pp_graphics2d_s {
     char               *second_buffer;
     cairo_surface_t    *cairo_surf;
     GList              *task_list;
-    Pixmap              pixmap;
+    Pixmap              pixmap;     ///< may be larger than scaled_width x scaled_height
     Picture             xr_pict;
     GC                  gc;
+    PP_Instance         instance_id;    ///< instance may be gone when resource is destroyed
+    struct g2d_xres_pool_s *xres_pool;  ///< pool the resources are from, or NULL if private
+    int                 xres_slot;  ///< index in xres_pool
+    int64_t             private_xres_size;  ///< estimated size of non-pooled pixmap
 };
 
+struct pp_instance_s;
+
 PP_Resource
 ppb_graphics2d_create(PP_Instance instance, const struct PP_Size *size, PP_Bool is_always_opaque);
 
@@ -79,3 +85,8 @@ ppb_graphics2d_set_scale(PP_Resource resource, float scale);
 
 float
 ppb_graphics2d_get_scale(PP_Resource resource);
+
+/// frees unused pooled presentation resources of the instance, and detaches pool from it. Slots
+/// still used by Graphics2D resources are freed when these are destroyed
+void
+ppb_graphics2d_release_instance_pool(struct pp_instance_s *pp_i);
@@ -23,6 +23,8 @@
  */
 
 #include "compat_glx_defines.h"
+#include "config.h"
+#include "mem_accounting.h"
 #include "pp_interface.h"
 #include "pp_resource.h"
 #include "ppb_core.h"
@@ -34,16 +36,128 @@
 #include "tables.h"
 #include "trace_core.h"
 #include "trace_helpers.h"
+#include "utils.h"
 #include <GL/glx.h>
 #include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
 #include <X11/Xlib.h>
 #include <assert.h>
 #include <ppapi/c/pp_errors.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 
 STATIC_ASSERT(sizeof(struct pp_graphics3d_s) <= LARGEST_RESOURCE_SIZE);
 
+#if HAVE_GLES2
+#define EGL_CLIENT_API      EGL_OPENGL_ES_API
+#else
+#define EGL_CLIENT_API      EGL_OPENGL_API
+#endif
+
+// GL_RGBA8_OES and GL_RGBA8 share the value, as do GL_DEPTH24_STENCIL8_OES and GL_DEPTH24_STENCIL8
+#define FBO_COLOR_FORMAT            GL_RGBA8_OES
+#define FBO_DEPTH_STENCIL_FORMAT    GL_DEPTH24_STENCIL8_OES
+
+// pixel buffer objects are not a part of OpenGL ES 2.0, but are used with desktop OpenGL contexts
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER        0x88EB
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ              0x88E1
+#endif
+#ifndef GL_READ_ONLY
+#define GL_READ_ONLY                0x88B8
+#endif
+
+/// brings memory accounted for context in line with |heap| and |pixmaps| bytes
+static
+void
+set_accounted_memory(struct pp_graphics3d_s *g3d, int64_t heap, int64_t pixmaps)
+{
+    const PP_Instance instance = g3d->instance->id;
+
+    mem_accounting_change(instance, PP_RESOURCE_GRAPHICS3D, MEM_KIND_HEAP,
+                          heap - g3d->accounted_heap);
+    mem_accounting_change(instance, PP_RESOURCE_GRAPHICS3D, MEM_KIND_X_PIXMAP,
+                          pixmaps - g3d->accounted_pixmaps);
+    g3d->accounted_heap = heap;
+    g3d->accounted_pixmaps = pixmaps;
+}
+
+/// accounts readback buffer and pixmaps context currently has
+static
+void
+account_buffers(struct pp_graphics3d_s *g3d)
+{
+    // there is no pixmap[0] with EGL
+    const int pixmap_count = (g3d->pixmap[0] != None) + (g3d->pixmap[1] != None);
+    const int64_t pixmap_size = mem_accounting_pixmap_size(MAX(g3d->width, 1),
+                                                           MAX(g3d->height, 1), g3d->depth);
+
+    int64_t heap = g3d->readback ? g3d->readback_size : 0;
+
+#if HAVE_EGL
+    heap += g3d->readback_spare ? g3d->readback_spare_size : 0;
+#endif
+
+    set_accounted_memory(g3d, heap, pixmap_count * pixmap_size);
+}
+
+int
+ppb_graphics3d_make_current(struct pp_graphics3d_s *g3d)
+{
+#if HAVE_EGL
+    if (g3d->use_egl) {
+        // EGL display is independent from X connections, no need to lock them. Context itself
+        // can be current to a single thread only
+        pthread_mutex_lock(&g3d->egl_lock);
+        eglBindAPI(EGL_CLIENT_API);
+        if (!eglMakeCurrent(display.egl, g3d->egl_surf, g3d->egl_surf, g3d->egl_ctx)) {
+            trace_error("%s, eglMakeCurrent failed, 0x%04x\n", __func__, eglGetError());
+            pthread_mutex_unlock(&g3d->egl_lock);
+            return -1;
+        }
+        return 0;
+    }
+#endif
+
+    lock_stats_lock(display.gl.lock);
+    if (!glXMakeCurrent(display.gl.x, g3d->glx_pixmap, g3d->glc)) {
+        trace_error("%s, glXMakeCurrent failed\n", __func__);
+        lock_stats_unlock(display.gl.lock);
+        return -1;
+    }
+    return 0;
+}
+
+void
+ppb_graphics3d_release_current(struct pp_graphics3d_s *g3d)
+{
+#if HAVE_EGL
+    if (g3d->use_egl) {
+        eglMakeCurrent(display.egl, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        pthread_mutex_unlock(&g3d->egl_lock);
+        return;
+    }
+#endif
+
+    glXMakeCurrent(display.gl.x, None, NULL);
+    lock_stats_unlock(display.gl.lock);
+}
+
+GLuint
+ppb_graphics3d_map_framebuffer(struct pp_graphics3d_s *g3d, GLuint framebuffer)
+{
+#if HAVE_EGL
+    // there is no default framebuffer in EGL offscreen mode, FBO takes its place
+    if (g3d->use_egl && framebuffer == 0)
+        return g3d->fbo;
+#endif
+
+    return framebuffer;
+}
+
 int32_t
 ppb_graphics3d_get_attrib_max_value(PP_Resource instance, int32_t attribute, int32_t *value)
 {
@@ -64,6 +178,398 @@ peek_gl_context(PP_Resource graphics3d)
     return glc;
 }
 
+static
+inline
+uint32_t
+swap_red_blue(uint32_t p)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return (p & 0xff00ff00u) | ((p & 0x000000ffu) << 16) | ((p >> 16) & 0x000000ffu);
+#else
+    return (p & 0x00ff00ffu) | ((p & 0x0000ff00u) << 16) | ((p >> 16) & 0x0000ff00u);
+#endif
+}
+
+/// converts frame got from glReadPixels() to X image layout
+///
+/// GL rows go bottom to top, and pixels are RGBA bytes, while X wants top to bottom rows of BGRA
+/// bytes. Both conversions are done at once, by processing rows from the ends in pairs. That also
+/// allows |src| and |dst| to be the same buffer.
+static
+void
+convert_gl_frame(uint32_t *dst, const uint32_t *src, int32_t width, int32_t height)
+{
+    for (int32_t y1 = 0, y2 = height - 1; y1 <= y2; y1 ++, y2 --) {
+        const uint32_t *src1 = src + (size_t)y1 * width;
+        const uint32_t *src2 = src + (size_t)y2 * width;
+        uint32_t       *dst1 = dst + (size_t)y1 * width;
+        uint32_t       *dst2 = dst + (size_t)y2 * width;
+
+        for (int32_t x = 0; x < width; x ++) {
+            const uint32_t p1 = src1[x];
+            const uint32_t p2 = src2[x];
+
+            dst1[x] = swap_red_blue(p2);
+            dst2[x] = swap_red_blue(p1);
+        }
+    }
+}
+
+/// converts frame pending in pixel buffer object into g3d->readback. Context must be current,
+/// display.gl.lock held
+static
+void
+glx_collect_pending_frame(struct pp_graphics3d_s *g3d)
+{
+    if (!g3d->pbo_pending)
+        return;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, g3d->pbo[1 - g3d->pbo_idx]);
+    const void *data = display.glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if (data) {
+        convert_gl_frame((uint32_t *)g3d->readback, data, g3d->width, g3d->height);
+        display.glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        g3d->readback_valid = 1;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    g3d->pbo_pending = 0;
+}
+
+/// reads frame into g3d->readback, for software compositing. Context must be current,
+/// display.gl.lock held
+///
+/// With pixel buffer objects available, readback is asynchronous. Frame is queued into one
+/// buffer of the ring, and is collected later on the plugin thread, see collect_frame_comt(),
+/// so swap doesn't wait for the transfer. The first frame after (re)allocation is read
+/// synchronously, as there is nothing to show before it.
+static
+int
+glx_read_frame(struct pp_graphics3d_s *g3d)
+{
+    const size_t frame_size = (size_t)g3d->width * g3d->height * 4;
+    GLint prev_fbo, prev_pack_alignment;
+
+    if (frame_size == 0)
+        return -1;
+
+    if (g3d->readback_size != frame_size) {
+        free(g3d->readback);
+        g3d->readback = malloc(frame_size);
+        g3d->readback_size = g3d->readback ? frame_size : 0;
+        g3d->readback_valid = 0;
+        g3d->pbo_pending = 0;
+        account_buffers(g3d);
+        if (!g3d->readback) {
+            trace_error("%s, can't allocate memory\n", __func__);
+            return -1;
+        }
+
+        if (g3d->use_pbo) {
+            for (int k = 0; k < 2; k ++) {
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, g3d->pbo[k]);
+                glBufferData(GL_PIXEL_PACK_BUFFER, frame_size, NULL, GL_STREAM_READ);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+    }
+
+    // plugin could leave its own framebuffer bound
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo);
+    glGetIntegerv(GL_PACK_ALIGNMENT, &prev_pack_alignment);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    if (g3d->use_pbo && g3d->readback_valid) {
+        // previous frame can still be in flight, if its collect task didn't run yet
+        glx_collect_pending_frame(g3d);
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, g3d->pbo[g3d->pbo_idx]);
+        glReadPixels(0, 0, g3d->width, g3d->height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        g3d->pbo_idx = 1 - g3d->pbo_idx;
+        g3d->pbo_pending = 1;
+
+    } else {
+        glReadPixels(0, 0, g3d->width, g3d->height, GL_RGBA, GL_UNSIGNED_BYTE, g3d->readback);
+        convert_gl_frame((uint32_t *)g3d->readback, (uint32_t *)g3d->readback, g3d->width,
+                         g3d->height);
+        g3d->readback_valid = 1;
+    }
+
+    glPixelStorei(GL_PACK_ALIGNMENT, prev_pack_alignment);
+    glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo);
+    return 0;
+}
+
+static
+int
+select_pixmap_depth(struct pp_graphics3d_s *g3d, struct pp_instance_s *pp_i, int screen)
+{
+    g3d->depth = pp_i->is_transparent ? 32 : DefaultDepth(display.gl.x, screen);
+    switch (g3d->depth) {
+    case 24:
+        g3d->xr_pictfmt = display.pictfmt_rgb24;
+        return 0;
+    case 32:
+        g3d->xr_pictfmt = display.pictfmt_argb32;
+        return 0;
+    default:
+        trace_error("%s, unsupported g3d->depth (%d)\n", __func__, g3d->depth);
+        return -1;
+    }
+}
+
+#if HAVE_EGL
+static
+EGLContext
+peek_egl_context(PP_Resource graphics3d)
+{
+    struct pp_graphics3d_s *g3d = pp_resource_acquire(graphics3d, PP_RESOURCE_GRAPHICS3D);
+    if (!g3d) {
+        trace_error("%s, bad resource\n", __func__);
+        return EGL_NO_CONTEXT;
+    }
+
+    EGLContext egl_ctx = g3d->egl_ctx;
+    pp_resource_release(graphics3d);
+    return egl_ctx;
+}
+
+/// (re)allocates storage for FBO attachments. Context must be current
+///
+/// Readback buffers are allocated by egl_present_frame(), once frame size is known there.
+static
+void
+egl_allocate_buffers(struct pp_graphics3d_s *g3d, int32_t width, int32_t height)
+{
+    width = MAX(width, 1);
+    height = MAX(height, 1);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, g3d->fbo_color);
+    glRenderbufferStorage(GL_RENDERBUFFER, FBO_COLOR_FORMAT, width, height);
+
+    if (g3d->fbo_depth_stencil) {
+        glBindRenderbuffer(GL_RENDERBUFFER, g3d->fbo_depth_stencil);
+        glRenderbufferStorage(GL_RENDERBUFFER, FBO_DEPTH_STENCIL_FORMAT, width, height);
+    }
+
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+}
+
+static
+int
+egl_create_context(struct pp_graphics3d_s *g3d, PP_Resource share_context,
+                   const int32_t attrib_list[])
+{
+    EGLContext share_ctx = (share_context == 0) ? EGL_NO_CONTEXT
+                                                : peek_egl_context(share_context);
+    int need_depth_stencil = 0;
+
+    for (int k = 0; attrib_list[k] != PP_GRAPHICS3DATTRIB_NONE; k += 2) {
+        if (attrib_list[k] == PP_GRAPHICS3DATTRIB_DEPTH_SIZE ||
+            attrib_list[k] == PP_GRAPHICS3DATTRIB_STENCIL_SIZE)
+        {
+            need_depth_stencil = need_depth_stencil || attrib_list[k + 1] > 0;
+        }
+    }
+
+#if HAVE_GLES2
+    const EGLint ctx_attrs[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+#else
+    const EGLint ctx_attrs[] = { EGL_NONE };
+#endif
+
+    eglBindAPI(EGL_CLIENT_API);
+    g3d->egl_ctx = eglCreateContext(display.egl, display.egl_config, share_ctx, ctx_attrs);
+    if (g3d->egl_ctx == EGL_NO_CONTEXT) {
+        trace_error("%s, eglCreateContext failed, 0x%04x\n", __func__, eglGetError());
+        return -1;
+    }
+
+    pthread_mutex_init(&g3d->egl_lock, NULL);
+
+    g3d->egl_surf = EGL_NO_SURFACE;
+    if (!display.egl_surfaceless) {
+        // contexts can't be made current without a surface, use a tiny dummy one
+        const EGLint pbuffer_attrs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        g3d->egl_surf = eglCreatePbufferSurface(display.egl, display.egl_config, pbuffer_attrs);
+        if (g3d->egl_surf == EGL_NO_SURFACE) {
+            trace_error("%s, eglCreatePbufferSurface failed, 0x%04x\n", __func__,
+                        eglGetError());
+            eglDestroyContext(display.egl, g3d->egl_ctx);
+            pthread_mutex_destroy(&g3d->egl_lock);
+            return -1;
+        }
+    }
+
+    if (!eglMakeCurrent(display.egl, g3d->egl_surf, g3d->egl_surf, g3d->egl_ctx)) {
+        trace_error("%s, eglMakeCurrent failed, 0x%04x\n", __func__, eglGetError());
+        goto err;
+    }
+
+    glGenFramebuffers(1, &g3d->fbo);
+    glGenRenderbuffers(1, &g3d->fbo_color);
+    if (need_depth_stencil)
+        glGenRenderbuffers(1, &g3d->fbo_depth_stencil);
+
+    egl_allocate_buffers(g3d, g3d->width, g3d->height);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, g3d->fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER,
+                              g3d->fbo_color);
+    if (g3d->fbo_depth_stencil) {
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER,
+                                  g3d->fbo_depth_stencil);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER,
+                                  g3d->fbo_depth_stencil);
+    }
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        trace_error("%s, framebuffer incomplete, 0x%04x\n", __func__, status);
+        goto err;
+    }
+
+    // there is no surface to take initial viewport size from
+    glViewport(0, 0, g3d->width, g3d->height);
+
+    // clear surface
+    glClearColor(0.0, 0.0, 0.0, 1.0);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    eglMakeCurrent(display.egl, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    return 0;
+
+err:
+    eglMakeCurrent(display.egl, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (g3d->egl_surf != EGL_NO_SURFACE)
+        eglDestroySurface(display.egl, g3d->egl_surf);
+    eglDestroyContext(display.egl, g3d->egl_ctx);
+    pthread_mutex_destroy(&g3d->egl_lock);
+    return -1;
+}
+
+static
+void
+egl_destroy_context(struct pp_graphics3d_s *g3d)
+{
+    if (ppb_graphics3d_make_current(g3d) == 0) {
+        glDeleteFramebuffers(1, &g3d->fbo);
+        glDeleteRenderbuffers(1, &g3d->fbo_color);
+        if (g3d->fbo_depth_stencil)
+            glDeleteRenderbuffers(1, &g3d->fbo_depth_stencil);
+        ppb_graphics3d_release_current(g3d);
+    }
+
+    if (g3d->egl_surf != EGL_NO_SURFACE)
+        eglDestroySurface(display.egl, g3d->egl_surf);
+    eglDestroyContext(display.egl, g3d->egl_ctx);
+    pthread_mutex_destroy(&g3d->egl_lock);
+
+    free(g3d->readback);
+    free(g3d->readback_spare);
+    g3d->readback = NULL;
+    g3d->readback_spare = NULL;
+}
+
+/// creates X pixmap frames are uploaded to. Unlike GLX case, there is no pixmap to draw into
+static
+int
+egl_create_x_resources(struct pp_graphics3d_s *g3d)
+{
+    g3d->pixmap[0] = None;
+    g3d->glx_pixmap = None;
+    g3d->pixmap[1] = XCreatePixmap(display.gl.x, DefaultRootWindow(display.gl.x),
+                                   MAX(g3d->width, 1), MAX(g3d->height, 1), g3d->depth);
+    g3d->gc = XCreateGC(display.gl.x, g3d->pixmap[1], 0, NULL);
+    if (!g3d->gc) {
+        trace_error("%s, can't create GC\n", __func__);
+        XFreePixmap(display.gl.x, g3d->pixmap[1]);
+        return -1;
+    }
+
+    XFlush(display.gl.x);
+    if (display.have_xrender) {
+        g3d->xr_pict[0] = None;
+        g3d->xr_pict[1] = XRenderCreatePicture(display.gl.x, g3d->pixmap[1], g3d->xr_pictfmt, 0, 0);
+    }
+
+    return 0;
+}
+
+static
+void
+egl_free_x_resources(struct pp_graphics3d_s *g3d)
+{
+    if (display.have_xrender)
+        XRenderFreePicture(display.gl.x, g3d->xr_pict[1]);
+
+    XFreeGC(display.gl.x, g3d->gc);
+    XFreePixmap(display.gl.x, g3d->pixmap[1]);
+}
+
+static
+int32_t
+egl_resize_buffers(struct pp_graphics3d_s *g3d, int32_t width, int32_t height)
+{
+    GLint prev_fbo;
+
+    if (ppb_graphics3d_make_current(g3d) != 0)
+        return PP_ERROR_FAILED;
+
+    egl_allocate_buffers(g3d, width, height);
+
+    // clear surface
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, g3d->fbo);
+    glClearColor(0.0, 0.0, 0.0, 1.0);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo);
+    ppb_graphics3d_release_current(g3d);
+
+    lock_stats_lock(display.gl.lock);
+    g3d->width = width;
+    g3d->height = height;
+
+    // frame of the old size can't be drawn anymore; buffer is reallocated on next swap
+    free(g3d->readback);
+    g3d->readback = NULL;
+    g3d->readback_size = 0;
+    g3d->readback_valid = 0;
+
+    egl_free_x_resources(g3d);
+    int ret = egl_create_x_resources(g3d);
+    lock_stats_unlock(display.gl.lock);
+
+    return ret == 0 ? PP_OK : PP_ERROR_FAILED;
+}
+
+/// reads current frame from FBO into |dst|, converting it to X pixel format. Returns 0 on success
+static
+int
+egl_read_frame(struct pp_graphics3d_s *g3d, char *dst, int32_t width, int32_t height)
+{
+    GLint prev_fbo, prev_pack_alignment;
+
+    if (ppb_graphics3d_make_current(g3d) != 0)
+        return -1;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo);
+    glGetIntegerv(GL_PACK_ALIGNMENT, &prev_pack_alignment);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, g3d->fbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, dst);
+
+    glPixelStorei(GL_PACK_ALIGNMENT, prev_pack_alignment);
+    glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo);
+    ppb_graphics3d_release_current(g3d);
+
+    convert_gl_frame((uint32_t *)dst, (uint32_t *)dst, width, height);
+    return 0;
+}
+#endif // HAVE_EGL
+
 PP_Resource
 ppb_graphics3d_create(PP_Instance instance, PP_Resource share_context, const int32_t attrib_list[])
 {
@@ -73,11 +579,13 @@ ppb_graphics3d_create(PP_Instance instance, PP_Resource share_context, const int
         return 0;
     }
 
-    GLXContext share_glc = (share_context == 0) ? NULL
-                                                : peek_gl_context(share_context);
+    GLXContext share_glc = (share_context == 0 || display.egl_available)
+                                ? NULL : peek_gl_context(share_context);
     // check for required GLX extensions
 #if HAVE_GLES2
-    if (!display.glx_arb_create_context || !display.glx_arb_create_context_profile ||
+    if (display.egl_available) {
+        // EGL offscreen rendering doesn't use GLX
+    } else if (!display.glx_arb_create_context || !display.glx_arb_create_context_profile ||
         !display.glx_ext_create_context_es2_profile)
     {
         trace_warning("%s, some of GLX_ARB_create_context, GLX_ARB_create_context_profile, "
@@ -85,7 +593,7 @@ ppb_graphics3d_create(PP_Instance instance, PP_Resource share_context, const int
         return 0;
     }
 
-    if (!display.glXCreateContextAttribsARB) {
+    } else if (!display.glXCreateContextAttribsARB) {
         trace_warning("%s, no glXCreateContextAttribsARB found\n", __func__);
         return 0;
     }
@@ -193,10 +701,31 @@ ppb_graphics3d_create(PP_Instance instance, PP_Resource share_context, const int
 
     assert(k2 <= max_attrib_count);
 
-    pthread_mutex_lock(&display.lock);
-    int screen = DefaultScreen(display.x);
+    lock_stats_lock(display.gl.lock);
+    int screen = DefaultScreen(display.gl.x);
+
+#if HAVE_EGL
+    if (display.egl_available) {
+        free(cfg_attrs);
+        g3d->use_egl = 1;
+        if (egl_create_context(g3d, share_context, attrib_list) != 0)
+            goto err;
+
+        if (select_pixmap_depth(g3d, pp_i, screen) != 0 || egl_create_x_resources(g3d) != 0) {
+            egl_destroy_context(g3d);
+            goto err;
+        }
+
+        g3d->sub_maps = g_hash_table_new(g_direct_hash, g_direct_equal);
+        account_buffers(g3d);
+        lock_stats_unlock(display.gl.lock);
+        pp_resource_release(context);
+        return context;
+    }
+#endif // HAVE_EGL
+
     int nconfigs = 0;
-    GLXFBConfig *fb_cfgs = glXChooseFBConfig(display.x, screen, cfg_attrs, &nconfigs);
+    GLXFBConfig *fb_cfgs = glXChooseFBConfig(display.gl.x, screen, cfg_attrs, &nconfigs);
     free(cfg_attrs);
 
     if (!fb_cfgs) {
@@ -230,7 +759,7 @@ ppb_graphics3d_create(PP_Instance instance, PP_Resource share_context, const int
 #endif
 
     if (display.glXCreateContextAttribsARB) {
-        g3d->glc = display.glXCreateContextAttribsARB(display.x, g3d->fb_config, share_glc, True,
+        g3d->glc = display.glXCreateContextAttribsARB(display.gl.x, g3d->fb_config, share_glc, True,
                                                       ctx_attrs);
         if (!g3d->glc)
             trace_warning("%s, glXCreateContextAttribsARB returned NULL\n", __func__);
@@ -242,63 +771,66 @@ ppb_graphics3d_create(PP_Instance instance, PP_Resource share_context, const int
     if (!g3d->glc) {
         // if glXCreateContextAttribsARB is not present or returned NULL,
         // request any GL context
-        g3d->glc = glXCreateNewContext(display.x, g3d->fb_config, GLX_RGBA_TYPE, share_glc, True);
+        g3d->glc = glXCreateNewContext(display.gl.x, g3d->fb_config, GLX_RGBA_TYPE, share_glc,
+                                       True);
         if (!g3d->glc) {
             trace_error("%s, glXCreateNewContext returned NULL\n", __func__);
             goto err;
         }
     }
 
-    g3d->depth = pp_i->is_transparent ? 32 : DefaultDepth(display.x, screen);
-    switch (g3d->depth) {
-    case 24:
-        g3d->xr_pictfmt = display.pictfmt_rgb24;
-        break;
-    case 32:
-        g3d->xr_pictfmt = display.pictfmt_argb32;
-        break;
-    default:
-        trace_error("%s, unsupported g3d->depth (%d)\n", __func__, g3d->depth);
+    if (select_pixmap_depth(g3d, pp_i, screen) != 0)
         goto err;
-    }
 
     // Creating two X pixmaps. First one is for drawing into, with a GLX Pixmap associated.
     // Second one is for double buffering.
-    g3d->pixmap[0] = XCreatePixmap(display.x, DefaultRootWindow(display.x), g3d->width, g3d->height,
-                                   g3d->depth);
-    g3d->pixmap[1] = XCreatePixmap(display.x, DefaultRootWindow(display.x), g3d->width, g3d->height,
-                                   g3d->depth);
-    g3d->glx_pixmap = glXCreatePixmap(display.x, g3d->fb_config, g3d->pixmap[0], NULL);
+    g3d->pixmap[0] = XCreatePixmap(display.gl.x, DefaultRootWindow(display.gl.x), g3d->width,
+                                   g3d->height, g3d->depth);
+    g3d->pixmap[1] = XCreatePixmap(display.gl.x, DefaultRootWindow(display.gl.x), g3d->width,
+                                   g3d->height, g3d->depth);
+    g3d->glx_pixmap = glXCreatePixmap(display.gl.x, g3d->fb_config, g3d->pixmap[0], NULL);
     if (g3d->glx_pixmap == None) {
         trace_error("%s, failed to create GLX pixmap\n", __func__);
         goto err;
     }
 
-    XFlush(display.x);
+    XFlush(display.gl.x);
     if (display.have_xrender) {
-        g3d->xr_pict[0] = XRenderCreatePicture(display.x, g3d->pixmap[0], g3d->xr_pictfmt, 0, 0);
-        g3d->xr_pict[1] = XRenderCreatePicture(display.x, g3d->pixmap[1], g3d->xr_pictfmt, 0, 0);
+        g3d->xr_pict[0] = XRenderCreatePicture(display.gl.x, g3d->pixmap[0], g3d->xr_pictfmt, 0, 0);
+        g3d->xr_pict[1] = XRenderCreatePicture(display.gl.x, g3d->pixmap[1], g3d->xr_pictfmt, 0, 0);
     }
 
-    int ret = glXMakeCurrent(display.x, g3d->glx_pixmap, g3d->glc);
+    int ret = glXMakeCurrent(display.gl.x, g3d->glx_pixmap, g3d->glc);
     if (!ret) {
         trace_error("%s, glXMakeCurrent failed\n", __func__);
         goto err;
     }
 
+#if !HAVE_GLES2
+    // frames are read back only for software compositing
+    if (!display.have_xrender && display.glMapBuffer && display.glUnmapBuffer) {
+        const char *gl_ext_str = (const char *)glGetString(GL_EXTENSIONS);
+        if (gl_ext_str && strstr(gl_ext_str, "GL_ARB_pixel_buffer_object")) {
+            glGenBuffers(2, g3d->pbo);
+            g3d->use_pbo = 1;
+        }
+    }
+#endif
+
     // clear surface
     glClearColor(0.0, 0.0, 0.0, 1.0);
     glClear(GL_COLOR_BUFFER_BIT);
 
-    glXMakeCurrent(display.x, None, NULL);
+    glXMakeCurrent(display.gl.x, None, NULL);
 
     g3d->sub_maps = g_hash_table_new(g_direct_hash, g_direct_equal);
-    pthread_mutex_unlock(&display.lock);
+    account_buffers(g3d);
+    lock_stats_unlock(display.gl.lock);
 
     pp_resource_release(context);
     return context;
 err:
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(display.gl.lock);
     pp_resource_release(context);
     pp_resource_expunge(context);
     return 0;
@@ -311,25 +843,42 @@ ppb_graphics3d_destroy(void *p)
     struct pp_graphics3d_s *g3d = p;
 
     g_hash_table_destroy(g3d->sub_maps);
-    pthread_mutex_lock(&display.lock);
+    set_accounted_memory(g3d, 0, 0);
+
+#if HAVE_EGL
+    if (g3d->use_egl) {
+        egl_destroy_context(g3d);
+        lock_stats_lock(display.gl.lock);
+        egl_free_x_resources(g3d);
+        lock_stats_unlock(display.gl.lock);
+        return;
+    }
+#endif // HAVE_EGL
+
+    lock_stats_lock(display.gl.lock);
 
     // bringing context to current thread releases it from any others
-    glXMakeCurrent(display.x, g3d->glx_pixmap, g3d->glc);
+    glXMakeCurrent(display.gl.x, g3d->glx_pixmap, g3d->glc);
+    if (g3d->use_pbo)
+        glDeleteBuffers(2, g3d->pbo);
     // free it here, to be able to destroy X Pixmap
-    glXMakeCurrent(display.x, None, NULL);
+    glXMakeCurrent(display.gl.x, None, NULL);
 
-    glXDestroyPixmap(display.x, g3d->glx_pixmap);
+    free(g3d->readback);
+    g3d->readback = NULL;
+
+    glXDestroyPixmap(display.gl.x, g3d->glx_pixmap);
 
     if (display.have_xrender) {
-        XRenderFreePicture(display.x, g3d->xr_pict[0]);
-        XRenderFreePicture(display.x, g3d->xr_pict[1]);
+        XRenderFreePicture(display.gl.x, g3d->xr_pict[0]);
+        XRenderFreePicture(display.gl.x, g3d->xr_pict[1]);
     }
 
-    XFreePixmap(display.x, g3d->pixmap[0]);
-    XFreePixmap(display.x, g3d->pixmap[1]);
+    XFreePixmap(display.gl.x, g3d->pixmap[0]);
+    XFreePixmap(display.gl.x, g3d->pixmap[1]);
 
-    glXDestroyContext(display.x, g3d->glc);
-    pthread_mutex_unlock(&display.lock);
+    glXDestroyContext(display.gl.x, g3d->glc);
+    lock_stats_unlock(display.gl.lock);
 }
 
 PP_Bool
@@ -370,46 +919,63 @@ ppb_graphics3d_resize_buffers(PP_Resource context, int32_t width, int32_t height
         return PP_ERROR_BADRESOURCE;
     }
 
-    g3d->width = width;
-    g3d->height = height;
+#if HAVE_EGL
+    if (g3d->use_egl) {
+        int32_t ret = egl_resize_buffers(g3d, width, height);
+        account_buffers(g3d);
+        pp_resource_release(context);
+        return ret;
+    }
+#endif // HAVE_EGL
 
     GLXPixmap old_glx_pixmap = g3d->glx_pixmap;
     Pixmap    old_pixmap[2] = { g3d->pixmap[0], g3d->pixmap[1] };
     Picture   old_pict[2] = { g3d->xr_pict[0], g3d->xr_pict[1] };
 
+    lock_stats_lock(display.gl.lock);
+    g3d->width = width;
+    g3d->height = height;
+
+    // frame of the old size can't be drawn anymore; buffer is reallocated on next swap
+    free(g3d->readback);
+    g3d->readback = NULL;
+    g3d->readback_size = 0;
+    g3d->readback_valid = 0;
+    g3d->pbo_pending = 0;
+
     // release possibly bound to other thread g3d->glx_pixmap and bind it to the current one
-    pthread_mutex_lock(&display.lock);
-    glXMakeCurrent(display.x, g3d->glx_pixmap, g3d->glc);
-    g3d->pixmap[0] = XCreatePixmap(display.x, DefaultRootWindow(display.x), g3d->width, g3d->height,
-                                   g3d->depth);
-    g3d->pixmap[1] = XCreatePixmap(display.x, DefaultRootWindow(display.x), g3d->width, g3d->height,
-                                   g3d->depth);
-    g3d->glx_pixmap = glXCreatePixmap(display.x, g3d->fb_config, g3d->pixmap[0], NULL);
-    XFlush(display.x);
+    glXMakeCurrent(display.gl.x, g3d->glx_pixmap, g3d->glc);
+    g3d->pixmap[0] = XCreatePixmap(display.gl.x, DefaultRootWindow(display.gl.x), g3d->width,
+                                   g3d->height, g3d->depth);
+    g3d->pixmap[1] = XCreatePixmap(display.gl.x, DefaultRootWindow(display.gl.x), g3d->width,
+                                   g3d->height, g3d->depth);
+    g3d->glx_pixmap = glXCreatePixmap(display.gl.x, g3d->fb_config, g3d->pixmap[0], NULL);
+    XFlush(display.gl.x);
     if (display.have_xrender) {
-        g3d->xr_pict[0] = XRenderCreatePicture(display.x, g3d->pixmap[0], g3d->xr_pictfmt, 0, 0);
-        g3d->xr_pict[1] = XRenderCreatePicture(display.x, g3d->pixmap[1], g3d->xr_pictfmt, 0, 0);
+        g3d->xr_pict[0] = XRenderCreatePicture(display.gl.x, g3d->pixmap[0], g3d->xr_pictfmt, 0, 0);
+        g3d->xr_pict[1] = XRenderCreatePicture(display.gl.x, g3d->pixmap[1], g3d->xr_pictfmt, 0, 0);
     }
 
     // make new g3d->glx_pixmap current to the current thread to allow releasing old_glx_pixmap
-    glXMakeCurrent(display.x, g3d->glx_pixmap, g3d->glc);
+    glXMakeCurrent(display.gl.x, g3d->glx_pixmap, g3d->glc);
 
     // clear surface
     glClearColor(0.0, 0.0, 0.0, 1.0);
     glClear(GL_COLOR_BUFFER_BIT);
 
     // destroy previous glx and x pixmaps
-    glXDestroyPixmap(display.x, old_glx_pixmap);
+    glXDestroyPixmap(display.gl.x, old_glx_pixmap);
 
     if (display.have_xrender) {
-        XRenderFreePicture(display.x, old_pict[0]);
-        XRenderFreePicture(display.x, old_pict[1]);
+        XRenderFreePicture(display.gl.x, old_pict[0]);
+        XRenderFreePicture(display.gl.x, old_pict[1]);
     }
 
-    XFreePixmap(display.x, old_pixmap[0]);
-    XFreePixmap(display.x, old_pixmap[1]);
+    XFreePixmap(display.gl.x, old_pixmap[0]);
+    XFreePixmap(display.gl.x, old_pixmap[1]);
 
-    pthread_mutex_unlock(&display.lock);
+    account_buffers(g3d);
+    lock_stats_unlock(display.gl.lock);
     pp_resource_release(context);
     return PP_OK;
 }
@@ -424,7 +990,7 @@ call_forceredraw_ptac(void *param)
         return;
     }
 
-    pthread_mutex_lock(&display.lock);
+    lock_stats_lock(&display.lock);
     if (pp_i->is_fullscreen || pp_i->windowed_mode) {
         XEvent ev = {
             .xgraphicsexpose = {
@@ -437,72 +1003,235 @@ call_forceredraw_ptac(void *param)
 
         XSendEvent(display.x, ev.xgraphicsexpose.drawable, True, ExposureMask, &ev);
         XFlush(display.x);
-        pthread_mutex_unlock(&display.lock);
+        lock_stats_unlock(&display.lock);
     } else {
-        pthread_mutex_unlock(&display.lock);
+        lock_stats_unlock(&display.lock);
         NPRect npr = {.top = 0, .left = 0, .bottom = pp_i->height, .right = pp_i->width};
         npn.invalidaterect(pp_i->npp, &npr);
         npn.forceredraw(pp_i->npp);
     }
 }
 
-int32_t
-ppb_graphics3d_swap_buffers(PP_Resource context, struct PP_CompletionCallback callback)
+/// collects frame left in flight by asynchronous readback. Called with display.gl.lock held
+static
+void
+glx_collect_readback(struct pp_graphics3d_s *g3d)
+{
+    if (!g3d->pbo_pending)
+        return;
+
+    glXMakeCurrent(display.gl.x, g3d->glx_pixmap, g3d->glc);
+    glx_collect_pending_frame(g3d);
+    glXMakeCurrent(display.gl.x, None, NULL);
+}
+
+/// finishes asynchronous readback of the swapped frame, then asks browser to draw it. Runs on
+/// plugin thread, so expose handler only draws what's already in memory
+static
+void
+collect_frame_comt(void *user_data, int32_t result)
 {
+    const PP_Resource context = GPOINTER_TO_SIZE(user_data);
     struct pp_graphics3d_s *g3d = pp_resource_acquire(context, PP_RESOURCE_GRAPHICS3D);
     if (!g3d) {
         trace_error("%s, bad resource\n", __func__);
-        return PP_ERROR_BADRESOURCE;
+        ppb_core_release_resource(context);
+        return;
     }
 
-    struct pp_instance_s *pp_i = g3d->instance;
+    const PP_Instance instance = g3d->instance->id;
 
-    pthread_mutex_lock(&display.lock);
-    if (pp_i->graphics != context) {
-        // Other context bound, do nothing.
-        pp_resource_release(context);
-        pthread_mutex_unlock(&display.lock);
-        return PP_ERROR_FAILED;
+    lock_stats_lock(display.gl.lock);
+    glx_collect_readback(g3d);
+    lock_stats_unlock(display.gl.lock);
+
+    pp_resource_release(context);
+    ppb_core_release_resource(context);
+
+    ppb_core_call_on_browser_thread(instance, call_forceredraw_ptac, GSIZE_TO_POINTER(instance));
+}
+
+/// copies finished frame to pixmap[1]. Called with display.gl.lock held. Returns whether frame
+/// is still in flight, to be collected by glx_collect_readback(), or -1 on failure
+static
+int
+glx_present_frame(struct pp_graphics3d_s *g3d)
+{
+    if (!glXMakeCurrent(display.gl.x, g3d->glx_pixmap, g3d->glc)) {
+        trace_error("%s, glXMakeCurrent failed\n", __func__);
+        return -1;
     }
 
-    if (pp_i->graphics_in_progress) {
-        pp_resource_release(context);
-        pthread_mutex_unlock(&display.lock);
-        return PP_ERROR_INPROGRESS;
+    if (!display.have_xrender && glx_read_frame(g3d) == 0) {
+        // software compositing needs frame in memory anyway, so it's read directly from GL
+        // instead of pulling it from pixmap[1] on each expose
+        glXMakeCurrent(display.gl.x, None, NULL);
+        return g3d->pbo_pending;
     }
 
-    glXMakeCurrent(display.x, g3d->glx_pixmap, g3d->glc);
     glFinish();  // ensure painting is done
-    glXMakeCurrent(display.x, None, NULL);
+    glXMakeCurrent(display.gl.x, None, NULL);
 
     // a round-trip to an X server is required here to be sure that drawing is completed
-    XSync(display.x, False);
+    XSync(display.gl.x, False);
 
     // copy from pixmap[0] to pixmap[1]
     if (display.have_xrender) {
-        XRenderComposite(display.x, PictOpSrc, g3d->xr_pict[0], None, g3d->xr_pict[1],
+        XRenderComposite(display.gl.x, PictOpSrc, g3d->xr_pict[0], None, g3d->xr_pict[1],
                          0, 0, 0, 0, 0, 0, g3d->width, g3d->height);
 
     } else {
-        const int screen = DefaultScreen(display.x);
-        const GC gc = DefaultGC(display.x, screen);
-        XCopyArea(display.x, g3d->pixmap[0], g3d->pixmap[1], gc, 0, 0, g3d->width, g3d->height,
+        const int screen = DefaultScreen(display.gl.x);
+        const GC gc = DefaultGC(display.gl.x, screen);
+        XCopyArea(display.gl.x, g3d->pixmap[0], g3d->pixmap[1], gc, 0, 0, g3d->width, g3d->height,
                   0, 0);
     }
 
     // a round-trip to an X server is required here to ensure that copying is completed, and further
     // GL drawing in this thread into pixmap[0] will not affect pixmap[1] which will be used in
     // another, browser thread
-    XSync(display.x, False);
+    XSync(display.gl.x, False);
+    return 0;
+}
+
+#if HAVE_EGL
+/// reads finished frame back and uploads it to pixmap[1]. Called with display.gl.lock held.
+/// Returns 0 on success, -1 if frame couldn't be read
+static
+int
+egl_present_frame(struct pp_graphics3d_s *g3d)
+{
+    const int32_t width = g3d->width;
+    const int32_t height = g3d->height;
+    const size_t frame_size = (size_t)width * height * 4;
+
+    if (frame_size == 0)
+        return 0;
+
+    // reading frame back doesn't involve X connection, don't block others while waiting. Frame
+    // goes to a buffer expose handler doesn't see, and replaces readback once complete
+    char *frame = g3d->readback_spare;
+    size_t frame_buf_size = g3d->readback_spare_size;
+    g3d->readback_spare = NULL;
+    g3d->readback_spare_size = 0;
+    lock_stats_unlock(display.gl.lock);
+
+    if (frame_buf_size != frame_size) {
+        free(frame);
+        frame = malloc(frame_size);
+        frame_buf_size = frame_size;
+    }
+
+    int read_ok = 0;
+    if (frame)
+        read_ok = (egl_read_frame(g3d, frame, width, height) == 0);
+    else
+        trace_error("%s, can't allocate memory\n", __func__);
+
+    lock_stats_lock(display.gl.lock);
+    if (!read_ok || g3d->width != width || g3d->height != height) {
+        // failed, or resized meanwhile so frame doesn't match new buffers
+        free(frame);
+        account_buffers(g3d);
+        return read_ok ? 0 : -1;
+    }
+
+    g3d->readback_spare = g3d->readback;
+    g3d->readback_spare_size = g3d->readback_size;
+    g3d->readback = frame;
+    g3d->readback_size = frame_buf_size;
+    g3d->readback_valid = 1;
+    account_buffers(g3d);
+
+    // software compositing draws from readback directly
+    if (!display.have_xrender)
+        return 0;
+
+    if (g3d->width > 0 && g3d->height > 0) {
+        Visual *visual = DefaultVisual(display.gl.x, DefaultScreen(display.gl.x));
+        XImage *xi = XCreateImage(display.gl.x, visual, g3d->depth, ZPixmap, 0, g3d->readback,
+                                  g3d->width, g3d->height, 32, g3d->width * 4);
+        XPutImage(display.gl.x, g3d->pixmap[1], g3d->gc, xi, 0, 0, 0, 0, g3d->width, g3d->height);
+        XFree(xi);
+    }
+
+    // pixmap[1] is used in browser thread through another connection, ensure upload is completed
+    XSync(display.gl.x, False);
+    return 0;
+}
+#endif // HAVE_EGL
+
+int32_t
+ppb_graphics3d_swap_buffers(PP_Resource context, struct PP_CompletionCallback callback)
+{
+    struct pp_graphics3d_s *g3d = pp_resource_acquire(context, PP_RESOURCE_GRAPHICS3D);
+    if (!g3d) {
+        trace_error("%s, bad resource\n", __func__);
+        return PP_ERROR_BADRESOURCE;
+    }
+
+    struct pp_instance_s *pp_i = g3d->instance;
+
+    lock_stats_lock(&display.lock);
+    if (pp_i->graphics != context) {
+        // Other context bound, do nothing.
+        pp_resource_release(context);
+        lock_stats_unlock(&display.lock);
+        return PP_ERROR_FAILED;
+    }
+
+    if (pp_i->graphics_in_progress) {
+        pp_resource_release(context);
+        lock_stats_unlock(&display.lock);
+        return PP_ERROR_INPROGRESS;
+    }
+
+    // frame is claimed before presenting, so concurrent swaps don't present both. Callback is
+    // set once frame is there; until then expose has nothing to complete
+    pp_i->graphics_in_progress = 1;
+    lock_stats_unlock(&display.lock);
+
+    // frame is copied over GL connection only, instance state is not locked meanwhile
+    int frame_in_flight;
+    lock_stats_lock(display.gl.lock);
+#if HAVE_EGL
+    if (g3d->use_egl)
+        frame_in_flight = egl_present_frame(g3d);
+    else
+#endif
+        frame_in_flight = glx_present_frame(g3d);
+    lock_stats_unlock(display.gl.lock);
 
     pp_resource_release(context);
 
+    lock_stats_lock(&display.lock);
+    if (frame_in_flight < 0) {
+        pp_i->graphics_in_progress = 0;
+        lock_stats_unlock(&display.lock);
+        return PP_ERROR_FAILED;
+    }
+
     pp_i->graphics_ccb = callback;
     pp_i->graphics_ccb_ml = ppb_message_loop_get_current();
-    pp_i->graphics_in_progress = 1;
-    pthread_mutex_unlock(&display.lock);
-
-    ppb_core_call_on_browser_thread(pp_i->id, call_forceredraw_ptac, GSIZE_TO_POINTER(pp_i->id));
+    lock_stats_unlock(&display.lock);
+
+    const PP_Resource m_loop = ppb_message_loop_get_current();
+    if (frame_in_flight) {
+        // let GPU finish transfer while plugin goes on; redraw is requested once frame is in.
+        // Without a message loop to come back to, frame is collected right away
+        ppb_core_add_ref_resource(context);
+        struct PP_CompletionCallback ccb = PP_MakeCCB(collect_frame_comt,
+                                                      GSIZE_TO_POINTER(context));
+        if (m_loop == 0 || ppb_message_loop_post_work_with_priority(m_loop, ccb, 0, PP_OK, 0,
+                                                                    ML_PRIORITY_PAINT,
+                                                                    __func__) != PP_OK)
+        {
+            collect_frame_comt(GSIZE_TO_POINTER(context), PP_OK);
+        }
+    } else {
+        ppb_core_call_on_browser_thread(pp_i->id, call_forceredraw_ptac,
+                                        GSIZE_TO_POINTER(pp_i->id));
+    }
 
     if (callback.func)
         return PP_OK_COMPLETIONPENDING;
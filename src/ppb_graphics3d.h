@@ -30,6 +30,11 @@
 #include <X11/extensions/Xrender.h>
 #include <glib.h>
 #include <ppapi/c/ppb_graphics_3d.h>
+#include <pthread.h>
+
+#if HAVE_EGL
+#include <EGL/egl.h>
+#endif
 
 struct pp_graphics3d_s {
     COMMON_STRUCTURE_FIELDS
@@ -43,8 +48,45 @@ struct pp_graphics3d_s {
     int32_t             width;
     int32_t             height;
     GHashTable         *sub_maps;
+    // readback fields, and width and height, are protected by display.gl.lock, as expose
+    // handler draws from them
+    char               *readback;       ///< last frame read back from GL, in X pixel format
+    size_t              readback_size;
+    int                 readback_valid; ///< readback can be drawn instead of pixmap[1]
+    int                 use_pbo;        ///< readback goes through pixel buffer objects
+    GLuint              pbo[2];         ///< ring of pixel buffers for asynchronous readback
+    uint32_t            pbo_idx;        ///< pixel buffer to read next frame into
+    int                 pbo_pending;    ///< pbo[1 - pbo_idx] holds frame not yet in readback
+    int                 use_egl;        ///< rendering goes to EGL offscreen FBO, not GLX pixmap
+    int64_t             accounted_heap;     ///< readback size known to mem_accounting
+    int64_t             accounted_pixmaps;  ///< pixmaps size known to mem_accounting
+#if HAVE_EGL
+    EGLContext          egl_ctx;
+    EGLSurface          egl_surf;       ///< 1x1 pbuffer, or EGL_NO_SURFACE for surfaceless
+    GLuint              fbo;            ///< framebuffer object substituting default framebuffer
+    GLuint              fbo_color;      ///< color renderbuffer of fbo
+    GLuint              fbo_depth_stencil;  ///< depth and stencil renderbuffer of fbo, if any
+    GC                  gc;             ///< GC for uploading readback to pixmap[1]
+    char               *readback_spare; ///< next frame is read here, then swapped with readback
+    size_t              readback_spare_size;
+    pthread_mutex_t     egl_lock;       ///< held while context is current to some thread
+#endif
 };
 
+/// makes context current to the calling thread. Returns 0 on success
+///
+/// GLX contexts are used through display.gl.x, so display.gl.lock is taken; EGL contexts have
+/// a lock of their own. On success, must be paired with ppb_graphics3d_release_current()
+int
+ppb_graphics3d_make_current(struct pp_graphics3d_s *g3d);
+
+void
+ppb_graphics3d_release_current(struct pp_graphics3d_s *g3d);
+
+/// translates framebuffer name passed by plugin into an actual one
+GLuint
+ppb_graphics3d_map_framebuffer(struct pp_graphics3d_s *g3d, GLuint framebuffer);
+
 int32_t
 ppb_graphics3d_get_attrib_max_value(PP_Resource instance, int32_t attribute, int32_t *value);
 
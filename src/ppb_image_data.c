@@ -22,10 +22,12 @@
  * SOFTWARE.
  */
 
+#include "mem_accounting.h"
 #include "pp_interface.h"
 #include "pp_resource.h"
 #include "ppb_core.h"
 #include "ppb_image_data.h"
+#include "ppb_instance.h"
 #include "reverse_constant.h"
 #include "static_assert.h"
 #include "tables.h"
@@ -86,6 +88,8 @@ ppb_image_data_create(PP_Instance instance, PP_ImageDataFormat format,
         trace_error("%s, can't allocate memory for image\n", __func__);
         return 0;
     }
+    mem_accounting_change(instance, PP_RESOURCE_IMAGE_DATA, MEM_KIND_HEAP,
+                          (int64_t)id->stride * id->height);
 
     id->cairo_surf = cairo_image_surface_create_for_data((void *)id->data, CAIRO_FORMAT_ARGB32,
                                                          id->width, id->height, id->stride);
@@ -105,6 +109,10 @@ ppb_image_data_destroy(void *p)
         cairo_surface_destroy(id->cairo_surf);
         id->cairo_surf = NULL;
     }
+    if (id->data) {
+        mem_accounting_change(id->instance->id, PP_RESOURCE_IMAGE_DATA, MEM_KIND_HEAP,
+                              -(int64_t)id->stride * id->height);
+    }
     free_and_nullify(id->data);
 }
 
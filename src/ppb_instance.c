@@ -41,6 +41,9 @@
 
 STATIC_ASSERT(sizeof(struct pp_instance_s) <= LARGEST_RESOURCE_SIZE);
 
+/// protects window_obj_var and owner_element_var of all instances
+static pthread_mutex_t cached_objects_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static
 void
 call_invalidaterect_ptac(void *param)
@@ -67,9 +70,9 @@ ppb_instance_bind_graphics(PP_Instance instance, PP_Resource device)
     if (device == 0) {
         // unbind
         ppb_core_release_resource(pp_i->graphics);
-        pthread_mutex_lock(&display.lock);
+        lock_stats_lock(&display.lock);
         pp_i->graphics = 0;
-        pthread_mutex_unlock(&display.lock);
+        lock_stats_unlock(&display.lock);
         return PP_TRUE;
     }
 
@@ -83,10 +86,10 @@ ppb_instance_bind_graphics(PP_Instance instance, PP_Resource device)
             goto done;
         }
 
-        pthread_mutex_lock(&display.lock);
+        lock_stats_lock(&display.lock);
         const PP_Resource previous_device = pp_i->graphics;
         pp_i->graphics = device;
-        pthread_mutex_unlock(&display.lock);
+        lock_stats_unlock(&display.lock);
 
         if (device != previous_device) {
             ppb_core_add_ref_resource(device);
@@ -102,10 +105,10 @@ ppb_instance_bind_graphics(PP_Instance instance, PP_Resource device)
             goto done;
         }
 
-        pthread_mutex_lock(&display.lock);
+        lock_stats_lock(&display.lock);
         const PP_Resource previous_device = pp_i->graphics;
         pp_i->graphics = device;
-        pthread_mutex_unlock(&display.lock);
+        lock_stats_unlock(&display.lock);
 
         if (device != previous_device) {
             ppb_core_add_ref_resource(device);
@@ -141,9 +144,9 @@ ppb_instance_is_full_frame(PP_Instance instance)
         return PP_FALSE;
     }
 
-    pthread_mutex_lock(&display.lock);
+    lock_stats_lock(&display.lock);
     int is_fullframe = pp_i->is_fullframe;
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(&display.lock);
 
     if (is_fullframe)
         return PP_TRUE;
@@ -151,8 +154,9 @@ ppb_instance_is_full_frame(PP_Instance instance)
         return PP_FALSE;
 }
 
-struct get_window_object_param_s {
+struct get_object_param_s {
     PP_Instance     instance;
+    int             owner_element;  ///< plugin element instead of window
     struct PP_Var   result;
     PP_Resource     m_loop;
     int             depth;
@@ -160,9 +164,9 @@ struct get_window_object_param_s {
 
 static
 void
-get_window_object_ptac(void *param)
+get_object_ptac(void *param)
 {
-    struct get_window_object_param_s *p = param;
+    struct get_object_param_s *p = param;
 
     struct pp_instance_s *pp_i = tables_get_pp_instance(p->instance);
     if (!pp_i) {
@@ -171,8 +175,14 @@ get_window_object_ptac(void *param)
         goto done;
     }
 
-    npn.retainobject(pp_i->np_window_obj);
-    p->result = ppb_var_create_object(p->instance, &n2p_proxy_class, pp_i->np_window_obj);
+    NPObject *np_obj = p->owner_element ? pp_i->np_plugin_element_obj : pp_i->np_window_obj;
+    if (!np_obj) {
+        p->result = PP_MakeUndefined();
+        goto done;
+    }
+
+    npn.retainobject(np_obj);
+    p->result = ppb_var_create_object(p->instance, &n2p_proxy_class, np_obj);
 
 done:
     ppb_message_loop_post_quit_depth(p->m_loop, PP_FALSE, p->depth);
@@ -180,33 +190,101 @@ done:
 
 static
 void
-get_window_object_comt(void *user_data, int32_t result)
+get_object_comt(void *user_data, int32_t result)
 {
-    struct get_window_object_param_s *p = user_data;
-    ppb_core_call_on_browser_thread(0, get_window_object_ptac, p);
+    struct get_object_param_s *p = user_data;
+    ppb_core_call_on_browser_thread(0, get_object_ptac, p);
 }
 
+// Window and owner element proxies are created once per instance and kept in a cache, as
+// Flash requests window object at the start of nearly every ExternalInterface call.
+static
 struct PP_Var
-ppb_instance_get_window_object(PP_Instance instance)
+get_cached_object(PP_Instance instance, int owner_element)
 {
-    struct get_window_object_param_s *p = g_slice_alloc(sizeof(*p));
-    p->instance =   instance;
-    p->m_loop =     ppb_message_loop_get_current();
-    p->depth =      ppb_message_loop_get_depth(p->m_loop) + 1;
+    struct pp_instance_s *pp_i = tables_get_pp_instance(instance);
+    if (!pp_i) {
+        trace_error("%s, bad instance\n", __func__);
+        return PP_MakeUndefined();
+    }
+
+    struct PP_Var *cached = owner_element ? &pp_i->owner_element_var : &pp_i->window_obj_var;
+
+    pthread_mutex_lock(&cached_objects_lock);
+    if (cached->type == PP_VARTYPE_OBJECT) {
+        struct PP_Var result = ppb_var_add_ref2(*cached);
+        pthread_mutex_unlock(&cached_objects_lock);
+        return result;
+    }
+    pthread_mutex_unlock(&cached_objects_lock);
+
+    struct get_object_param_s *p = g_slice_alloc(sizeof(*p));
+    p->instance =       instance;
+    p->owner_element =  owner_element;
+    p->m_loop =         ppb_message_loop_get_current();
+    p->depth =          ppb_message_loop_get_depth(p->m_loop) + 1;
 
-    ppb_message_loop_post_work_with_result(p->m_loop, PP_MakeCCB(get_window_object_comt, p), 0,
+    ppb_message_loop_post_work_with_result(p->m_loop, PP_MakeCCB(get_object_comt, p), 0,
                                            PP_OK, p->depth, __func__);
     ppb_message_loop_run_nested(p->m_loop);
 
     struct PP_Var result = p->result;
     g_slice_free1(sizeof(*p), p);
+
+    if (result.type != PP_VARTYPE_OBJECT)
+        return result;
+
+    // instance could have gone while nested loop was running
+    pp_i = tables_get_pp_instance(instance);
+    if (!pp_i)
+        return result;
+
+    struct PP_Var extra_ref = PP_MakeUndefined();
+
+    pthread_mutex_lock(&cached_objects_lock);
+    cached = owner_element ? &pp_i->owner_element_var : &pp_i->window_obj_var;
+    if (cached->type == PP_VARTYPE_OBJECT) {
+        // other thread was faster, use its proxy
+        extra_ref = result;
+        result = ppb_var_add_ref2(*cached);
+    } else {
+        *cached = ppb_var_add_ref2(result);
+    }
+    pthread_mutex_unlock(&cached_objects_lock);
+
+    // releasing proxy may require browser thread, do that without holding the lock
+    ppb_var_release(extra_ref);
     return result;
 }
 
+struct PP_Var
+ppb_instance_get_window_object(PP_Instance instance)
+{
+    return get_cached_object(instance, 0);
+}
+
 struct PP_Var
 ppb_instance_get_owner_element_object(PP_Instance instance)
 {
-    return PP_MakeUndefined();
+    return get_cached_object(instance, 1);
+}
+
+void
+ppb_instance_drop_cached_objects(PP_Instance instance)
+{
+    struct pp_instance_s *pp_i = tables_get_pp_instance(instance);
+    if (!pp_i)
+        return;
+
+    pthread_mutex_lock(&cached_objects_lock);
+    struct PP_Var window_obj_var = pp_i->window_obj_var;
+    struct PP_Var owner_element_var = pp_i->owner_element_var;
+    pp_i->window_obj_var = PP_MakeUndefined();
+    pp_i->owner_element_var = PP_MakeUndefined();
+    pthread_mutex_unlock(&cached_objects_lock);
+
+    ppb_var_release(window_obj_var);
+    ppb_var_release(owner_element_var);
 }
 
 struct execute_script_param_s {
@@ -327,7 +405,7 @@ TRACE_WRAPPER
 struct PP_Var
 trace_ppb_instance_get_owner_element_object(PP_Instance instance)
 {
-    trace_info("[PPB] {zilch} %s instance=%d\n", __func__+6, instance);
+    trace_info("[PPB] {full} %s instance=%d\n", __func__+6, instance);
     return ppb_instance_get_owner_element_object(instance);
 }
 
@@ -350,7 +428,7 @@ const struct PPB_Instance_1_0 ppb_instance_interface_1_0 = {
 
 const struct PPB_Instance_Private_0_1 ppb_instance_private_interface_0_1 = {
     .GetWindowObject =          TWRAPF(ppb_instance_get_window_object),
-    .GetOwnerElementObject =    TWRAPZ(ppb_instance_get_owner_element_object),
+    .GetOwnerElementObject =    TWRAPF(ppb_instance_get_owner_element_object),
     .ExecuteScript =            TWRAPF(ppb_instance_execute_script),
 };
 
@@ -25,6 +25,7 @@
 #pragma once
 
 #include "gtk_wrapper.h"
+#include <X11/extensions/Xrender.h>
 #include <glib.h>
 #include <npapi/npapi.h>
 #include <npapi/npruntime.h>
@@ -35,6 +36,31 @@
 #include <pthread.h>
 #include <stdint.h>
 
+#define G2D_XRES_POOL_SIZE  3
+
+/// server-side resources used by Graphics2D to present transparent instances
+struct g2d_xres_s {
+    Pixmap      pixmap;
+    Picture     xr_pict;
+    GC          gc;
+    int32_t     width;          ///< allocated width, rounded up to a bucket size
+    int32_t     height;         ///< allocated height, rounded up to a bucket size
+    int32_t     depth;
+    uint32_t    in_use;
+    gint64      released_at;    ///< monotonic time of last release, in microseconds
+};
+
+/// per-instance pool of Graphics2D presentation resources. Graphics2D resources can outlive
+/// their instance, so pool is reference counted: instance holds one reference, and each
+/// Graphics2D occupying a slot holds another. Protected by display.g2d.lock
+struct g2d_xres_pool_s {
+    int                 ref_cnt;
+    PP_Instance         instance;
+    uint32_t            trim_scheduled;
+    uint32_t            orphaned;       ///< instance is gone, released slots are freed at once
+    struct g2d_xres_s   slot[G2D_XRES_POOL_SIZE];
+};
+
 struct pp_instance_s {
     const struct PPP_Instance_1_1  *ppp_instance_1_1;
     const struct PPP_InputEvent_0_1 *ppp_input_event;
@@ -43,6 +69,8 @@ struct pp_instance_s {
     struct PP_Var                   scriptable_pp_obj;
     NPObject                       *np_window_obj;
     NPObject                       *np_plugin_element_obj;
+    struct PP_Var                   window_obj_var;         ///< cached proxy of np_window_obj
+    struct PP_Var                   owner_element_var;      ///< cached proxy of np_plugin_element_obj
     uint32_t                        event_mask;
     uint32_t                        filtered_event_mask;
     Window                          wnd;
@@ -110,6 +138,9 @@ struct pp_instance_s {
     uint32_t                        graphics_in_progress;
     PP_Resource                     graphics_ccb_ml;
 
+    // Graphics2D presentation resources, kept across rebinds and resizes
+    struct g2d_xres_pool_s         *g2d_xres_pool;
+
     // input method context
     PP_TextInput_Type_Dev           textinput_type;
     GtkIMContext                   *im_context;
@@ -129,5 +160,9 @@ ppb_instance_get_window_object(PP_Instance instance);
 struct PP_Var
 ppb_instance_get_owner_element_object(PP_Instance instance);
 
+/// releases cached window and owner element proxies; they are recreated on next request
+void
+ppb_instance_drop_cached_objects(PP_Instance instance);
+
 struct PP_Var
 ppb_instance_execute_script(PP_Instance instance, struct PP_Var script, struct PP_Var *exception);
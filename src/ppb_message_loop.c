@@ -23,24 +23,36 @@
  */
 
 #include "compat.h"
+#include "config.h"
+#include "hang_watchdog.h"
 #include "pp_interface.h"
 #include "pp_resource.h"
 #include "ppb_message_loop.h"
 #include "static_assert.h"
 #include "tables.h"
+#include "task_profiler.h"
 #include "thread_local.h"
 #include "trace_core.h"
 #include <glib.h>
 #include <inttypes.h>
 #include <ppapi/c/pp_errors.h>
 #include <stdlib.h>
+#include <sys/prctl.h>
 #include <sys/time.h>
 #include <time.h>
 
+/// tasks which were taken from async_q, one tree per priority class. Quit requests are kept
+/// apart, they are not subject to class ordering
+struct task_queue_s {
+    GTree                  *tree[ML_PRIORITY_COUNT];
+    GTree                  *quit_tree;
+    uint64_t                serial;     ///< keeps order of tasks with equal deadlines
+};
+
 struct pp_message_loop_s {
     COMMON_STRUCTURE_FIELDS
     GAsyncQueue            *async_q;
-    GTree                  *int_q;
+    struct task_queue_s    *int_q;
     int                     running;
     int                     teardown;
     int                     depth;
@@ -51,10 +63,23 @@ STATIC_ASSERT(sizeof(struct pp_message_loop_s) <= LARGEST_RESOURCE_SIZE);
 static PP_Resource main_thread_message_loop = 0;
 static PP_Resource browser_thread_message_loop = 0;
 
+/// due task which waits for longer than that is run ahead of higher priority ones
+#define STARVATION_LIMIT_US     (100 * 1000)
+
+static struct {
+    volatile gint   wakeups;
+    volatile gint   timer_wakeups;
+    volatile gint   idle_wakeups;
+    volatile gint   tasks_run;
+    volatile gint   coalesced_tasks;
+} stats;
+
 struct message_loop_task_s {
     struct timespec                 when;
     int                             terminate;
     int                             depth;
+    enum ml_priority_e              priority;
+    uint64_t                        serial;
     const char                     *origin;     ///< name of the function that scheduled the task
     struct PP_CompletionCallback    ccb;
     int32_t                         result_to_pass;
@@ -75,10 +100,30 @@ task_tree_compare_func(gconstpointer a, gconstpointer b)
         return -1;
     else if (task_a->when.tv_nsec > task_b->when.tv_nsec)
         return 1;
+    else if (task_a->serial < task_b->serial)
+        return -1;
+    else if (task_a->serial > task_b->serial)
+        return 1;
     else
         return 0;
 }
 
+static
+void
+task_queue_insert(struct task_queue_s *q, struct message_loop_task_s *task)
+{
+    task->serial = q->serial ++;
+    g_tree_insert(task->terminate ? q->quit_tree : q->tree[task->priority], task,
+                  GINT_TO_POINTER(1));
+}
+
+static
+void
+task_queue_remove(struct task_queue_s *q, struct message_loop_task_s *task)
+{
+    g_tree_remove(task->terminate ? q->quit_tree : q->tree[task->priority], task);
+}
+
 PP_Resource
 ppb_message_loop_create(PP_Instance instance)
 {
@@ -96,7 +141,10 @@ ppb_message_loop_create(PP_Instance instance)
     }
 
     ml->async_q = g_async_queue_new();
-    ml->int_q = g_tree_new(task_tree_compare_func);
+    ml->int_q = g_slice_alloc0(sizeof(*ml->int_q));
+    for (int k = 0; k < ML_PRIORITY_COUNT; k ++)
+        ml->int_q->tree[k] = g_tree_new(task_tree_compare_func);
+    ml->int_q->quit_tree = g_tree_new(task_tree_compare_func);
     ml->depth = 0;  // running loop will always have depth > 0
 
     pp_resource_release(message_loop);
@@ -115,7 +163,10 @@ ppb_message_loop_destroy(void *p)
     }
 
     if (ml->int_q) {
-        g_tree_destroy(ml->int_q);
+        for (int k = 0; k < ML_PRIORITY_COUNT; k ++)
+            g_tree_destroy(ml->int_q->tree[k]);
+        g_tree_destroy(ml->int_q->quit_tree);
+        g_slice_free1(sizeof(*ml->int_q), ml->int_q);
         ml->int_q = NULL;
     }
 }
@@ -135,6 +186,7 @@ ppb_message_loop_proclaim_this_thread_main(void)
     }
 
     main_thread_message_loop = get_thread_local()->this_thread_message_loop;
+    thread_local_set_role(THREAD_ROLE_PLUGIN_MAIN);
     return PP_OK;
 }
 
@@ -153,6 +205,7 @@ ppb_message_loop_proclaim_this_thread_browser(void)
     }
 
     browser_thread_message_loop = get_thread_local()->this_thread_message_loop;
+    thread_local_set_role(THREAD_ROLE_BROWSER);
     return PP_OK;
 }
 
@@ -165,6 +218,11 @@ ppb_message_loop_get_current(void)
 int
 ppb_message_loop_get_depth(PP_Resource message_loop)
 {
+    // loop's depth is only changed by the thread it's attached to, which keeps a copy
+    struct thread_local_block *tl = get_thread_local();
+    if (message_loop == tl->this_thread_message_loop && message_loop != 0)
+        return tl->message_loop_depth;
+
     struct pp_message_loop_s *ml = pp_resource_acquire(message_loop, PP_RESOURCE_MESSAGE_LOOP);
     if (!ml) {
         trace_error("%s, bad resource\n", __func__);
@@ -182,8 +240,9 @@ ppb_message_loop_mark_thread_unsuitable(void)
     get_thread_local()->thread_is_not_suitable_for_message_loop = 1;
 }
 
+static
 int32_t
-ppb_message_loop_attach_to_current_thread(PP_Resource message_loop)
+attach_to_current_thread(PP_Resource message_loop, int plugin_thread)
 {
     if (pp_resource_get_type(message_loop) != PP_RESOURCE_MESSAGE_LOOP) {
         trace_error("%s, bad resource\n", __func__);
@@ -201,9 +260,34 @@ ppb_message_loop_attach_to_current_thread(PP_Resource message_loop)
     }
 
     get_thread_local()->this_thread_message_loop = message_loop;
+    get_thread_local()->message_loop_depth = 0;
+
+    // let kernel group this thread's timer expirations with others. Browser thread is not
+    // ours, its timers are left alone
+    if (plugin_thread && config.timer_slack_ms > 0) {
+        if (prctl(PR_SET_TIMERSLACK, (unsigned long)config.timer_slack_ms * 1000 * 1000) != 0)
+            trace_warning("%s, can't set timer slack\n", __func__);
+    }
+
     return PP_OK;
 }
 
+int32_t
+ppb_message_loop_attach_to_current_thread(PP_Resource message_loop)
+{
+    return attach_to_current_thread(message_loop, 1);
+}
+
+int32_t
+ppb_message_loop_attach_to_browser_thread(PP_Resource message_loop)
+{
+    int32_t ret = attach_to_current_thread(message_loop, 0);
+    if (ret != PP_OK)
+        return ret;
+
+    return ppb_message_loop_proclaim_this_thread_browser();
+}
+
 int32_t
 ppb_message_loop_run(PP_Resource message_loop)
 {
@@ -258,6 +342,132 @@ find_first_task_with_appropriate_depth(GTree *q, int current_depth)
     return state.result;
 }
 
+static
+gint64
+timespec_to_us(const struct timespec *ts)
+{
+    return (gint64)ts->tv_sec * 1000 * 1000 + ts->tv_nsec / 1000;
+}
+
+/// computes how long to wait for a task, in microseconds. With timer slack, wakeup is
+/// postponed to the end of the slack window the deadline falls in. Windows are aligned to
+/// wall clock, so tasks of all loops with deadlines within the same window share a wakeup
+static
+gint64
+get_task_timeout(const struct message_loop_task_s *task, gint64 now_us)
+{
+    gint64 when_us = timespec_to_us(&task->when);
+
+    if (when_us <= now_us)
+        return 0;
+
+    const gint64 slack_us = (gint64)config.timer_slack_ms * 1000;
+    if (slack_us > 0)
+        when_us = (when_us + slack_us - 1) / slack_us * slack_us;
+
+    return when_us - now_us;
+}
+
+static
+void
+pump_async_queue(GAsyncQueue *async_q, struct task_queue_s *int_q)
+{
+    struct message_loop_task_s *task;
+    while ((task = g_async_queue_try_pop(async_q)) != NULL)
+        task_queue_insert(int_q, task);
+}
+
+/// picks task to run next. Among due tasks, the one of the highest priority class wins, unless
+/// a lower priority task is waiting for too long. Due quit request goes ahead of everything
+/// queued after it. If nothing is due, returns the task to wait for. |timeout| receives time
+/// to wait, zero if returned task should be run right now
+static
+struct message_loop_task_s *
+pick_task(struct task_queue_s *q, int depth, gint64 *timeout)
+{
+    struct message_loop_task_s *due = NULL;
+    struct message_loop_task_s *starving = NULL;
+    struct message_loop_task_s *next = NULL;
+    gint64 next_timeout = 0;
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    const gint64 now_us = timespec_to_us(&now);
+
+    struct message_loop_task_s *quit = find_first_task_with_appropriate_depth(q->quit_tree,
+                                                                              depth);
+    if (quit) {
+        next_timeout = get_task_timeout(quit, now_us);
+        next = quit;
+        if (next_timeout > 0)
+            quit = NULL;
+    }
+
+    for (int k = 0; k < ML_PRIORITY_COUNT; k ++) {
+        struct message_loop_task_s *task = find_first_task_with_appropriate_depth(q->tree[k],
+                                                                                  depth);
+        if (!task)
+            continue;
+
+        // trees are ordered by time, nothing in this one was queued before due quit request
+        if (quit && task_tree_compare_func(task, quit) > 0)
+            continue;
+
+        const gint64 task_timeout = get_task_timeout(task, now_us);
+        if (task_timeout > 0) {
+            if (!next || task_timeout < next_timeout) {
+                next = task;
+                next_timeout = task_timeout;
+            }
+            continue;
+        }
+
+        if (!due) {
+            due = task;
+        } else if (now_us - timespec_to_us(&task->when) > STARVATION_LIMIT_US) {
+            if (!starving || task_tree_compare_func(task, starving) < 0)
+                starving = task;
+        }
+    }
+
+    // due task of a higher class, if older, is starving too; the oldest goes first
+    if (starving && task_tree_compare_func(due, starving) < 0)
+        starving = due;
+
+    if (starving || due) {
+        *timeout = 0;
+        return starving ? starving : due;
+    }
+
+    if (quit) {
+        *timeout = 0;
+        return quit;
+    }
+
+    *timeout = next_timeout;
+    return next;
+}
+
+void
+ppb_message_loop_get_stats(struct ppb_message_loop_stats_s *s)
+{
+    s->wakeups =         g_atomic_int_get(&stats.wakeups);
+    s->timer_wakeups =   g_atomic_int_get(&stats.timer_wakeups);
+    s->idle_wakeups =    g_atomic_int_get(&stats.idle_wakeups);
+    s->tasks_run =       g_atomic_int_get(&stats.tasks_run);
+    s->coalesced_tasks = g_atomic_int_get(&stats.coalesced_tasks);
+}
+
+void
+ppb_message_loop_reset_stats(void)
+{
+    g_atomic_int_set(&stats.wakeups, 0);
+    g_atomic_int_set(&stats.timer_wakeups, 0);
+    g_atomic_int_set(&stats.idle_wakeups, 0);
+    g_atomic_int_set(&stats.tasks_run, 0);
+    g_atomic_int_set(&stats.coalesced_tasks, 0);
+}
+
 int32_t
 ppb_message_loop_run_int(PP_Resource message_loop, uint32_t flags)
 {
@@ -289,39 +499,46 @@ ppb_message_loop_run_int(PP_Resource message_loop, uint32_t flags)
 
     ml->running = 1;
     ml->teardown = 0;
-    if (flags & ML_INCREASE_DEPTH)
+    if (flags & ML_INCREASE_DEPTH) {
         ml->depth++;
+        get_thread_local()->message_loop_depth++;
+    }
 
     int teardown = 0;
     int destroy_ml = 0;
     int depth = ml->depth;
     pp_resource_ref(message_loop);
     GAsyncQueue *async_q = ml->async_q;
-    GTree *int_q = ml->int_q;
+    struct task_queue_s *int_q = ml->int_q;
     pp_resource_release(message_loop);
 
     if (flags & ML_EXIT_ON_EMPTY) {
-        // pump tasks from async_q to int_q. If there is no ML_EXIT_ON_EMPTY in flags, such
-        // action is not necessary
-        struct message_loop_task_s *task;
-        do {
-            task = g_async_queue_try_pop(async_q);
-            if (task)
-                g_tree_insert(int_q, task, GINT_TO_POINTER(1));
-        } while (task != NULL);
+        // pump tasks from async_q to int_q, to know whether there are any
+        pump_async_queue(async_q, int_q);
+    }
+
+    int tasks_since_wakeup = 0;
+    int timer_wakeup = 0;
+
+    // browser thread loop is watched through calls posted to it
+    const int watched = message_loop != ppb_message_loop_get_for_browser_thread();
+    if (watched) {
+        hang_watchdog_thread_enter(message_loop == ppb_message_loop_get_for_main_thread()
+                                       ? "plugin main thread" : "message loop thread");
+        hang_watchdog_thread_busy();
     }
 
     while (1) {
-        struct timespec now;
-        struct message_loop_task_s *task = find_first_task_with_appropriate_depth(int_q, depth);
-        gint64 timeout = 1000 * 1000;
+        // all posted tasks should be visible to pick_task(), for priorities to work
+        if (!(flags & ML_EXIT_ON_EMPTY))
+            pump_async_queue(async_q, int_q);
+
+        gint64 timeout;
+        struct message_loop_task_s *task = pick_task(int_q, depth, &timeout);
         if (task) {
-            clock_gettime(CLOCK_REALTIME, &now);
-            timeout = (task->when.tv_sec - now.tv_sec) * 1000 * 1000 +
-                      (task->when.tv_nsec - now.tv_nsec) / 1000;
-            if (timeout <= 0) {
+            if (timeout == 0) {
                 // remove task from the queue
-                g_tree_remove(int_q, task);
+                task_queue_remove(int_q, task);
 
                 if (task->terminate) {
                     // if depth > 1 or loop was reentered with no depth increase, it's a nested loop
@@ -344,13 +561,31 @@ ppb_message_loop_run_int(PP_Resource message_loop, uint32_t flags)
                     continue;
                 }
 
-                // run task
+                // run task. Tasks of the outermost loop are separate plugin calls
+                if (depth == 1)
+                    get_thread_local()->task_serial ++;
+                g_atomic_int_inc(&stats.tasks_run);
+                if (timer_wakeup && tasks_since_wakeup > 0)
+                    g_atomic_int_inc(&stats.coalesced_tasks);
+                tasks_since_wakeup ++;
                 const struct PP_CompletionCallback ccb = task->ccb;
                 if (ccb.func) {
+                    const int profile = task_profiler_enabled();
+                    struct timespec start, end;
+
                     trace_info_f("   calling callback={.func=%p, .user_data=%p, .flags=%d}, "
                                  "result=%d, origin=%s\n", ccb.func, ccb.user_data, ccb.flags,
                                  task->result_to_pass, task->origin);
+                    if (profile)
+                        clock_gettime(CLOCK_REALTIME, &start);
                     ccb.func(ccb.user_data, task->result_to_pass);
+                    if (profile) {
+                        clock_gettime(CLOCK_REALTIME, &end);
+                        const gint64 start_us = timespec_to_us(&start);
+                        task_profiler_record(task->origin, ccb.func,
+                                             start_us - timespec_to_us(&task->when),
+                                             timespec_to_us(&end) - start_us);
+                    }
                     trace_info_f("   returning from callback={.func=%p, .user_data=%p, .flags=%d}, "
                                  "result=%d, origin=%s\n", ccb.func, ccb.user_data, ccb.flags,
                                  task->result_to_pass, task->origin);
@@ -366,14 +601,45 @@ ppb_message_loop_run_int(PP_Resource message_loop, uint32_t flags)
         } else if (flags & ML_EXIT_ON_EMPTY) {
             // loop break was requested for "no-task" condition; and there is no tasks left
             break;
+        } else {
+            timeout = -1;   // wait indefinitely, there is nothing to do
+        }
+
+        // thread is going to sleep. If it was awake with nothing to run, that wakeup was wasted
+        if (timer_wakeup && tasks_since_wakeup == 0)
+            g_atomic_int_inc(&stats.idle_wakeups);
+
+        if (watched)
+            hang_watchdog_thread_waiting(depth > 1);
+
+        if (timeout < 0)
+            task = g_async_queue_pop(async_q);
+        else
+            task = g_async_queue_timeout_pop(async_q, timeout);
+
+        if (watched)
+            hang_watchdog_thread_busy();
+
+        g_atomic_int_inc(&stats.wakeups);
+        tasks_since_wakeup = 0;
+        timer_wakeup = !task;
+        if (task) {
+            task_queue_insert(int_q, task);
+        } else {
+            g_atomic_int_inc(&stats.timer_wakeups);
         }
+    }
 
-        task = g_async_queue_timeout_pop(async_q, timeout);
-        if (task)
-            g_tree_insert(int_q, task, GINT_TO_POINTER(1));
+    if (watched) {
+        hang_watchdog_thread_leave();
+        // returning into a task of an outer loop
+        if (depth > 1)
+            hang_watchdog_thread_busy();
     }
 
     // mark thread as non-running
+    if (flags & ML_INCREASE_DEPTH)
+        get_thread_local()->message_loop_depth--;
     ml = pp_resource_acquire(message_loop, PP_RESOURCE_MESSAGE_LOOP);
     if (ml) {
         if (flags & ML_INCREASE_DEPTH)
@@ -396,6 +662,22 @@ ppb_message_loop_post_work_with_result(PP_Resource message_loop,
                                        struct PP_CompletionCallback callback, int64_t delay_ms,
                                        int32_t result_to_pass, int depth, const char *origin)
 {
+    return ppb_message_loop_post_work_with_priority(message_loop, callback, delay_ms,
+                                                    result_to_pass, depth, ML_PRIORITY_NORMAL,
+                                                    origin);
+}
+
+int32_t
+ppb_message_loop_post_work_with_priority(PP_Resource message_loop,
+                                         struct PP_CompletionCallback callback, int64_t delay_ms,
+                                         int32_t result_to_pass, int depth,
+                                         enum ml_priority_e priority, const char *origin)
+{
+    if (priority < 0 || priority >= ML_PRIORITY_COUNT) {
+        trace_error("%s, bad priority %d\n", __func__, priority);
+        return PP_ERROR_BADARGUMENT;
+    }
+
     if (callback.func == NULL) {
         trace_error("%s, callback.func == NULL\n", __func__);
         return PP_ERROR_BADARGUMENT;
@@ -424,6 +706,7 @@ ppb_message_loop_post_work_with_result(PP_Resource message_loop,
     task->result_to_pass = result_to_pass;
     task->ccb = callback;
     task->depth = depth;
+    task->priority = priority;
     task->origin = origin;
 
     // calculate absolute time callback should be run at
@@ -444,8 +727,10 @@ int32_t
 ppb_message_loop_post_work(PP_Resource message_loop, struct PP_CompletionCallback callback,
                            int64_t delay_ms)
 {
-    return ppb_message_loop_post_work_with_result(message_loop, callback, delay_ms, PP_OK, 0,
-                                                  __func__);
+    return ppb_message_loop_post_work_with_priority(message_loop, callback, delay_ms, PP_OK, 0,
+                                                    delay_ms > 0 ? ML_PRIORITY_TIMER
+                                                                 : ML_PRIORITY_NORMAL,
+                                                    __func__);
 }
 
 int32_t
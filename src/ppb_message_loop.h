@@ -33,6 +33,27 @@ enum ppb_message_loop_flags_e {
     ML_EXIT_ON_EMPTY =      (1 << 2),
 };
 
+/// priority classes of tasks, from the highest. Among due tasks, ones of higher class are run
+/// first. Lower class tasks which wait for too long are run regardless, to avoid starvation
+enum ml_priority_e {
+    ML_PRIORITY_INPUT = 0,
+    ML_PRIORITY_PAINT,
+    ML_PRIORITY_TIMER,
+    ML_PRIORITY_NORMAL,
+    ML_PRIORITY_NETWORK,
+    ML_PRIORITY_BACKGROUND,
+    ML_PRIORITY_COUNT,
+};
+
+/// wakeup counters, summed over all message loops
+struct ppb_message_loop_stats_s {
+    int     wakeups;            ///< times a loop thread returned from waiting
+    int     timer_wakeups;      ///< ... of them because a delayed task became due
+    int     idle_wakeups;       ///< timer wakeups which ran nothing
+    int     tasks_run;
+    int     coalesced_tasks;    ///< tasks run on a timer wakeup in addition to the first one
+};
+
 
 PP_Resource
 ppb_message_loop_create(PP_Instance instance);
@@ -58,6 +79,11 @@ ppb_message_loop_get_depth(PP_Resource message_loop);
 int32_t
 ppb_message_loop_attach_to_current_thread(PP_Resource message_loop);
 
+/// attaches |message_loop| to the browser thread, which is the current one, and proclaims it
+/// browser thread. Unlike with plugin threads, thread's timer slack is not changed
+int32_t
+ppb_message_loop_attach_to_browser_thread(PP_Resource message_loop);
+
 int32_t
 ppb_message_loop_run(PP_Resource message_loop);
 
@@ -72,6 +98,12 @@ ppb_message_loop_post_work_with_result(PP_Resource message_loop,
                                        struct PP_CompletionCallback callback, int64_t delay_ms,
                                        int32_t result_to_pass, int depth, const char *origin);
 
+int32_t
+ppb_message_loop_post_work_with_priority(PP_Resource message_loop,
+                                         struct PP_CompletionCallback callback, int64_t delay_ms,
+                                         int32_t result_to_pass, int depth,
+                                         enum ml_priority_e priority, const char *origin);
+
 int32_t
 ppb_message_loop_post_work(PP_Resource message_loop, struct PP_CompletionCallback callback,
                            int64_t delay_ms);
@@ -84,3 +116,9 @@ ppb_message_loop_post_quit_depth(PP_Resource message_loop, PP_Bool should_destro
 
 void
 ppb_message_loop_mark_thread_unsuitable(void);
+
+void
+ppb_message_loop_get_stats(struct ppb_message_loop_stats_s *s);
+
+void
+ppb_message_loop_reset_stats(void);
@@ -50,18 +50,22 @@ STATIC_ASSERT(sizeof(struct pp_graphics3d_s) <= LARGEST_RESOURCE_SIZE);
         trace_error("%s, bad resource\n", __func__);                                    \
         escape_statement;                                                               \
     }                                                                                   \
-    pthread_mutex_lock(&display.lock);                                                  \
-    glXMakeCurrent(display.x, g3d->glx_pixmap, g3d->glc)
+    if (ppb_graphics3d_make_current(g3d) != 0) {                                        \
+        pp_resource_release(context);                                                   \
+        escape_statement;                                                               \
+    }
 
 #define EPILOGUE()                                                                      \
-    glXMakeCurrent(display.x, None, NULL);                                              \
-    pthread_mutex_unlock(&display.lock);                                                \
+    ppb_graphics3d_release_current(g3d);                                                \
     pp_resource_release(context)
 
 
 #if !HAVE_GLES2
 static GHashTable  *shader_type_ht = NULL;      // shader id -> shader type
 static GHashTable  *shader_source_ht = NULL;    // shader id -> original shader source
+
+// contexts of different instances are used from different threads concurrently
+static pthread_mutex_t shader_ht_lock = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
 
@@ -116,7 +120,7 @@ void
 ppb_opengles2_BindFramebuffer(PP_Resource context, GLenum target, GLuint framebuffer)
 {
     PROLOGUE(g3d, return);
-    glBindFramebuffer(target, framebuffer);
+    glBindFramebuffer(target, ppb_graphics3d_map_framebuffer(g3d, framebuffer));
     EPILOGUE();
 }
 
@@ -309,7 +313,9 @@ ppb_opengles2_CreateShader(PP_Resource context, GLenum type)
     PROLOGUE(g3d, return 0);
     GLuint res = glCreateShader(type);
 #if !HAVE_GLES2
+    pthread_mutex_lock(&shader_ht_lock);
     g_hash_table_insert(shader_type_ht, GSIZE_TO_POINTER(res), GSIZE_TO_POINTER(type));
+    pthread_mutex_unlock(&shader_ht_lock);
 #endif
     EPILOGUE();
     return res;
@@ -362,8 +368,10 @@ ppb_opengles2_DeleteShader(PP_Resource context, GLuint shader)
     glDeleteShader(shader);
 
 #if !HAVE_GLES2
+    pthread_mutex_lock(&shader_ht_lock);
     g_hash_table_remove(shader_source_ht, GSIZE_TO_POINTER(shader));
     g_hash_table_remove(shader_type_ht, GSIZE_TO_POINTER(shader));
+    pthread_mutex_unlock(&shader_ht_lock);
 #endif
 
     EPILOGUE();
@@ -623,6 +631,11 @@ ppb_opengles2_GetIntegerv(PP_Resource context, GLenum pname, GLint *params)
 {
     PROLOGUE(g3d, return);
     glGetIntegerv(pname, params);
+    if (pname == GL_FRAMEBUFFER_BINDING) {
+        // hide framebuffer which substitutes default one
+        if (params[0] == (GLint)ppb_graphics3d_map_framebuffer(g3d, 0))
+            params[0] = 0;
+    }
     EPILOGUE();
 }
 
@@ -661,8 +674,10 @@ ppb_opengles2_GetShaderiv(PP_Resource context, GLuint shader, GLenum pname, GLin
 #else
 
     if (pname == GL_SHADER_SOURCE_LENGTH) {
+        pthread_mutex_lock(&shader_ht_lock);
         char *s = g_hash_table_lookup(shader_source_ht, GSIZE_TO_POINTER(shader));
         size_t len = s ? strlen(s) : 0;
+        pthread_mutex_unlock(&shader_ht_lock);
 
         if (params)
             params[0] = len;
@@ -702,6 +717,7 @@ ppb_opengles2_GetShaderSource(PP_Resource context, GLuint shader, GLsizei bufsiz
 #else
 
     GLsizei  len;
+    pthread_mutex_lock(&shader_ht_lock);
     char    *s = g_hash_table_lookup(shader_source_ht, GSIZE_TO_POINTER(shader));
     if (!s) {
         len = 0;
@@ -718,6 +734,7 @@ ppb_opengles2_GetShaderSource(PP_Resource context, GLuint shader, GLsizei bufsiz
     source[len] = '\0';
 
 done:
+    pthread_mutex_unlock(&shader_ht_lock);
     if (length)
         *length = len;
 #endif
@@ -984,14 +1001,20 @@ ppb_opengles2_ShaderSource(PP_Resource context, GLuint shader, GLsizei count, co
     glShaderSource(shader, count, str, length);
 #else
 
-    GLenum type = GPOINTER_TO_SIZE(g_hash_table_lookup(shader_type_ht, GSIZE_TO_POINTER(shader)));
-
-    // save combined body
     char *body = combine_shader_source_parts(count, str, length);
-    g_hash_table_insert(shader_source_ht, GSIZE_TO_POINTER(shader), body);
+
+    pthread_mutex_lock(&shader_ht_lock);
+    GLenum type = GPOINTER_TO_SIZE(g_hash_table_lookup(shader_type_ht, GSIZE_TO_POINTER(shader)));
+    pthread_mutex_unlock(&shader_ht_lock);
 
     // provide GL function with translated shader body
     char *translated_body = translate_shader(type, body);
+
+    // save combined body. Table owns it from now on
+    pthread_mutex_lock(&shader_ht_lock);
+    g_hash_table_insert(shader_source_ht, GSIZE_TO_POINTER(shader), body);
+    pthread_mutex_unlock(&shader_ht_lock);
+
     glShaderSource(shader, 1, (const char **)&translated_body, NULL);
     g_free(translated_body);
 #endif
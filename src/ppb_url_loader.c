@@ -25,6 +25,7 @@
 #define _XOPEN_SOURCE   600
 #include "config.h"
 #include "eintr_retry.h"
+#include "mem_accounting.h"
 #include "pp_interface.h"
 #include "pp_resource.h"
 #include "ppb_core.h"
@@ -74,6 +75,20 @@ ppb_url_loader_create(PP_Instance instance)
     return url_loader;
 }
 
+static
+void
+close_temporary_file(struct pp_url_loader_s *ul)
+{
+    if (ul->fd < 0)
+        return;
+
+    close(ul->fd);
+    ul->fd = -1;
+    mem_accounting_change(ul->instance->id, PP_RESOURCE_URL_LOADER, MEM_KIND_TEMP_FILE,
+                          -ul->fd_size);
+    ul->fd_size = 0;
+}
+
 static
 void
 ppb_url_loader_destroy(void *p)
@@ -82,10 +97,7 @@ ppb_url_loader_destroy(void *p)
         return;
     struct pp_url_loader_s *ul = p;
 
-    if (ul->fd >= 0) {
-        close(ul->fd);
-        ul->fd = -1;
-    }
+    close_temporary_file(ul);
     free_and_nullify(ul->headers);
     free_and_nullify(ul->url);
     free_and_nullify(ul->status_line);
@@ -401,10 +413,7 @@ ppb_url_loader_follow_redirect(PP_Resource loader, struct PP_CompletionCallback
     post_data_free(ul->post_data);
     ul->post_data = NULL;
 
-    if (ul->fd >= 0) {
-        close(ul->fd);
-        ul->fd = -1;
-    }
+    close_temporary_file(ul);
 
     // abort further handling of the NPStream
     if (ul->np_stream) {
@@ -574,8 +583,8 @@ ppb_url_loader_read_response_body(PP_Resource loader, void *buffer, int32_t byte
     if (callback.flags & PP_COMPLETIONCALLBACK_FLAG_OPTIONAL)
         return read_bytes;
 
-    ppb_message_loop_post_work_with_result(ppb_message_loop_get_current(), callback, 0, read_bytes,
-                                           0, __func__);
+    ppb_message_loop_post_work_with_priority(ppb_message_loop_get_current(), callback, 0,
+                                             read_bytes, 0, ML_PRIORITY_NETWORK, __func__);
     return PP_OK_COMPLETIONPENDING;
 
 schedule_read_task:
@@ -623,10 +632,7 @@ ppb_url_loader_close(PP_Resource loader)
         return;
     }
 
-    if (ul->fd >= 0) {
-        close(ul->fd);
-        ul->fd = -1;
-    }
+    close_temporary_file(ul);
     free_and_nullify(ul->headers);
     free_and_nullify(ul->url);
     pp_resource_release(loader);
@@ -37,6 +37,7 @@ struct pp_url_loader_s {
     char                   *headers;        ///< response headers
     int                     http_code;      ///< HTTP response code
     int                     fd;             ///< file used to store response
+    int64_t                 fd_size;        ///< bytes stored in fd, for memory accounting
     size_t                  read_pos;       ///< reading position
     enum pp_request_method_e method;        ///< GET/POST
     char                   *url;            ///< request URL
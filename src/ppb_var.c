@@ -24,7 +24,11 @@
 
 #include "compat.h"
 #include "config.h"
+#include "hang_watchdog.h"
+#include "lock_stats.h"
+#include "mem_accounting.h"
 #include "n2p_proxy_class.h"
+#include "object_tracker.h"
 #include "p2n_proxy_class.h"
 #include "pp_interface.h"
 #include "ppb_core.h"
@@ -100,12 +104,46 @@ static
 struct var_s *
 get_var_s(struct PP_Var var)
 {
-    pthread_mutex_lock(&lock);
+    lock_stats_lock(&lock);
     struct var_s *v = g_hash_table_lookup(var_ht, GSIZE_TO_POINTER(var.value.as_id));
-    pthread_mutex_unlock(&lock);
+    lock_stats_unlock(&lock);
     return v;
 }
 
+/// heap memory var holds, approximately
+static
+int64_t
+var_storage_size(const struct var_s *v)
+{
+    switch (v->var.type) {
+    case PP_VARTYPE_STRING:
+        return sizeof(*v) + v->str.len + 1;
+    case PP_VARTYPE_ARRAY_BUFFER:
+        return sizeof(*v) + v->str.len;
+    default:
+        return sizeof(*v);
+    }
+}
+
+/// assigns id to a new var and makes it visible. |site| is code address var creation is
+/// attributed to in object tracker
+static
+struct PP_Var
+register_var(struct var_s *v, struct PP_Var var, const void *site)
+{
+    lock_stats_lock(&lock);
+    var.value.as_id = get_new_var_id();
+    v->var = var;
+    g_hash_table_insert(var_ht, GSIZE_TO_POINTER(var.value.as_id), v);
+    lock_stats_unlock(&lock);
+
+    mem_accounting_change(0, MEM_TYPE_VAR, MEM_KIND_HEAP, var_storage_size(v));
+    if (config.track_objects)
+        object_tracker_created(OBJECT_KIND_VAR, var.value.as_id, var.type, site);
+
+    return var;
+}
+
 struct create_np_object_param_s {
     NPClass        *npclass;
     NPObject       *res;
@@ -299,24 +337,33 @@ np_variant_to_pp_var(NPVariant v)
     }
 }
 
+static
 void
-ppb_var_add_ref(struct PP_Var var)
+var_add_ref(struct PP_Var var, const void *site)
 {
     if (!reference_countable(var))
         return;
 
-    pthread_mutex_lock(&lock);
+    lock_stats_lock(&lock);
     void *key = GSIZE_TO_POINTER(var.value.as_id);
     struct var_s *v = g_hash_table_lookup(var_ht, key);
-    if (v)
-        v->ref_count ++;
-    pthread_mutex_unlock(&lock);
+    const int ref_count = v ? ++v->ref_count : 0;
+    lock_stats_unlock(&lock);
+
+    if (v && config.track_objects)
+        object_tracker_ref_changed(OBJECT_KIND_VAR, var.value.as_id, ref_count, site);
+}
+
+void
+ppb_var_add_ref(struct PP_Var var)
+{
+    var_add_ref(var, __builtin_return_address(0));
 }
 
 struct PP_Var
 ppb_var_add_ref2(struct PP_Var var)
 {
-    ppb_var_add_ref(var);
+    var_add_ref(var, __builtin_return_address(0));
     return var;
 }
 
@@ -326,22 +373,33 @@ ppb_var_release(struct PP_Var var)
     if (!reference_countable(var))
         return;
 
-    pthread_mutex_lock(&lock);
+    lock_stats_lock(&lock);
     void *key = GSIZE_TO_POINTER(var.value.as_id);
     struct var_s *v = g_hash_table_lookup(var_ht, key);
     int retain = 1;
+    int ref_count = 0;
     if (v) {
-        v->ref_count --;
-        if (v->ref_count <= 0) {
+        ref_count = --v->ref_count;
+        if (ref_count <= 0) {
             retain = 0;
             g_hash_table_remove(var_ht, key);
         }
     }
-    pthread_mutex_unlock(&lock);
+    lock_stats_unlock(&lock);
+
+    if (v && config.track_objects) {
+        if (retain) {
+            object_tracker_ref_changed(OBJECT_KIND_VAR, var.value.as_id, ref_count,
+                                       __builtin_return_address(0));
+        } else {
+            object_tracker_destroyed(OBJECT_KIND_VAR, var.value.as_id);
+        }
+    }
 
     if (retain)
         return;
 
+    mem_accounting_change(0, MEM_TYPE_VAR, MEM_KIND_HEAP, -var_storage_size(v));
     switch (var.type) {
     case PP_VARTYPE_STRING:
         free(v->str.data);
@@ -375,18 +433,18 @@ ppb_var_release(struct PP_Var var)
 
         if (current_time % 5 == 0 || config.quirks.dump_variables > 1) {
             if (!throttling || config.quirks.dump_variables > 1) {
-                pthread_mutex_lock(&lock);
+                lock_stats_lock(&lock);
                 GList *key_list = g_hash_table_get_keys(var_ht);
                 guint var_count = g_list_length(key_list);
-                pthread_mutex_unlock(&lock);
+                lock_stats_unlock(&lock);
                 trace_info("--- %3u variables --------------------------------\n", var_count);
 
                 GList *lptr = key_list;
                 while (lptr) {
-                    pthread_mutex_lock(&lock);
+                    lock_stats_lock(&lock);
                     struct var_s *v = g_hash_table_lookup(var_ht, lptr->data);
                     struct PP_Var var = v ? v->var : PP_MakeUndefined();
-                    pthread_mutex_unlock(&lock);
+                    lock_stats_unlock(&lock);
 
                     if (v) {
                         gchar *s_var = trace_var_as_string(var);
@@ -413,17 +471,18 @@ ppb_var_get_ref_count(struct PP_Var var)
     if (!reference_countable(var))
         return 0;
 
-    pthread_mutex_lock(&lock);
+    lock_stats_lock(&lock);
     void *key = GSIZE_TO_POINTER(var.value.as_id);
     struct var_s *v = g_hash_table_lookup(var_ht, key);
     int ref_count = v ? v->ref_count : 0;
-    pthread_mutex_unlock(&lock);
+    lock_stats_unlock(&lock);
 
     return ref_count;
 }
 
+static
 struct PP_Var
-ppb_var_var_from_utf8(const char *data, uint32_t len)
+var_from_utf8(const char *data, uint32_t len, const void *site)
 {
     struct var_s *v = g_slice_alloc(sizeof(*v));
     struct PP_Var var = {};
@@ -440,26 +499,26 @@ ppb_var_var_from_utf8(const char *data, uint32_t len)
     v->str.data[len] = 0;       // ensure all strings are zero terminated
     v->ref_count = 1;
 
-    pthread_mutex_lock(&lock);
-    var.value.as_id = get_new_var_id();
-    v->var = var;
-    g_hash_table_insert(var_ht, GSIZE_TO_POINTER(var.value.as_id), v);
-    pthread_mutex_unlock(&lock);
+    return register_var(v, var, site);
+}
 
-    return var;
+struct PP_Var
+ppb_var_var_from_utf8(const char *data, uint32_t len)
+{
+    return var_from_utf8(data, len, __builtin_return_address(0));
 }
 
 struct PP_Var
 ppb_var_var_from_utf8_z(const char *data)
 {
-    return ppb_var_var_from_utf8(data, data ? strlen(data) : 0);
+    return var_from_utf8(data, data ? strlen(data) : 0, __builtin_return_address(0));
 }
 
 
 struct PP_Var
 ppb_var_var_from_utf8_1_0(PP_Module module, const char *data, uint32_t len)
 {
-    return ppb_var_var_from_utf8(data, len);
+    return var_from_utf8(data, len, __builtin_return_address(0));
 }
 
 const char *
@@ -666,11 +725,11 @@ ppb_var_is_instance_of(struct PP_Var var, const struct PPP_Class_Deprecated *obj
     return false;
 }
 
+static
 struct PP_Var
-ppb_var_create_object(PP_Instance instance, const struct PPP_Class_Deprecated *object_class,
-                      void *object_data)
+create_object(const struct PPP_Class_Deprecated *object_class, void *object_data,
+              const void *site)
 {
-    (void)instance;
     struct PP_Var var = {};
     struct var_s *v = g_slice_alloc(sizeof(*v));
 
@@ -679,13 +738,15 @@ ppb_var_create_object(PP_Instance instance, const struct PPP_Class_Deprecated *o
     v->obj.data = object_data;
     v->ref_count = 1;
 
-    pthread_mutex_lock(&lock);
-    var.value.as_id = get_new_var_id();
-    v->var = var;
-    g_hash_table_insert(var_ht, GSIZE_TO_POINTER(var.value.as_id), v);
-    pthread_mutex_unlock(&lock);
+    return register_var(v, var, site);
+}
 
-    return var;
+struct PP_Var
+ppb_var_create_object(PP_Instance instance, const struct PPP_Class_Deprecated *object_class,
+                      void *object_data)
+{
+    (void)instance;
+    return create_object(object_class, object_data, __builtin_return_address(0));
 }
 
 struct PP_Var
@@ -694,7 +755,7 @@ ppb_var_create_object_with_module_deprecated(PP_Module module,
                                              void *object_data)
 {
     (void)module;
-    return ppb_var_create_object(0, object_class, object_data);
+    return create_object(object_class, object_data, __builtin_return_address(0));
 }
 
 char *
@@ -721,13 +782,7 @@ ppb_var_array_buffer_create(uint32_t size_in_bytes)
     v->str.data = calloc(size_in_bytes, 1);
     v->ref_count = 1;
 
-    pthread_mutex_lock(&lock);
-    var.value.as_id = get_new_var_id();
-    v->var = var;
-    g_hash_table_insert(var_ht, GSIZE_TO_POINTER(var.value.as_id), v);
-    pthread_mutex_unlock(&lock);
-
-    return var;
+    return register_var(v, var, __builtin_return_address(0));
 }
 
 PP_Bool
@@ -821,13 +876,7 @@ ppb_var_dictionary_create(void)
     v->dict = g_hash_table_new_full(g_str_hash, g_str_equal, var_dict_key_destroy_func,
                                     var_dict_val_destroy_func);
 
-    pthread_mutex_lock(&lock);
-    var.value.as_id = get_new_var_id();
-    v->var = var;
-    g_hash_table_insert(var_ht, GSIZE_TO_POINTER(var.value.as_id), v);
-    pthread_mutex_unlock(&lock);
-
-    return var;
+    return register_var(v, var, __builtin_return_address(0));
 }
 
 struct PP_Var
@@ -917,13 +966,7 @@ ppb_var_array_create(void)
     v->array = g_array_new(FALSE, TRUE, sizeof(struct PP_Var));
     g_array_set_clear_func(v->array, var_array_value_clear_func);
 
-    pthread_mutex_lock(&lock);
-    var.value.as_id = get_new_var_id();
-    v->var = var;
-    g_hash_table_insert(var_ht, GSIZE_TO_POINTER(var.value.as_id), v);
-    pthread_mutex_unlock(&lock);
-
-    return var;
+    return register_var(v, var, __builtin_return_address(0));
 }
 
 struct PP_Var
@@ -1399,6 +1442,8 @@ constructor_ppb_var(void)
 {
     var_ht = g_hash_table_new(g_direct_hash, g_direct_equal);
     pthread_mutex_init(&lock, NULL);
+    hang_watchdog_register_lock("var lock", &lock);
+    lock_stats_register("var lock", &lock);
 
     register_interface(PPB_VAR_INTERFACE_1_0, &ppb_var_interface_1_0);
     register_interface(PPB_VAR_INTERFACE_1_1, &ppb_var_interface_1_1);
@@ -23,6 +23,7 @@
  */
 
 #include "config.h"
+#include "device_registry.h"
 #include "eintr_retry.h"
 #include "pp_interface.h"
 #include "pp_resource.h"
@@ -37,7 +38,7 @@
 #include "tables.h"
 #include "trace_core.h"
 #include "utils.h"
-#include <dirent.h>
+#include "video_convert.h"
 #include <fcntl.h>
 #include <glib.h>
 #include <linux/videodev2.h>
@@ -59,6 +60,9 @@ struct pp_video_capture_s {
     uint32_t            width;
     uint32_t            height;
     uint32_t            fps;
+    uint32_t            pixelformat;    // format device delivers frames in
+    uint32_t            bytesperline;
+    size_t              frame_size;     // size of device frame, in bytes
     size_t              buffer_size;
     uint32_t            buffer_count;
     PP_Resource        *buffers;
@@ -105,6 +109,136 @@ v4l2_ioctl(int fd, unsigned long int request, void *data)
 }
 #endif // !HAVE_LIBV4L2
 
+struct capture_format_s {
+    uint32_t    pixelformat;
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    fps;        // highest device can do at that size, 0 if unknown
+};
+
+/// relative cost of converting frames to I420. Negative for unsupported formats
+static
+int
+pixelformat_cost(uint32_t pixelformat)
+{
+    switch (pixelformat) {
+    case V4L2_PIX_FMT_YUV420:
+        return 0;
+    case V4L2_PIX_FMT_YUYV:
+        return 1;
+#if HAVE_LIBJPEG
+    case V4L2_PIX_FMT_MJPEG:
+    case V4L2_PIX_FMT_JPEG:
+        return 2;
+#endif // HAVE_LIBJPEG
+    default:
+        return -1;
+    }
+}
+
+static
+uint32_t
+max_fps_for_size(int fd, uint32_t pixelformat, uint32_t width, uint32_t height)
+{
+    struct v4l2_frmivalenum ival = {
+        .pixel_format = pixelformat,
+        .width =        width,
+        .height =       height,
+    };
+    uint32_t fps = 0;
+
+    while (v4l2_ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &ival) == 0) {
+        if (ival.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+            if (ival.discrete.numerator > 0)
+                fps = MAX(fps, ival.discrete.denominator / ival.discrete.numerator);
+        } else {
+            // stepwise or continuous, shortest interval goes first
+            if (ival.stepwise.min.numerator > 0)
+                fps = MAX(fps, ival.stepwise.min.denominator / ival.stepwise.min.numerator);
+            break;
+        }
+        ival.index ++;
+    }
+
+    return fps;
+}
+
+/// returns non-zero if |a| suits request better than |b|
+static
+int
+capture_format_is_better(const struct capture_format_s *a, const struct capture_format_s *b,
+                         uint32_t width, uint32_t height, uint32_t fps)
+{
+    // closest size first, then ability to deliver requested frame rate, then conversion cost
+    const int64_t dist_a = llabs((int64_t)a->width - width) + llabs((int64_t)a->height - height);
+    const int64_t dist_b = llabs((int64_t)b->width - width) + llabs((int64_t)b->height - height);
+    if (dist_a != dist_b)
+        return dist_a < dist_b;
+
+    const int fps_ok_a = (a->fps == 0 || a->fps >= fps);
+    const int fps_ok_b = (b->fps == 0 || b->fps >= fps);
+    if (fps_ok_a != fps_ok_b)
+        return fps_ok_a;
+
+    const int cost_a = pixelformat_cost(a->pixelformat);
+    const int cost_b = pixelformat_cost(b->pixelformat);
+    if (cost_a != cost_b)
+        return cost_a < cost_b;
+
+    return a->fps > b->fps;
+}
+
+/// picks native format, size, and frame rate closest to requested ones
+///
+/// Returns 0 on success, -1 if device doesn't enumerate its formats.
+static
+int
+select_capture_format(int fd, uint32_t width, uint32_t height, uint32_t fps,
+                      struct capture_format_s *best)
+{
+    struct v4l2_fmtdesc fmtdesc = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+    int found = 0;
+
+    for (; v4l2_ioctl(fd, VIDIOC_ENUM_FMT, &fmtdesc) == 0; fmtdesc.index ++) {
+        // formats libv4l2 emulates are converted by it, which is what we are avoiding
+        if (fmtdesc.flags & V4L2_FMT_FLAG_EMULATED)
+            continue;
+        if (pixelformat_cost(fmtdesc.pixelformat) < 0)
+            continue;
+
+        struct v4l2_frmsizeenum fsize = { .pixel_format = fmtdesc.pixelformat };
+        for (; v4l2_ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &fsize) == 0; fsize.index ++) {
+            struct capture_format_s cand = { .pixelformat = fmtdesc.pixelformat };
+
+            if (fsize.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+                cand.width =  fsize.discrete.width;
+                cand.height = fsize.discrete.height;
+            } else {
+                // stepwise or continuous, take allowed size nearest to requested
+                const struct v4l2_frmsize_stepwise *sw = &fsize.stepwise;
+                const uint32_t step_w = MAX(sw->step_width, 1);
+                const uint32_t step_h = MAX(sw->step_height, 1);
+
+                cand.width = CLAMP(width, sw->min_width, sw->max_width);
+                cand.height = CLAMP(height, sw->min_height, sw->max_height);
+                cand.width -= (cand.width - sw->min_width) % step_w;
+                cand.height -= (cand.height - sw->min_height) % step_h;
+            }
+
+            cand.fps = max_fps_for_size(fd, cand.pixelformat, cand.width, cand.height);
+
+            if (!found || capture_format_is_better(&cand, best, width, height, fps))
+                *best = cand;
+            found = 1;
+
+            if (fsize.type != V4L2_FRMSIZE_TYPE_DISCRETE)
+                break;
+        }
+    }
+
+    return found ? 0 : -1;
+}
+
 
 PP_Resource
 ppb_video_capture_create(PP_Instance instance)
@@ -133,6 +267,9 @@ ppb_video_capture_create(PP_Instance instance)
     vc->ppp_video_capture_dev = ppp_video_capture_dev;
 
     pp_resource_release(video_capture);
+
+    // device list will likely be requested soon, start gathering it now
+    device_registry_start();
     return video_capture;
 }
 
@@ -142,6 +279,8 @@ ppb_video_capture_destroy(void *p)
 {
     struct pp_video_capture_s *vc = p;
 
+    device_registry_forget_owner(vc->self_id);
+
     if (vc->fd != -1) {
         v4l2_close(vc->fd);
         vc->fd = -1;
@@ -162,9 +301,8 @@ ppb_video_capture_is_video_capture(PP_Resource video_capture)
     return pp_resource_get_type(video_capture) == PP_RESOURCE_VIDEO_CAPTURE;
 }
 
-static
 int
-video_device_is_usable(const char *dev, char **shortname)
+ppb_video_capture_device_is_usable(const char *dev, char **shortname)
 {
     if (!config.probe_video_capture_devices) {
         // do not probe device, assume it have default name,
@@ -208,70 +346,37 @@ int32_t
 ppb_video_capture_enumerate_devices(PP_Resource video_capture, struct PP_ArrayOutput output,
                                     struct PP_CompletionCallback callback)
 {
-    int32_t retval;
     struct pp_video_capture_s *vc = pp_resource_acquire(video_capture, PP_RESOURCE_VIDEO_CAPTURE);
     if (!vc) {
         trace_error("%s, bad resource\n", __func__);
         return PP_ERROR_BADRESOURCE;
     }
+    PP_Instance instance = vc->instance->id;
+    pp_resource_release(video_capture);
 
-    GArray *vc_devices = g_array_new(FALSE, TRUE, sizeof(PP_Resource));
-
-    struct dirent **namelist;
-    int n = scandir("/dev", &namelist, NULL, NULL);
-    if (n >= 0) {
-        for (int k = 0; k < n; k ++) {
-            if (strncmp(namelist[k]->d_name, "video", sizeof("video") - 1) != 0)
-                continue;
-
-            char *fullpath = g_strdup_printf("/dev/%s", namelist[k]->d_name);
-            char *shortname = NULL;
-            if (video_device_is_usable(fullpath, &shortname)) {
-                struct PP_Var v_shortname = ppb_var_var_from_utf8_z(shortname);
-                struct PP_Var v_fullpath = ppb_var_var_from_utf8_z(fullpath);
-                PP_Resource device = ppb_device_ref_create(vc->instance->id, v_shortname,
-                                                           v_fullpath,
-                                                           PP_DEVICETYPE_DEV_VIDEOCAPTURE);
-                g_array_append_val(vc_devices, device);
-                free(shortname);
-                ppb_var_release(v_shortname);
-                ppb_var_release(v_fullpath);
-            }
-            g_free(fullpath);
-        }
-
-        for (int k = 0; k < n; k ++)
-            free(namelist[k]);
-        free(namelist);
-    }
-
-    PP_Resource *devs = output.GetDataBuffer(output.user_data, vc_devices->len,
-                                             sizeof(PP_Resource));
-    if (!devs) {
-        retval = PP_ERROR_FAILED;
-        for (uintptr_t k = 0; k < vc_devices->len; k ++)
-            ppb_core_release_resource(g_array_index(vc_devices, PP_Resource, k));
-        goto err;
-    }
-
-    for (uintptr_t k = 0; k < vc_devices->len; k ++)
-        devs[k] = g_array_index(vc_devices, PP_Resource, k);
+    int32_t retval = device_registry_enumerate(instance, DEVICE_REGISTRY_VIDEO_CAPTURE, output);
+    if (retval != PP_OK)
+        return retval;
 
-    retval = PP_OK_COMPLETIONPENDING;
     ppb_message_loop_post_work_with_result(ppb_message_loop_get_current(), callback, 0, PP_OK, 0,
                                            __func__);
-
-err:
-    pp_resource_release(video_capture);
-    g_array_free(vc_devices, TRUE);
-    return retval;
+    return PP_OK_COMPLETIONPENDING;
 }
 
 int32_t
 ppb_video_capture_monitor_device_change(PP_Resource video_capture,
                                         PP_MonitorDeviceChangeCallback callback, void *user_data)
 {
-    return 0;
+    struct pp_video_capture_s *vc = pp_resource_acquire(video_capture, PP_RESOURCE_VIDEO_CAPTURE);
+    if (!vc) {
+        trace_error("%s, bad resource\n", __func__);
+        return PP_ERROR_BADRESOURCE;
+    }
+    PP_Instance instance = vc->instance->id;
+    pp_resource_release(video_capture);
+
+    return device_registry_monitor(video_capture, instance, DEVICE_REGISTRY_VIDEO_CAPTURE,
+                                   callback, user_data);
 }
 
 int32_t
@@ -336,11 +441,22 @@ ppb_video_capture_open(PP_Resource video_capture, PP_Resource device_ref,
         vc->fps =    15;
     }
 
+    // PPAPI hardcodes format to YUV420. Device's own format is used if it's one we can convert
+    // from, otherwise libv4l2 (if present) is left to do conversion
+    struct capture_format_s cf = {
+        .pixelformat =  V4L2_PIX_FMT_YUV420,
+        .width =        vc->width,
+        .height =       vc->height,
+    };
+
+    if (select_capture_format(vc->fd, vc->width, vc->height, vc->fps, &cf) != 0)
+        trace_info_f("%s, device doesn't enumerate formats, requesting YUV420\n", __func__);
+
     struct v4l2_format fmt = {
         .type =                 V4L2_BUF_TYPE_VIDEO_CAPTURE,
-        .fmt.pix.width =        vc->width,
-        .fmt.pix.height =       vc->height,
-        .fmt.pix.pixelformat =  V4L2_PIX_FMT_YUV420,    // PPAPI hardcodes format to YUV420
+        .fmt.pix.width =        cf.width,
+        .fmt.pix.height =       cf.height,
+        .fmt.pix.pixelformat =  cf.pixelformat,
         .fmt.pix.field =        V4L2_FIELD_INTERLACED,
     };
 
@@ -350,10 +466,37 @@ ppb_video_capture_open(PP_Resource video_capture, PP_Resource device_ref,
         goto point_2;
     }
 
-    vc->width =  fmt.fmt.pix.width;
-    vc->height = fmt.fmt.pix.height;
+    if (pixelformat_cost(fmt.fmt.pix.pixelformat) < 0) {
+        trace_error("%s, device switched to unsupported format\n", __func__);
+        result = PP_ERROR_FAILED;
+        goto point_2;
+    }
+
+    vc->width =         fmt.fmt.pix.width;
+    vc->height =        fmt.fmt.pix.height;
+    vc->pixelformat =   fmt.fmt.pix.pixelformat;
+    vc->bytesperline =  fmt.fmt.pix.bytesperline;
+    vc->frame_size =    fmt.fmt.pix.sizeimage;
+
+    if (vc->bytesperline == 0) {
+        vc->bytesperline = (vc->pixelformat == V4L2_PIX_FMT_YUYV) ? 2 * vc->width
+                                                                  : vc->width;
+    }
+
+    trace_info_f("%s, capturing %ux%u, format %.4s, up to %u fps\n", __func__, vc->width,
+                 vc->height, (const char *)&vc->pixelformat, cf.fps);
+
+    struct v4l2_streamparm parm = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+    if (v4l2_ioctl(vc->fd, VIDIOC_G_PARM, &parm) == 0 &&
+        (parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME) && vc->fps > 0)
+    {
+        parm.parm.capture.timeperframe.numerator = 1;
+        parm.parm.capture.timeperframe.denominator = vc->fps;
+        if (v4l2_ioctl(vc->fd, VIDIOC_S_PARM, &parm) != 0)
+            trace_warning("%s, can't set frame rate\n", __func__);
+    }
 
-    vc->buffer_size = fmt.fmt.pix.sizeimage;    // buffer size in bytes
+    vc->buffer_size = video_convert_i420_size(vc->width, vc->height);    // in bytes
     vc->buffer_count = MAX(buffer_count, 5);    // limit lowest number of buffers, just in case
 
     vc->buffers = calloc(sizeof(*vc->buffers), vc->buffer_count);
@@ -434,10 +577,27 @@ video_capture_thread(void *param)
 {
     struct pp_video_capture_s *vc = param;
 
-    PP_Resource  video_capture = vc->self_id;
-    PP_Instance  instance = vc->instance->id;
-    const int    fd = vc->fd;
-    const size_t buffer_size = vc->buffer_size;
+    PP_Resource    video_capture = vc->self_id;
+    PP_Instance    instance = vc->instance->id;
+    const int      fd = vc->fd;
+    const size_t   buffer_size = vc->buffer_size;
+    const size_t   frame_size = vc->frame_size;
+    const uint32_t pixelformat = vc->pixelformat;
+    const uint32_t width = vc->width;
+    const uint32_t height = vc->height;
+    const uint32_t bytesperline = vc->bytesperline;
+
+    // frames which are already in I420 are read directly into plugin buffers
+    const int direct_read = (pixelformat == V4L2_PIX_FMT_YUV420 && bytesperline == width);
+    uint8_t *frame = NULL;
+
+    if (!direct_read) {
+        frame = malloc(frame_size);
+        if (!frame) {
+            trace_error("%s, can't allocate frame buffer\n", __func__);
+            return NULL;
+        }
+    }
 
     vc = pp_resource_acquire(video_capture, PP_RESOURCE_VIDEO_CAPTURE);
     if (!vc)
@@ -469,13 +629,36 @@ video_capture_thread(void *param)
 
         // wait on v4l2_read() with resource unlocked
         void *ptr = ppb_buffer_map(buffer);
-        RETRY_ON_EINTR(v4l2_read(fd, ptr, buffer_size));
+        int frame_ok = 1;
+        if (direct_read) {
+            RETRY_ON_EINTR(v4l2_read(fd, ptr, buffer_size));
+        } else {
+            // conversion is done here, on capture thread
+            ssize_t got = RETRY_ON_EINTR(v4l2_read(fd, frame, frame_size));
+            frame_ok = (got > 0);
+
+            if (!frame_ok) {
+                // nothing to convert
+            } else if (pixelformat == V4L2_PIX_FMT_YUV420) {
+                video_convert_yuv420_to_i420(ptr, frame, width, height, bytesperline);
+            } else if (pixelformat == V4L2_PIX_FMT_YUYV) {
+                video_convert_yuyv_to_i420(ptr, frame, width, height, bytesperline);
+            } else {
+                frame_ok = (video_convert_mjpeg_to_i420(ptr, frame, got, width, height) == 0);
+            }
+        }
         ppb_buffer_unmap(buffer);
 
         vc = pp_resource_acquire(video_capture, PP_RESOURCE_VIDEO_CAPTURE);
         if (!vc)
             goto gone;
 
+        if (!frame_ok) {
+            // corrupted frame, drop it
+            vc->buffer_is_free[buf_idx] = 1;
+            continue;
+        }
+
         struct on_buffer_ready_param_s *p = g_slice_alloc(sizeof(*p));
         p->instance =               instance;
         p->video_capture =          video_capture;
@@ -487,10 +670,12 @@ video_capture_thread(void *param)
     }
 
     pp_resource_release(video_capture);
+    free(frame);
     return NULL;
 
 gone:
     trace_error("%s, resource gone\n", __func__);
+    free(frame);
     return NULL;
 }
 
@@ -640,7 +825,7 @@ trace_ppb_video_capture_monitor_device_change(PP_Resource video_capture,
                                               PP_MonitorDeviceChangeCallback callback,
                                               void *user_data)
 {
-    trace_info("[PPB] {zilch} %s video_capture=%d, callback=%p, user_data=%p\n", __func__+6,
+    trace_info("[PPB] {full} %s video_capture=%d, callback=%p, user_data=%p\n", __func__+6,
                video_capture, callback, user_data);
     return ppb_video_capture_monitor_device_change(video_capture, callback, user_data);
 }
@@ -707,7 +892,7 @@ const struct PPB_VideoCapture_Dev_0_3 ppb_video_capture_dev_interface_0_3 = {
     .Create =               TWRAPF(ppb_video_capture_create),
     .IsVideoCapture =       TWRAPF(ppb_video_capture_is_video_capture),
     .EnumerateDevices =     TWRAPF(ppb_video_capture_enumerate_devices),
-    .MonitorDeviceChange =  TWRAPZ(ppb_video_capture_monitor_device_change),
+    .MonitorDeviceChange =  TWRAPF(ppb_video_capture_monitor_device_change),
     .Open =                 TWRAPF(ppb_video_capture_open),
     .StartCapture =         TWRAPF(ppb_video_capture_start_capture),
     .ReuseBuffer =          TWRAPF(ppb_video_capture_reuse_buffer),
@@ -56,3 +56,7 @@ ppb_video_capture_stop_capture(PP_Resource video_capture);
 
 void
 ppb_video_capture_close(PP_Resource video_capture);
+
+/// probes whether |dev| supports video capturing; on success, stores card name in |shortname|
+int
+ppb_video_capture_device_is_usable(const char *dev, char **shortname);
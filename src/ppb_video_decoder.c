@@ -271,16 +271,16 @@ deinitialize_decoder(struct pp_video_decoder_s *vd)
     for (uintptr_t k = 0; k < vd->buffer_count; k ++) {
         vd->ppp_video_decoder_dev->DismissPictureBuffer(vd->instance->id, vd->self_id,
                                                         vd->buffers[k].id);
-        pthread_mutex_lock(&display.lock);
+        lock_stats_lock(display.gl.lock);
         if (vd->buffers[k].glx_pixmap != None) {
-            glXDestroyPixmap(display.x, vd->buffers[k].glx_pixmap);
+            glXDestroyPixmap(display.gl.x, vd->buffers[k].glx_pixmap);
             vd->buffers[k].glx_pixmap = None;
         }
         if (vd->buffers[k].pixmap != None) {
-            XFreePixmap(display.x, vd->buffers[k].pixmap);
+            XFreePixmap(display.gl.x, vd->buffers[k].pixmap);
             vd->buffers[k].pixmap = None;
         }
-        pthread_mutex_unlock(&display.lock);
+        lock_stats_unlock(display.gl.lock);
     }
 
     vd->buffer_count = 0;
@@ -674,6 +674,11 @@ ppb_video_decoder_create(PP_Instance instance, PP_Resource context, PP_VideoDeco
         return 0;
     }
 
+    if (display.egl_available) {
+        trace_info_f("      EGL offscreen contexts can't bind GLX pixmaps\n");
+        return 0;
+    }
+
     if (!display.glXBindTexImageEXT) {
         trace_info_f("      no glXBindTexImageEXT available\n");
         return 0;
@@ -802,12 +807,15 @@ issue_frame(struct pp_video_decoder_s *vd)
         return;
     }
 
-    pthread_mutex_lock(&display.lock);
-    glXMakeCurrent(display.x, g3d->glx_pixmap, g3d->glc);
+    // picture buffers are GL resources, while decoder puts frames into them over video
+    // connection. Locks are always taken in that order: GL, then video
+    lock_stats_lock(display.gl.lock);
+    glXMakeCurrent(display.gl.x, g3d->glx_pixmap, g3d->glc);
     glBindTexture(GL_TEXTURE_2D, vd->buffers[idx].texture_id);
-    display.glXBindTexImageEXT(display.x, vd->buffers[idx].glx_pixmap, GLX_FRONT_EXT, NULL);
-    XFlush(display.x);
+    display.glXBindTexImageEXT(display.gl.x, vd->buffers[idx].glx_pixmap, GLX_FRONT_EXT, NULL);
+    XFlush(display.gl.x);
 
+    lock_stats_lock(display.video.lock);
     switch (vd->hwdec_api) {
     case HWDEC_VAAPI:
         {
@@ -841,9 +849,12 @@ issue_frame(struct pp_video_decoder_s *vd)
         break;
     }
 
-    XFlush(display.x);
-    glXMakeCurrent(display.x, None, NULL);
-    pthread_mutex_unlock(&display.lock);
+    // texture is sampled over GL connection, frame should be in the pixmap by then
+    XSync(display.video.x, False);
+    lock_stats_unlock(display.video.lock);
+
+    glXMakeCurrent(display.gl.x, None, NULL);
+    lock_stats_unlock(display.gl.lock);
 
     pp_resource_release(vd->graphics3d);
 
@@ -871,10 +882,10 @@ decode_frame(struct pp_video_decoder_s *vd, uint8_t *data, size_t data_len,
 
     // libavcodec can call hw functions, which in turn can call Xlib functions,
     // therefore we need to lock
-    pthread_mutex_lock(&display.lock);
+    lock_stats_lock(display.video.lock);
     int got_frame = 0;
     int len = avcodec_decode_video2(vd->avctx, vd->avframe, &got_frame, &packet);
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(display.video.lock);
     if (len < 0) {
         trace_error("%s, error %d while decoding frame\n", __func__, len);
         return;
@@ -978,8 +989,8 @@ ppb_video_decoder_assign_picture_buffers(PP_Resource video_decoder, uint32_t no_
         vd->buffers[k].texture_id = buffers[k].texture_id;
         vd->buffers[k].used =       0;
 
-        pthread_mutex_lock(&display.lock);
-        vd->buffers[k].pixmap = XCreatePixmap(display.x, DefaultRootWindow(display.x),
+        lock_stats_lock(display.gl.lock);
+        vd->buffers[k].pixmap = XCreatePixmap(display.gl.x, DefaultRootWindow(display.gl.x),
                                               buffers[k].size.width, buffers[k].size.height,
                                               g3d->depth);
         int tfp_pixmap_attrs[] = {
@@ -989,9 +1000,12 @@ ppb_video_decoder_assign_picture_buffers(PP_Resource video_decoder, uint32_t no_
                                                      : GLX_TEXTURE_FORMAT_RGB_EXT,
             GL_NONE
         };
-        vd->buffers[k].glx_pixmap = glXCreatePixmap(display.x, g3d->fb_config,
+        vd->buffers[k].glx_pixmap = glXCreatePixmap(display.gl.x, g3d->fb_config,
                                                     vd->buffers[k].pixmap, tfp_pixmap_attrs);
-        pthread_mutex_unlock(&display.lock);
+
+        // decoder refers to the pixmap over video connection
+        XSync(display.gl.x, False);
+        lock_stats_unlock(display.gl.lock);
         if (vd->buffers[k].glx_pixmap == None) {
             trace_error("%s, failed to create GLX pixmap\n", __func__);
             goto err_3;
@@ -1006,8 +1020,7 @@ ppb_video_decoder_assign_picture_buffers(PP_Resource video_decoder, uint32_t no_
             vd->buffers[k].vdp_presentation_queue_target = VDP_INVALID_HANDLE;
             vd->buffers[k].vdp_presentation_queue = VDP_INVALID_HANDLE;
 
-            pthread_mutex_lock(&display.lock);
-            XSync(display.x, False);
+            lock_stats_lock(display.video.lock);
             st = display.vdp_presentation_queue_target_create_x11(
                                                     display.vdp_device, vd->buffers[k].pixmap,
                                                     &pq_target);
@@ -1015,7 +1028,7 @@ ppb_video_decoder_assign_picture_buffers(PP_Resource video_decoder, uint32_t no_
 
             st = display.vdp_presentation_queue_create(display.vdp_device, pq_target, &pq);
             report_vdpau_error(st, "VdpPresentationQueueCreate", __func__);
-            pthread_mutex_unlock(&display.lock);
+            lock_stats_unlock(display.video.lock);
 
             vd->buffers[k].vdp_presentation_queue_target = pq_target;
             vd->buffers[k].vdp_presentation_queue =        pq;
@@ -1046,13 +1059,14 @@ ppb_video_decoder_reuse_picture_buffer(PP_Resource video_decoder, int32_t pictur
             struct pp_graphics3d_s *g3d = pp_resource_acquire(vd->graphics3d,
                                                               PP_RESOURCE_GRAPHICS3D);
             if (g3d) {
-                pthread_mutex_lock(&display.lock);
-                glXMakeCurrent(display.x, g3d->glx_pixmap, g3d->glc);
+                lock_stats_lock(display.gl.lock);
+                glXMakeCurrent(display.gl.x, g3d->glx_pixmap, g3d->glc);
                 glBindTexture(GL_TEXTURE_2D, vd->buffers[k].texture_id);
-                display.glXReleaseTexImageEXT(display.x, vd->buffers[k].glx_pixmap, GLX_FRONT_EXT);
-                glXMakeCurrent(display.x, None, NULL);
-                XFlush(display.x);
-                pthread_mutex_unlock(&display.lock);
+                display.glXReleaseTexImageEXT(display.gl.x, vd->buffers[k].glx_pixmap,
+                                              GLX_FRONT_EXT);
+                glXMakeCurrent(display.gl.x, None, NULL);
+                XFlush(display.gl.x);
+                lock_stats_unlock(display.gl.lock);
 
                 pp_resource_release(vd->graphics3d);
             }
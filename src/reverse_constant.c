@@ -22,6 +22,7 @@
  * SOFTWARE.
  */
 
+#include "pp_resource.h"
 #include "reverse_constant.h"
 #include <X11/Xlib.h>
 #include <ppapi/c/pp_graphics_3d.h>
@@ -1223,3 +1224,45 @@ reverse_graphics3d_attribute(int32_t attr)
         return "UNKNOWNATTRIBUTE";
     }
 }
+
+const char *
+reverse_resource_type(int type)
+{
+    switch (type) {
+    CASE(PP_RESOURCE_UNKNOWN);
+    CASE(PP_RESOURCE_URL_LOADER);
+    CASE(PP_RESOURCE_URL_REQUEST_INFO);
+    CASE(PP_RESOURCE_URL_RESPONSE_INFO);
+    CASE(PP_RESOURCE_VIEW);
+    CASE(PP_RESOURCE_GRAPHICS3D);
+    CASE(PP_RESOURCE_IMAGE_DATA);
+    CASE(PP_RESOURCE_GRAPHICS2D);
+    CASE(PP_RESOURCE_NETWORK_MONITOR);
+    CASE(PP_RESOURCE_BROWSER_FONT);
+    CASE(PP_RESOURCE_AUDIO_CONFIG);
+    CASE(PP_RESOURCE_AUDIO);
+    CASE(PP_RESOURCE_INPUT_EVENT);
+    CASE(PP_RESOURCE_FLASH_FONT_FILE);
+    CASE(PP_RESOURCE_PRINTING);
+    CASE(PP_RESOURCE_VIDEO_CAPTURE);
+    CASE(PP_RESOURCE_AUDIO_INPUT);
+    CASE(PP_RESOURCE_FLASH_MENU);
+    CASE(PP_RESOURCE_FLASH_MESSAGE_LOOP);
+    CASE(PP_RESOURCE_TCP_SOCKET);
+    CASE(PP_RESOURCE_FILE_REF);
+    CASE(PP_RESOURCE_FILE_IO);
+    CASE(PP_RESOURCE_MESSAGE_LOOP);
+    CASE(PP_RESOURCE_FLASH_DRM);
+    CASE(PP_RESOURCE_VIDEO_DECODER);
+    CASE(PP_RESOURCE_BUFFER);
+    CASE(PP_RESOURCE_FILE_CHOOSER);
+    CASE(PP_RESOURCE_UDP_SOCKET);
+    CASE(PP_RESOURCE_X509_CERTIFICATE);
+    CASE(PP_RESOURCE_FONT);
+    CASE(PP_RESOURCE_DEVICE_REF);
+    CASE(PP_RESOURCE_HOST_RESOLVER);
+    CASE(PP_RESOURCE_NET_ADDRESS);
+    default:
+        return "UNKNOWNRESOURCETYPE";
+    }
+}
@@ -58,3 +58,4 @@ const char *reverse_x509_certificate_field(PP_X509Certificate_Private_Field fiel
 const char *reverse_pdf_feature(PP_PDFFeature feature);
 const char *reverse_private_font_charset(PP_PrivateFontCharset charset);
 const char *reverse_graphics3d_attribute(int32_t attr);
+const char *reverse_resource_type(int type);
@@ -26,6 +26,7 @@
 #include "config.h"
 #include "screensaver_control.h"
 #include "trace_core.h"
+#include "work_pool.h"
 #include <X11/Xatom.h>
 #include <assert.h>
 #include <gio/gio.h>
@@ -50,7 +51,11 @@
 
 
 #if HAVE_GLIB_DBUS
+#define DBUS_SCREENSAVERS   (SST_FDO_SCREENSAVER | SST_GNOME_SCREENSAVER | SST_KDE_SCREENSAVER | \
+                             SST_CINNAMON_SCREENSAVER)
+
 static GDBusConnection *connection = NULL;
+static volatile gint    dbus_deactivation_pending = 0;
 #endif // HAVE_GLIB_DBUS
 
 
@@ -277,18 +282,17 @@ deactivate_dbus_based_screensaver(const char *d_service, const char *d_path,
 err:
     g_object_unref(msg);
 }
-#endif // HAVE_GLIB_DBUS
 
-void
-screensaver_deactivate(Display *dpy, uint32_t types)
+/// does D-Bus part of screensaver_deactivate(). Runs on a worker thread
+static
+int32_t
+deactivate_dbus_based_screensavers_work(void *user_data)
 {
-    if (types & SST_XSCREENSAVER)
-        deactivate_xscreensaver(dpy);
+    const uint32_t types = GPOINTER_TO_UINT(user_data);
 
-    // reset internal X screen saver timer
-    XResetScreenSaver(dpy);
+    // let the next activity report queue another request
+    g_atomic_int_set(&dbus_deactivation_pending, 0);
 
-#if HAVE_GLIB_DBUS
     if (types & SST_FDO_SCREENSAVER)
         deactivate_dbus_based_screensaver(FDOS_SERVICE, FDOS_PATH, FDOS_INTERFACE);
 
@@ -300,6 +304,33 @@ screensaver_deactivate(Display *dpy, uint32_t types)
 
     if (types & SST_CINNAMON_SCREENSAVER)
         deactivate_dbus_based_screensaver(CINNAMON_SERVICE, CINNAMON_PATH, CINNAMON_INTERFACE);
+
+    return 0;
+}
+#endif // HAVE_GLIB_DBUS
+
+void
+screensaver_deactivate(Display *dpy, uint32_t types)
+{
+    if (types & SST_XSCREENSAVER)
+        deactivate_xscreensaver(dpy);
+
+    // reset internal X screen saver timer
+    XResetScreenSaver(dpy);
+
+#if HAVE_GLIB_DBUS
+    // D-Bus calls are synchronous and may take a while, so they are done in background. Activity
+    // is reported often, there is no point in having more than one request queued
+    if ((types & DBUS_SCREENSAVERS) &&
+        g_atomic_int_compare_and_exchange(&dbus_deactivation_pending, 0, 1))
+    {
+        if (work_pool_submit(work_pool_get_queue("dbus", 1),
+                             deactivate_dbus_based_screensavers_work, NULL,
+                             GUINT_TO_POINTER(types), NULL, __func__) != 0)
+        {
+            g_atomic_int_set(&dbus_deactivation_pending, 0);
+        }
+    }
 #endif // HAVE_GLIB_DBUS
 }
 
@@ -415,6 +446,8 @@ void
 screensaver_disconnect(void)
 {
 #if HAVE_GLIB_DBUS
+    // queued requests use the connection
+    work_pool_wait_idle(work_pool_get_queue("dbus", 1));
     g_object_unref(connection);
     connection = NULL;
 #endif // HAVE_GLIB_DBUS
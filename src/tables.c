@@ -23,6 +23,7 @@
  */
 
 #include "config.h"
+#include "hang_watchdog.h"
 #include "ppb_instance.h"
 #include "screensaver_control.h"
 #include "tables.h"
@@ -41,6 +42,9 @@
 #if HAVE_HWDEC
 #include <va/va_x11.h>
 #endif
+#if HAVE_EGL
+#include <EGL/eglext.h>
+#endif
 
 NPNetscapeFuncs     npn;
 struct display_s    display;
@@ -188,7 +192,7 @@ static
 void
 check_glx_extensions(void)
 {
-    const char *glx_ext_str = glXQueryExtensionsString(display.x, 0);
+    const char *glx_ext_str = glXQueryExtensionsString(display.gl.x, 0);
     if (!glx_ext_str)
         return;
 
@@ -207,6 +211,8 @@ check_glx_extensions(void)
         glXGetProcAddress((GLubyte *)"glXGetVideoSyncSGI");
     display.glXWaitVideoSyncSGI = (glx_wait_video_sync_sgi_f)
         glXGetProcAddress((GLubyte *)"glXWaitVideoSyncSGI");
+    display.glMapBuffer = (gl_map_buffer_f)glXGetProcAddress((GLubyte *)"glMapBuffer");
+    display.glUnmapBuffer = (gl_unmap_buffer_f)glXGetProcAddress((GLubyte *)"glUnmapBuffer");
 }
 
 #if HAVE_HWDEC
@@ -230,7 +236,7 @@ initialize_vaapi(void)
     VAStatus st;
     int major, minor;
 
-    display.va = vaGetDisplay(display.x);
+    display.va = vaGetDisplay(display.video.x);
     st = vaInitialize(display.va, &major, &minor);
     if (st == VA_STATUS_SUCCESS) {
         trace_info_f("libva version %d.%d\n", major, minor);
@@ -259,8 +265,8 @@ initialize_vdpau(void)
     VdpStatus st;
 
     display.vdp_device = VDP_INVALID_HANDLE;
-    st = vdp_device_create_x11(display.x, DefaultScreen(display.x), &display.vdp_device,
-                               &display.vdp_get_proc_address);
+    st = vdp_device_create_x11(display.video.x, DefaultScreen(display.video.x),
+                               &display.vdp_device, &display.vdp_get_proc_address);
 
     if (st == VDP_STATUS_OK && display.vdp_get_proc_address) {
         display.vdp_get_error_string = get_proc_helper(VDP_FUNC_ID_GET_ERROR_STRING);
@@ -326,6 +332,138 @@ deinitialize_vdpau(void)
 }
 #endif // HAVE_HWDEC
 
+#if HAVE_EGL
+static
+EGLDisplay
+get_egl_offscreen_display(void)
+{
+    const char *client_ext_str = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+    // Prefer platform which doesn't need any window system. Mesa provides it as
+    // EGL_MESA_platform_surfaceless, and it works with llvmpipe too.
+    if (client_ext_str && strstr(client_ext_str, "EGL_MESA_platform_surfaceless")) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+            eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+        if (get_platform_display) {
+            EGLDisplay dpy = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                                  EGL_DEFAULT_DISPLAY, NULL);
+            if (dpy != EGL_NO_DISPLAY)
+                return dpy;
+        }
+    }
+
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+static
+void
+initialize_egl(void)
+{
+    EGLint major, minor;
+
+    display.egl = get_egl_offscreen_display();
+    if (display.egl == EGL_NO_DISPLAY) {
+        trace_error("%s, can't get EGL display\n", __func__);
+        return;
+    }
+
+    if (!eglInitialize(display.egl, &major, &minor)) {
+        trace_error("%s, eglInitialize failed\n", __func__);
+        display.egl = EGL_NO_DISPLAY;
+        return;
+    }
+
+    trace_info_f("EGL version %d.%d\n", major, minor);
+
+    const char *egl_ext_str = eglQueryString(display.egl, EGL_EXTENSIONS);
+    display.egl_surfaceless = egl_ext_str && strstr(egl_ext_str, "EGL_KHR_surfaceless_context");
+
+#if HAVE_GLES2
+    const EGLint renderable_type = EGL_OPENGL_ES2_BIT;
+    const EGLenum api = EGL_OPENGL_ES_API;
+#else
+    // OpenGL ES 2.0 is emulated with help of shader translator, desktop GL is required
+    const EGLint renderable_type = EGL_OPENGL_BIT;
+    const EGLenum api = EGL_OPENGL_API;
+#endif
+
+    // actual framebuffer format is determined by FBO attachments, config is only needed
+    // to create context and a tiny pbuffer if surfaceless contexts are not supported
+    const EGLint cfg_attrs[] = {
+        EGL_RENDERABLE_TYPE,    renderable_type,
+        EGL_SURFACE_TYPE,       display.egl_surfaceless ? 0 : EGL_PBUFFER_BIT,
+        EGL_NONE,
+    };
+
+    EGLint nconfigs = 0;
+    if (!eglChooseConfig(display.egl, cfg_attrs, &display.egl_config, 1, &nconfigs) ||
+        nconfigs < 1)
+    {
+        trace_error("%s, no suitable EGL config found\n", __func__);
+        eglTerminate(display.egl);
+        display.egl = EGL_NO_DISPLAY;
+        return;
+    }
+
+    if (!eglBindAPI(api)) {
+        trace_error("%s, eglBindAPI failed\n", __func__);
+        eglTerminate(display.egl);
+        display.egl = EGL_NO_DISPLAY;
+        return;
+    }
+
+    trace_info_f("EGL offscreen rendering enabled, %s\n",
+                 display.egl_surfaceless ? "surfaceless" : "pbuffer");
+    display.egl_available = 1;
+}
+
+static
+void
+deinitialize_egl(void)
+{
+    if (display.egl != EGL_NO_DISPLAY)
+        eglTerminate(display.egl);
+    display.egl = EGL_NO_DISPLAY;
+    display.egl_available = 0;
+}
+#endif // HAVE_EGL
+
+static
+void
+x_conn_open(struct x_conn_s *c, const char *name)
+{
+    c->x = config.separate_x_connections ? XOpenDisplay(NULL) : NULL;
+    if (!c->x) {
+        if (config.separate_x_connections)
+            trace_warning("%s, can't open connection for %s, using shared one\n", __func__, name);
+        c->x = display.x;
+        c->lock = &display.lock;
+        return;
+    }
+
+    if (config.quirks.x_synchronize)
+        XSynchronize(c->x, True);
+
+    pthread_mutex_init(&c->own_lock, &display.mutex_attr_recursive);
+    c->lock = &c->own_lock;
+    hang_watchdog_register_lock(name, c->lock);
+    lock_stats_register(name, c->lock);
+}
+
+static
+void
+x_conn_close(struct x_conn_s *c)
+{
+    if (c->lock == &display.lock)
+        return;
+
+    XCloseDisplay(c->x);
+    hang_watchdog_unregister_lock(c->lock);
+    lock_stats_unregister(c->lock);
+    pthread_mutex_destroy(&c->own_lock);
+}
+
 int
 tables_open_display(void)
 {
@@ -336,7 +474,9 @@ tables_open_display(void)
     pthread_mutexattr_settype(&display.mutex_attr_recursive, PTHREAD_MUTEX_RECURSIVE);
 
     pthread_mutex_init(&display.lock, &display.mutex_attr_recursive);
-    pthread_mutex_lock(&display.lock);
+    hang_watchdog_register_lock("display.lock", &display.lock);
+    lock_stats_register("display.lock", &display.lock);
+    lock_stats_lock(&display.lock);
     display.x = XOpenDisplay(NULL);
     if (!display.x) {
         trace_error("%s, can't open X Display\n", __func__);
@@ -347,6 +487,13 @@ tables_open_display(void)
     if (config.quirks.x_synchronize)
         XSynchronize(display.x, True);
 
+    // subsystems with no X resources in common get own connections. Where resources do
+    // cross connections (GL pixmaps shown by Graphics3D, video surfaces bound as textures),
+    // producer side does XSync before handing them over
+    x_conn_open(&display.gl, "display.gl.lock");
+    x_conn_open(&display.g2d, "display.g2d.lock");
+    x_conn_open(&display.video, "display.video.lock");
+
     display.dri_fd = open("/dev/dri/card0", O_RDWR);
 
 #if HAVE_HWDEC
@@ -364,7 +511,7 @@ tables_open_display(void)
 
 #endif // HAVE_HWDEC
 
-    if (!glXQueryVersion(display.x, &major, &minor)) {
+    if (!glXQueryVersion(display.gl.x, &major, &minor)) {
         trace_error("%s, glXQueryVersion returned False\n", __func__);
     } else {
         trace_info_f("GLX version %d.%d\n", major, minor);
@@ -372,6 +519,13 @@ tables_open_display(void)
 
     check_glx_extensions();
 
+    display.egl_available = 0;
+#if HAVE_EGL
+    display.egl = EGL_NO_DISPLAY;
+    if (config.enable_egl_offscreen)
+        initialize_egl();
+#endif // HAVE_EGL
+
     // initialize screensaver inhibition library
     screensaver_connect();
     display.screensaver_types = screensaver_type_detect(display.x);
@@ -444,14 +598,14 @@ tables_open_display(void)
     }
 
 quit:
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(&display.lock);
     return retval;
 }
 
 void
 tables_close_display(void)
 {
-    pthread_mutex_lock(&display.lock);
+    lock_stats_lock(&display.lock);
     screensaver_disconnect();
 
 #if HAVE_HWDEC
@@ -466,12 +620,22 @@ tables_close_display(void)
 
 #endif // HAVE_HWDEC
 
+#if HAVE_EGL
+    deinitialize_egl();
+#endif // HAVE_EGL
+
     close(display.dri_fd);
     display.dri_fd = -1;
 
+    x_conn_close(&display.video);
+    x_conn_close(&display.g2d);
+    x_conn_close(&display.gl);
+
     XFreeCursor(display.x, display.transparent_cursor);
     XCloseDisplay(display.x);
-    pthread_mutex_unlock(&display.lock);
+    lock_stats_unlock(&display.lock);
+    hang_watchdog_unregister_lock(&display.lock);
+    lock_stats_unregister(&display.lock);
     pthread_mutex_destroy(&display.lock);
     pthread_mutexattr_destroy(&display.mutex_attr_recursive);
 }
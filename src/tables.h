@@ -25,6 +25,7 @@
 #pragma once
 
 #include "glx.h"
+#include "lock_stats.h"
 #include <ppapi/c/pp_instance.h>
 #include <X11/Xlib.h>
 #include <X11/extensions/Xrender.h>
@@ -41,6 +42,10 @@
 #include <vdpau/vdpau_x11.h>
 #endif // HAVE_HWDEC
 
+#if HAVE_EGL
+#include <EGL/egl.h>
+#endif // HAVE_EGL
+
 #define NPString_literal(str) { .UTF8Characters = str, .UTF8Length = strlen(str) }
 
 typedef GLXContext
@@ -60,9 +65,28 @@ typedef int
 typedef int
 (*glx_wait_video_sync_sgi_f)(int divisor, int remainder, unsigned int *count);
 
+typedef void *
+(*gl_map_buffer_f)(GLenum target, GLenum access);
+
+typedef GLboolean
+(*gl_unmap_buffer_f)(GLenum target);
+
+
+/// X connection dedicated to a single subsystem. Subsystems which don't share X resources
+/// get connections of their own, so they don't serialize on the global display.lock.
+/// If separate connections are disabled or can't be opened, |x| is display.x and |lock|
+/// points to display.lock
+struct x_conn_s {
+    Display            *x;
+    pthread_mutex_t    *lock;
+    pthread_mutex_t     own_lock;
+};
 
 struct display_s {
-    Display                            *x;
+    Display                            *x;         ///< misc: cursors, screensaver, XRandR
+    struct x_conn_s                     gl;         ///< GLX rendering, Graphics3D frames
+    struct x_conn_s                     g2d;        ///< Graphics2D presentation pixmaps
+    struct x_conn_s                     video;      ///< VA-API and VDPAU decoding
 #if HAVE_HWDEC
     unsigned int                        va_available;
     VADisplay                           va;
@@ -103,10 +127,18 @@ struct display_s {
     glx_release_tex_image_ext_f         glXReleaseTexImageEXT;
     glx_get_video_sync_sgi_f            glXGetVideoSyncSGI;
     glx_wait_video_sync_sgi_f           glXWaitVideoSyncSGI;
+    gl_map_buffer_f                     glMapBuffer;
+    gl_unmap_buffer_f                   glUnmapBuffer;
     uint32_t                            glx_arb_create_context;
     uint32_t                            glx_arb_create_context_profile;
     uint32_t                            glx_ext_create_context_es2_profile;
     int                                 dri_fd;
+    uint32_t                            egl_available;  ///< Graphics3D renders through EGL
+#if HAVE_EGL
+    EGLDisplay                          egl;
+    EGLConfig                           egl_config;
+    uint32_t                            egl_surfaceless;    ///< EGL_KHR_surfaceless_context
+#endif // HAVE_EGL
 };
 
 extern NPNetscapeFuncs  npn;
@@ -0,0 +1,232 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+#include "task_profiler.h"
+#include "trace_core.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/// how often data directory is checked for report request
+#define REQUEST_CHECK_INTERVAL_US   (1000 * 1000)
+
+static pthread_mutex_t  lock = PTHREAD_MUTEX_INITIALIZER;
+static GHashTable      *origins_ht;        // origin -> struct task_stats_s
+static gint64           next_report = 0;
+static gint64           next_request_check = 0;
+
+
+/// should be called with lock held
+static
+GHashTable *
+get_origins_ht(void)
+{
+    // origins are __func__ strings, pointers are unique and live forever
+    if (!origins_ht)
+        origins_ht = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+
+    return origins_ht;
+}
+
+int
+task_profiler_enabled(void)
+{
+    return config.task_profile_interval > 0 || config.long_task_threshold_ms > 0;
+}
+
+/// checks whether report is due, either periodic or requested. Should be called with lock held
+static
+int
+report_is_due(void)
+{
+    const char *data_dir = fpp_config_get_pepper_data_dir();
+    const gint64 now = g_get_monotonic_time();
+    int due = 0;
+
+    if (config.task_profile_interval <= 0)
+        return 0;
+
+    if (next_report == 0) {
+        next_report = now + (gint64)config.task_profile_interval * G_USEC_PER_SEC;
+    } else if (now >= next_report) {
+        next_report = now + (gint64)config.task_profile_interval * G_USEC_PER_SEC;
+        due = 1;
+    }
+
+    if (data_dir && now >= next_request_check) {
+        next_request_check = now + REQUEST_CHECK_INTERVAL_US;
+
+        gchar *fname = g_strdup_printf("%s/task_profile.request", data_dir);
+        if (unlink(fname) == 0)
+            due = 1;
+        g_free(fname);
+    }
+
+    return due;
+}
+
+void
+task_profiler_record(const char *origin, void *func, int64_t queue_delay_us,
+                     int64_t run_time_us)
+{
+    const int is_long = config.long_task_threshold_ms > 0 &&
+                        run_time_us >= (int64_t)config.long_task_threshold_ms * 1000;
+
+    if (is_long) {
+        trace_warning("long task: origin %s, callback %p, ran for %.1f ms, waited for %.1f ms\n",
+                      origin ? origin : "(unknown)", func, run_time_us / 1e3,
+                      queue_delay_us / 1e3);
+    }
+
+    if (config.task_profile_interval <= 0)
+        return;
+
+    pthread_mutex_lock(&lock);
+    GHashTable *ht = get_origins_ht();
+    struct task_stats_s *ts = g_hash_table_lookup(ht, origin);
+    if (!ts) {
+        ts = g_new0(struct task_stats_s, 1);
+        ts->origin = origin;
+        g_hash_table_insert(ht, (gpointer)origin, ts);
+    }
+
+    diag_histogram_add(&ts->queue_delay, queue_delay_us);
+    diag_histogram_add(&ts->run_time, run_time_us);
+    if (is_long)
+        ts->long_tasks ++;
+
+    const int report_due = report_is_due();
+    pthread_mutex_unlock(&lock);
+
+    if (report_due)
+        task_profiler_write_report();
+}
+
+int
+task_profiler_get_stats(const char *origin, struct task_stats_s *stats)
+{
+    pthread_mutex_lock(&lock);
+    struct task_stats_s *ts = g_hash_table_lookup(get_origins_ht(), origin);
+    if (ts)
+        *stats = *ts;
+    pthread_mutex_unlock(&lock);
+
+    return ts ? 0 : -1;
+}
+
+static
+void
+append_histogram(GString *s, const char *name, const struct diag_histogram_s *h)
+{
+    g_string_append_printf(s, "    %-12s avg %8.3f ms, p50 %8.3f ms, p99 %8.3f ms, max %8.3f ms |",
+                           name, h->count ? h->sum_us / 1e3 / h->count : 0,
+                           diag_histogram_percentile(h, 0.5) / 1e3,
+                           diag_histogram_percentile(h, 0.99) / 1e3, h->max_us / 1e3);
+
+    for (int k = 0; k < DIAG_HISTOGRAM_BUCKETS; k ++) {
+        if (h->bucket[k] > 0) {
+            g_string_append_printf(s, " <%.3g ms: %" PRIu64, (((int64_t)2 << k) - 1) / 1e3,
+                                   h->bucket[k]);
+        }
+    }
+    g_string_append(s, "\n");
+}
+
+static
+gint
+compare_total_run_time(gconstpointer a, gconstpointer b)
+{
+    const struct task_stats_s *ta = a;
+    const struct task_stats_s *tb = b;
+
+    return ta->run_time.sum_us > tb->run_time.sum_us ? -1
+                                                     : (ta->run_time.sum_us < tb->run_time.sum_us);
+}
+
+gchar *
+task_profiler_get_report(void)
+{
+    GArray *origins = g_array_new(FALSE, FALSE, sizeof(struct task_stats_s));
+    GHashTableIter iter;
+    gpointer value;
+
+    pthread_mutex_lock(&lock);
+    g_hash_table_iter_init(&iter, get_origins_ht());
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+        g_array_append_vals(origins, value, 1);
+    pthread_mutex_unlock(&lock);
+
+    // the most time consuming first
+    g_array_sort(origins, compare_total_run_time);
+
+    GString *s = g_string_new(NULL);
+    g_string_append_printf(s, "message loop tasks, pid %d, %.1f s\n", (int)getpid(),
+                           g_get_monotonic_time() / 1e6);
+
+    for (guint k = 0; k < origins->len; k ++) {
+        const struct task_stats_s *ts = &g_array_index(origins, struct task_stats_s, k);
+
+        g_string_append_printf(s, "%s: %" PRIu64 " tasks, %.3f s total, %" PRIu64 " long\n",
+                               ts->origin ? ts->origin : "(unknown)", ts->run_time.count,
+                               ts->run_time.sum_us / 1e6, ts->long_tasks);
+        append_histogram(s, "queue delay", &ts->queue_delay);
+        append_histogram(s, "run time", &ts->run_time);
+    }
+
+    g_array_free(origins, TRUE);
+    return g_string_free(s, FALSE);
+}
+
+int
+task_profiler_write_report(void)
+{
+    gchar *report = task_profiler_get_report();
+    int retval = diag_write_report("task_profile", report);
+
+    g_free(report);
+    return retval;
+}
+
+void
+task_profiler_reset(void)
+{
+    pthread_mutex_lock(&lock);
+    g_hash_table_remove_all(get_origins_ht());
+    next_report = 0;
+    next_request_check = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+static
+void
+__attribute__((destructor))
+destructor_task_profiler(void)
+{
+    if (origins_ht)
+        g_hash_table_unref(origins_ht);
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "diag_report.h"
+#include <glib.h>
+#include <stdint.h>
+
+/// Collects statistics of message loop tasks, keyed by task origin (name of the function which
+/// posted the task): histograms of queue delay (time from deadline to start) and of execution
+/// time. Enabled by config.task_profile_interval; report is written to
+/// "task_profile.<pid>.txt" in the plugin data directory that often, and also whenever file
+/// "task_profile.request" appears there. Tasks running longer than
+/// config.long_task_threshold_ms are logged separately.
+
+struct task_stats_s {
+    const char                 *origin;
+    struct diag_histogram_s     queue_delay;
+    struct diag_histogram_s     run_time;
+    uint64_t                    long_tasks;
+};
+
+/// whether message loops should measure tasks at all
+int
+task_profiler_enabled(void);
+
+/// records a single task run. |func| is used for logging long tasks only
+void
+task_profiler_record(const char *origin, void *func, int64_t queue_delay_us,
+                     int64_t run_time_us);
+
+/// gets statistics of tasks posted from |origin|. Returns 0 on success, -1 if there were none
+int
+task_profiler_get_stats(const char *origin, struct task_stats_s *stats);
+
+/// returns human-readable report. Caller should free it with g_free()
+gchar *
+task_profiler_get_report(void);
+
+/// writes report to the file in plugin data directory. Returns 0 on success
+int
+task_profiler_write_report(void);
+
+/// forgets everything
+void
+task_profiler_reset(void);
@@ -25,17 +25,78 @@
 #include "thread_local.h"
 #include <glib.h>
 #include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
-static GPrivate priv = G_PRIVATE_INIT(g_free);
+#define SCRATCH_ALIGN   16
 
-struct thread_local_block *
-get_thread_local(void)
+__thread struct thread_local_block thread_local_block_tls;
+
+// only frees scratch arenas of exiting threads
+static GPrivate scratch_priv = G_PRIVATE_INIT(g_free);
+
+pid_t
+thread_local_get_tid(void)
+{
+    struct thread_local_block *tl = get_thread_local();
+
+    if (tl->tid == 0)
+        tl->tid = syscall(__NR_gettid);
+
+    return tl->tid;
+}
+
+void
+thread_local_set_role(enum thread_role_e role)
+{
+    get_thread_local()->role = role;
+}
+
+const char *
+thread_local_role_name(enum thread_role_e role)
+{
+    switch (role) {
+    case THREAD_ROLE_BROWSER:       return "browser";
+    case THREAD_ROLE_PLUGIN_MAIN:   return "plugin main";
+    case THREAD_ROLE_NETWORK:       return "network";
+    case THREAD_ROLE_AUDIO:         return "audio";
+    case THREAD_ROLE_WORKER:        return "worker";
+    case THREAD_ROLE_UNKNOWN:
+    default:                        return "other";
+    }
+}
+
+void *
+thread_local_scratch_alloc(size_t size)
 {
-    struct thread_local_block *data = g_private_get(&priv);
-    if (data == NULL) {
-        data = g_malloc0(sizeof(*data));
-        g_private_set(&priv, data);
+    struct thread_local_block *tl = get_thread_local();
+    const size_t aligned_size = (size + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1);
+
+    if (!tl->scratch) {
+        tl->scratch = g_malloc(THREAD_SCRATCH_SIZE);
+        g_private_set(&scratch_priv, tl->scratch);
+    }
+
+    // zero-sized allocation still needs an address inside the arena to be freed correctly
+    if (aligned_size >= THREAD_SCRATCH_SIZE - tl->scratch_used)
+        return g_malloc(MAX(size, 1));
+
+    void *ptr = tl->scratch + tl->scratch_used;
+    tl->scratch_used += aligned_size;
+    return ptr;
+}
+
+void
+thread_local_scratch_free(void *ptr)
+{
+    struct thread_local_block *tl = get_thread_local();
+    char *p = ptr;
+
+    if (tl->scratch && p >= tl->scratch && p < tl->scratch + THREAD_SCRATCH_SIZE) {
+        // allocations are freed in reverse order, so everything past |ptr| is free as well
+        tl->scratch_used = p - tl->scratch;
+        return;
     }
 
-    return data;
+    g_free(ptr);
 }
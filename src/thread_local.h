@@ -22,14 +22,75 @@
  * SOFTWARE.
  */
 
+#pragma once
+
 #include <ppapi/c/pp_resource.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
 #include <time.h>
 
+/// what thread is used for. Set once by code which owns the thread
+enum thread_role_e {
+    THREAD_ROLE_UNKNOWN = 0,
+    THREAD_ROLE_BROWSER,
+    THREAD_ROLE_PLUGIN_MAIN,
+    THREAD_ROLE_NETWORK,
+    THREAD_ROLE_AUDIO,
+    THREAD_ROLE_WORKER,
+};
+
+/// size of per-thread scratch arena. Larger allocations go to the heap
+#define THREAD_SCRATCH_SIZE     (16 * 1024)
+
 struct thread_local_block {
     PP_Resource this_thread_message_loop;
+    int message_loop_depth; ///< depth of this_thread_message_loop, mirrors its ->depth
     int thread_is_not_suitable_for_message_loop;
     struct timespec tictoc_ts;
+    uint32_t task_serial;   ///< incremented each time outermost message loop runs a task
+    int watchdog_slot;      ///< hang watchdog slot index plus one, zero if not registered
+    int work_pool_worker;   ///< work pool worker index plus one, zero for other threads
+    int audio_rt_state;     ///< enum audio_rt_state_e, outcome of real-time elevation
+    pid_t tid;              ///< kernel thread id, zero until first asked for
+    enum thread_role_e role;
+    char *scratch;          ///< scratch arena, allocated on first use
+    size_t scratch_used;
 };
 
+extern __thread struct thread_local_block thread_local_block_tls;
+
+/// per-thread context. Lives in TLS and is zero-initialized, so no lookup or allocation is
+/// needed on access
+static inline
 struct thread_local_block *
-get_thread_local(void);
+get_thread_local(void)
+{
+    return &thread_local_block_tls;
+}
+
+/// kernel thread id of the calling thread. Syscall is made on the first call only
+pid_t
+thread_local_get_tid(void);
+
+void
+thread_local_set_role(enum thread_role_e role);
+
+static inline
+enum thread_role_e
+thread_local_get_role(void)
+{
+    return get_thread_local()->role;
+}
+
+const char *
+thread_local_role_name(enum thread_role_e role);
+
+/// allocates |size| bytes from per-thread scratch arena. Allocations must be freed in reverse
+/// order with thread_local_scratch_free(), on the same thread. Falls back to heap if arena
+/// is exhausted
+void *
+thread_local_scratch_alloc(size_t size);
+
+void
+thread_local_scratch_free(void *ptr);
@@ -28,7 +28,6 @@
 #include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
-#include <sys/syscall.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -45,7 +44,7 @@ trace_info(const char *fmt, ...)
     pthread_mutex_lock(&lock);
     va_list args;
 //    fprintf(stdout, "[fresh] ");
-    fprintf(stdout, "[fresh %5d] ", (int)syscall(__NR_gettid));
+    fprintf(stdout, "[fresh %5d] ", (int)thread_local_get_tid());
     va_start(args, fmt);
     vfprintf(stdout, fmt, args);
     va_end(args);
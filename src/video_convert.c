@@ -0,0 +1,282 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "trace_core.h"
+#include "video_convert.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif // __SSE2__
+
+#if HAVE_LIBJPEG
+#include <setjmp.h>
+#include <stdio.h>      // jpeglib.h needs FILE
+#include <jpeglib.h>
+#endif // HAVE_LIBJPEG
+
+
+size_t
+video_convert_i420_size(uint32_t width, uint32_t height)
+{
+    const size_t chroma_width = (width + 1) / 2;
+    const size_t chroma_height = (height + 1) / 2;
+
+    return (size_t)width * height + 2 * chroma_width * chroma_height;
+}
+
+void
+video_convert_yuv420_to_i420(uint8_t *dst, const uint8_t *src, uint32_t width, uint32_t height,
+                             uint32_t stride)
+{
+    const uint32_t chroma_width = (width + 1) / 2;
+    const uint32_t chroma_height = (height + 1) / 2;
+    const uint32_t chroma_stride = (stride + 1) / 2;
+
+    if (stride == width) {
+        memcpy(dst, src, video_convert_i420_size(width, height));
+        return;
+    }
+
+    for (uint32_t y = 0; y < height; y ++)
+        memcpy(dst + y * width, src + y * stride, width);
+
+    dst += width * height;
+    src += stride * height;
+    for (uint32_t plane = 0; plane < 2; plane ++) {
+        for (uint32_t y = 0; y < chroma_height; y ++)
+            memcpy(dst + y * chroma_width, src + y * chroma_stride, chroma_width);
+
+        dst += chroma_width * chroma_height;
+        src += chroma_stride * chroma_height;
+    }
+}
+
+/// converts |count| pixels of two YUYV lines. Second line may be the same as the first
+static
+void
+yuyv_line_pair(uint8_t *dst_y0, uint8_t *dst_y1, uint8_t *dst_u, uint8_t *dst_v,
+               const uint8_t *src0, const uint8_t *src1, uint32_t count)
+{
+    uint32_t x = 0;
+
+#ifdef __SSE2__
+    // 16 pixels at once
+    const __m128i lo_mask = _mm_set1_epi16(0x00ff);
+
+    for (; x + 16 <= count; x += 16) {
+        const __m128i a0 = _mm_loadu_si128((const __m128i *)(src0 + 2 * x));
+        const __m128i b0 = _mm_loadu_si128((const __m128i *)(src0 + 2 * x + 16));
+        const __m128i a1 = _mm_loadu_si128((const __m128i *)(src1 + 2 * x));
+        const __m128i b1 = _mm_loadu_si128((const __m128i *)(src1 + 2 * x + 16));
+
+        // even bytes are luma
+        _mm_storeu_si128((__m128i *)(dst_y0 + x),
+                         _mm_packus_epi16(_mm_and_si128(a0, lo_mask),
+                                          _mm_and_si128(b0, lo_mask)));
+        _mm_storeu_si128((__m128i *)(dst_y1 + x),
+                         _mm_packus_epi16(_mm_and_si128(a1, lo_mask),
+                                          _mm_and_si128(b1, lo_mask)));
+
+        // odd bytes are interleaved U and V, average them between lines
+        const __m128i c0 = _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(b0, 8));
+        const __m128i c1 = _mm_packus_epi16(_mm_srli_epi16(a1, 8), _mm_srli_epi16(b1, 8));
+        const __m128i c = _mm_avg_epu8(c0, c1);
+        const __m128i zero = _mm_setzero_si128();
+
+        _mm_storel_epi64((__m128i *)(dst_u + x / 2),
+                         _mm_packus_epi16(_mm_and_si128(c, lo_mask), zero));
+        _mm_storel_epi64((__m128i *)(dst_v + x / 2),
+                         _mm_packus_epi16(_mm_srli_epi16(c, 8), zero));
+    }
+#endif // __SSE2__
+
+    for (; x + 2 <= count; x += 2) {
+        dst_y0[x] =     src0[2 * x];
+        dst_y0[x + 1] = src0[2 * x + 2];
+        dst_y1[x] =     src1[2 * x];
+        dst_y1[x + 1] = src1[2 * x + 2];
+        dst_u[x / 2] = (src0[2 * x + 1] + src1[2 * x + 1] + 1) / 2;
+        dst_v[x / 2] = (src0[2 * x + 3] + src1[2 * x + 3] + 1) / 2;
+    }
+
+    if (x < count) {
+        // odd width, last pixel is a lone Y U pair. Its V is taken from the previous one, as
+        // line ends right after U
+        dst_y0[x] = src0[2 * x];
+        dst_y1[x] = src1[2 * x];
+        dst_u[x / 2] = (src0[2 * x + 1] + src1[2 * x + 1] + 1) / 2;
+        dst_v[x / 2] = (x > 0) ? (src0[2 * x - 1] + src1[2 * x - 1] + 1) / 2 : 128;
+    }
+}
+
+void
+video_convert_yuyv_to_i420(uint8_t *dst, const uint8_t *src, uint32_t width, uint32_t height,
+                           uint32_t stride)
+{
+    const uint32_t chroma_width = (width + 1) / 2;
+    const uint32_t chroma_height = (height + 1) / 2;
+    uint8_t *dst_y = dst;
+    uint8_t *dst_u = dst + width * height;
+    uint8_t *dst_v = dst_u + chroma_width * chroma_height;
+
+    for (uint32_t y = 0; y < height; y += 2) {
+        const uint32_t y1 = (y + 1 < height) ? y + 1 : y;
+
+        yuyv_line_pair(dst_y + y * width, dst_y + y1 * width,
+                       dst_u + (y / 2) * chroma_width, dst_v + (y / 2) * chroma_width,
+                       src + y * stride, src + y1 * stride, width);
+    }
+}
+
+#if HAVE_LIBJPEG
+
+struct mjpeg_error_mgr_s {
+    struct jpeg_error_mgr   pub;
+    jmp_buf                 jmpbuf;
+};
+
+static
+void
+mjpeg_error_exit(j_common_ptr cinfo)
+{
+    struct mjpeg_error_mgr_s *err = (struct mjpeg_error_mgr_s *)cinfo->err;
+
+    // default handler terminates the process
+    longjmp(err->jmpbuf, 1);
+}
+
+static
+void
+mjpeg_output_message(j_common_ptr cinfo)
+{
+    // webcams often produce slightly broken frames, don't flood the log
+}
+
+int
+video_convert_mjpeg_to_i420(uint8_t *dst, const uint8_t *src, size_t src_size, uint32_t width,
+                            uint32_t height)
+{
+    struct jpeg_decompress_struct   cinfo;
+    struct mjpeg_error_mgr_s        jerr;
+    int                             retval = -1;
+
+    const uint32_t chroma_width = (width + 1) / 2;
+    const uint32_t chroma_height = (height + 1) / 2;
+    uint8_t *dst_y = dst;
+    uint8_t *dst_u = dst + width * height;
+    uint8_t *dst_v = dst_u + chroma_width * chroma_height;
+
+    // two decoded YCbCr lines. Allocated before setjmp(), so it's valid after longjmp()
+    uint8_t *lines = malloc(2 * width * 3);
+    if (!lines)
+        return -1;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = mjpeg_error_exit;
+    jerr.pub.output_message = mjpeg_output_message;
+
+    if (setjmp(jerr.jmpbuf)) {
+        // decoder bailed out
+        jpeg_destroy_decompress(&cinfo);
+        free(lines);
+        return -1;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char *)src, src_size);
+
+    if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK)
+        goto done;
+
+    // skip color conversion, and trade some quality for speed
+    cinfo.out_color_space = JCS_YCbCr;
+    cinfo.dct_method = JDCT_IFAST;
+    cinfo.do_fancy_upsampling = FALSE;
+
+    jpeg_start_decompress(&cinfo);
+    if (cinfo.output_width != width || cinfo.output_height != height ||
+        cinfo.output_components != 3)
+    {
+        trace_error("%s, unexpected frame geometry %ux%u\n", __func__, cinfo.output_width,
+                    cinfo.output_height);
+        jpeg_abort_decompress(&cinfo);
+        goto done;
+    }
+
+    uint8_t *l0 = lines;
+    uint8_t *l1 = lines + width * 3;
+
+    for (uint32_t y = 0; y < height; y += 2) {
+        const uint32_t line_count = (y + 1 < height) ? 2 : 1;
+
+        // decoder may return fewer lines than asked, so lines are requested one by one
+        for (uint32_t k = 0; k < line_count; k ++) {
+            JSAMPROW row = (k == 0) ? l0 : l1;
+            if (jpeg_read_scanlines(&cinfo, &row, 1) != 1) {
+                jpeg_abort_decompress(&cinfo);
+                goto done;
+            }
+        }
+
+        if (line_count == 1)
+            memcpy(l1, l0, width * 3);
+
+        for (uint32_t x = 0; x < width; x ++) {
+            dst_y[y * width + x] = l0[3 * x];
+            if (line_count == 2)
+                dst_y[(y + 1) * width + x] = l1[3 * x];
+        }
+
+        uint8_t *u = dst_u + (y / 2) * chroma_width;
+        uint8_t *v = dst_v + (y / 2) * chroma_width;
+        for (uint32_t x = 0; x < chroma_width; x ++) {
+            const uint32_t x0 = 2 * x;
+            const uint32_t x1 = (x0 + 1 < width) ? x0 + 1 : x0;
+
+            u[x] = (l0[3 * x0 + 1] + l0[3 * x1 + 1] + l1[3 * x0 + 1] + l1[3 * x1 + 1] + 2) / 4;
+            v[x] = (l0[3 * x0 + 2] + l0[3 * x1 + 2] + l1[3 * x0 + 2] + l1[3 * x1 + 2] + 2) / 4;
+        }
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    retval = 0;
+
+done:
+    jpeg_destroy_decompress(&cinfo);
+    free(lines);
+    return retval;
+}
+
+#else // HAVE_LIBJPEG
+
+int
+video_convert_mjpeg_to_i420(uint8_t *dst, const uint8_t *src, size_t src_size, uint32_t width,
+                            uint32_t height)
+{
+    return -1;
+}
+
+#endif // HAVE_LIBJPEG
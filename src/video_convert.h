@@ -0,0 +1,53 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Conversion of frames delivered by capture devices to I420, the only format PPAPI video
+/// capture supports. Chroma planes of odd-sized frames are rounded up.
+
+/// returns size of I420 frame in bytes
+size_t
+video_convert_i420_size(uint32_t width, uint32_t height);
+
+/// copies planar YUV 4:2:0 frame, which lines may be padded to |stride| bytes
+void
+video_convert_yuv420_to_i420(uint8_t *dst, const uint8_t *src, uint32_t width, uint32_t height,
+                             uint32_t stride);
+
+/// converts packed YUYV 4:2:2 frame to I420, averaging chroma of line pairs
+void
+video_convert_yuyv_to_i420(uint8_t *dst, const uint8_t *src, uint32_t width, uint32_t height,
+                           uint32_t stride);
+
+/// decodes MJPEG frame to I420
+///
+/// Returns 0 on success, -1 if frame is corrupted, has unexpected size, or MJPEG support
+/// was not compiled in.
+int
+video_convert_mjpeg_to_i420(uint8_t *dst, const uint8_t *src, size_t src_size, uint32_t width,
+                            uint32_t height);
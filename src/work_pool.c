@@ -0,0 +1,410 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "work_pool.h"
+#include "config.h"
+#include "hang_watchdog.h"
+#include "ppb_message_loop.h"
+#include "thread_local.h"
+#include "trace_core.h"
+#include "utils.h"
+#include <glib.h>
+#include <ppapi/c/pp_errors.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_WORKERS     64
+
+struct work_token_s {
+    volatile gint   refcount;
+    volatile gint   cancelled;
+};
+
+struct work_queue_s {
+    gchar              *name;
+    int                 max_concurrency;
+    pthread_mutex_t     lock;
+    int                 running;        ///< items doing work right now, guarded by |lock|
+    GQueue              parked;         ///< items put aside when queue was at its limit
+    int                 pending;        ///< submitted items with work not done yet, guarded
+                                        ///< by pool lock
+};
+
+struct work_item_s {
+    struct work_queue_s    *queue;
+    work_pool_work_f       *work;
+    work_pool_completion_f *completion;
+    void                   *user_data;
+    struct work_token_s    *token;
+    PP_Resource             m_loop;
+    const char             *origin;
+};
+
+struct worker_s {
+    pthread_mutex_t     lock;
+    GQueue              deque;          ///< owner takes from tail, thieves from head
+};
+
+static pthread_mutex_t      lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t       work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t       idle_cond = PTHREAD_COND_INITIALIZER;
+static GHashTable          *queues = NULL;
+static GQueue               injector = G_QUEUE_INIT;    ///< items submitted from outside
+static struct worker_s      workers[MAX_WORKERS];
+static int                  worker_count = 0;
+static int                  pending = 0;                ///< guarded by |lock|
+static volatile gint        runnable = 0;               ///< items in injector and deques
+static struct work_pool_stats_s stats;
+
+
+static
+int
+get_worker_count(void)
+{
+    int count = config.background_threads;
+
+    if (count <= 0)
+        count = CLAMP(g_get_num_processors(), 2, 8);
+
+    return MIN(count, MAX_WORKERS);
+}
+
+static
+struct worker_s *
+get_current_worker(void)
+{
+    const int idx = get_thread_local()->work_pool_worker;
+    return idx > 0 ? &workers[idx - 1] : NULL;
+}
+
+/// makes item available to workers. Items go to the deque of current worker, if any
+static
+void
+push_runnable(struct work_item_s *item)
+{
+    struct worker_s *self = get_current_worker();
+
+    // counted before it's published, so a worker taking it never drives the count below zero
+    g_atomic_int_inc(&runnable);
+
+    if (self) {
+        pthread_mutex_lock(&self->lock);
+        g_queue_push_tail(&self->deque, item);
+        pthread_mutex_unlock(&self->lock);
+    }
+
+    pthread_mutex_lock(&lock);
+    if (!self)
+        g_queue_push_tail(&injector, item);
+    pthread_cond_signal(&work_cond);
+    pthread_mutex_unlock(&lock);
+}
+
+static
+struct work_item_s *
+take_runnable(struct worker_s *self)
+{
+    struct work_item_s *item;
+
+    pthread_mutex_lock(&self->lock);
+    item = g_queue_pop_tail(&self->deque);
+    pthread_mutex_unlock(&self->lock);
+    if (item)
+        goto done;
+
+    pthread_mutex_lock(&lock);
+    item = g_queue_pop_head(&injector);
+    pthread_mutex_unlock(&lock);
+    if (item)
+        goto done;
+
+    const int self_idx = self - workers;
+    for (int k = 1; k < worker_count && !item; k ++) {
+        struct worker_s *victim = &workers[(self_idx + k) % worker_count];
+
+        pthread_mutex_lock(&victim->lock);
+        item = g_queue_pop_head(&victim->deque);
+        pthread_mutex_unlock(&victim->lock);
+    }
+    if (!item)
+        return NULL;
+
+    g_atomic_int_inc(&stats.stolen);
+
+done:
+    g_atomic_int_add(&runnable, -1);
+    return item;
+}
+
+static
+void
+completion_comt(void *user_data, int32_t result)
+{
+    struct work_item_s *item = user_data;
+
+    if (item->token && work_token_is_cancelled(item->token))
+        result = PP_ERROR_ABORTED;
+
+    if (item->completion)
+        item->completion(item->user_data, result);
+
+    if (item->token)
+        work_token_unref(item->token);
+    g_slice_free(struct work_item_s, item);
+}
+
+static
+void
+run_item(struct work_item_s *item)
+{
+    struct work_queue_s *q = item->queue;
+    int32_t result = PP_ERROR_ABORTED;
+
+    if (item->token && work_token_is_cancelled(item->token)) {
+        g_atomic_int_inc(&stats.cancelled);
+    } else if (item->work) {
+        result = item->work(item->user_data);
+    } else {
+        result = PP_OK;
+    }
+
+    // free slot goes to the oldest parked item, which continues on this worker
+    pthread_mutex_lock(&q->lock);
+    q->running --;
+    struct work_item_s *next = g_queue_pop_head(&q->parked);
+    pthread_mutex_unlock(&q->lock);
+
+    if (next)
+        push_runnable(next);
+
+    // items with completion always have a loop to post it to, submit ensures that
+    int32_t ret = PP_OK;
+    if (item->completion) {
+        ret = ppb_message_loop_post_work_with_result(item->m_loop,
+                                                     PP_MakeCCB(completion_comt, item), 0,
+                                                     result, 0, item->origin);
+        if (ret != PP_OK)
+            trace_error("%s, can't post completion of %s\n", __func__, item->origin);
+    }
+
+    if (!item->completion || ret != PP_OK) {
+        if (item->token)
+            work_token_unref(item->token);
+        g_slice_free(struct work_item_s, item);
+    }
+
+    pthread_mutex_lock(&lock);
+    pending --;
+    q->pending --;
+    if (q->pending == 0)
+        pthread_cond_broadcast(&idle_cond);
+    pthread_mutex_unlock(&lock);
+}
+
+static
+void *
+worker_thread(void *param)
+{
+    struct worker_s *self = param;
+
+    get_thread_local()->work_pool_worker = self - workers + 1;
+    thread_local_set_role(THREAD_ROLE_WORKER);
+    hang_watchdog_thread_enter("work pool");
+
+    while (1) {
+        struct work_item_s *item = take_runnable(self);
+
+        if (!item) {
+            hang_watchdog_thread_waiting(0);
+            pthread_mutex_lock(&lock);
+            while (g_atomic_int_get(&runnable) == 0)
+                pthread_cond_wait(&work_cond, &lock);
+            pthread_mutex_unlock(&lock);
+            hang_watchdog_thread_busy();
+            continue;
+        }
+
+        struct work_queue_s *q = item->queue;
+        pthread_mutex_lock(&q->lock);
+        if (q->max_concurrency > 0 && q->running >= q->max_concurrency) {
+            // will be pushed back once one of running items is done
+            g_queue_push_tail(&q->parked, item);
+            pthread_mutex_unlock(&q->lock);
+            g_atomic_int_inc(&stats.parked);
+            continue;
+        }
+        q->running ++;
+        pthread_mutex_unlock(&q->lock);
+
+        run_item(item);
+    }
+
+    return NULL;
+}
+
+/// should be called with |lock| held
+static
+void
+ensure_workers_running(void)
+{
+    if (worker_count > 0)
+        return;
+
+    const int count = get_worker_count();
+    for (int k = 0; k < count; k ++) {
+        pthread_t t;
+
+        pthread_mutex_init(&workers[k].lock, NULL);
+        g_queue_init(&workers[k].deque);
+        worker_count = k + 1;
+        if (pthread_create(&t, NULL, worker_thread, &workers[k]) != 0) {
+            trace_error("%s, can't create worker thread\n", __func__);
+            worker_count = k;
+            break;
+        }
+        pthread_detach(t);
+    }
+}
+
+struct work_queue_s *
+work_pool_get_queue(const char *name, int max_concurrency)
+{
+    pthread_mutex_lock(&lock);
+    if (!queues)
+        queues = g_hash_table_new(g_str_hash, g_str_equal);
+
+    struct work_queue_s *q = g_hash_table_lookup(queues, name);
+    if (!q) {
+        q = g_slice_new0(struct work_queue_s);
+        q->name = g_strdup(name);
+        q->max_concurrency = MAX(max_concurrency, 0);
+        pthread_mutex_init(&q->lock, NULL);
+        g_queue_init(&q->parked);
+        g_hash_table_insert(queues, q->name, q);
+    }
+    pthread_mutex_unlock(&lock);
+
+    return q;
+}
+
+int
+work_pool_submit(struct work_queue_s *queue, work_pool_work_f *work,
+                 work_pool_completion_f *completion, void *user_data,
+                 struct work_token_s *token, const char *origin)
+{
+    const PP_Resource m_loop = ppb_message_loop_get_current();
+
+    // running completion on a worker would surprise callers, they expect their own thread
+    if (completion && m_loop == 0) {
+        trace_error("%s, no message loop to run completion of %s on\n", __func__, origin);
+        return PP_ERROR_NO_MESSAGE_LOOP;
+    }
+
+    pthread_mutex_lock(&lock);
+    ensure_workers_running();
+    if (worker_count == 0) {
+        pthread_mutex_unlock(&lock);
+        trace_error("%s, no workers\n", __func__);
+        return PP_ERROR_FAILED;
+    }
+    pending ++;
+    queue->pending ++;
+    pthread_mutex_unlock(&lock);
+
+    struct work_item_s *item = g_slice_new0(struct work_item_s);
+    item->queue =       queue;
+    item->work =        work;
+    item->completion =  completion;
+    item->user_data =   user_data;
+    item->token =       token ? work_token_ref(token) : NULL;
+    item->m_loop =      m_loop;
+    item->origin =      origin;
+
+    g_atomic_int_inc(&stats.submitted);
+    push_runnable(item);
+    return PP_OK;
+}
+
+void
+work_pool_wait_idle(struct work_queue_s *queue)
+{
+    pthread_mutex_lock(&lock);
+    while ((queue ? queue->pending : pending) > 0)
+        pthread_cond_wait(&idle_cond, &lock);
+    pthread_mutex_unlock(&lock);
+}
+
+struct work_token_s *
+work_token_new(void)
+{
+    struct work_token_s *token = g_slice_new0(struct work_token_s);
+    token->refcount = 1;
+    return token;
+}
+
+struct work_token_s *
+work_token_ref(struct work_token_s *token)
+{
+    g_atomic_int_inc(&token->refcount);
+    return token;
+}
+
+void
+work_token_unref(struct work_token_s *token)
+{
+    if (g_atomic_int_dec_and_test(&token->refcount))
+        g_slice_free(struct work_token_s, token);
+}
+
+void
+work_token_cancel(struct work_token_s *token)
+{
+    g_atomic_int_set(&token->cancelled, 1);
+}
+
+int
+work_token_is_cancelled(struct work_token_s *token)
+{
+    return g_atomic_int_get(&token->cancelled);
+}
+
+void
+work_pool_get_stats(struct work_pool_stats_s *s)
+{
+    s->submitted =  g_atomic_int_get(&stats.submitted);
+    s->cancelled =  g_atomic_int_get(&stats.cancelled);
+    s->stolen =     g_atomic_int_get(&stats.stolen);
+    s->parked =     g_atomic_int_get(&stats.parked);
+}
+
+void
+work_pool_reset_stats(void)
+{
+    g_atomic_int_set(&stats.submitted, 0);
+    g_atomic_int_set(&stats.cancelled, 0);
+    g_atomic_int_set(&stats.stolen, 0);
+    g_atomic_int_set(&stats.parked, 0);
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright © 2013-2017  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+
+/// Shared pool of worker threads for blocking work, like file access or D-Bus calls. Work is
+/// submitted to named queues, each of which limits how many of its items may run at once.
+/// Items submitted from outside are taken from a common FIFO; items submitted by workers
+/// themselves, or released from a queue limit, go to worker's own deque. Idle workers steal
+/// from deques of others. Result of work is passed to completion, which runs on the message
+/// loop of submitting thread. Workers are started on first submit; their number is set by
+/// config.background_threads.
+
+struct work_queue_s;
+
+/// cancellation token, usually owned by a resource and cancelled on its destruction
+struct work_token_s;
+
+/// does the work on a worker thread. Returned value is passed to completion
+typedef int32_t (work_pool_work_f)(void *user_data);
+
+/// |result| is PP_ERROR_ABORTED if token was cancelled before completion had a chance to run
+typedef void (work_pool_completion_f)(void *user_data, int32_t result);
+
+struct work_pool_stats_s {
+    int     submitted;
+    int     cancelled;      ///< items whose token was cancelled before work was started
+    int     stolen;         ///< items taken from deque of another worker
+    int     parked;         ///< times an item was put aside due to queue concurrency limit
+};
+
+/// returns queue named |name|, creating it on first use. |max_concurrency| of zero means no
+/// limit besides the number of workers. Limit is set by the first call
+struct work_queue_s *
+work_pool_get_queue(const char *name, int max_concurrency);
+
+/// runs |work| on a worker thread, then |completion| on the message loop attached to calling
+/// thread. Both may be NULL. If |token| is cancelled before work starts, work is skipped.
+/// Returns PP_OK on success, PP_ERROR_NO_MESSAGE_LOOP if there is |completion| but calling
+/// thread has no message loop, or PP_ERROR_FAILED
+int
+work_pool_submit(struct work_queue_s *queue, work_pool_work_f *work,
+                 work_pool_completion_f *completion, void *user_data,
+                 struct work_token_s *token, const char *origin);
+
+/// waits until work of all items submitted to |queue|, or to any queue if NULL, is done.
+/// Completions posted to message loops may still be pending
+void
+work_pool_wait_idle(struct work_queue_s *queue);
+
+struct work_token_s *
+work_token_new(void);
+
+struct work_token_s *
+work_token_ref(struct work_token_s *token);
+
+void
+work_token_unref(struct work_token_s *token);
+
+void
+work_token_cancel(struct work_token_s *token);
+
+int
+work_token_is_cancelled(struct work_token_s *token);
+
+void
+work_pool_get_stats(struct work_pool_stats_s *stats);
+
+void
+work_pool_reset_stats(void);
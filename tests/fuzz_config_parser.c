@@ -0,0 +1,67 @@
+// fuzzing harness for configuration file parser
+
+#include "fuzz_driver.h"
+#include <glib.h>
+#include <src/config_parser/config_parser.h>
+#include <stdlib.h>
+
+static
+void
+ignore_error(const char *s)
+{
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    gchar *s = g_strndup((const char *)data, size);
+    char *str_value = NULL;
+    int int_value = 0;
+    double float_value = 0;
+
+    cfg_opt_t opts[] = {
+        CFG_SIMPLE_STR("string", &str_value),
+        CFG_SIMPLE_INT("int", &int_value),
+        CFG_SIMPLE_FLOAT("float", &float_value),
+        CFG_END()
+    };
+
+    cfg_t *cfg = cfg_init(opts, 0);
+    if (!cfg)
+        abort();
+
+    cfg_set_error_func(cfg, ignore_error);
+    cfg_parse_string(cfg, s);
+    cfg_free(cfg);
+
+    free(str_value);
+    g_free(s);
+    return 0;
+}
+
+const char *
+fuzz_pathological_input(unsigned int kind, char *buf, size_t size)
+{
+    switch (kind) {
+    case 0:
+        fuzz_fill(buf, size, "string = ", "value ");
+        return "long value with spaces";
+    case 1:
+        fuzz_fill(buf, size, "string = \"", "value ");
+        return "unterminated quote";
+    case 2:
+        fuzz_fill(buf, size, "", "int = 1\n");
+        return "many lines";
+    case 3:
+        fuzz_fill(buf, size, "", "unknown_key = 1\n");
+        return "many unknown keys";
+    case 4:
+        fuzz_fill(buf, size, "", "name_");
+        return "long name";
+    case 5:
+        fuzz_fill(buf, size, "# ", "comment ");
+        return "long comment";
+    default:
+        return NULL;
+    }
+}
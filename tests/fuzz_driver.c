@@ -0,0 +1,163 @@
+// standalone driver for fuzz_*.c harnesses, used when they are not built with libFuzzer.
+//
+//     ./fuzz_uri_parser [file-or-directory ...]
+//
+// Runs every given file through the harness and reports throughput, then checks that parse
+// time of pathological inputs grows linearly with their size. AFL can use the same binary,
+// passing input file as an argument. For coverage-guided fuzzing with libFuzzer, configure
+// with clang and -DWITH_FUZZER=1, then run harness with seed corpus from data/fuzz:
+//
+//     ./fuzz_uri_parser corpus/ ../tests/data/fuzz/uri_parser
+
+#include "fuzz_driver.h"
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SMALL_SIZE      (64 * 1024)
+#define SIZE_FACTOR     8
+#define MAX_SLOWDOWN    (3 * SIZE_FACTOR)   // linear growth, plus cache and allocator effects
+#define MIN_SLOW_TIME   0.05                // seconds, parse times below are never a failure
+#define MIN_MEASURE_NS  (20 * 1000 * 1000)
+
+struct totals_s {
+    unsigned int    inputs;
+    size_t          bytes;
+    double          time;
+    double          slowest_time;
+    gchar          *slowest_name;
+};
+
+static
+double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static
+void
+run_file(const char *fname, struct totals_s *totals)
+{
+    gchar *data;
+    gsize len;
+
+    if (!g_file_get_contents(fname, &data, &len, NULL)) {
+        fprintf(stderr, "can't read %s\n", fname);
+        return;
+    }
+
+    const double t = now();
+    LLVMFuzzerTestOneInput((const uint8_t *)data, len);
+    const double elapsed = now() - t;
+
+    totals->inputs += 1;
+    totals->bytes += len;
+    totals->time += elapsed;
+    if (elapsed > totals->slowest_time) {
+        totals->slowest_time = elapsed;
+        g_free(totals->slowest_name);
+        totals->slowest_name = g_strdup(fname);
+    }
+
+    g_free(data);
+}
+
+static
+void
+run_path(const char *path, struct totals_s *totals)
+{
+    if (!g_file_test(path, G_FILE_TEST_IS_DIR)) {
+        run_file(path, totals);
+        return;
+    }
+
+    GDir *dir = g_dir_open(path, 0, NULL);
+    if (!dir) {
+        fprintf(stderr, "can't open %s\n", path);
+        return;
+    }
+
+    const gchar *name;
+    while ((name = g_dir_read_name(dir)) != NULL) {
+        gchar *fname = g_build_filename(path, name, NULL);
+        run_path(fname, totals);
+        g_free(fname);
+    }
+
+    g_dir_close(dir);
+}
+
+/// returns time of a single parse of pathological input, seconds
+static
+double
+measure(unsigned int kind, size_t size)
+{
+    char *buf = malloc(size);
+    unsigned int runs = 0;
+    double elapsed = 0;
+
+    fuzz_pathological_input(kind, buf, size);
+
+    // short inputs are parsed many times to get meaningful duration
+    while (elapsed < MIN_MEASURE_NS / 1e9) {
+        const double t = now();
+        LLVMFuzzerTestOneInput((const uint8_t *)buf, size);
+        elapsed += now() - t;
+        runs += 1;
+    }
+
+    free(buf);
+    return elapsed / runs;
+}
+
+static
+int
+check_pathological_inputs(void)
+{
+    const char *name;
+    char probe[1];
+    int failed = 0;
+
+    for (unsigned int kind = 0; (name = fuzz_pathological_input(kind, probe, 0)) != NULL;
+         kind ++)
+    {
+        const double t_small = measure(kind, SMALL_SIZE);
+        const double t_large = measure(kind, SMALL_SIZE * SIZE_FACTOR);
+        const double slowdown = t_large / t_small;
+        const int too_slow = slowdown > MAX_SLOWDOWN && t_large > MIN_SLOW_TIME;
+
+        printf("%-32s %7.3f ms for %u KiB, %8.3f ms for %u KiB, x%.1f%s\n", name,
+               1e3 * t_small, SMALL_SIZE / 1024, 1e3 * t_large,
+               SMALL_SIZE * SIZE_FACTOR / 1024, slowdown,
+               too_slow ? ", FAILED: grows faster than linearly" : "");
+
+        if (too_slow)
+            failed = 1;
+    }
+
+    return failed;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct totals_s totals = {};
+
+    for (int k = 1; k < argc; k ++)
+        run_path(argv[k], &totals);
+
+    if (totals.inputs > 0) {
+        printf("%u inputs, %zu bytes in %.3f ms, %.0f inputs/s, %.2f MB/s\n", totals.inputs,
+               totals.bytes, 1e3 * totals.time, totals.inputs / totals.time,
+               totals.bytes / totals.time / 1e6);
+        printf("slowest: %s, %.3f ms\n", totals.slowest_name, 1e3 * totals.slowest_time);
+    }
+    g_free(totals.slowest_name);
+
+    return check_pathological_inputs();
+}
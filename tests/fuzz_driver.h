@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Each fuzz_*.c harness implements both functions. Harnesses are built either for libFuzzer,
+// or with fuzz_driver.c, which runs given files and directories through the harness (that's
+// how AFL runs them too) and checks parse time of pathological inputs grows linearly.
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+/// fills |buf| of |size| bytes with pathological input number |kind|.
+///
+/// returns short description, or NULL if there is no such kind
+const char *
+fuzz_pathological_input(unsigned int kind, char *buf, size_t size);
+
+/// fills |buf| with |prefix| followed by |pattern| repeated until the end
+static inline
+void
+fuzz_fill(char *buf, size_t size, const char *prefix, const char *pattern)
+{
+    const size_t prefix_len = strlen(prefix);
+    const size_t pattern_len = strlen(pattern);
+    size_t pos = 0;
+
+    for (; pos < size && pos < prefix_len; pos ++)
+        buf[pos] = prefix[pos];
+
+    for (; pos < size; pos ++)
+        buf[pos] = pattern[(pos - prefix_len) % pattern_len];
+}
@@ -0,0 +1,55 @@
+// fuzzing harness for HTTP response header parser
+
+#include "fuzz_driver.h"
+#include <glib.h>
+#include <src/header_parser.c>
+#include <stdlib.h>
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    gchar *s = g_strndup((const char *)data, size);
+
+    struct parsed_headers_s *ph = hp_parse_headers(s);
+    if (!ph)
+        abort();
+
+    // every parsed header can be found by its name
+    for (unsigned int k = 0; k < ph->cnt; k ++) {
+        if (!hp_header_exists(ph, ph->name[k]) || !hp_get_header_value(ph, ph->name[k]))
+            abort();
+    }
+
+    hp_free_parsed_headers(ph);
+    g_free(s);
+    return 0;
+}
+
+const char *
+fuzz_pathological_input(unsigned int kind, char *buf, size_t size)
+{
+    switch (kind) {
+    case 0:
+        fuzz_fill(buf, size, "HTTP/1.1 200 OK\r\nX-Long: ", "value ");
+        return "long header value";
+    case 1:
+        // lookup of each header scans all of them, so the count is limited
+        fuzz_fill(buf, MIN(size, 4096), "HTTP/1.1 200 OK\r\n", "X-A: b\r\n");
+        fuzz_fill(buf + MIN(size, 4096), size - MIN(size, 4096), "X-Long: ", "value");
+        return "some headers and long one";
+    case 2:
+        fuzz_fill(buf, size, "HTTP/1.1 200 OK\r\n", "\r\n");
+        return "empty lines";
+    case 3:
+        fuzz_fill(buf, size, "HTTP/", "1");
+        return "long status line";
+    case 4:
+        fuzz_fill(buf, size, "HTTP/1.1 200 OK\r\nX-Colons", ":");
+        return "many colons";
+    case 5:
+        fuzz_fill(buf, size, "HTTP/1.1 200 OK\r\nX-Spaces:", " ");
+        return "leading spaces in value";
+    default:
+        return NULL;
+    }
+}
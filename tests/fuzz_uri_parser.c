@@ -0,0 +1,78 @@
+// fuzzing harness for uri_parser_parse_uri() and uri_parser_merge_uris(). Input is parsed
+// as a whole, then, if it has a newline, the first line is used as base URI, and the rest
+// as relative one.
+
+#include "fuzz_driver.h"
+#include <glib.h>
+#include <src/uri_parser/uri_parser.h>
+#include <stdlib.h>
+#include <string.h>
+
+static
+void
+check_component(struct PP_URLComponent_Dev c, size_t len)
+{
+    // missing components have negative length
+    if (c.len < 0)
+        return;
+
+    if (c.begin < 0 || (size_t)c.begin + c.len > len)
+        abort();
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    // parser works with zero-terminated strings
+    gchar *s = g_strndup((const char *)data, size);
+    const size_t len = strlen(s);
+    struct PP_URLComponents_Dev c;
+
+    uri_parser_parse_uri(s, &c);
+    check_component(c.scheme, len);
+    check_component(c.username, len);
+    check_component(c.password, len);
+    check_component(c.host, len);
+    check_component(c.port, len);
+    check_component(c.path, len);
+    check_component(c.query, len);
+    check_component(c.ref, len);
+
+    char *newline = strchr(s, '\n');
+    if (newline) {
+        *newline = 0;
+        g_free(uri_parser_merge_uris(s, newline + 1));
+    }
+
+    g_free(s);
+    return 0;
+}
+
+const char *
+fuzz_pathological_input(unsigned int kind, char *buf, size_t size)
+{
+    switch (kind) {
+    case 0:
+        fuzz_fill(buf, size, "http://example.org/", "segment/");
+        return "long path";
+    case 1:
+        fuzz_fill(buf, size, "http://example.org/", "./a/../");
+        return "dot segments";
+    case 2:
+        // base with deep path, and relative one going up; both halves are of equal length
+        fuzz_fill(buf, size / 2, "http://example.org/", "a/");
+        fuzz_fill(buf + size / 2, size - size / 2, "\n", "../");
+        return "merge going up deep path";
+    case 3:
+        fuzz_fill(buf, size, "http://example.org/?", "key=value&");
+        return "long query";
+    case 4:
+        fuzz_fill(buf, size, "http://user:", "password");
+        return "long userinfo without host";
+    case 5:
+        fuzz_fill(buf, size, "", "%");
+        return "percent signs";
+    default:
+        return NULL;
+    }
+}
@@ -0,0 +1,326 @@
+#include "common.h"
+#include "nih_test.h"
+#include <src/audio_rt.h>
+#include <src/audio_thread.c>
+#include <src/thread_local.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct playback_s {
+    volatile gint   calls;
+    volatile gint   bad_size;
+    uint32_t        expected_size;
+    int             stall_at_call;  ///< callback with that number sleeps for |stall_ms|
+    int             stall_ms;
+    volatile gint   rt_state;
+    int             fill;           ///< byte plugin writes to playback buffers, if non-zero
+};
+
+static volatile gint    burners_stop;
+
+static volatile gint    stalled_destroyed;
+
+static audio_stream_playback_cb_f  *resuming_cb;
+static void                        *resuming_cb_user_data;
+static volatile gint                resuming_late_cb_silent;
+
+static
+void
+playback_cb(void *buf, uint32_t sz, double latency, void *user_data)
+{
+    struct playback_s *pb = user_data;
+
+    if (sz != pb->expected_size)
+        g_atomic_int_set(&pb->bad_size, 1);
+    if (pb->fill)
+        memset(buf, pb->fill, sz);
+    if (g_atomic_int_add(&pb->calls, 1) + 1 == pb->stall_at_call)
+        usleep(pb->stall_ms * 1000);
+    g_atomic_int_set(&pb->rt_state, get_thread_local()->audio_rt_state);
+}
+
+static
+int
+wait_for_calls(struct playback_s *pb, int calls)
+{
+    for (int k = 0; k < 300; k ++) {
+        if (g_atomic_int_get(&pb->calls) >= calls)
+            return 1;
+        usleep(10 * 1000);
+    }
+    return 0;
+}
+
+// backend which accepts streams, but never calls their callbacks
+static
+int
+stalled_available(void)
+{
+    return 1;
+}
+
+static
+audio_stream *
+stalled_create_playback_stream(unsigned int sample_rate, unsigned int sample_frame_count,
+                               audio_stream_playback_cb_f *cb, void *cb_user_data)
+{
+    static int dummy;
+    return (audio_stream *)&dummy;
+}
+
+static
+void
+stalled_pause(audio_stream *s, int enabled)
+{
+}
+
+static
+void
+stalled_destroy(audio_stream *s)
+{
+    g_atomic_int_inc(&stalled_destroyed);
+}
+
+static audio_stream_ops audio_stalled = {
+    .available =                stalled_available,
+    .create_playback_stream =   stalled_create_playback_stream,
+    .pause =                    stalled_pause,
+    .destroy =                  stalled_destroy,
+};
+
+// backend which stalls, but wakes up and calls back once more when it's being destroyed
+static
+audio_stream *
+resuming_create_playback_stream(unsigned int sample_rate, unsigned int sample_frame_count,
+                                audio_stream_playback_cb_f *cb, void *cb_user_data)
+{
+    static int dummy;
+
+    resuming_cb = cb;
+    resuming_cb_user_data = cb_user_data;
+    return (audio_stream *)&dummy;
+}
+
+static
+void
+resuming_destroy(audio_stream *s)
+{
+    uint8_t buf[441 * 2 * sizeof(int16_t)];
+    int silent = 1;
+
+    memset(buf, 0x11, sizeof(buf));
+    resuming_cb(buf, sizeof(buf), 0, resuming_cb_user_data);
+    for (size_t k = 0; k < sizeof(buf); k ++)
+        silent = silent && buf[k] == 0;
+    g_atomic_int_set(&resuming_late_cb_silent, silent);
+}
+
+static audio_stream_ops audio_resuming = {
+    .available =                stalled_available,
+    .create_playback_stream =   resuming_create_playback_stream,
+    .pause =                    stalled_pause,
+    .destroy =                  resuming_destroy,
+};
+
+TEST(audio_backend, null_sink_keeps_real_time_rate)
+{
+    struct playback_s pb = { .expected_size = 480 * 2 * sizeof(int16_t) };
+    struct audio_null_sink_stats_s stats;
+
+    audio_stream *as = audio_noaudio.create_playback_stream(48000, 480, playback_cb, &pb);
+    ASSERT_TRUE(as);
+
+    // nothing is consumed while paused
+    usleep(50 * 1000);
+    ASSERT_EQ(g_atomic_int_get(&pb.calls), 0);
+
+    audio_null_sink_reset_stats();
+    audio_noaudio.pause(as, 0);
+    usleep(1000 * 1000);
+    audio_noaudio.pause(as, 1);
+    audio_null_sink_get_stats(&stats);
+    audio_noaudio.destroy(as);
+
+    // 10 ms periods
+    printf("%d callbacks, jitter avg %.3f ms, max %.3f ms, %u late, callback time avg %.3f ms\n",
+           pb.calls, 1e3 * stats.jitter_avg, 1e3 * stats.jitter_max,
+           (unsigned)stats.late_callbacks, 1e3 * stats.cb_time_avg);
+    // bounds are wide, test may run on a loaded machine
+    ASSERT_GE(pb.calls, 30);
+    ASSERT_LE(pb.calls, 110);
+    ASSERT_EQ(stats.callbacks, (uint64_t)pb.calls);
+    ASSERT_LT(stats.jitter_avg, 0.1);
+    ASSERT_FALSE(pb.bad_size);
+}
+
+TEST(audio_backend, null_sink_counts_underruns)
+{
+    struct playback_s pb = { .expected_size = 480 * 2 * sizeof(int16_t), .stall_at_call = 10,
+                             .stall_ms = 50 };
+    struct audio_stream_stats_s stats = {};
+
+    audio_stream *as = audio_noaudio.create_playback_stream(48000, 480, playback_cb, &pb);
+    ASSERT_TRUE(as);
+
+    audio_noaudio.pause(as, 0);
+    ASSERT_TRUE(wait_for_calls(&pb, 30));
+    audio_noaudio.pause(as, 1);
+    audio_noaudio.get_stats(as, &stats);
+    audio_noaudio.destroy(as);
+
+    // single 50 ms stall in 10 ms periods
+    printf("%" PRIu64 " underruns\n", stats.underruns);
+    ASSERT_GE(stats.underruns, (uint64_t)1);
+}
+
+static
+void *
+burner_thread(void *param)
+{
+    volatile uint64_t x = 0;
+
+    while (!g_atomic_int_get(&burners_stop))
+        x ++;
+    return NULL;
+}
+
+TEST(audio_backend, loopback_playback_under_cpu_load)
+{
+    struct playback_s pb = { .expected_size = 441 * 2 * sizeof(int16_t) };
+    struct audio_stream_stats_s stats = {};
+    const int burner_count = 2 * g_get_num_processors();
+    pthread_t burners[burner_count];
+
+    // needs snd-aloop module loaded
+    if (access("/proc/asound/Loopback", F_OK) != 0) {
+        printf("no ALSA loopback device, skipping\n");
+        return;
+    }
+
+    setenv("ALSA_CARD", "Loopback", 1);
+    config.audio_backend = "alsa";
+    config.audio_realtime_priority = 1;
+
+    audio_stream_ops *ops = audio_select_implementation();
+    audio_stream *as = ops->create_playback_stream(44100, 441, playback_cb, &pb);
+    ASSERT_TRUE(as);
+
+    g_atomic_int_set(&burners_stop, 0);
+    for (int k = 0; k < burner_count; k ++)
+        pthread_create(&burners[k], NULL, burner_thread, NULL);
+
+    ops->pause(as, 0);
+    usleep(2 * 1000 * 1000);
+    ops->pause(as, 1);
+
+    g_atomic_int_set(&burners_stop, 1);
+    for (int k = 0; k < burner_count; k ++)
+        pthread_join(burners[k], NULL);
+
+    ops->get_stats(as, &stats);
+    ops->destroy(as);
+    config.audio_backend = NULL;
+    config.audio_realtime_priority = 0;
+
+    const int rt_state = g_atomic_int_get(&pb.rt_state);
+    printf("%d burners, audio thread %s, %" PRIu64 " callbacks, %" PRIu64 " underruns, "
+           "%" PRIu64 " slow callbacks, longest %.3f ms\n", burner_count,
+           audio_rt_state_name(rt_state), stats.callbacks, stats.underruns,
+           stats.slow_callbacks, 1e3 * stats.cb_time_max);
+    ASSERT_GE(stats.callbacks, (uint64_t)100);
+    ASSERT_FALSE(pb.bad_size);
+
+    // without elevation, glitches depend on how busy the machine is
+    if (rt_state == AUDIO_RT_DIRECT || rt_state == AUDIO_RT_RTKIT)
+        ASSERT_EQ(stats.underruns, (uint64_t)0);
+}
+
+TEST(audio_backend, blocking_plugin_callback_is_not_a_stall)
+{
+    struct playback_s pb = { .expected_size = 441 * 2 * sizeof(int16_t), .stall_at_call = 3,
+                             .stall_ms = 600 };
+    audio_stream_ops *saved_ops = backends[0].ops;
+
+    // timer-driven backend taking place of the first real one, so watchdog checks it
+    backends[0].ops = &audio_noaudio;
+    stall_timeout_ms = 200;
+
+    audio_stream_ops *ops = audio_select_implementation();
+    audio_stream *as = ops->create_playback_stream(44100, 441, playback_cb, &pb);
+    ASSERT_TRUE(as);
+    ASSERT_EQ(as->backend_idx, 0);
+
+    ops->pause(as, 0);
+    ASSERT_TRUE(wait_for_calls(&pb, 10));
+    ops->pause(as, 1);
+
+    ASSERT_EQ(as->backend_idx, 0);
+    ASSERT_FALSE(g_atomic_int_get(&backends[0].failed));
+    ops->destroy(as);
+
+    backends[0].ops = saved_ops;
+    stall_timeout_ms = 2000;
+}
+
+TEST(audio_backend, stalled_stream_moves_to_next_backend)
+{
+    struct playback_s pb = { .expected_size = 441 * 2 * sizeof(int16_t) };
+
+    // every real backend gets replaced by a stalling one; null sink is the last resort
+    for (size_t k = 0; k < NULL_BACKEND; k ++)
+        backends[k].ops = &audio_stalled;
+    stall_timeout_ms = 200;
+
+    audio_stream_ops *ops = audio_select_implementation();
+    audio_stream *as = ops->create_playback_stream(44100, 441, playback_cb, &pb);
+    ASSERT_TRUE(as);
+    ASSERT_EQ(as->backend_idx, 0);
+
+    ops->pause(as, 0);
+    ASSERT_TRUE(wait_for_calls(&pb, 10));
+
+    // all stalled backends were tried in turn
+    ASSERT_EQ(as->backend_idx, NULL_BACKEND);
+    ASSERT_EQ(g_atomic_int_get(&stalled_destroyed), (gint)NULL_BACKEND);
+    for (size_t k = 0; k < NULL_BACKEND; k ++)
+        ASSERT_TRUE(g_atomic_int_get(&backends[k].failed));
+
+    // new streams avoid failed backends right away
+    struct playback_s pb2 = { .expected_size = 441 * 2 * sizeof(int16_t) };
+    audio_stream *as2 = ops->create_playback_stream(44100, 441, playback_cb, &pb2);
+    ASSERT_TRUE(as2);
+    ASSERT_EQ(as2->backend_idx, NULL_BACKEND);
+
+    ops->destroy(as2);
+    ops->destroy(as);
+    ASSERT_FALSE(pb.bad_size);
+}
+
+TEST(audio_backend, stalled_backend_resuming_after_failover_is_ignored)
+{
+    struct playback_s pb = { .expected_size = 441 * 2 * sizeof(int16_t), .fill = 0x55 };
+
+    // first backend stalls, the rest except null sink are unavailable
+    backends[0].ops = &audio_resuming;
+    g_atomic_int_set(&backends[0].failed, 0);
+    for (size_t k = 1; k < NULL_BACKEND; k ++)
+        g_atomic_int_set(&backends[k].failed, 1);
+    stall_timeout_ms = 200;
+
+    audio_stream_ops *ops = audio_select_implementation();
+    audio_stream *as = ops->create_playback_stream(44100, 441, playback_cb, &pb);
+    ASSERT_TRUE(as);
+    ASSERT_EQ(as->backend_idx, 0);
+
+    ops->pause(as, 0);
+    ASSERT_TRUE(wait_for_calls(&pb, 10));
+    ASSERT_EQ(as->backend_idx, NULL_BACKEND);
+
+    // watchdog destroys replaced streams with teardown lock held, so it's done by now
+    ops->destroy(as);
+    ASSERT_FALSE(pb.bad_size);
+
+    // late callback of replaced stream got silence instead of reaching plugin
+    ASSERT_TRUE(g_atomic_int_get(&resuming_late_cb_silent));
+}
@@ -0,0 +1,257 @@
+#include "common.h"
+#include "nih_test.h"
+#include <math.h>
+#include <src/audio_capture_pipeline.c>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define MAX_OUTPUT  (4 * 48000)
+
+struct output_s {
+    int16_t     samples[MAX_OUTPUT];
+    uint32_t    count;
+    uint32_t    block_count;
+    int         bad_block_size;
+    uint32_t    expected_block_size;
+};
+
+static
+void
+output_cb(const void *buf, uint32_t sz, double latency, void *user_data)
+{
+    struct output_s *out = user_data;
+    const uint32_t frames = sz / sizeof(int16_t);
+
+    if (sz != out->expected_block_size)
+        out->bad_block_size = 1;
+
+    out->block_count += 1;
+    if (out->count + frames <= MAX_OUTPUT) {
+        memcpy(out->samples + out->count, buf, sz);
+        out->count += frames;
+    }
+}
+
+static
+void
+wait_for_input(audio_capture_pipeline *p, uint64_t frames)
+{
+    struct audio_capture_stats_s stats;
+
+    for (int k = 0; k < 1000; k ++) {
+        audio_capture_pipeline_get_stats(p, &stats);
+        if (stats.frames_in >= frames)
+            return;
+        usleep(10 * 1000);
+    }
+}
+
+static
+uint32_t
+count_rising_zero_crossings(const int16_t *s, uint32_t count)
+{
+    uint32_t crossings = 0;
+    for (uint32_t k = 1; k < count; k ++) {
+        if (s[k - 1] < 0 && s[k] >= 0)
+            crossings ++;
+    }
+    return crossings;
+}
+
+TEST(audio_capture_pipeline, stereo_float_48000_to_mono_s16_44100)
+{
+    const uint32_t in_rate = 48000;
+    const uint32_t chunk = 333;     // doesn't divide anything on purpose
+    const uint32_t frame_count = 1024;
+    struct output_s *out = calloc(1, sizeof(*out));
+    float buf[2 * chunk];
+
+    out->expected_block_size = frame_count * sizeof(int16_t);
+    audio_capture_pipeline *p = audio_capture_pipeline_create(44100, frame_count, 0, output_cb,
+                                                              out);
+    ASSERT_TRUE(p);
+
+    audio_stream_format fmt = {
+        .sample_rate =      in_rate,
+        .channels =         2,
+        .sample_format =    AUDIO_SAMPLE_FLOAT,
+    };
+    audio_capture_pipeline_start(p, &fmt);
+
+    // one second of 1 kHz tone
+    uint32_t pos = 0;
+    while (pos < in_rate) {
+        for (uint32_t k = 0; k < chunk; k ++) {
+            const float v = 0.5f * sinf(2 * M_PI * 1000 * (pos + k) / in_rate);
+            buf[2 * k] = v;
+            buf[2 * k + 1] = v;
+        }
+        audio_capture_pipeline_push(p, buf, sizeof(buf), 0);
+        pos += chunk;
+    }
+
+    wait_for_input(p, pos);
+    audio_capture_pipeline_destroy(p);
+
+    ASSERT_FALSE(out->bad_block_size);
+    ASSERT_EQ(out->count, out->block_count * frame_count);
+
+    // all complete blocks of about 44100 * pos / 48000 output frames
+    const uint32_t expected = 44100ull * pos / in_rate;
+    ASSERT_GE(out->count, expected - frame_count);
+    ASSERT_LE(out->count, expected);
+
+    // frequency is preserved. Resampling filter rings around zero for a few samples at the
+    // start, as input starts from silence, so those are skipped
+    const uint32_t settle = 64;
+    const uint32_t crossings = count_rising_zero_crossings(out->samples + settle,
+                                                           out->count - settle);
+    const uint32_t expected_crossings = 1000ull * (out->count - settle) / 44100;
+    printf("%u frames, %u zero crossings, %u expected\n", out->count, crossings,
+           expected_crossings);
+    ASSERT_LE(abs((int)crossings - (int)expected_crossings), 2);
+
+    // and amplitude too
+    int16_t peak = 0;
+    for (uint32_t k = 0; k < out->count; k ++)
+        peak = MAX(peak, abs(out->samples[k]));
+    ASSERT_GT(peak, 0.5 * 32767 * 0.95);
+    ASSERT_LT(peak, 0.5 * 32767 * 1.05);
+
+    free(out);
+}
+
+/// resamples one second of a tone of |freq| Hz, returns output peak, first block skipped
+static
+int16_t
+resampled_tone_peak(uint32_t in_rate, uint32_t out_rate, float freq)
+{
+    const uint32_t chunk = 480;
+    const uint32_t frame_count = out_rate / 100;
+    struct output_s *out = calloc(1, sizeof(*out));
+    int16_t buf[chunk];
+
+    out->expected_block_size = frame_count * sizeof(int16_t);
+    audio_capture_pipeline *p = audio_capture_pipeline_create(out_rate, frame_count, 0,
+                                                              output_cb, out);
+    audio_stream_format fmt = {
+        .sample_rate =      in_rate,
+        .channels =         1,
+        .sample_format =    AUDIO_SAMPLE_S16,
+    };
+    audio_capture_pipeline_start(p, &fmt);
+
+    uint32_t pos = 0;
+    while (pos < in_rate) {
+        for (uint32_t k = 0; k < chunk; k ++)
+            buf[k] = 16384 * sinf(2 * M_PI * freq * (pos + k) / in_rate);
+        audio_capture_pipeline_push(p, buf, sizeof(buf), 0);
+        pos += chunk;
+    }
+
+    wait_for_input(p, pos);
+    audio_capture_pipeline_destroy(p);
+
+    int16_t peak = 0;
+    for (uint32_t k = frame_count; k < out->count; k ++)
+        peak = MAX(peak, abs(out->samples[k]));
+
+    free(out);
+    return peak;
+}
+
+TEST(audio_capture_pipeline, downsampling_doesnt_alias)
+{
+    // 1 kHz is well within 8 kHz output band
+    const int16_t passed = resampled_tone_peak(48000, 8000, 1000);
+
+    // 6 kHz is above output Nyquist frequency, and would fold back to 2 kHz
+    const int16_t rejected = resampled_tone_peak(48000, 8000, 6000);
+
+    printf("1 kHz peak %d, 6 kHz peak %d\n", passed, rejected);
+    ASSERT_GT(passed, 16384 * 0.9);
+    ASSERT_LT(passed, 16384 * 1.1);
+    ASSERT_LT(rejected, 16384 / 100);
+}
+
+TEST(audio_capture_pipeline, agc_raises_quiet_input)
+{
+    const uint32_t rate = 44100;
+    const uint32_t chunk = 441;
+    const uint32_t frame_count = 441;
+    const int16_t amplitude = 328;  // about -40 dBFS
+    struct output_s *out = calloc(1, sizeof(*out));
+    int16_t buf[chunk];
+
+    out->expected_block_size = frame_count * sizeof(int16_t);
+    audio_capture_pipeline *p = audio_capture_pipeline_create(rate, frame_count, 1, output_cb,
+                                                              out);
+    ASSERT_TRUE(p);
+
+    audio_stream_format fmt = {
+        .sample_rate =      rate,
+        .channels =         1,
+        .sample_format =    AUDIO_SAMPLE_S16,
+    };
+    audio_capture_pipeline_start(p, &fmt);
+
+    uint32_t pos = 0;
+    while (pos < 2 * rate) {
+        for (uint32_t k = 0; k < chunk; k ++)
+            buf[k] = amplitude * sinf(2 * M_PI * 440 * (pos + k) / rate);
+        audio_capture_pipeline_push(p, buf, sizeof(buf), 0);
+        pos += chunk;
+    }
+
+    wait_for_input(p, pos);
+    audio_capture_pipeline_destroy(p);
+
+    ASSERT_FALSE(out->bad_block_size);
+    ASSERT_GT(out->count, frame_count);
+
+    int16_t peak = 0;
+    for (uint32_t k = out->count - frame_count; k < out->count; k ++)
+        peak = MAX(peak, abs(out->samples[k]));
+
+    printf("input peak %d, output peak %d\n", amplitude, peak);
+    ASSERT_GT(peak, 5 * amplitude);
+    ASSERT_LT(peak, 32767);
+
+    free(out);
+}
+
+TEST(audio_capture_pipeline, overruns_are_counted)
+{
+    struct output_s *out = calloc(1, sizeof(*out));
+    static int16_t buf[48000];
+    struct audio_capture_stats_s stats;
+
+    out->expected_block_size = 480 * sizeof(int16_t);
+    audio_capture_pipeline *p = audio_capture_pipeline_create(48000, 480, 0, output_cb, out);
+    ASSERT_TRUE(p);
+
+    // nobody reads the ring until pipeline is started
+    for (int k = 0; k < 20; k ++)
+        audio_capture_pipeline_push(p, buf, sizeof(buf), 0);
+
+    audio_stream_format fmt = {
+        .sample_rate =      48000,
+        .channels =         1,
+        .sample_format =    AUDIO_SAMPLE_S16,
+    };
+    audio_capture_pipeline_start(p, &fmt);
+
+    // 1 MiB ring fits ten 96000-byte chunks
+    wait_for_input(p, 10 * 48000);
+    audio_capture_pipeline_get_stats(p, &stats);
+    audio_capture_pipeline_destroy(p);
+
+    printf("%u overruns, %u frames dropped\n", stats.overruns, (unsigned)stats.frames_dropped);
+    ASSERT_EQ(stats.overruns, 10);
+    ASSERT_EQ(stats.frames_dropped, 10 * 48000);
+    ASSERT_EQ(stats.frames_in, 10 * 48000);
+    ASSERT_FALSE(out->bad_block_size);
+
+    free(out);
+}
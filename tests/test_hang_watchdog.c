@@ -0,0 +1,76 @@
+#include "common.h"
+#include "nih_test.h"
+#include <pthread.h>
+#include <src/config.h>
+#include <src/hang_watchdog.h>
+#include <src/pp_resource.h>
+#include <src/ppb_message_loop.h>
+#include <src/utils.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static PP_Instance      instance;
+static pthread_mutex_t  wedge_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static
+void
+wedge_comt(void *user_data, int32_t result)
+{
+    // deliberately block the loop while holding a lock
+    pthread_mutex_lock(&wedge_lock);
+    usleep(600 * 1000);
+    pthread_mutex_unlock(&wedge_lock);
+
+    ppb_message_loop_post_quit(ppb_message_loop_get_current(), PP_FALSE);
+}
+
+static
+void
+idle_comt(void *user_data, int32_t result)
+{
+    ppb_message_loop_post_work(ppb_message_loop_get_current(),
+                               PP_MakeCCB(wedge_comt, NULL), 300);
+}
+
+static
+void *
+loop_thread(void *param)
+{
+    PP_Resource m_loop = ppb_message_loop_create(instance);
+    ppb_message_loop_attach_to_current_thread(m_loop);
+    ppb_message_loop_post_work(m_loop, PP_MakeCCB(idle_comt, NULL), 0);
+    ppb_message_loop_run(m_loop);
+    pp_resource_unref(m_loop);
+    return NULL;
+}
+
+TEST(hang_watchdog, wedged_loop_is_reported)
+{
+    pthread_t t;
+
+    config.hang_watchdog_ms = 100;
+    hang_watchdog_reset();
+    hang_watchdog_register_lock("wedge lock", &wedge_lock);
+    instance = create_instance();
+
+    pthread_create(&t, NULL, loop_thread, NULL);
+    pthread_join(t, NULL);
+
+    // waiting for a delayed task is not a hang, the wedged task is reported exactly once
+    ASSERT_EQ(hang_watchdog_get_report_count(), 1);
+
+    gchar *log = hang_watchdog_get_log();
+    printf("%s", log);
+    ASSERT_TRUE(strstr(log, "\"message loop thread\"") != NULL);
+    ASSERT_TRUE(strstr(log, "is busy for") != NULL);
+    ASSERT_TRUE(strstr(log, "#0") != NULL);
+    ASSERT_TRUE(strstr(log, "wedge lock") != NULL);
+    ASSERT_TRUE(strstr(log, "(this thread)") != NULL);
+    g_free(log);
+
+    hang_watchdog_unregister_lock(&wedge_lock);
+    hang_watchdog_reset();
+    destroy_instance(instance);
+    config.hang_watchdog_ms = 0;
+}
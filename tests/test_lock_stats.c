@@ -0,0 +1,75 @@
+#include "common.h"
+#include "nih_test.h"
+#include <pthread.h>
+#include <src/config.h>
+#include <src/lock_stats.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static pthread_mutex_t  test_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static
+void *
+contending_thread(void *param)
+{
+    for (int k = 0; k < 20; k ++) {
+        lock_stats_lock(&test_lock);
+        usleep(2000);
+        lock_stats_unlock(&test_lock);
+        usleep(100);
+    }
+    return NULL;
+}
+
+TEST(lock_stats, contention_is_recorded)
+{
+    struct lock_stats_s stats;
+    pthread_t t[2];
+
+    // interval long enough to avoid periodic reports during the test
+    config.lock_stats_interval = 3600;
+    lock_stats_register("test lock", &test_lock);
+    lock_stats_reset();
+
+    for (int k = 0; k < 2; k ++)
+        pthread_create(&t[k], NULL, contending_thread, NULL);
+    for (int k = 0; k < 2; k ++)
+        pthread_join(t[k], NULL);
+
+    ASSERT_EQ(lock_stats_get(&test_lock, &stats), 0);
+    ASSERT_EQ(stats.acquisitions, 40);
+    ASSERT_GT(stats.contended, 0);
+    ASSERT_EQ(stats.wait.count, 40);
+    ASSERT_EQ(stats.hold.count, 40);
+    ASSERT_GE(stats.hold.sum_us, 40 * 2000);
+    ASSERT_GT(stats.wait.max_us, 0);
+
+    // both threads lock from the same place
+    int sites = 0;
+    for (int k = 0; k < LOCK_STATS_SITES; k ++)
+        sites += stats.sites[k].site != NULL;
+    ASSERT_EQ(sites, 1);
+
+    gchar *report = lock_stats_get_report();
+    printf("%s", report);
+    g_free(report);
+
+    lock_stats_unregister(&test_lock);
+    config.lock_stats_interval = 0;
+}
+
+TEST(lock_stats, nothing_is_recorded_when_disabled)
+{
+    struct lock_stats_s stats;
+
+    config.lock_stats_interval = 0;
+    lock_stats_register("test lock", &test_lock);
+    lock_stats_reset();
+
+    lock_stats_lock(&test_lock);
+    lock_stats_unlock(&test_lock);
+
+    ASSERT_EQ(lock_stats_get(&test_lock, &stats), 0);
+    ASSERT_EQ(stats.acquisitions, 0);
+    lock_stats_unregister(&test_lock);
+}
@@ -0,0 +1,59 @@
+#include "common.h"
+#include "nih_test.h"
+#include <src/mem_accounting.h>
+#include <src/ppb_var.h>
+#include <stdio.h>
+
+TEST(mem_accounting, peaks_and_totals)
+{
+    struct mem_usage_s u;
+
+    mem_accounting_reset();
+    ASSERT_EQ(mem_accounting_get_usage(1, &u), -1);
+
+    mem_accounting_change(1, PP_RESOURCE_IMAGE_DATA, MEM_KIND_HEAP, 1000);
+    mem_accounting_change(1, PP_RESOURCE_GRAPHICS2D, MEM_KIND_X_PIXMAP, 500);
+    mem_accounting_change(2, PP_RESOURCE_IMAGE_DATA, MEM_KIND_HEAP, 300);
+    mem_accounting_change(1, PP_RESOURCE_IMAGE_DATA, MEM_KIND_HEAP, -600);
+
+    ASSERT_EQ(mem_accounting_get_usage(1, &u), 0);
+    ASSERT_EQ(u.current[PP_RESOURCE_IMAGE_DATA][MEM_KIND_HEAP], 400);
+    ASSERT_EQ(u.peak[PP_RESOURCE_IMAGE_DATA][MEM_KIND_HEAP], 1000);
+    ASSERT_EQ(u.current[PP_RESOURCE_GRAPHICS2D][MEM_KIND_X_PIXMAP], 500);
+    ASSERT_EQ(u.total_current[MEM_KIND_HEAP], 400);
+
+    mem_accounting_get_total_usage(&u);
+    ASSERT_EQ(u.total_current[MEM_KIND_HEAP], 700);
+    ASSERT_EQ(u.total_peak[MEM_KIND_HEAP], 1300);
+    ASSERT_EQ(u.total_current[MEM_KIND_X_PIXMAP], 500);
+
+    gchar *report = mem_accounting_get_report();
+    printf("%s", report);
+    g_free(report);
+
+    // destroyed instance is kept until it releases everything
+    mem_accounting_instance_destroyed(1);
+    ASSERT_EQ(mem_accounting_get_usage(1, &u), 0);
+    mem_accounting_change(1, PP_RESOURCE_IMAGE_DATA, MEM_KIND_HEAP, -400);
+    mem_accounting_change(1, PP_RESOURCE_GRAPHICS2D, MEM_KIND_X_PIXMAP, -500);
+    ASSERT_EQ(mem_accounting_get_usage(1, &u), -1);
+
+    mem_accounting_get_total_usage(&u);
+    ASSERT_EQ(u.total_current[MEM_KIND_HEAP], 300);
+    ASSERT_EQ(u.total_current[MEM_KIND_X_PIXMAP], 0);
+}
+
+TEST(mem_accounting, vars_are_accounted)
+{
+    struct mem_usage_s u;
+
+    mem_accounting_reset();
+    struct PP_Var var = ppb_var_var_from_utf8_z("sixteen bytes!!!");
+
+    ASSERT_EQ(mem_accounting_get_usage(0, &u), 0);
+    ASSERT_GE(u.current[MEM_TYPE_VAR][MEM_KIND_HEAP], 16);
+
+    ppb_var_release(var);
+    mem_accounting_get_total_usage(&u);
+    ASSERT_EQ(u.total_current[MEM_KIND_HEAP], 0);
+}
@@ -0,0 +1,266 @@
+#include "common.h"
+#include "nih_test.h"
+#include <glib.h>
+#include <ppapi/c/pp_errors.h>
+#include <pthread.h>
+#include <src/config.h>
+#include <src/pp_resource.h>
+#include <src/ppb_message_loop.h>
+#include <src/utils.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static PP_Instance  instance;
+static int          tasks_done;
+
+static
+void
+count_comt(void *user_data, int32_t result)
+{
+    tasks_done ++;
+}
+
+static
+void
+quit_comt(void *user_data, int32_t result)
+{
+    ppb_message_loop_post_quit(ppb_message_loop_get_current(), PP_FALSE);
+}
+
+static
+void *
+idle_thread(void *param)
+{
+    PP_Resource m_loop = GPOINTER_TO_SIZE(param);
+    ppb_message_loop_attach_to_current_thread(m_loop);
+    ppb_message_loop_run(m_loop);
+    return NULL;
+}
+
+TEST(message_loop, idle_loop_does_not_wake)
+{
+    struct ppb_message_loop_stats_s stats;
+    pthread_t t;
+
+    instance = create_instance();
+    PP_Resource m_loop = ppb_message_loop_create(instance);
+    ppb_message_loop_reset_stats();
+    pthread_create(&t, NULL, idle_thread, GSIZE_TO_POINTER(m_loop));
+
+    usleep(1500 * 1000);
+    ppb_message_loop_get_stats(&stats);
+    ASSERT_EQ(stats.wakeups, 0);
+
+    ppb_message_loop_post_quit(m_loop, PP_TRUE);
+    pthread_join(t, NULL);
+
+    ppb_message_loop_get_stats(&stats);
+    ASSERT_EQ(stats.timer_wakeups, 0);
+    destroy_instance(instance);
+}
+
+static
+void *
+delayed_tasks_thread(void *param)
+{
+    PP_Resource m_loop = ppb_message_loop_create(instance);
+    ppb_message_loop_attach_to_current_thread(m_loop);
+
+    for (int k = 1; k <= 10; k ++)
+        ppb_message_loop_post_work(m_loop, PP_MakeCCB(count_comt, NULL), 2 * k);
+    ppb_message_loop_post_work(m_loop, PP_MakeCCB(quit_comt, NULL), 200);
+    ppb_message_loop_run(m_loop);
+
+    pp_resource_unref(m_loop);
+    return NULL;
+}
+
+static
+void
+run_delayed_tasks(int slack_ms, struct ppb_message_loop_stats_s *stats)
+{
+    pthread_t t;
+
+    config.timer_slack_ms = slack_ms;
+    tasks_done = 0;
+    ppb_message_loop_reset_stats();
+
+    pthread_create(&t, NULL, delayed_tasks_thread, NULL);
+    pthread_join(t, NULL);
+
+    ppb_message_loop_get_stats(stats);
+    config.timer_slack_ms = 0;
+}
+
+TEST(message_loop, delayed_tasks_are_coalesced)
+{
+    struct ppb_message_loop_stats_s stats;
+
+    instance = create_instance();
+
+    run_delayed_tasks(0, &stats);
+    printf("no slack: %d wakeups, %d timer wakeups, %d coalesced tasks\n", stats.wakeups,
+           stats.timer_wakeups, stats.coalesced_tasks);
+    ASSERT_EQ(tasks_done, 10);
+
+    run_delayed_tasks(100, &stats);
+    printf("100 ms slack: %d wakeups, %d timer wakeups, %d coalesced tasks\n", stats.wakeups,
+           stats.timer_wakeups, stats.coalesced_tasks);
+    ASSERT_EQ(tasks_done, 10);
+
+    // ten tasks within 20 ms fall into one or two windows
+    ASSERT_GE(stats.coalesced_tasks, 8);
+    ASSERT_LE(stats.timer_wakeups, 4);
+
+    destroy_instance(instance);
+}
+
+static GArray      *run_order;
+
+static
+void
+record_comt(void *user_data, int32_t result)
+{
+    int priority = GPOINTER_TO_INT(user_data);
+    g_array_append_val(run_order, priority);
+}
+
+static
+void *
+priorities_thread(void *param)
+{
+    PP_Resource m_loop = ppb_message_loop_create(instance);
+    ppb_message_loop_attach_to_current_thread(m_loop);
+
+    const enum ml_priority_e order[] = { ML_PRIORITY_NETWORK, ML_PRIORITY_BACKGROUND,
+                                         ML_PRIORITY_NORMAL, ML_PRIORITY_INPUT,
+                                         ML_PRIORITY_PAINT, ML_PRIORITY_INPUT };
+    for (size_t k = 0; k < sizeof(order) / sizeof(order[0]); k ++) {
+        ppb_message_loop_post_work_with_priority(m_loop,
+                                                 PP_MakeCCB(record_comt, GINT_TO_POINTER(order[k])),
+                                                 0, PP_OK, 0, order[k], __func__);
+    }
+    ppb_message_loop_post_work_with_priority(m_loop, PP_MakeCCB(quit_comt, NULL), 0, PP_OK, 0,
+                                             ML_PRIORITY_BACKGROUND, __func__);
+    ppb_message_loop_run(m_loop);
+
+    pp_resource_unref(m_loop);
+    return NULL;
+}
+
+TEST(message_loop, due_tasks_run_by_priority)
+{
+    pthread_t t;
+
+    instance = create_instance();
+    run_order = g_array_new(FALSE, FALSE, sizeof(int));
+
+    pthread_create(&t, NULL, priorities_thread, NULL);
+    pthread_join(t, NULL);
+
+    const int expected[] = { ML_PRIORITY_INPUT, ML_PRIORITY_INPUT, ML_PRIORITY_PAINT,
+                             ML_PRIORITY_NORMAL, ML_PRIORITY_NETWORK, ML_PRIORITY_BACKGROUND };
+    ASSERT_EQ(run_order->len, sizeof(expected) / sizeof(expected[0]));
+    for (size_t k = 0; k < run_order->len; k ++)
+        ASSERT_EQ(g_array_index(run_order, int, k), expected[k]);
+
+    g_array_free(run_order, TRUE);
+    destroy_instance(instance);
+}
+
+static
+void *
+quit_order_thread(void *param)
+{
+    PP_Resource m_loop = ppb_message_loop_create(instance);
+    ppb_message_loop_attach_to_current_thread(m_loop);
+
+    const enum ml_priority_e order[] = { ML_PRIORITY_NETWORK, ML_PRIORITY_BACKGROUND };
+    for (size_t k = 0; k < sizeof(order) / sizeof(order[0]); k ++) {
+        ppb_message_loop_post_work_with_priority(m_loop,
+                                                 PP_MakeCCB(record_comt, GINT_TO_POINTER(order[k])),
+                                                 0, PP_OK, 0, order[k], __func__);
+    }
+
+    // quit is posted before the loop runs, work queued ahead of it must not be dropped
+    ppb_message_loop_post_quit(m_loop, PP_FALSE);
+    ppb_message_loop_run(m_loop);
+
+    pp_resource_unref(m_loop);
+    return NULL;
+}
+
+TEST(message_loop, quit_runs_after_earlier_work)
+{
+    pthread_t t;
+
+    instance = create_instance();
+    run_order = g_array_new(FALSE, FALSE, sizeof(int));
+
+    pthread_create(&t, NULL, quit_order_thread, NULL);
+    pthread_join(t, NULL);
+
+    ASSERT_EQ(run_order->len, 2u);
+    ASSERT_EQ(g_array_index(run_order, int, 0), ML_PRIORITY_NETWORK);
+    ASSERT_EQ(g_array_index(run_order, int, 1), ML_PRIORITY_BACKGROUND);
+
+    g_array_free(run_order, TRUE);
+    destroy_instance(instance);
+}
+
+static
+void
+nested_loop_comt(void *user_data, int32_t result)
+{
+    PP_Resource m_loop = ppb_message_loop_get_current();
+    const int nested_returned = 100;
+
+    // work posted before quit runs in nested loop, work posted after it is left to outer one,
+    // even if its class is higher
+    ppb_message_loop_post_work_with_priority(m_loop,
+                                             PP_MakeCCB(record_comt,
+                                                        GINT_TO_POINTER(ML_PRIORITY_NORMAL)),
+                                             0, PP_OK, 0, ML_PRIORITY_NORMAL, __func__);
+    ppb_message_loop_post_quit_depth(m_loop, PP_FALSE, ppb_message_loop_get_depth(m_loop) + 1);
+    ppb_message_loop_post_work_with_priority(m_loop,
+                                             PP_MakeCCB(record_comt,
+                                                        GINT_TO_POINTER(ML_PRIORITY_INPUT)),
+                                             0, PP_OK, 0, ML_PRIORITY_INPUT, __func__);
+    ppb_message_loop_run_nested(m_loop);
+
+    g_array_append_val(run_order, nested_returned);
+    ppb_message_loop_post_quit(m_loop, PP_FALSE);
+}
+
+static
+void *
+nested_quit_thread(void *param)
+{
+    PP_Resource m_loop = ppb_message_loop_create(instance);
+    ppb_message_loop_attach_to_current_thread(m_loop);
+
+    ppb_message_loop_post_work(m_loop, PP_MakeCCB(nested_loop_comt, NULL), 0);
+    ppb_message_loop_run(m_loop);
+
+    pp_resource_unref(m_loop);
+    return NULL;
+}
+
+TEST(message_loop, nested_quit_goes_ahead_of_later_work)
+{
+    pthread_t t;
+
+    instance = create_instance();
+    run_order = g_array_new(FALSE, FALSE, sizeof(int));
+
+    pthread_create(&t, NULL, nested_quit_thread, NULL);
+    pthread_join(t, NULL);
+
+    ASSERT_EQ(run_order->len, 3u);
+    ASSERT_EQ(g_array_index(run_order, int, 0), ML_PRIORITY_NORMAL);
+    ASSERT_EQ(g_array_index(run_order, int, 1), 100);
+    ASSERT_EQ(g_array_index(run_order, int, 2), ML_PRIORITY_INPUT);
+
+    g_array_free(run_order, TRUE);
+    destroy_instance(instance);
+}
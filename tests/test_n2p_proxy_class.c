@@ -0,0 +1,222 @@
+#include "common.h"
+#include "nih_test.h"
+#include <src/n2p_proxy_class.c>
+#include <src/ppb_instance.h>
+#include <src/ppb_message_loop.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define PROPERTY_COUNT  1000
+
+struct async_call_s {
+    void      (*func)(void *);
+    void       *param;
+};
+
+static struct _NPP          fake_npp;
+static NPObject             fake_obj;
+static GAsyncQueue         *browser_q;
+static pthread_barrier_t    browser_ready;
+static PP_Instance          instance;
+static volatile gint        browser_calls;
+
+// results, gathered on plugin thread
+static uint32_t     enumerated_count;
+static int          values_are_correct;
+static int          calls_enumerate;
+static int          calls_next_task;
+static double       enumerate_time;
+
+static
+double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static
+void *
+t_memalloc(uint32_t sz)
+{
+    return malloc(sz);
+}
+
+static
+void
+t_pluginthreadasynccall(NPP npp, void (*func)(void *), void *param)
+{
+    struct async_call_s *c = g_slice_alloc(sizeof(*c));
+    c->func = func;
+    c->param = param;
+    g_atomic_int_inc(&browser_calls);
+    g_async_queue_push(browser_q, c);
+}
+
+static
+NPIdentifier
+t_getstringidentifier(const NPUTF8 *name)
+{
+    return (NPIdentifier)g_intern_string(name);
+}
+
+static
+bool
+t_identifierisstring(NPIdentifier identifier)
+{
+    return true;
+}
+
+static
+NPUTF8 *
+t_utf8fromidentifier(NPIdentifier identifier)
+{
+    return strdup(identifier);
+}
+
+static
+bool
+t_enumerate(NPP npp, NPObject *npobj, NPIdentifier **identifiers, uint32_t *count)
+{
+    *identifiers = malloc(PROPERTY_COUNT * sizeof(NPIdentifier));
+    for (int k = 0; k < PROPERTY_COUNT; k ++) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "prop%d", k);
+        (*identifiers)[k] = t_getstringidentifier(buf);
+    }
+    *count = PROPERTY_COUNT;
+    return true;
+}
+
+static
+bool
+t_getproperty(NPP npp, NPObject *npobj, NPIdentifier name, NPVariant *result)
+{
+    int k;
+    if (sscanf(name, "prop%d", &k) != 1)
+        return false;
+    INT32_TO_NPVARIANT(k, *result);
+    return true;
+}
+
+static
+void
+t_releasevariantvalue(NPVariant *variant)
+{
+}
+
+static
+void *
+browser_thread(void *param)
+{
+    PP_Resource m_loop = ppb_message_loop_create(instance);
+    ppb_message_loop_attach_to_browser_thread(m_loop);
+    pthread_barrier_wait(&browser_ready);
+
+    while (1) {
+        struct async_call_s *c = g_async_queue_pop(browser_q);
+        void (*func)(void *) = c->func;
+        void *func_param = c->param;
+
+        g_slice_free1(sizeof(*c), c);
+        if (!func)
+            break;
+        func(func_param);
+    }
+
+    return NULL;
+}
+
+static
+void
+enumerate_comt(void *user_data, int32_t result)
+{
+    struct PP_Var  *names = NULL;
+    struct PP_Var   exception = PP_MakeUndefined();
+    const int       calls_before = g_atomic_int_get(&browser_calls);
+
+    double t = now();
+    n2p_get_all_property_names(&fake_obj, &enumerated_count, &names, &exception);
+
+    values_are_correct = 1;
+    for (uint32_t k = 0; k < enumerated_count; k ++) {
+        struct PP_Var value = n2p_get_property(&fake_obj, names[k], &exception);
+        if (value.type != PP_VARTYPE_INT32 || value.value.as_int != (int32_t)k)
+            values_are_correct = 0;
+        ppb_var_release(value);
+    }
+    enumerate_time = now() - t;
+    calls_enumerate = g_atomic_int_get(&browser_calls) - calls_before;
+
+    for (uint32_t k = 0; k < enumerated_count; k ++)
+        ppb_var_release(names[k]);
+    free(names);
+}
+
+static
+void
+next_task_comt(void *user_data, int32_t result)
+{
+    struct PP_Var   exception = PP_MakeUndefined();
+    struct PP_Var   name = ppb_var_var_from_utf8_z("prop1");
+    const int       calls_before = g_atomic_int_get(&browser_calls);
+
+    // snapshot taken during previous plugin call should not be used
+    struct PP_Var value = n2p_get_property(&fake_obj, name, &exception);
+    calls_next_task = g_atomic_int_get(&browser_calls) - calls_before;
+
+    ppb_var_release(value);
+    ppb_var_release(name);
+}
+
+TESTSUITE_SETUP(void)
+{
+    // npn is globally visible struct
+    npn.memalloc = t_memalloc;
+    npn.memfree = free;
+    npn.pluginthreadasynccall = t_pluginthreadasynccall;
+    npn.getstringidentifier = t_getstringidentifier;
+    npn.identifierisstring = t_identifierisstring;
+    npn.utf8fromidentifier = t_utf8fromidentifier;
+    npn.enumerate = t_enumerate;
+    npn.getproperty = t_getproperty;
+    npn.releasevariantvalue = t_releasevariantvalue;
+}
+
+TEST(n2p_proxy_class, enumerate_1000_properties)
+{
+    pthread_t t;
+
+    instance = create_instance();
+    tables_get_pp_instance(instance)->npp = &fake_npp;
+    tables_add_npobj_npp_mapping(&fake_obj, &fake_npp);
+
+    browser_q = g_async_queue_new();
+    pthread_barrier_init(&browser_ready, NULL, 2);
+    pthread_create(&t, NULL, browser_thread, NULL);
+    pthread_barrier_wait(&browser_ready);
+
+    PP_Resource m_loop = ppb_message_loop_create(instance);
+    ppb_message_loop_attach_to_current_thread(m_loop);
+    ppb_message_loop_post_work(m_loop, PP_MakeCCB(enumerate_comt, NULL), 0);
+    ppb_message_loop_post_work(m_loop, PP_MakeCCB(next_task_comt, NULL), 0);
+    ppb_message_loop_post_quit(m_loop, PP_FALSE);
+    ppb_message_loop_run(m_loop);
+
+    printf("enumerated %u properties with values in %.3f ms, %d browser thread calls\n",
+           enumerated_count, 1e3 * enumerate_time, calls_enumerate);
+
+    ASSERT_EQ(enumerated_count, PROPERTY_COUNT);
+    ASSERT_TRUE(values_are_correct);
+    ASSERT_EQ(calls_enumerate, 1);
+    ASSERT_EQ(calls_next_task, 1);
+
+    t_pluginthreadasynccall(NULL, NULL, NULL);   // stop browser thread
+    pthread_join(t, NULL);
+    g_async_queue_unref(browser_q);
+
+    tables_remove_npobj_npp_mapping(&fake_obj);
+    destroy_instance(instance);
+}
@@ -0,0 +1,118 @@
+#include "common.h"
+#include "nih_test.h"
+#include <src/config.h>
+#include <src/object_tracker.h>
+#include <src/pp_resource.h>
+#include <src/ppb_var.h>
+#include <stdio.h>
+#include <string.h>
+
+static
+struct PP_Var
+__attribute__((noinline))
+make_leaking_var(int k)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "leaking %d", k);
+    return ppb_var_var_from_utf8_z(buf);
+}
+
+static
+int
+site_is_within(const void *site, void *func)
+{
+    // call instruction is close to function start
+    return (const char *)site > (const char *)func && (const char *)site < (char *)func + 256;
+}
+
+TEST(object_tracker, leaked_vars_are_grouped_by_site)
+{
+    struct PP_Var leaking[5];
+    struct PP_Var temporary[3];
+
+    // interval long enough to avoid periodic reports during the test
+    config.track_objects = 3600;
+    object_tracker_reset();
+
+    for (int k = 0; k < 5; k ++)
+        leaking[k] = make_leaking_var(k);
+
+    for (int k = 0; k < 3; k ++) {
+        temporary[k] = ppb_var_var_from_utf8_z("temporary");
+        ppb_var_add_ref(temporary[k]);
+        ppb_var_release(temporary[k]);
+        ppb_var_release(temporary[k]);
+    }
+
+    ASSERT_EQ(object_tracker_live_count(OBJECT_KIND_VAR), 5);
+
+    GArray *sites = object_tracker_get_sites();
+    ASSERT_EQ(sites->len, 1);
+
+    struct object_site_s *s = &g_array_index(sites, struct object_site_s, 0);
+    ASSERT_EQ(s->kind, OBJECT_KIND_VAR);
+    ASSERT_EQ(s->type, PP_VARTYPE_STRING);
+    ASSERT_EQ(s->count, 5);
+    ASSERT_TRUE(site_is_within(s->site, make_leaking_var));
+
+    gchar *s_site = object_tracker_describe_site(s->site);
+    printf("leaking vars created at %s\n", s_site);
+    g_free(s_site);
+    g_array_free(sites, TRUE);
+
+    gchar *report = object_tracker_get_report();
+    printf("%s", report);
+    ASSERT_TRUE(strstr(report, "5 live vars") != NULL);
+    g_free(report);
+
+    for (int k = 0; k < 5; k ++)
+        ppb_var_release(leaking[k]);
+
+    ASSERT_EQ(object_tracker_live_count(OBJECT_KIND_VAR), 0);
+    config.track_objects = 0;
+}
+
+TEST(object_tracker, resources_are_tracked)
+{
+    config.track_objects = 3600;
+    object_tracker_reset();
+
+    PP_Resource resource = pp_resource_allocate(PP_RESOURCE_UNKNOWN, NULL);
+    pp_resource_ref(resource);
+    pp_resource_unref(resource);
+
+    // acquire-release pairs don't count
+    pp_resource_acquire(resource, PP_RESOURCE_UNKNOWN);
+    pp_resource_release(resource);
+
+    ASSERT_EQ(object_tracker_live_count(OBJECT_KIND_RESOURCE), 1);
+
+    GArray *sites = object_tracker_get_sites();
+    ASSERT_EQ(sites->len, 1);
+    ASSERT_EQ(g_array_index(sites, struct object_site_s, 0).kind, OBJECT_KIND_RESOURCE);
+    ASSERT_EQ(g_array_index(sites, struct object_site_s, 0).type, PP_RESOURCE_UNKNOWN);
+    g_array_free(sites, TRUE);
+
+    gchar *report = object_tracker_get_report();
+    ASSERT_TRUE(strstr(report, "1 live resources") != NULL);
+    g_free(report);
+
+    pp_resource_expunge(resource);
+    ASSERT_EQ(object_tracker_live_count(OBJECT_KIND_RESOURCE), 0);
+    config.track_objects = 0;
+}
+
+TEST(object_tracker, objects_are_not_tracked_when_disabled)
+{
+    config.track_objects = 0;
+    object_tracker_reset();
+
+    struct PP_Var var = ppb_var_var_from_utf8_z("untracked");
+    PP_Resource resource = pp_resource_allocate(PP_RESOURCE_UNKNOWN, NULL);
+
+    ASSERT_EQ(object_tracker_live_count(OBJECT_KIND_VAR), 0);
+    ASSERT_EQ(object_tracker_live_count(OBJECT_KIND_RESOURCE), 0);
+
+    pp_resource_expunge(resource);
+    ppb_var_release(var);
+}
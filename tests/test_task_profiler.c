@@ -0,0 +1,58 @@
+#include "common.h"
+#include "nih_test.h"
+#include <src/config.h>
+#include <src/task_profiler.h>
+#include <stdio.h>
+
+TEST(task_profiler, histograms)
+{
+    struct task_stats_s stats;
+    const char *origin = __func__;
+
+    // interval long enough to avoid periodic reports during the test
+    config.task_profile_interval = 3600;
+    config.long_task_threshold_ms = 50;
+    task_profiler_reset();
+
+    ASSERT_EQ(task_profiler_get_stats(origin, &stats), -1);
+
+    for (int k = 0; k < 98; k ++)
+        task_profiler_record(origin, NULL, 10, 100);
+    task_profiler_record(origin, NULL, 5000, 30 * 1000);
+    task_profiler_record(origin, NULL, 0, 80 * 1000);
+
+    ASSERT_EQ(task_profiler_get_stats(origin, &stats), 0);
+    ASSERT_EQ(stats.run_time.count, 100);
+    ASSERT_EQ(stats.run_time.max_us, 80 * 1000);
+    ASSERT_EQ(stats.run_time.sum_us, 98 * 100 + 30 * 1000 + 80 * 1000);
+    ASSERT_EQ(stats.queue_delay.max_us, 5000);
+    ASSERT_EQ(stats.long_tasks, 1);
+
+    // percentiles are bucket upper bounds
+    ASSERT_EQ(diag_histogram_percentile(&stats.run_time, 0.5), 127);
+    ASSERT_EQ(diag_histogram_percentile(&stats.run_time, 0.98), 32767);
+    ASSERT_EQ(diag_histogram_percentile(&stats.run_time, 1.0), 80 * 1000);
+    ASSERT_EQ(diag_histogram_percentile(&stats.queue_delay, 0.5), 15);
+
+    gchar *report = task_profiler_get_report();
+    printf("%s", report);
+    g_free(report);
+
+    task_profiler_reset();
+    ASSERT_EQ(task_profiler_get_stats(origin, &stats), -1);
+    config.task_profile_interval = 0;
+    config.long_task_threshold_ms = 0;
+}
+
+TEST(task_profiler, disabled)
+{
+    struct task_stats_s stats;
+
+    config.task_profile_interval = 0;
+    config.long_task_threshold_ms = 0;
+    task_profiler_reset();
+
+    ASSERT_FALSE(task_profiler_enabled());
+    task_profiler_record(__func__, NULL, 10, 100);
+    ASSERT_EQ(task_profiler_get_stats(__func__, &stats), -1);
+}
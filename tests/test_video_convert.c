@@ -0,0 +1,174 @@
+#include "common.h"
+#include "nih_test.h"
+#include <src/video_convert.c>
+#include <stdlib.h>
+
+// straightforward conversion, to compare optimized one against
+static
+void
+reference_yuyv_to_i420(uint8_t *dst, const uint8_t *src, uint32_t width, uint32_t height,
+                       uint32_t stride)
+{
+    const uint32_t cw = (width + 1) / 2;
+    const uint32_t ch = (height + 1) / 2;
+    uint8_t *u = dst + width * height;
+    uint8_t *v = u + cw * ch;
+
+    for (uint32_t y = 0; y < height; y ++)
+        for (uint32_t x = 0; x < width; x ++)
+            dst[y * width + x] = src[y * stride + 2 * x];
+
+    for (uint32_t y = 0; y < ch; y ++) {
+        const uint8_t *l0 = src + 2 * y * stride;
+        const uint8_t *l1 = (2 * y + 1 < height) ? l0 + stride : l0;
+
+        for (uint32_t x = 0; x < cw; x ++) {
+            u[y * cw + x] = (l0[4 * x + 1] + l1[4 * x + 1] + 1) / 2;
+            if (2 * x + 1 < width)
+                v[y * cw + x] = (l0[4 * x + 3] + l1[4 * x + 3] + 1) / 2;
+            else if (x > 0)
+                v[y * cw + x] = (l0[4 * x - 1] + l1[4 * x - 1] + 1) / 2;
+            else
+                v[y * cw + x] = 128;
+        }
+    }
+}
+
+TEST(video_convert, i420_size)
+{
+    ASSERT_EQ(video_convert_i420_size(640, 480), 640 * 480 * 3 / 2);
+    ASSERT_EQ(video_convert_i420_size(3, 3), 9 + 2 * 2 * 2);
+}
+
+TEST(video_convert, yuyv_matches_reference)
+{
+    const uint32_t sizes[][2] = { {1, 1}, {2, 1}, {2, 2}, {3, 3}, {16, 3}, {34, 5}, {35, 4},
+                                  {64, 2}, {640, 480} };
+
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k ++) {
+        const uint32_t width = sizes[k][0];
+        const uint32_t height = sizes[k][1];
+        const uint32_t stride = 2 * width + 8;  // padded lines
+        const size_t out_size = video_convert_i420_size(width, height);
+
+        uint8_t *src = malloc(stride * height);
+        uint8_t *out = malloc(out_size);
+        uint8_t *expected = malloc(out_size);
+
+        for (size_t j = 0; j < stride * height; j ++)
+            src[j] = rand();
+
+        video_convert_yuyv_to_i420(out, src, width, height, stride);
+        reference_yuyv_to_i420(expected, src, width, height, stride);
+        ASSERT_EQ(memcmp(out, expected, out_size), 0);
+
+        free(src);
+        free(out);
+        free(expected);
+    }
+}
+
+TEST(video_convert, yuyv_odd_width_stays_within_line)
+{
+    const uint32_t width = 35;
+    const uint32_t height = 4;
+    const uint32_t stride = 2 * width + 8;
+    const size_t out_size = video_convert_i420_size(width, height);
+
+    uint8_t *src = malloc(stride * height);
+    uint8_t *out1 = malloc(out_size);
+    uint8_t *out2 = malloc(out_size);
+
+    for (size_t j = 0; j < stride * height; j ++)
+        src[j] = rand();
+
+    // line padding must not affect the result
+    for (uint32_t y = 0; y < height; y ++)
+        memset(src + y * stride + 2 * width, 0x00, stride - 2 * width);
+    video_convert_yuyv_to_i420(out1, src, width, height, stride);
+
+    for (uint32_t y = 0; y < height; y ++)
+        memset(src + y * stride + 2 * width, 0xff, stride - 2 * width);
+    video_convert_yuyv_to_i420(out2, src, width, height, stride);
+
+    ASSERT_EQ(memcmp(out1, out2, out_size), 0);
+
+    free(src);
+    free(out1);
+    free(out2);
+}
+
+TEST(video_convert, yuv420_strided)
+{
+    const uint32_t width = 6;
+    const uint32_t height = 4;
+    const uint32_t stride = 8;
+    uint8_t src[8 * 4 + 2 * 4 * 2];
+    uint8_t out[6 * 4 + 2 * 3 * 2];
+
+    for (size_t k = 0; k < sizeof(src); k ++)
+        src[k] = k;
+
+    video_convert_yuv420_to_i420(out, src, width, height, stride);
+
+    ASSERT_EQ(out[0], 0);
+    ASSERT_EQ(out[6], 8);           // second line starts after padding
+    ASSERT_EQ(out[23], 3 * 8 + 5);
+    ASSERT_EQ(out[24], 32);         // U plane
+    ASSERT_EQ(out[27], 36);
+    ASSERT_EQ(out[30], 40);         // V plane
+}
+
+#if HAVE_LIBJPEG
+TEST(video_convert, mjpeg_decodes)
+{
+    const uint32_t width = 64;
+    const uint32_t height = 48;
+    unsigned char *jpeg_data = NULL;
+    unsigned long jpeg_size = 0;
+    uint8_t line[64 * 3];
+
+    // encode YCbCr gradient
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &jpeg_data, &jpeg_size);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_YCbCr;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 95, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < height) {
+        for (uint32_t x = 0; x < width; x ++) {
+            line[3 * x + 0] = 2 * x + cinfo.next_scanline;
+            line[3 * x + 1] = 100;
+            line[3 * x + 2] = 150;
+        }
+        JSAMPROW row = line;
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    uint8_t *out = malloc(video_convert_i420_size(width, height));
+    ASSERT_EQ(video_convert_mjpeg_to_i420(out, jpeg_data, jpeg_size, width, height), 0);
+
+    for (uint32_t y = 0; y < height; y ++) {
+        for (uint32_t x = 0; x < width; x ++)
+            ASSERT_LE(abs(out[y * width + x] - (int)(2 * x + y)), 6);
+    }
+    ASSERT_LE(abs(out[width * height] - 100), 3);
+    ASSERT_LE(abs(out[width * height + (width / 2) * (height / 2)] - 150), 3);
+
+    // wrong size and garbage are rejected
+    ASSERT_EQ(video_convert_mjpeg_to_i420(out, jpeg_data, jpeg_size, 32, 32), -1);
+    ASSERT_EQ(video_convert_mjpeg_to_i420(out, (const uint8_t *)"garbage", 7, width, height),
+              -1);
+
+    free(out);
+    free(jpeg_data);
+}
+#endif // HAVE_LIBJPEG
@@ -0,0 +1,252 @@
+#include "common.h"
+#include "nih_test.h"
+#include <glib.h>
+#include <ppapi/c/pp_errors.h>
+#include <pthread.h>
+#include <src/config.h>
+#include <src/pp_resource.h>
+#include <src/ppb_message_loop.h>
+#include <src/work_pool.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static volatile gint    running;
+static volatile gint    max_running;
+static volatile gint    works_done;
+static int              completions;
+static int              aborted;
+static int              wrong_thread;
+static pthread_t        loop_thread;
+static PP_Instance      instance;
+static struct work_token_s *token_to_cancel;
+
+static
+void
+setup(void)
+{
+    // takes effect only before the first submit
+    config.background_threads = 4;
+    g_atomic_int_set(&running, 0);
+    g_atomic_int_set(&max_running, 0);
+    g_atomic_int_set(&works_done, 0);
+    completions = 0;
+    aborted = 0;
+    wrong_thread = 0;
+}
+
+static
+int32_t
+sleeping_work(void *user_data)
+{
+    int now = g_atomic_int_add(&running, 1) + 1;
+    int prev;
+
+    while ((prev = g_atomic_int_get(&max_running)) < now &&
+           !g_atomic_int_compare_and_exchange(&max_running, prev, now))
+    {
+    }
+
+    usleep(2 * 1000);
+    g_atomic_int_add(&running, -1);
+    g_atomic_int_inc(&works_done);
+    return GPOINTER_TO_INT(user_data);
+}
+
+static
+int32_t
+cancelling_work(void *user_data)
+{
+    work_token_cancel(token_to_cancel);
+    return PP_OK;
+}
+
+static
+void
+count_comt(void *user_data, int32_t result)
+{
+    if (!pthread_equal(pthread_self(), loop_thread))
+        wrong_thread ++;
+
+    if (result == PP_ERROR_ABORTED)
+        aborted ++;
+    else
+        completions ++;
+}
+
+TEST(work_pool, queue_limit_is_respected)
+{
+    setup();
+    struct work_queue_s *q = work_pool_get_queue("test_limited", 2);
+
+    // limit is set by the first call
+    ASSERT_EQ(work_pool_get_queue("test_limited", 10), q);
+
+    for (int k = 0; k < 40; k ++)
+        ASSERT_EQ(work_pool_submit(q, sleeping_work, NULL, NULL, NULL, __func__), 0);
+    work_pool_wait_idle(q);
+
+    printf("max running %d\n", max_running);
+    ASSERT_EQ(works_done, 40);
+    ASSERT_LE(max_running, 2);
+    ASSERT_GE(max_running, 1);
+}
+
+static
+int32_t
+spawning_work(void *user_data)
+{
+    struct work_queue_s *q = user_data;
+
+    for (int k = 0; k < 50; k ++)
+        work_pool_submit(q, sleeping_work, NULL, NULL, NULL, __func__);
+    return PP_OK;
+}
+
+TEST(work_pool, idle_workers_steal_nested_work)
+{
+    struct work_pool_stats_s stats;
+
+    setup();
+    work_pool_reset_stats();
+    struct work_queue_s *q = work_pool_get_queue("test_unlimited", 0);
+
+    ASSERT_EQ(work_pool_submit(q, spawning_work, NULL, q, NULL, __func__), 0);
+    work_pool_wait_idle(q);
+
+    work_pool_get_stats(&stats);
+    printf("max running %d, %d stolen\n", max_running, stats.stolen);
+    ASSERT_EQ(works_done, 50);
+    ASSERT_EQ(stats.submitted, 51);
+    ASSERT_GT(stats.stolen, 0);
+    ASSERT_GT(max_running, 1);
+}
+
+static
+void
+quit_when_done_comt(void *user_data, int32_t result)
+{
+    const int expected = GPOINTER_TO_INT(user_data);
+
+    count_comt(NULL, result);
+    if (completions + aborted == expected)
+        ppb_message_loop_post_quit(ppb_message_loop_get_current(), PP_FALSE);
+}
+
+/// runs |submit| on a thread with message loop attached, until completions post quit
+static
+void *
+loop_thread_func(void *param)
+{
+    void (*submit)(void) = param;
+    PP_Resource m_loop = ppb_message_loop_create(instance);
+
+    ppb_message_loop_attach_to_current_thread(m_loop);
+    loop_thread = pthread_self();
+    submit();
+    ppb_message_loop_run(m_loop);
+
+    pp_resource_unref(m_loop);
+    return NULL;
+}
+
+static
+void
+run_on_loop_thread(void (*submit)(void))
+{
+    pthread_t t;
+
+    instance = create_instance();
+    pthread_create(&t, NULL, loop_thread_func, submit);
+    pthread_join(t, NULL);
+    destroy_instance(instance);
+}
+
+static
+void
+submit_sleeping_work(void)
+{
+    struct work_queue_s *q = work_pool_get_queue("test_completions", 0);
+
+    for (int k = 0; k < 20; k ++) {
+        work_pool_submit(q, sleeping_work, quit_when_done_comt, GINT_TO_POINTER(20), NULL,
+                         __func__);
+    }
+}
+
+TEST(work_pool, completions_run_on_submitting_loop)
+{
+    setup();
+    run_on_loop_thread(submit_sleeping_work);
+
+    ASSERT_EQ(works_done, 20);
+    ASSERT_EQ(completions, 20);
+    ASSERT_EQ(aborted, 0);
+    ASSERT_EQ(wrong_thread, 0);
+}
+
+static
+void
+submit_cancelled_work(void)
+{
+    struct work_queue_s *q = work_pool_get_queue("test_cancel", 0);
+
+    // cancelled before work starts
+    struct work_token_s *token = work_token_new();
+    work_token_cancel(token);
+    for (int k = 0; k < 5; k ++) {
+        work_pool_submit(q, sleeping_work, quit_when_done_comt, GINT_TO_POINTER(6), token,
+                         __func__);
+    }
+    work_token_unref(token);
+
+    // cancelled after work is done, but before completion
+    token_to_cancel = work_token_new();
+    work_pool_submit(q, cancelling_work, quit_when_done_comt, GINT_TO_POINTER(6),
+                     token_to_cancel, __func__);
+    work_token_unref(token_to_cancel);
+}
+
+TEST(work_pool, cancelled_items_are_aborted)
+{
+    struct work_pool_stats_s stats;
+
+    setup();
+    work_pool_reset_stats();
+    run_on_loop_thread(submit_cancelled_work);
+
+    work_pool_get_stats(&stats);
+    ASSERT_EQ(works_done, 0);
+    ASSERT_EQ(aborted, 6);
+    ASSERT_EQ(completions, 0);
+    ASSERT_EQ(stats.cancelled, 5);
+    ASSERT_EQ(wrong_thread, 0);
+}
+
+static
+void *
+submit_without_loop_thread(void *param)
+{
+    struct work_queue_s *q = work_pool_get_queue("test_no_loop", 0);
+    int32_t *rets = param;
+
+    rets[0] = work_pool_submit(q, sleeping_work, count_comt, NULL, NULL, __func__);
+    rets[1] = work_pool_submit(q, sleeping_work, NULL, NULL, NULL, __func__);
+    work_pool_wait_idle(q);
+    return NULL;
+}
+
+TEST(work_pool, completion_requires_message_loop)
+{
+    int32_t rets[2];
+    pthread_t t;
+
+    setup();
+    pthread_create(&t, NULL, submit_without_loop_thread, rets);
+    pthread_join(t, NULL);
+
+    // completion would otherwise have to run on a worker
+    ASSERT_EQ(rets[0], PP_ERROR_NO_MESSAGE_LOOP);
+    ASSERT_EQ(rets[1], PP_OK);
+    ASSERT_EQ(works_done, 1);
+    ASSERT_EQ(completions, 0);
+}
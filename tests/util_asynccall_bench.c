@@ -0,0 +1,145 @@
+// measures throughput of cross-thread calls to a GMainLoop: one idle GSource per call (the
+// way np_asynccall used to work) versus single coalescing dispatch source of np_asynccall.
+// Several producer threads post calls while main thread runs the loop:
+//
+//     ./util_asynccall_bench [calls per thread] [threads]
+
+#undef NDEBUG
+#include <assert.h>
+#include <glib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <src/np_asynccall.c>
+
+struct run_s {
+    int             calls_per_thread;
+    int             expected;
+    int             done;
+    GMainLoop      *loop;
+    void          (*post)(void (*func)(void *), void *user_data);
+};
+
+static struct run_s run;
+
+void
+trace_error(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+static
+double
+clock_seconds(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+struct legacy_params_s {
+    void  (*func)(void *);
+    void   *user_data;
+};
+
+static
+gboolean
+legacy_proxy(gpointer user_data)
+{
+    struct legacy_params_s *p = user_data;
+
+    p->func(p->user_data);
+    g_slice_free(struct legacy_params_s, p);
+    return FALSE;
+}
+
+static
+void
+legacy_post(void (*func)(void *), void *user_data)
+{
+    GSource *source = g_idle_source_new();
+    struct legacy_params_s *p = g_slice_alloc0(sizeof(*p));
+
+    p->func = func;
+    p->user_data = user_data;
+    g_source_set_priority(source, G_PRIORITY_DEFAULT);
+    g_source_set_callback(source, legacy_proxy, p, NULL);
+    g_source_attach(source, g_main_context_default());
+    g_source_unref(source);
+}
+
+static
+void
+coalescing_post(void (*func)(void *), void *user_data)
+{
+    np_asynccall_call(NULL, func, user_data);
+}
+
+static
+void
+call_func(void *user_data)
+{
+    if (++ run.done == run.expected)
+        g_main_loop_quit(run.loop);
+}
+
+static
+gpointer
+producer_thread(gpointer param)
+{
+    for (int k = 0; k < run.calls_per_thread; k ++)
+        run.post(call_func, NULL);
+    return NULL;
+}
+
+static
+void
+measure(const char *name, void (*post)(void (*)(void *), void *), int calls_per_thread,
+        int threads)
+{
+    GThread *t[threads];
+
+    run.calls_per_thread = calls_per_thread;
+    run.expected = calls_per_thread * threads;
+    run.done = 0;
+    run.post = post;
+    run.loop = g_main_loop_new(NULL, FALSE);
+
+    double wall = clock_seconds(CLOCK_MONOTONIC);
+    double cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+
+    for (int k = 0; k < threads; k ++)
+        t[k] = g_thread_new("producer", producer_thread, NULL);
+    g_main_loop_run(run.loop);
+    for (int k = 0; k < threads; k ++)
+        g_thread_join(t[k]);
+
+    wall = clock_seconds(CLOCK_MONOTONIC) - wall;
+    cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    assert(run.done == run.expected);
+
+    printf("%-12s %d threads, %8.0f calls/s, %6.2f us CPU per call\n", name, threads,
+           run.expected / wall, 1e6 * cpu / run.expected);
+    g_main_loop_unref(run.loop);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const int calls_per_thread = argc > 1 ? atoi(argv[1]) : 200000;
+    const int max_threads = argc > 2 ? atoi(argv[2]) : 4;
+
+    assert(np_asynccall_initialize() == 0);
+
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        measure("idle source", legacy_post, calls_per_thread, threads);
+        measure("coalescing", coalescing_post, calls_per_thread, threads);
+    }
+
+    np_asynccall_shutdown();
+    return 0;
+}
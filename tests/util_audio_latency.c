@@ -0,0 +1,153 @@
+// measures round-trip latency through snd-aloop loopback card for several sample frame
+// counts, configured the way ALSA backend configures its streams (period matching frame
+// count, buffer of four periods). Shows which frame counts device accepts as is and what
+// latency each of them costs.
+//
+//     modprobe snd-aloop && ./util_audio_latency [rate]
+
+#undef NDEBUG
+#include <alsa/asoundlib.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PLAYBACK_PCM    "hw:Loopback,0,0"
+#define CAPTURE_PCM     "hw:Loopback,1,0"
+#define CHANNELS        2
+#define IMPULSE_PERIOD  10
+#define MAX_PERIODS     200
+
+static
+snd_pcm_t *
+open_pcm(const char *name, snd_pcm_stream_t stream, unsigned int rate,
+         snd_pcm_uframes_t *period_size)
+{
+    snd_pcm_t *pcm;
+    snd_pcm_hw_params_t *hw_params;
+    snd_pcm_uframes_t buffer_size = 4 * *period_size;
+    int dir = 0;
+
+    if (snd_pcm_open(&pcm, name, stream, 0) < 0)
+        return NULL;
+
+    snd_pcm_hw_params_malloc(&hw_params);
+    snd_pcm_hw_params_any(pcm, hw_params);
+    snd_pcm_hw_params_set_rate_resample(pcm, hw_params, 0);
+    snd_pcm_hw_params_set_access(pcm, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
+    snd_pcm_hw_params_set_format(pcm, hw_params, SND_PCM_FORMAT_S16_LE);
+    snd_pcm_hw_params_set_channels(pcm, hw_params, CHANNELS);
+    snd_pcm_hw_params_set_rate_near(pcm, hw_params, &rate, &dir);
+    dir = 0;
+    snd_pcm_hw_params_set_period_size_near(pcm, hw_params, period_size, &dir);
+    snd_pcm_hw_params_set_buffer_size_near(pcm, hw_params, &buffer_size);
+    int ret = snd_pcm_hw_params(pcm, hw_params);
+    snd_pcm_hw_params_free(hw_params);
+
+    if (ret < 0) {
+        snd_pcm_close(pcm);
+        return NULL;
+    }
+
+    snd_pcm_prepare(pcm);
+    return pcm;
+}
+
+static
+int
+measure(unsigned int rate, uint32_t frame_count, snd_pcm_uframes_t *period_out,
+        double *latency_ms)
+{
+    snd_pcm_uframes_t period_size = frame_count;
+    snd_pcm_t *play = open_pcm(PLAYBACK_PCM, SND_PCM_STREAM_PLAYBACK, rate, &period_size);
+    if (!play)
+        return -1;
+
+    // capture side uses the same period as playback got
+    snd_pcm_uframes_t cap_period_size = period_size;
+    snd_pcm_t *cap = open_pcm(CAPTURE_PCM, SND_PCM_STREAM_CAPTURE, rate, &cap_period_size);
+    if (!cap) {
+        snd_pcm_close(play);
+        return -1;
+    }
+
+    int16_t *buf = calloc(period_size * CHANNELS, sizeof(int16_t));
+    assert(buf);
+
+    // prime playback with two periods of silence
+    snd_pcm_writei(play, buf, period_size);
+    snd_pcm_writei(play, buf, period_size);
+    snd_pcm_start(cap);
+
+    int64_t played = 2 * period_size;
+    int64_t captured = 0;
+    int64_t impulse_played = -1;
+    int64_t impulse_captured = -1;
+
+    for (int k = 0; k < MAX_PERIODS && impulse_captured < 0; k ++) {
+        memset(buf, 0, period_size * CHANNELS * sizeof(int16_t));
+        if (k == IMPULSE_PERIOD) {
+            buf[0] = buf[1] = INT16_MAX;
+            impulse_played = played;
+        }
+
+        snd_pcm_sframes_t written = snd_pcm_writei(play, buf, period_size);
+        if (written < 0) {
+            snd_pcm_recover(play, written, 1);
+            continue;
+        }
+        played += written;
+
+        snd_pcm_sframes_t got = snd_pcm_readi(cap, buf, cap_period_size);
+        if (got < 0) {
+            snd_pcm_recover(cap, got, 1);
+            continue;
+        }
+
+        for (snd_pcm_sframes_t j = 0; j < got && impulse_played >= 0; j ++) {
+            if (abs(buf[j * CHANNELS]) > INT16_MAX / 2) {
+                impulse_captured = captured + j;
+                break;
+            }
+        }
+        captured += got;
+    }
+
+    free(buf);
+    snd_pcm_close(cap);
+    snd_pcm_close(play);
+
+    if (impulse_captured < 0)
+        return -1;
+
+    *period_out = period_size;
+    *latency_ms = 1e3 * (impulse_captured - impulse_played) / rate;
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    // typical requests, followed by sizes aligned to common device periods
+    const uint32_t frame_counts[] = { 441, 480, 1000, 1024, 2048, 4096, 4410 };
+    const unsigned int rate = argc > 1 ? atoi(argv[1]) : 48000;
+
+    printf("rate %u Hz, %s -> %s\n", rate, PLAYBACK_PCM, CAPTURE_PCM);
+    printf("requested  period  aligned  latency, ms\n");
+
+    for (size_t k = 0; k < sizeof(frame_counts) / sizeof(frame_counts[0]); k ++) {
+        snd_pcm_uframes_t period;
+        double latency;
+
+        if (measure(rate, frame_counts[k], &period, &latency) != 0) {
+            printf("%9u  failed (is snd-aloop loaded?)\n", frame_counts[k]);
+            continue;
+        }
+
+        printf("%9u  %6lu  %7s  %11.2f\n", frame_counts[k], (unsigned long)period,
+               period == frame_counts[k] ? "yes" : "no", latency);
+    }
+
+    return 0;
+}
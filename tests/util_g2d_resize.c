@@ -0,0 +1,179 @@
+// measures cost of server-side resources Graphics2D needs to present transparent instances
+// during a resize storm: recreating pixmap, picture, and GC on every size change versus
+// reusing bucket-aligned, grow-only pooled ones.
+//
+//     DISPLAY=:0 ./util_g2d_resize
+
+#undef NDEBUG
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/Xrender.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define STEPS       2000
+#define BUCKET      64
+#define MAX_WIDTH   1280
+#define MAX_HEIGHT  720
+
+Display            *dpy;
+XRenderPictFormat  *pictfmt;
+XImage             *xi;
+Pixmap              dst_pixmap;
+Picture             dst_pict;
+
+struct xres_s {
+    Pixmap      pixmap;
+    Picture     pict;
+    GC          gc;
+    int         width;
+    int         height;
+};
+
+static
+double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static
+void
+size_for_step(int k, int *width, int *height)
+{
+    // window being dragged back and forth
+    int phase = k % 200;
+    phase = phase < 100 ? phase : 200 - phase;
+    *width = 320 + (MAX_WIDTH - 320) * phase / 100;
+    *height = 240 + (MAX_HEIGHT - 240) * phase / 100;
+}
+
+static
+void
+xres_create(struct xres_s *xres, int width, int height)
+{
+    xres->pixmap = XCreatePixmap(dpy, DefaultRootWindow(dpy), width, height, 32);
+    xres->pict = XRenderCreatePicture(dpy, xres->pixmap, pictfmt, 0, 0);
+    xres->gc = XCreateGC(dpy, xres->pixmap, 0, 0);
+    xres->width = width;
+    xres->height = height;
+}
+
+static
+void
+xres_free(struct xres_s *xres)
+{
+    XRenderFreePicture(dpy, xres->pict);
+    XFreeGC(dpy, xres->gc);
+    XFreePixmap(dpy, xres->pixmap);
+}
+
+static
+void
+present(struct xres_s *xres, int width, int height)
+{
+    XPutImage(dpy, xres->pixmap, xres->gc, xi, 0, 0, 0, 0, width, height);
+    XRenderComposite(dpy, PictOpOver, xres->pict, None, dst_pict, 0, 0, 0, 0, 0, 0, width,
+                     height);
+    XSync(dpy, False);
+}
+
+static
+double
+run_recreate(void)
+{
+    double t = now();
+    for (int k = 0; k < STEPS; k ++) {
+        struct xres_s xres;
+        int width, height;
+
+        size_for_step(k, &width, &height);
+        xres_create(&xres, width, height);
+        present(&xres, width, height);
+        xres_free(&xres);
+    }
+    return (now() - t) / STEPS;
+}
+
+static
+double
+run_pooled(int *allocations)
+{
+    struct xres_s xres = {};
+
+    *allocations = 0;
+    double t = now();
+    for (int k = 0; k < STEPS; k ++) {
+        int width, height;
+
+        size_for_step(k, &width, &height);
+        if (xres.width < width || xres.height < height) {
+            int alloc_width = (width + BUCKET - 1) / BUCKET * BUCKET;
+            int alloc_height = (height + BUCKET - 1) / BUCKET * BUCKET;
+
+            alloc_width = alloc_width > xres.width ? alloc_width : xres.width;
+            alloc_height = alloc_height > xres.height ? alloc_height : xres.height;
+            if (xres.pixmap)
+                xres_free(&xres);
+            xres_create(&xres, alloc_width, alloc_height);
+            *allocations += 1;
+        }
+        present(&xres, width, height);
+    }
+    t = (now() - t) / STEPS;
+
+    xres_free(&xres);
+    return t;
+}
+
+int
+main(void)
+{
+    int event_base, error_base;
+
+    dpy = XOpenDisplay(NULL);
+    assert(dpy);
+
+    if (!XRenderQueryExtension(dpy, &event_base, &error_base)) {
+        printf("no RENDER extension\n");
+        return 0;
+    }
+
+    pictfmt = XRenderFindStandardFormat(dpy, PictStandardARGB32);
+    assert(pictfmt);
+
+    char *data = calloc(MAX_WIDTH * MAX_HEIGHT, 4);
+    assert(data);
+
+    XVisualInfo vi_template = { .depth = 32 };
+    int nitems = 0;
+    XVisualInfo *vi = XGetVisualInfo(dpy, VisualDepthMask, &vi_template, &nitems);
+    Visual *visual = (vi && nitems > 0) ? vi[0].visual : DefaultVisual(dpy, 0);
+    xi = XCreateImage(dpy, visual, 32, ZPixmap, 0, data, MAX_WIDTH, MAX_HEIGHT, 32,
+                      MAX_WIDTH * 4);
+    assert(xi);
+    if (vi)
+        XFree(vi);
+
+    dst_pixmap = XCreatePixmap(dpy, DefaultRootWindow(dpy), MAX_WIDTH, MAX_HEIGHT,
+                               DefaultDepth(dpy, 0));
+    dst_pict = XRenderCreatePicture(dpy, dst_pixmap,
+                                    XRenderFindVisualFormat(dpy, DefaultVisual(dpy, 0)), 0, 0);
+
+    int allocations;
+    printf("%d resize steps, up to %dx%d\n", STEPS, MAX_WIDTH, MAX_HEIGHT);
+    printf("recreate on resize: %7.3f ms/step, %d allocations\n", 1e3 * run_recreate(), STEPS);
+    double t = run_pooled(&allocations);
+    printf("pooled, grow-only:  %7.3f ms/step, %d allocations\n", 1e3 * t, allocations);
+
+    XRenderFreePicture(dpy, dst_pict);
+    XFreePixmap(dpy, dst_pixmap);
+    XDestroyImage(xi);  // frees data too
+    XCloseDisplay(dpy);
+    return 0;
+}
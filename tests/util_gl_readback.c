@@ -0,0 +1,175 @@
+// measures frame times of ways to get GL frame rendered into GLX pixmap to the CPU side, as
+// software compositing needs. Run under Xvfb without RENDER extension, to match the case:
+//
+//     Xvfb :9 -extension RENDER & DISPLAY=:9 ./util_gl_readback
+
+#undef NDEBUG
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glx.h>
+#include <GL/glext.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define WIDTH       1280
+#define HEIGHT      720
+#define FRAMES      200
+
+Display    *dpy;
+Pixmap      pixmap;
+GLXContext  glc;
+GLXPixmap   glx_pixmap;
+uint32_t   *frame;
+
+static
+double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static
+void
+draw_frame(int k)
+{
+    glClearColor((k % 32) / 32.0, 0.5, 1.0 - (k % 64) / 64.0, 1);
+    glClear(GL_COLOR_BUFFER_BIT);
+}
+
+static
+void
+consume_frame(const uint32_t *data)
+{
+    // touch data the way compositing would
+    for (int k = 0; k < WIDTH * HEIGHT; k ++)
+        frame[k] = data[k] | 0xff000000u;
+}
+
+static
+double
+run_xgetimage(void)
+{
+    double t = now();
+    for (int k = 0; k < FRAMES; k ++) {
+        draw_frame(k);
+        glFinish();
+        XImage *xi = XGetImage(dpy, pixmap, 0, 0, WIDTH, HEIGHT, AllPlanes, ZPixmap);
+        consume_frame((const uint32_t *)xi->data);
+        XDestroyImage(xi);
+    }
+    return (now() - t) / FRAMES;
+}
+
+static
+double
+run_read_pixels(void)
+{
+    uint32_t *buf = malloc(WIDTH * HEIGHT * 4);
+    double t = now();
+    for (int k = 0; k < FRAMES; k ++) {
+        draw_frame(k);
+        glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, buf);
+        consume_frame(buf);
+    }
+    t = (now() - t) / FRAMES;
+    free(buf);
+    return t;
+}
+
+static
+double
+run_pbo_ring(void)
+{
+    GLuint pbo[2];
+    uint32_t idx = 0;
+
+    glGenBuffers(2, pbo);
+    for (int k = 0; k < 2; k ++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[k]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, WIDTH * HEIGHT * 4, NULL, GL_STREAM_READ);
+    }
+
+    double t = now();
+    for (int k = 0; k < FRAMES; k ++) {
+        draw_frame(k);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[idx]);
+        glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        idx = 1 - idx;
+        if (k > 0) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[idx]);
+            const uint32_t *data = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+            assert(data);
+            consume_frame(data);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+    }
+    t = (now() - t) / FRAMES;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glDeleteBuffers(2, pbo);
+    return t;
+}
+
+int
+main(void)
+{
+    int event_base, error_base;
+
+    dpy = XOpenDisplay(NULL);
+    assert(dpy);
+
+    if (XQueryExtension(dpy, "RENDER", &event_base, &event_base, &error_base))
+        printf("warning: RENDER extension present, software compositing won't be used\n");
+
+    int nconfigs = -1;
+    int cfg_attrs[] = { GLX_ALPHA_SIZE,     0,
+                        GLX_BLUE_SIZE,      8,
+                        GLX_GREEN_SIZE,     8,
+                        GLX_RED_SIZE,       8,
+                        GLX_X_RENDERABLE,   True,
+                        GLX_DRAWABLE_TYPE,  GLX_PIXMAP_BIT,
+                        None };
+
+    GLXFBConfig *fb_cfgs = glXChooseFBConfig(dpy, 0, cfg_attrs, &nconfigs);
+    assert(fb_cfgs && nconfigs > 0);
+    GLXFBConfig fb_config = fb_cfgs[0];
+    XFree(fb_cfgs);
+
+    glc = glXCreateNewContext(dpy, fb_config, GLX_RGBA_TYPE, NULL, True);
+    assert(glc);
+
+    pixmap = XCreatePixmap(dpy, DefaultRootWindow(dpy), WIDTH, HEIGHT, DefaultDepth(dpy, 0));
+    glx_pixmap = glXCreatePixmap(dpy, fb_config, pixmap, NULL);
+    assert(glx_pixmap);
+
+    int ret = glXMakeCurrent(dpy, glx_pixmap, glc);
+    assert(ret);
+
+    printf("GL_RENDERER = %s\n", glGetString(GL_RENDERER));
+    printf("%dx%d, %d frames\n", WIDTH, HEIGHT, FRAMES);
+
+    frame = malloc(WIDTH * HEIGHT * 4);
+    printf("XGetImage:            %7.3f ms/frame\n", 1e3 * run_xgetimage());
+    printf("glReadPixels:         %7.3f ms/frame\n", 1e3 * run_read_pixels());
+
+    const char *gl_ext_str = (const char *)glGetString(GL_EXTENSIONS);
+    if (gl_ext_str && strstr(gl_ext_str, "GL_ARB_pixel_buffer_object"))
+        printf("glReadPixels, 2 PBOs: %7.3f ms/frame\n", 1e3 * run_pbo_ring());
+    else
+        printf("no GL_ARB_pixel_buffer_object\n");
+
+    free(frame);
+    glXMakeCurrent(dpy, None, NULL);
+    glXDestroyPixmap(dpy, glx_pixmap);
+    XFreePixmap(dpy, pixmap);
+    glXDestroyContext(dpy, glc);
+    XCloseDisplay(dpy);
+    return 0;
+}
@@ -0,0 +1,185 @@
+// measures input-to-callback latency of the plugin main thread message loop under heavy
+// network load. One thread floods the loop with network completions, each taking some CPU
+// time, while another posts input events at a fixed rate. Runs with input tasks sharing
+// class with network ones, which is how all tasks were ordered before priority classes, and
+// with input tasks in their own class:
+//
+//     ./util_input_latency [seconds] [network task cost, us]
+
+#undef NDEBUG
+#include "common.h"
+#include <assert.h>
+#include <glib.h>
+#include <ppapi/c/pp_errors.h>
+#include <pthread.h>
+#include <src/pp_resource.h>
+#include <src/ppb_message_loop.h>
+#include <src/utils.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define INPUT_PERIOD_US     (5 * 1000)
+#define MAX_SAMPLES         (64 * 1024)
+#define NETWORK_BACKLOG     200         ///< network tasks kept in the queue
+
+struct run_s {
+    PP_Resource             m_loop;
+    enum ml_priority_e      input_priority;
+    int                     network_cost_us;
+    volatile gint           stop;
+    volatile gint           network_queued;
+    int                     network_done;
+    double                  latency[MAX_SAMPLES];
+    int                     samples;
+};
+
+static PP_Instance  instance;
+static struct run_s run;
+
+static
+double
+clock_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static
+void
+network_comt(void *user_data, int32_t result)
+{
+    // emulate parsing of received data
+    const double end = clock_seconds() + 1e-6 * run.network_cost_us;
+    while (clock_seconds() < end) {
+    }
+
+    run.network_done ++;
+    g_atomic_int_add(&run.network_queued, -1);
+}
+
+static
+void
+input_comt(void *user_data, int32_t result)
+{
+    const double *posted = user_data;
+
+    if (run.samples < MAX_SAMPLES)
+        run.latency[run.samples ++] = clock_seconds() - *posted;
+    g_slice_free(double, (double *)posted);
+}
+
+static
+void *
+network_thread(void *param)
+{
+    while (!g_atomic_int_get(&run.stop)) {
+        if (g_atomic_int_get(&run.network_queued) >= NETWORK_BACKLOG) {
+            usleep(100);
+            continue;
+        }
+
+        g_atomic_int_inc(&run.network_queued);
+        ppb_message_loop_post_work_with_priority(run.m_loop, PP_MakeCCB(network_comt, NULL), 0,
+                                                 PP_OK, 0, ML_PRIORITY_NETWORK, __func__);
+    }
+    return NULL;
+}
+
+static
+void *
+input_thread(void *param)
+{
+    while (!g_atomic_int_get(&run.stop)) {
+        double *posted = g_slice_new(double);
+        *posted = clock_seconds();
+        ppb_message_loop_post_work_with_priority(run.m_loop, PP_MakeCCB(input_comt, posted), 0,
+                                                 PP_OK, 0, run.input_priority, __func__);
+        usleep(INPUT_PERIOD_US);
+    }
+    return NULL;
+}
+
+static
+void
+stop_comt(void *user_data, int32_t result)
+{
+    g_atomic_int_set(&run.stop, 1);
+    ppb_message_loop_post_quit(run.m_loop, PP_FALSE);
+}
+
+static
+int
+compare_doubles(const void *a, const void *b)
+{
+    const double da = *(const double *)a;
+    const double db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+static
+void *
+plugin_thread(void *param)
+{
+    const int seconds = GPOINTER_TO_INT(param);
+    pthread_t t_network, t_input;
+
+    ppb_message_loop_attach_to_current_thread(run.m_loop);
+    pthread_create(&t_network, NULL, network_thread, NULL);
+    pthread_create(&t_input, NULL, input_thread, NULL);
+
+    ppb_message_loop_post_work_with_priority(run.m_loop, PP_MakeCCB(stop_comt, NULL),
+                                             seconds * 1000, PP_OK, 0, ML_PRIORITY_INPUT,
+                                             __func__);
+    ppb_message_loop_run(run.m_loop);
+
+    pthread_join(t_network, NULL);
+    pthread_join(t_input, NULL);
+    return NULL;
+}
+
+static
+void
+measure(const char *name, enum ml_priority_e input_priority, int network_cost_us, int seconds)
+{
+    pthread_t t;
+
+    memset(&run, 0, sizeof(run));
+    run.input_priority = input_priority;
+    run.network_cost_us = network_cost_us;
+    run.m_loop = ppb_message_loop_create(instance);
+
+    pthread_create(&t, NULL, plugin_thread, GINT_TO_POINTER(seconds));
+    pthread_join(t, NULL);
+    pp_resource_unref(run.m_loop);
+
+    assert(run.samples > 0);
+    qsort(run.latency, run.samples, sizeof(run.latency[0]), compare_doubles);
+
+    double sum = 0;
+    for (int k = 0; k < run.samples; k ++)
+        sum += run.latency[k];
+
+    printf("%-10s %5d input events, %7d network tasks, latency avg %7.2f ms, "
+           "p50 %7.2f ms, p99 %7.2f ms, max %7.2f ms\n", name, run.samples, run.network_done,
+           1e3 * sum / run.samples, 1e3 * run.latency[run.samples / 2],
+           1e3 * run.latency[run.samples * 99 / 100], 1e3 * run.latency[run.samples - 1]);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const int seconds = argc > 1 ? atoi(argv[1]) : 5;
+    const int network_cost_us = argc > 2 ? atoi(argv[2]) : 200;
+
+    instance = create_instance();
+
+    measure("fifo", ML_PRIORITY_NETWORK, network_cost_us, seconds);
+    measure("input", ML_PRIORITY_INPUT, network_cost_us, seconds);
+
+    destroy_instance(instance);
+    return 0;
+}
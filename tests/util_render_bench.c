@@ -0,0 +1,513 @@
+// measures end-to-end presentation of Graphics2D and Graphics3D: ppb_graphics2d_flush() or
+// ppb_graphics3d_swap_buffers(), invalidation through the browser thread, expose handling in
+// NPP_HandleEvent(), and completion callback delivery. Fake instance is bound to a window
+// of its own, and the main thread plays browser role. Runs over sizes, device scales,
+// transparency, and XRender enabled/disabled, reporting frame rate, per-stage latencies, and
+// X requests issued per frame. Meant to be run under Xvfb with Mesa's llvmpipe:
+//
+//     export GALLIUM_DRIVER=llvmpipe
+//     xvfb-run -s "-screen 0 1920x1080x24 +extension GLX" ./util_render_bench [frames] [egl]
+
+#undef NDEBUG
+#include "common.h"
+#include <X11/Xlib.h>
+#include <assert.h>
+#include <glib.h>
+#include <npapi/npapi.h>
+#include <npapi/npfunctions.h>
+#include <poll.h>
+#include <ppapi/c/pp_errors.h>
+#include <pthread.h>
+#include <src/config.h>
+#include <src/pp_resource.h>
+#include <src/ppb_core.h>
+#include <src/ppb_graphics2d.h>
+#include <src/ppb_graphics3d.h>
+#include <src/ppb_image_data.h>
+#include <src/ppb_instance.h>
+#include <src/ppb_message_loop.h>
+#include <src/ppb_opengles2.h>
+#include <src/tables.h>
+#include <src/utils.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WARMUP_FRAMES   5
+
+struct async_call_s {
+    void      (*func)(void *);
+    void       *param;
+};
+
+/// timestamps of a single frame, filled by both plugin and browser threads
+struct frame_s {
+    double          start;          ///< plugin begins painting
+    double          flush_begin;
+    double          flush_end;
+    double          expose;         ///< browser thread got GraphicsExpose
+    double          handled;        ///< NPP_HandleEvent() returned
+    double          presented;      ///< X server finished drawing
+    unsigned long   browser_requests;
+    int             browser_done;
+};
+
+struct run_s {
+    int             is_3d;
+    int32_t         width;
+    int32_t         height;
+    float           scale;
+    int             transparent;
+    int             xrender;
+
+    PP_Resource     graphics;
+    PP_Resource     image_data;
+    int             frame_idx;
+    double          first_start;
+    double          last_callback;
+
+    // sums over measured frames, in seconds
+    double          paint;
+    double          flush;
+    double          invalidate;
+    double          handle;
+    double          server;
+    double          callback;
+    double          frame_max;
+
+    unsigned long   wrapper_requests;   ///< on all wrapper connections
+    unsigned long   browser_requests;   ///< on browser connection, within NPP_HandleEvent()
+    int             failed;
+    volatile gint   done;
+};
+
+static struct _NPP          fake_npp;
+static PP_Instance          instance;
+static Display             *browser_dpy;
+static Window               wnd;
+static GAsyncQueue         *browser_q;
+static int                  wakeup_pipe[2];
+static PP_Resource          plugin_ml;
+static pthread_barrier_t    plugin_ready;
+static int                  frame_count = 100;
+static int                  xrender_available;
+
+static pthread_mutex_t      frame_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t       frame_cond = PTHREAD_COND_INITIALIZER;
+static struct frame_s       frame;
+
+static
+double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/// requests issued by the wrapper, over all its X connections
+static
+unsigned long
+wrapper_request_count(void)
+{
+    Display *conns[] = { display.x, display.gl.x, display.g2d.x };
+    unsigned long count = 0;
+
+    for (size_t k = 0; k < sizeof(conns) / sizeof(conns[0]); k ++) {
+        int seen = 0;
+        for (size_t j = 0; j < k; j ++)
+            seen = seen || conns[j] == conns[k];
+        if (!seen)
+            count += NextRequest(conns[k]);
+    }
+
+    return count;
+}
+
+static
+void
+wakeup_browser(void)
+{
+    char c = 0;
+    ssize_t ret = write(wakeup_pipe[1], &c, 1);
+    (void)ret;
+}
+
+static
+void
+t_pluginthreadasynccall(NPP npp, void (*func)(void *), void *param)
+{
+    struct async_call_s *c = g_slice_alloc(sizeof(*c));
+    c->func = func;
+    c->param = param;
+    g_async_queue_push(browser_q, c);
+    wakeup_browser();
+}
+
+static
+void
+t_invalidaterect(NPP npp, NPRect *invalidRect)
+{
+    // windowed mode instance is redrawn through GraphicsExpose only
+}
+
+static
+void
+t_forceredraw(NPP npp)
+{
+}
+
+static
+void
+frame_done_comt(void *user_data, int32_t result);
+
+static
+void
+draw_frame(struct run_s *run)
+{
+    struct frame_s *f = &frame;
+
+    f->start = now();
+
+    if (run->is_3d) {
+        const float c = (run->frame_idx % 64) / 64.0f;
+        ppb_opengles2_ClearColor(run->graphics, c, 1.0f - c, 0.5f, run->transparent ? 0.5f : 1);
+        ppb_opengles2_Clear(run->graphics, GL_COLOR_BUFFER_BIT);
+
+        f->flush_begin = now();
+        int32_t ret = ppb_graphics3d_swap_buffers(run->graphics,
+                                                  PP_MakeCCB(frame_done_comt, run));
+        f->flush_end = now();
+        assert(ret == PP_OK_COMPLETIONPENDING);
+
+    } else {
+        struct PP_ImageDataDesc desc;
+        ppb_image_data_describe(run->image_data, &desc);
+        uint8_t *data = ppb_image_data_map(run->image_data);
+        const uint8_t alpha = run->transparent ? 0x80 : 0xff;
+        const int32_t band = run->frame_idx % desc.size.height;
+
+        // moving band over a solid background, every pixel changes from frame to frame.
+        // Colors are premultiplied
+        const uint32_t bg = (run->frame_idx * 0x030201u) & 0x7f7f7f;
+        const uint32_t fg = 0x7f7f7f;
+        for (int32_t y = 0; y < desc.size.height; y ++) {
+            uint32_t *line = (uint32_t *)(data + y * desc.stride);
+            uint32_t color = (y >= band && y < band + 16) ? fg : bg;
+            if (!run->transparent)
+                color <<= 1;
+            for (int32_t x = 0; x < desc.size.width; x ++)
+                line[x] = ((uint32_t)alpha << 24) | color;
+        }
+        ppb_image_data_unmap(run->image_data);
+        ppb_graphics2d_paint_image_data(run->graphics, run->image_data, &(struct PP_Point){0, 0},
+                                        NULL);
+
+        f->flush_begin = now();
+        int32_t ret = ppb_graphics2d_flush(run->graphics, PP_MakeCCB(frame_done_comt, run));
+        f->flush_end = now();
+        assert(ret == PP_OK_COMPLETIONPENDING);
+    }
+}
+
+static
+void
+finish_run(struct run_s *run)
+{
+    ppb_instance_bind_graphics(instance, 0);
+    if (run->graphics)
+        ppb_core_release_resource(run->graphics);
+    if (run->image_data)
+        ppb_core_release_resource(run->image_data);
+
+    g_atomic_int_set(&run->done, 1);
+    wakeup_browser();
+}
+
+static
+void
+frame_done_comt(void *user_data, int32_t result)
+{
+    struct run_s *run = user_data;
+    const double t = now();
+    struct frame_s f;
+
+    // browser thread may still be waiting for X server to complete drawing
+    pthread_mutex_lock(&frame_lock);
+    while (!frame.browser_done)
+        pthread_cond_wait(&frame_cond, &frame_lock);
+    f = frame;
+    memset(&frame, 0, sizeof(frame));
+    pthread_mutex_unlock(&frame_lock);
+
+    if (run->frame_idx == WARMUP_FRAMES)
+        run->first_start = f.start;
+
+    if (run->frame_idx >= WARMUP_FRAMES) {
+        run->paint += f.flush_begin - f.start;
+        run->flush += f.flush_end - f.flush_begin;
+        run->invalidate += MAX(0, f.expose - f.flush_end);
+        run->handle += f.handled - f.expose;
+        run->server += f.presented - f.handled;
+        run->callback += t - f.handled;
+        run->frame_max = MAX(run->frame_max, t - f.start);
+        run->browser_requests += f.browser_requests;
+    }
+
+    run->last_callback = t;
+    run->frame_idx ++;
+
+    // count requests of measured frames only
+    if (run->frame_idx == WARMUP_FRAMES || run->frame_idx == WARMUP_FRAMES + frame_count) {
+        pthread_mutex_lock(&display.lock);
+        run->wrapper_requests = wrapper_request_count() - run->wrapper_requests;
+        pthread_mutex_unlock(&display.lock);
+    }
+
+    if (run->frame_idx < WARMUP_FRAMES + frame_count)
+        draw_frame(run);
+    else
+        finish_run(run);
+}
+
+static
+void
+start_run_comt(void *user_data, int32_t result)
+{
+    struct run_s *run = user_data;
+
+    if (run->is_3d) {
+        const int32_t attrib_list[] = {
+            PP_GRAPHICS3DATTRIB_ALPHA_SIZE, 8,
+            PP_GRAPHICS3DATTRIB_WIDTH,      run->width,
+            PP_GRAPHICS3DATTRIB_HEIGHT,     run->height,
+            PP_GRAPHICS3DATTRIB_NONE,
+        };
+        run->graphics = ppb_graphics3d_create(instance, 0, attrib_list);
+    } else {
+        struct PP_Size size = { .width = run->width, .height = run->height };
+        run->graphics = ppb_graphics2d_create(instance, &size, !run->transparent);
+        run->image_data = ppb_image_data_create(instance,
+                                                ppb_image_data_get_native_image_data_format(),
+                                                &size, PP_FALSE);
+    }
+
+    if (!run->graphics || (!run->is_3d && !run->image_data) ||
+        !ppb_instance_bind_graphics(instance, run->graphics))
+    {
+        run->failed = 1;
+        finish_run(run);
+        return;
+    }
+
+    draw_frame(run);
+}
+
+static
+void
+handle_expose(XEvent *ev)
+{
+    const double t_expose = now();
+    const unsigned long req = NextRequest(browser_dpy);
+
+    NPP_HandleEvent(&fake_npp, ev);
+
+    const unsigned long requests = NextRequest(browser_dpy) - req;
+    const double t_handled = now();
+
+    // wait for the server to actually draw
+    XSync(browser_dpy, False);
+    const double t_presented = now();
+
+    pthread_mutex_lock(&frame_lock);
+    frame.expose = t_expose;
+    frame.handled = t_handled;
+    frame.presented = t_presented;
+    frame.browser_requests = requests;
+    frame.browser_done = 1;
+    pthread_cond_signal(&frame_cond);
+    pthread_mutex_unlock(&frame_lock);
+}
+
+static
+void
+run_browser_tasks(void)
+{
+    struct async_call_s *c;
+
+    while ((c = g_async_queue_try_pop(browser_q)) != NULL) {
+        void (*func)(void *) = c->func;
+        void *param = c->param;
+
+        g_slice_free1(sizeof(*c), c);
+        func(param);
+    }
+}
+
+/// browser thread main loop, serves async calls and X events until run is completed
+static
+void
+serve_run(struct run_s *run)
+{
+    while (!g_atomic_int_get(&run->done)) {
+        run_browser_tasks();
+
+        while (XPending(browser_dpy)) {
+            XEvent ev;
+            XNextEvent(browser_dpy, &ev);
+
+            // only synthetic events come from the wrapper
+            if (ev.type == GraphicsExpose && ev.xgraphicsexpose.send_event)
+                handle_expose(&ev);
+        }
+
+        struct pollfd fds[2] = {
+            { .fd = ConnectionNumber(browser_dpy), .events = POLLIN },
+            { .fd = wakeup_pipe[0], .events = POLLIN },
+        };
+        if (poll(fds, 2, 100) > 0 && (fds[1].revents & POLLIN)) {
+            char buf[64];
+            ssize_t ret = read(wakeup_pipe[0], buf, sizeof(buf));
+            (void)ret;
+        }
+    }
+}
+
+static
+void *
+plugin_thread(void *param)
+{
+    plugin_ml = ppb_message_loop_create(instance);
+    ppb_message_loop_attach_to_current_thread(plugin_ml);
+    ppb_message_loop_proclaim_this_thread_main();
+    pthread_barrier_wait(&plugin_ready);
+    ppb_message_loop_run(plugin_ml);
+    return NULL;
+}
+
+static
+void
+bench(int is_3d, int32_t width, int32_t height, float scale, int transparent, int xrender)
+{
+    struct run_s run = {
+        .is_3d =        is_3d,
+        .width =        width,
+        .height =       height,
+        .scale =        scale,
+        .transparent =  transparent,
+        .xrender =      xrender,
+    };
+    struct pp_instance_s *pp_i = tables_get_pp_instance(instance);
+    // Graphics2D content is presented at device scale
+    const uint32_t wnd_width = is_3d ? width : width * scale + 0.5;
+    const uint32_t wnd_height = is_3d ? height : height * scale + 0.5;
+
+    XResizeWindow(browser_dpy, wnd, wnd_width, wnd_height);
+    XSync(browser_dpy, False);
+
+    // nothing is in flight between runs, so it's safe to change these
+    pthread_mutex_lock(&display.lock);
+    config.device_scale = scale;
+    display.have_xrender = xrender;
+    pp_i->is_transparent = transparent;
+    pp_i->width = wnd_width;
+    pp_i->height = wnd_height;
+    pthread_mutex_unlock(&display.lock);
+
+    ppb_message_loop_post_work(plugin_ml, PP_MakeCCB(start_run_comt, &run), 0);
+    serve_run(&run);
+
+    printf("%s %4dx%-4d %4.2f %5s %7s ", is_3d ? "3D" : "2D", width, height, scale,
+           transparent ? "yes" : "no", xrender ? "yes" : "no");
+    if (run.failed) {
+        printf("can't create graphics context\n");
+        return;
+    }
+
+    const double n = frame_count;
+    printf("%7.1f %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f %6.1f %6.1f\n",
+           n / (run.last_callback - run.first_start), 1e3 * run.paint / n, 1e3 * run.flush / n,
+           1e3 * run.invalidate / n, 1e3 * run.handle / n, 1e3 * run.server / n,
+           1e3 * run.callback / n, 1e3 * run.frame_max,
+           run.wrapper_requests / n, run.browser_requests / n);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const int32_t sizes[][2] = { {320, 240}, {800, 600}, {1280, 720}, {1920, 1080} };
+    const float scales[] = { 1.0f, 1.5f };
+
+    if (argc > 1)
+        frame_count = MAX(1, atoi(argv[1]));
+
+    fpp_config_initialize();
+    config.enable_xrender = 1;
+    config.enable_egl_offscreen = (argc > 2 && strcmp(argv[2], "egl") == 0);
+
+    if (tables_open_display() != 0) {
+        printf("can't open display\n");
+        return 1;
+    }
+    xrender_available = display.have_xrender;
+
+    npn.pluginthreadasynccall = t_pluginthreadasynccall;
+    npn.invalidaterect = t_invalidaterect;
+    npn.forceredraw = t_forceredraw;
+
+    // browser side: own connection and a window instance is bound to
+    browser_dpy = XOpenDisplay(NULL);
+    assert(browser_dpy);
+    wnd = XCreateSimpleWindow(browser_dpy, DefaultRootWindow(browser_dpy), 0, 0, 320, 240, 0,
+                              0, 0);
+    XSelectInput(browser_dpy, wnd, ExposureMask);
+    XMapWindow(browser_dpy, wnd);
+    XSync(browser_dpy, False);
+
+    instance = create_instance();
+    struct pp_instance_s *pp_i = tables_get_pp_instance(instance);
+    fake_npp.pdata = pp_i;
+    pp_i->npp = &fake_npp;
+    pp_i->windowed_mode = 1;
+    pp_i->wnd = wnd;
+
+    browser_q = g_async_queue_new();
+    assert(pipe(wakeup_pipe) == 0);
+    make_nonblock(wakeup_pipe[0]);
+
+    PP_Resource browser_ml = ppb_message_loop_create(instance);
+    ppb_message_loop_attach_to_browser_thread(browser_ml);
+
+    pthread_t t;
+    pthread_barrier_init(&plugin_ready, NULL, 2);
+    pthread_create(&t, NULL, plugin_thread, NULL);
+    pthread_barrier_wait(&plugin_ready);
+
+    printf("%d frames per run, XRender %savailable, Graphics3D through %s. "
+           "Latencies are in ms\n", frame_count, xrender_available ? "" : "not ",
+           display.egl_available ? "EGL" : "GLX");
+    printf("   size      scale alpha xrender     fps    paint    flush invalid.   handle"
+           "   server callback  max frm  req/wr req/br\n");
+
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k ++)
+        for (size_t j = 0; j < sizeof(scales) / sizeof(scales[0]); j ++)
+            for (int transparent = 0; transparent <= 1; transparent ++)
+                for (int xrender = 0; xrender <= xrender_available; xrender ++)
+                    bench(0, sizes[k][0], sizes[k][1], scales[j], transparent, xrender);
+
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k ++)
+        for (int transparent = 0; transparent <= 1; transparent ++)
+            for (int xrender = 0; xrender <= xrender_available; xrender ++)
+                bench(1, sizes[k][0], sizes[k][1], 1.0f, transparent, xrender);
+
+    ppb_message_loop_post_quit(plugin_ml, PP_FALSE);
+    pthread_join(t, NULL);
+
+    destroy_instance(instance);
+    XDestroyWindow(browser_dpy, wnd);
+    XCloseDisplay(browser_dpy);
+    tables_close_display();
+    return 0;
+}
@@ -0,0 +1,107 @@
+// measures cost of per-thread lookups: GPrivate-backed block (the way get_thread_local() used
+// to work) versus __thread block; gettid syscall versus cached thread id; and malloc/free of
+// short-lived argument arrays versus per-thread scratch arena:
+//
+//     ./util_thread_local_bench [iterations]
+
+#undef NDEBUG
+#include <assert.h>
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <src/thread_local.c>
+
+static GPrivate legacy_priv = G_PRIVATE_INIT(g_free);
+
+static
+double
+clock_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static
+struct thread_local_block *
+__attribute__((noinline))
+legacy_get_thread_local(void)
+{
+    struct thread_local_block *data = g_private_get(&legacy_priv);
+    if (data == NULL) {
+        data = g_malloc0(sizeof(*data));
+        g_private_set(&legacy_priv, data);
+    }
+
+    return data;
+}
+
+static
+struct thread_local_block *
+__attribute__((noinline))
+tls_get_thread_local(void)
+{
+    return get_thread_local();
+}
+
+static
+void
+report(const char *name, double elapsed, long iterations)
+{
+    printf("%-24s %8.2f ns/call\n", name, 1e9 * elapsed / iterations);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const long iterations = argc > 1 ? atol(argv[1]) : 10 * 1000 * 1000;
+    volatile uintptr_t sink = 0;
+    double t;
+
+    printf("%ld iterations\n", iterations);
+
+    t = clock_seconds();
+    for (long k = 0; k < iterations; k ++)
+        sink += (uintptr_t)legacy_get_thread_local()->this_thread_message_loop;
+    report("GPrivate block", clock_seconds() - t, iterations);
+
+    t = clock_seconds();
+    for (long k = 0; k < iterations; k ++)
+        sink += (uintptr_t)tls_get_thread_local()->this_thread_message_loop;
+    report("__thread block", clock_seconds() - t, iterations);
+
+    t = clock_seconds();
+    for (long k = 0; k < iterations; k ++)
+        sink += syscall(__NR_gettid);
+    report("gettid syscall", clock_seconds() - t, iterations);
+
+    t = clock_seconds();
+    for (long k = 0; k < iterations; k ++)
+        sink += thread_local_get_tid();
+    report("cached tid", clock_seconds() - t, iterations);
+    assert(thread_local_get_tid() == syscall(__NR_gettid));
+
+    t = clock_seconds();
+    for (long k = 0; k < iterations; k ++) {
+        // typical NPVariant argument array of a scripting call
+        void *p = malloc(3 * 16 + (k & 7) * 16);
+        sink += (uintptr_t)p;
+        free(p);
+    }
+    report("malloc/free", clock_seconds() - t, iterations);
+
+    t = clock_seconds();
+    for (long k = 0; k < iterations; k ++) {
+        void *p = thread_local_scratch_alloc(3 * 16 + (k & 7) * 16);
+        sink += (uintptr_t)p;
+        thread_local_scratch_free(p);
+    }
+    report("scratch arena", clock_seconds() - t, iterations);
+    assert(get_thread_local()->scratch_used == 0);
+
+    (void)sink;
+    return 0;
+}
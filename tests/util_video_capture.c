@@ -0,0 +1,198 @@
+// measures frame rate and CPU load of video capture, for each device's native format that
+// is converted to I420 in-house, and for libv4l2 conversion (if compiled with it). Meant to
+// be run against vivid virtual driver:
+//
+//     modprobe vivid && ./util_video_capture /dev/video0 1280 720
+
+#undef NDEBUG
+#include <assert.h>
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include <src/video_convert.c>
+
+#if HAVE_LIBV4L2
+#include <libv4l2.h>
+#endif // HAVE_LIBV4L2
+
+#define FRAMES      150
+
+void
+trace_error(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+static
+double
+clock_seconds(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static
+void
+report(const char *name, uint32_t width, uint32_t height, int frames, double wall, double cpu,
+       double convert)
+{
+    printf("%-16s %4ux%-4u %6.1f fps, CPU %5.1f%%, conversion %6.2f ms/frame\n", name, width,
+           height, frames / wall, 100 * cpu / wall, frames ? 1e3 * convert / frames : 0);
+}
+
+static
+void
+run_native(const char *dev, uint32_t pixelformat, uint32_t width, uint32_t height)
+{
+    int fd = open(dev, O_RDWR);
+    assert(fd >= 0);
+
+    struct v4l2_format fmt = {
+        .type =                 V4L2_BUF_TYPE_VIDEO_CAPTURE,
+        .fmt.pix.width =        width,
+        .fmt.pix.height =       height,
+        .fmt.pix.pixelformat =  pixelformat,
+        .fmt.pix.field =        V4L2_FIELD_ANY,
+    };
+
+    if (ioctl(fd, VIDIOC_S_FMT, &fmt) != 0 || fmt.fmt.pix.pixelformat != pixelformat) {
+        printf("%.4s: can't set format\n", (const char *)&pixelformat);
+        close(fd);
+        return;
+    }
+
+    width = fmt.fmt.pix.width;
+    height = fmt.fmt.pix.height;
+    uint8_t *frame = malloc(fmt.fmt.pix.sizeimage);
+    uint8_t *out = malloc(video_convert_i420_size(width, height));
+    double convert = 0;
+    int frames = 0;
+
+    double wall = clock_seconds(CLOCK_MONOTONIC);
+    double cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+
+    for (int k = 0; k < FRAMES; k ++) {
+        ssize_t got = read(fd, frame, fmt.fmt.pix.sizeimage);
+        if (got <= 0)
+            continue;
+
+        double t = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+        if (pixelformat == V4L2_PIX_FMT_YUYV) {
+            video_convert_yuyv_to_i420(out, frame, width, height, fmt.fmt.pix.bytesperline);
+        } else if (pixelformat == V4L2_PIX_FMT_YUV420) {
+            video_convert_yuv420_to_i420(out, frame, width, height, fmt.fmt.pix.bytesperline);
+        } else if (video_convert_mjpeg_to_i420(out, frame, got, width, height) != 0) {
+            continue;
+        }
+        convert += clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - t;
+        frames ++;
+    }
+
+    wall = clock_seconds(CLOCK_MONOTONIC) - wall;
+    cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+
+    char name[32];
+    snprintf(name, sizeof(name), "native %.4s", (const char *)&pixelformat);
+    report(name, width, height, frames, wall, cpu, convert);
+
+    free(frame);
+    free(out);
+    close(fd);
+}
+
+#if HAVE_LIBV4L2
+static
+void
+run_libv4l2(const char *dev, uint32_t width, uint32_t height)
+{
+    int fd = v4l2_open(dev, O_RDWR);
+    assert(fd >= 0);
+
+    struct v4l2_format fmt = {
+        .type =                 V4L2_BUF_TYPE_VIDEO_CAPTURE,
+        .fmt.pix.width =        width,
+        .fmt.pix.height =       height,
+        .fmt.pix.pixelformat =  V4L2_PIX_FMT_YUV420,
+        .fmt.pix.field =        V4L2_FIELD_ANY,
+    };
+
+    if (v4l2_ioctl(fd, VIDIOC_S_FMT, &fmt) != 0) {
+        printf("libv4l2: can't set format\n");
+        v4l2_close(fd);
+        return;
+    }
+
+    uint8_t *frame = malloc(fmt.fmt.pix.sizeimage);
+    int frames = 0;
+
+    double wall = clock_seconds(CLOCK_MONOTONIC);
+    double cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+
+    for (int k = 0; k < FRAMES; k ++) {
+        if (v4l2_read(fd, frame, fmt.fmt.pix.sizeimage) > 0)
+            frames ++;
+    }
+
+    wall = clock_seconds(CLOCK_MONOTONIC) - wall;
+    cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+
+    // conversion is done inside v4l2_read(), so it's included in CPU load only
+    report("libv4l2 YUV420", fmt.fmt.pix.width, fmt.fmt.pix.height, frames, wall, cpu, 0);
+
+    free(frame);
+    v4l2_close(fd);
+}
+#endif // HAVE_LIBV4L2
+
+int
+main(int argc, char *argv[])
+{
+    const char *dev = argc > 1 ? argv[1] : "/dev/video0";
+    const uint32_t width = argc > 3 ? atoi(argv[2]) : 1280;
+    const uint32_t height = argc > 3 ? atoi(argv[3]) : 720;
+
+    int fd = open(dev, O_RDWR);
+    if (fd < 0) {
+        printf("can't open %s (is vivid loaded?)\n", dev);
+        return 0;
+    }
+
+    struct v4l2_fmtdesc fmtdesc = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+    uint32_t formats[64];
+    int format_count = 0;
+
+    for (; ioctl(fd, VIDIOC_ENUM_FMT, &fmtdesc) == 0 && format_count < 64; fmtdesc.index ++) {
+        switch (fmtdesc.pixelformat) {
+        case V4L2_PIX_FMT_YUV420:
+        case V4L2_PIX_FMT_YUYV:
+#if HAVE_LIBJPEG
+        case V4L2_PIX_FMT_MJPEG:
+        case V4L2_PIX_FMT_JPEG:
+#endif // HAVE_LIBJPEG
+            formats[format_count ++] = fmtdesc.pixelformat;
+            break;
+        }
+    }
+    close(fd);
+
+    printf("%s, %d frames per run\n", dev, FRAMES);
+    for (int k = 0; k < format_count; k ++)
+        run_native(dev, formats[k], width, height);
+
+#if HAVE_LIBV4L2
+    run_libv4l2(dev, width, height);
+#endif // HAVE_LIBV4L2
+
+    return 0;
+}
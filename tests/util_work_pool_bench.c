@@ -0,0 +1,173 @@
+// saturates background execution with bursts of blocking work items, submitted by several
+// producer threads at once, the way scattered file and D-Bus requests arrive. Thread per item
+// (how ad-hoc helper threads behave) is compared to the shared work pool, with and without a
+// concurrency limit on the queue. Throughput, queueing delay from submit to start of work, and
+// peak number of threads are reported:
+//
+//     ./util_work_pool_bench [items per producer] [producers] [work us]
+
+#undef NDEBUG
+#include "common.h"
+#include <assert.h>
+#include <glib.h>
+#include <pthread.h>
+#include <src/config.h>
+#include <src/work_pool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct item_s {
+    gint64      submitted;
+    gint64      started;
+};
+
+struct run_s {
+    int                     items_per_producer;
+    int                     producers;
+    int                     work_us;
+    struct item_s          *items;
+    volatile gint           done;
+    volatile gint           threads;
+    volatile gint           peak_threads;
+    struct work_queue_s    *queue;
+};
+
+static struct run_s run;
+
+static
+void
+item_work(struct item_s *item)
+{
+    item->started = g_get_monotonic_time();
+
+    // half sleeping as if blocked on I/O, half busy
+    usleep(run.work_us / 2);
+    const gint64 busy_until = g_get_monotonic_time() + run.work_us / 2;
+    while (g_get_monotonic_time() < busy_until) {
+    }
+
+    g_atomic_int_inc(&run.done);
+}
+
+static
+void *
+item_thread(void *param)
+{
+    int now = g_atomic_int_add(&run.threads, 1) + 1;
+    int prev;
+
+    while ((prev = g_atomic_int_get(&run.peak_threads)) < now &&
+           !g_atomic_int_compare_and_exchange(&run.peak_threads, prev, now))
+    {
+    }
+
+    item_work(param);
+    g_atomic_int_add(&run.threads, -1);
+    return NULL;
+}
+
+static
+int32_t
+item_pool_work(void *user_data)
+{
+    item_work(user_data);
+    return 0;
+}
+
+static
+void *
+producer_thread(void *param)
+{
+    const int idx = GPOINTER_TO_INT(param);
+
+    for (int k = 0; k < run.items_per_producer; k ++) {
+        struct item_s *item = &run.items[idx * run.items_per_producer + k];
+
+        item->submitted = g_get_monotonic_time();
+        if (run.queue) {
+            work_pool_submit(run.queue, item_pool_work, NULL, item, NULL, __func__);
+        } else {
+            pthread_t t;
+            pthread_create(&t, NULL, item_thread, item);
+            pthread_detach(t);
+        }
+    }
+
+    return NULL;
+}
+
+static
+int
+cmp_int64(const void *a, const void *b)
+{
+    const int64_t x = *(const int64_t *)a;
+    const int64_t y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static
+void
+do_run(const char *name, struct work_queue_s *queue)
+{
+    const int total = run.items_per_producer * run.producers;
+    pthread_t producers[run.producers];
+
+    run.items = calloc(total, sizeof(run.items[0]));
+    run.done = 0;
+    run.threads = 0;
+    run.peak_threads = 0;
+    run.queue = queue;
+
+    const gint64 start = g_get_monotonic_time();
+    for (int k = 0; k < run.producers; k ++)
+        pthread_create(&producers[k], NULL, producer_thread, GINT_TO_POINTER(k));
+    for (int k = 0; k < run.producers; k ++)
+        pthread_join(producers[k], NULL);
+
+    while (g_atomic_int_get(&run.done) < total)
+        usleep(1000);
+    const double elapsed = (g_get_monotonic_time() - start) / 1e6;
+
+    int64_t *delay = calloc(total, sizeof(delay[0]));
+    for (int k = 0; k < total; k ++)
+        delay[k] = run.items[k].started - run.items[k].submitted;
+    qsort(delay, total, sizeof(delay[0]), cmp_int64);
+
+    printf("%-20s %8.0f items/s, delay p50 %7.2f ms, p99 %7.2f ms, max %7.2f ms",
+           name, total / elapsed, delay[total / 2] / 1e3, delay[total * 99 / 100] / 1e3,
+           delay[total - 1] / 1e3);
+    if (queue)
+        printf("\n");
+    else
+        printf(", peak %d threads\n", run.peak_threads);
+
+    free(delay);
+    free(run.items);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct work_pool_stats_s stats;
+
+    run.items_per_producer = argc > 1 ? atoi(argv[1]) : 500;
+    run.producers = argc > 2 ? atoi(argv[2]) : 4;
+    run.work_us = argc > 3 ? atoi(argv[3]) : 2000;
+
+    printf("%d producers, %d items each, %d us of work per item, %d CPUs\n", run.producers,
+           run.items_per_producer, run.work_us, g_get_num_processors());
+
+    do_run("thread per item", NULL);
+
+    work_pool_reset_stats();
+    do_run("work pool", work_pool_get_queue("bench", 0));
+    do_run("work pool, limit 2", work_pool_get_queue("bench_limited", 2));
+
+    work_pool_get_stats(&stats);
+    printf("%d submitted, %d stolen, %d parked\n", stats.submitted, stats.stolen, stats.parked);
+
+    return 0;
+}
@@ -0,0 +1,431 @@
+// measures how Graphics2D and Graphics3D instances running side by side slow each other down.
+// One instance flushes full-window Graphics2D frames, the other issues a stream of small GL
+// calls and swaps buffers; each runs on a plugin thread of its own, and the main thread plays
+// browser role, handling expose events of both. Same workload is run with all subsystems
+// sharing a single X connection, and with separate per-subsystem connections. Frame rates,
+// frame times, and lock contention statistics are reported. Meant to be run under Xvfb with
+// Mesa's llvmpipe:
+//
+//     export GALLIUM_DRIVER=llvmpipe
+//     xvfb-run -s "-screen 0 1920x1080x24 +extension GLX" ./util_x_contention [seconds]
+
+#undef NDEBUG
+#include "common.h"
+#include <X11/Xlib.h>
+#include <assert.h>
+#include <glib.h>
+#include <inttypes.h>
+#include <npapi/npapi.h>
+#include <npapi/npfunctions.h>
+#include <poll.h>
+#include <ppapi/c/pp_errors.h>
+#include <pthread.h>
+#include <src/config.h>
+#include <src/lock_stats.h>
+#include <src/pp_resource.h>
+#include <src/ppb_core.h>
+#include <src/ppb_graphics2d.h>
+#include <src/ppb_graphics3d.h>
+#include <src/ppb_image_data.h>
+#include <src/ppb_instance.h>
+#include <src/ppb_message_loop.h>
+#include <src/ppb_opengles2.h>
+#include <src/tables.h>
+#include <src/utils.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WIDTH       800
+#define HEIGHT      600
+#define GL_TILES    16      ///< GL calls per frame are issued in that many tiles per side
+
+struct async_call_s {
+    void      (*func)(void *);
+    void       *param;
+};
+
+struct inst_s {
+    int             is_3d;
+    PP_Instance     instance;
+    struct _NPP     npp;
+    Window          wnd;
+    PP_Resource     ml;
+    pthread_t       thread;
+    PP_Resource     graphics;
+    PP_Resource     image_data;
+    double          deadline;
+    double          frame_start;
+    int             frame_idx;
+    int             frames;
+    double          frame_sum;
+    double          frame_max;
+    int             failed;
+    volatile gint   done;
+};
+
+static Display             *browser_dpy;
+static GAsyncQueue         *browser_q;
+static int                  wakeup_pipe[2];
+static pthread_barrier_t    plugins_ready;
+static double               duration = 5.0;
+
+static
+double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static
+void
+wakeup_browser(void)
+{
+    char c = 0;
+    ssize_t ret = write(wakeup_pipe[1], &c, 1);
+    (void)ret;
+}
+
+static
+void
+t_pluginthreadasynccall(NPP npp, void (*func)(void *), void *param)
+{
+    struct async_call_s *c = g_slice_alloc(sizeof(*c));
+    c->func = func;
+    c->param = param;
+    g_async_queue_push(browser_q, c);
+    wakeup_browser();
+}
+
+static
+void
+t_invalidaterect(NPP npp, NPRect *invalidRect)
+{
+}
+
+static
+void
+t_forceredraw(NPP npp)
+{
+}
+
+static
+void
+frame_done_comt(void *user_data, int32_t result);
+
+static
+void
+draw_frame(struct inst_s *inst)
+{
+    inst->frame_start = now();
+
+    if (inst->is_3d) {
+        // a lot of short GL calls, each takes GL connection lock
+        const float c = (inst->frame_idx % 64) / 64.0f;
+        ppb_opengles2_Enable(inst->graphics, GL_SCISSOR_TEST);
+        for (int y = 0; y < GL_TILES; y ++) {
+            for (int x = 0; x < GL_TILES; x ++) {
+                ppb_opengles2_Scissor(inst->graphics, x * WIDTH / GL_TILES,
+                                      y * HEIGHT / GL_TILES, WIDTH / GL_TILES, HEIGHT / GL_TILES);
+                ppb_opengles2_ClearColor(inst->graphics, c, (float)x / GL_TILES,
+                                         (float)y / GL_TILES, 1.0f);
+                ppb_opengles2_Clear(inst->graphics, GL_COLOR_BUFFER_BIT);
+            }
+        }
+        ppb_opengles2_Disable(inst->graphics, GL_SCISSOR_TEST);
+
+        int32_t ret = ppb_graphics3d_swap_buffers(inst->graphics,
+                                                  PP_MakeCCB(frame_done_comt, inst));
+        assert(ret == PP_OK_COMPLETIONPENDING);
+
+    } else {
+        struct PP_ImageDataDesc desc;
+        ppb_image_data_describe(inst->image_data, &desc);
+        uint8_t *data = ppb_image_data_map(inst->image_data);
+        const uint32_t color = 0xff000000u | ((inst->frame_idx * 0x030201u) & 0xffffff);
+
+        for (int32_t y = 0; y < desc.size.height; y ++) {
+            uint32_t *line = (uint32_t *)(data + y * desc.stride);
+            for (int32_t x = 0; x < desc.size.width; x ++)
+                line[x] = color;
+        }
+        ppb_image_data_unmap(inst->image_data);
+        ppb_graphics2d_paint_image_data(inst->graphics, inst->image_data,
+                                        &(struct PP_Point){0, 0}, NULL);
+
+        int32_t ret = ppb_graphics2d_flush(inst->graphics, PP_MakeCCB(frame_done_comt, inst));
+        assert(ret == PP_OK_COMPLETIONPENDING);
+    }
+}
+
+static
+void
+finish_run(struct inst_s *inst)
+{
+    ppb_instance_bind_graphics(inst->instance, 0);
+    if (inst->graphics)
+        ppb_core_release_resource(inst->graphics);
+    if (inst->image_data)
+        ppb_core_release_resource(inst->image_data);
+
+    g_atomic_int_set(&inst->done, 1);
+    wakeup_browser();
+}
+
+static
+void
+frame_done_comt(void *user_data, int32_t result)
+{
+    struct inst_s *inst = user_data;
+    const double t = now() - inst->frame_start;
+
+    inst->frames ++;
+    inst->frame_sum += t;
+    inst->frame_max = MAX(inst->frame_max, t);
+    inst->frame_idx ++;
+
+    if (now() < inst->deadline)
+        draw_frame(inst);
+    else
+        finish_run(inst);
+}
+
+static
+void
+start_run_comt(void *user_data, int32_t result)
+{
+    struct inst_s *inst = user_data;
+    struct PP_Size size = { .width = WIDTH, .height = HEIGHT };
+
+    if (inst->is_3d) {
+        const int32_t attrib_list[] = {
+            PP_GRAPHICS3DATTRIB_WIDTH,      WIDTH,
+            PP_GRAPHICS3DATTRIB_HEIGHT,     HEIGHT,
+            PP_GRAPHICS3DATTRIB_NONE,
+        };
+        inst->graphics = ppb_graphics3d_create(inst->instance, 0, attrib_list);
+    } else {
+        inst->graphics = ppb_graphics2d_create(inst->instance, &size, PP_TRUE);
+        inst->image_data = ppb_image_data_create(inst->instance,
+                                                 ppb_image_data_get_native_image_data_format(),
+                                                 &size, PP_FALSE);
+    }
+
+    if (!inst->graphics || (!inst->is_3d && !inst->image_data) ||
+        !ppb_instance_bind_graphics(inst->instance, inst->graphics))
+    {
+        inst->failed = 1;
+        finish_run(inst);
+        return;
+    }
+
+    draw_frame(inst);
+}
+
+static
+void *
+plugin_thread(void *param)
+{
+    struct inst_s *inst = param;
+
+    inst->ml = ppb_message_loop_create(inst->instance);
+    ppb_message_loop_attach_to_current_thread(inst->ml);
+    if (!inst->is_3d)
+        ppb_message_loop_proclaim_this_thread_main();
+    pthread_barrier_wait(&plugins_ready);
+    ppb_message_loop_run(inst->ml);
+    return NULL;
+}
+
+static
+void
+run_browser_tasks(void)
+{
+    struct async_call_s *c;
+
+    while ((c = g_async_queue_try_pop(browser_q)) != NULL) {
+        void (*func)(void *) = c->func;
+        void *param = c->param;
+
+        g_slice_free1(sizeof(*c), c);
+        func(param);
+    }
+}
+
+/// browser thread main loop, serves async calls and X events until both instances are done
+static
+void
+serve_run(struct inst_s *inst, int count)
+{
+    while (1) {
+        int done = 1;
+        for (int k = 0; k < count; k ++)
+            done = done && g_atomic_int_get(&inst[k].done);
+        if (done)
+            break;
+
+        run_browser_tasks();
+
+        while (XPending(browser_dpy)) {
+            XEvent ev;
+            XNextEvent(browser_dpy, &ev);
+
+            // only synthetic events come from the wrapper
+            if (ev.type != GraphicsExpose || !ev.xgraphicsexpose.send_event)
+                continue;
+
+            for (int k = 0; k < count; k ++) {
+                if (ev.xgraphicsexpose.drawable == inst[k].wnd)
+                    NPP_HandleEvent(&inst[k].npp, &ev);
+            }
+        }
+
+        struct pollfd fds[2] = {
+            { .fd = ConnectionNumber(browser_dpy), .events = POLLIN },
+            { .fd = wakeup_pipe[0], .events = POLLIN },
+        };
+        if (poll(fds, 2, 100) > 0 && (fds[1].revents & POLLIN)) {
+            char buf[64];
+            ssize_t ret = read(wakeup_pipe[0], buf, sizeof(buf));
+            (void)ret;
+        }
+    }
+}
+
+static
+void
+print_lock(const char *name, pthread_mutex_t *mutex)
+{
+    struct lock_stats_s st;
+
+    if (lock_stats_get(mutex, &st) != 0)
+        return;
+
+    printf("  %-20s %9" PRIu64 " acq, %5.1f%% contended, wait total %8.2f ms, max %7.2f ms\n",
+           name, st.acquisitions, st.acquisitions ? 100.0 * st.contended / st.acquisitions : 0,
+           1e-3 * st.wait.sum_us, 1e-3 * st.wait.max_us);
+}
+
+static
+void
+bench(int separate_connections, int with_2d, int with_3d)
+{
+    struct inst_s inst[2] = {
+        { .is_3d = 0 },
+        { .is_3d = 1 },
+    };
+
+    config.separate_x_connections = separate_connections;
+    if (tables_open_display() != 0) {
+        printf("can't open display\n");
+        exit(1);
+    }
+
+    const int first = with_2d ? 0 : 1;
+    const int count = (with_2d && with_3d) ? 2 : 1;
+    struct inst_s *active = &inst[first];
+
+    pthread_barrier_init(&plugins_ready, NULL, count + 1);
+    for (int k = 0; k < count; k ++) {
+        struct inst_s *it = &active[k];
+        it->wnd = XCreateSimpleWindow(browser_dpy, DefaultRootWindow(browser_dpy),
+                                      k * WIDTH, 0, WIDTH, HEIGHT, 0, 0, 0);
+        XSelectInput(browser_dpy, it->wnd, ExposureMask);
+        XMapWindow(browser_dpy, it->wnd);
+
+        it->instance = create_instance();
+        struct pp_instance_s *pp_i = tables_get_pp_instance(it->instance);
+        it->npp.pdata = pp_i;
+        pp_i->npp = &it->npp;
+        pp_i->windowed_mode = 1;
+        pp_i->wnd = it->wnd;
+        pp_i->width = WIDTH;
+        pp_i->height = HEIGHT;
+
+        pthread_create(&it->thread, NULL, plugin_thread, it);
+    }
+    XSync(browser_dpy, False);
+    pthread_barrier_wait(&plugins_ready);
+    pthread_barrier_destroy(&plugins_ready);
+
+    const double deadline = now() + duration;
+    for (int k = 0; k < count; k ++) {
+        active[k].deadline = deadline;
+        ppb_message_loop_post_work(active[k].ml, PP_MakeCCB(start_run_comt, &active[k]), 0);
+    }
+    serve_run(active, count);
+
+    printf("%s connections, %s:\n", separate_connections ? "separate" : "shared",
+           count == 2 ? "2D and 3D together" : (with_2d ? "2D alone" : "3D alone"));
+    for (int k = 0; k < count; k ++) {
+        struct inst_s *it = &active[k];
+        if (it->failed) {
+            printf("  %s: can't create graphics context\n", it->is_3d ? "3D" : "2D");
+            continue;
+        }
+        printf("  %s: %7.1f fps, frame avg %7.3f ms, max %7.3f ms\n", it->is_3d ? "3D" : "2D",
+               it->frames / duration, it->frames ? 1e3 * it->frame_sum / it->frames : 0,
+               1e3 * it->frame_max);
+    }
+
+    print_lock("display.lock", &display.lock);
+    if (display.gl.lock != &display.lock)
+        print_lock("display.gl.lock", display.gl.lock);
+    if (display.g2d.lock != &display.lock)
+        print_lock("display.g2d.lock", display.g2d.lock);
+
+    for (int k = 0; k < count; k ++) {
+        struct inst_s *it = &active[k];
+        ppb_message_loop_post_quit(it->ml, PP_FALSE);
+        pthread_join(it->thread, NULL);
+        destroy_instance(it->instance);
+        XDestroyWindow(browser_dpy, it->wnd);
+    }
+    XSync(browser_dpy, False);
+
+    tables_close_display();
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc > 1)
+        duration = MAX(0.5, atof(argv[1]));
+
+    fpp_config_initialize();
+    config.enable_xrender = 1;
+    config.lock_stats_interval = 3600;  // collect statistics, but don't write reports
+
+    npn.pluginthreadasynccall = t_pluginthreadasynccall;
+    npn.invalidaterect = t_invalidaterect;
+    npn.forceredraw = t_forceredraw;
+
+    browser_dpy = XOpenDisplay(NULL);
+    if (!browser_dpy) {
+        printf("can't open display\n");
+        return 1;
+    }
+
+    browser_q = g_async_queue_new();
+    assert(pipe(wakeup_pipe) == 0);
+    make_nonblock(wakeup_pipe[0]);
+
+    PP_Instance browser_instance = create_instance();
+    PP_Resource browser_ml = ppb_message_loop_create(browser_instance);
+    ppb_message_loop_attach_to_browser_thread(browser_ml);
+
+    printf("%dx%d windows, %.1f s per run\n", WIDTH, HEIGHT, duration);
+    for (int separate = 0; separate <= 1; separate ++) {
+        bench(separate, 1, 0);
+        bench(separate, 0, 1);
+        bench(separate, 1, 1);
+    }
+
+    destroy_instance(browser_instance);
+    XCloseDisplay(browser_dpy);
+    return 0;
+}